@@ -0,0 +1,34 @@
+require 'bench_helper'
+
+# The cost the NEWOBJ tracepoint adds to every allocation in the app, in each
+# tracking mode. Compare against "tracking off".
+ScoutBench.suite "Allocations" do |s|
+  allocations = ScoutApm::Instruments::Allocations
+  previous = {}
+
+  with_mode = lambda do |mode, sample_rate|
+    {
+      :before => lambda {
+        previous[:mode], previous[:sample_rate] = allocations.mode, allocations.sample_rate
+        allocations.mode = mode
+        allocations.sample_rate = sample_rate
+      },
+      :after => lambda {
+        allocations.mode = previous[:mode]
+        allocations.sample_rate = previous[:sample_rate]
+      },
+    }
+  end
+
+  s.bench("Object.new, tracking off", with_mode.call(:off, 1)) { Object.new }
+  s.bench("Object.new, tracking always", with_mode.call(:always, 1)) { Object.new }
+  s.bench("Object.new, sample rate 16", with_mode.call(:always, 16)) { Object.new }
+
+  site_profile = with_mode.call(:always, 1)
+  s.bench("Object.new, site profile", {
+    :before => lambda { site_profile[:before].call; allocations.start_site_profile },
+    :after  => lambda { allocations.stop_site_profile(0); site_profile[:after].call },
+  }) { Object.new }
+
+  s.bench("mark + delta") { allocations.delta(allocations.mark) }
+end
@@ -0,0 +1,210 @@
+# A small benchmark harness for the agent's hot paths and native extensions.
+# Run every suite with `rake bench`, or one with `ruby -Ilib -Ibench
+# bench/histogram_bench.rb`.
+#
+# Each benchmark is warmed up, then run for BENCH_TIME seconds (default 1),
+# and reported as ops/sec, ns/op and objects allocated per op. Settings, from
+# the environment:
+#
+#   BENCH_TIME   - seconds to run each benchmark for
+#   BENCH_FILTER - only run benchmarks whose "Suite name" matches this regex
+#   BENCH_OUTPUT - also write the results as JSON to this path, to compare
+#                  across releases
+require 'json'
+require 'time'
+
+# Keep the agent's own startup logging out of the results
+ENV['SCOUT_LOG_FILE_PATH'] ||= 'STDOUT'
+ENV['SCOUT_LOG_LEVEL'] ||= 'warn'
+
+require 'scout_apm'
+
+module ScoutBench
+  Result = Struct.new(:suite, :name, :iterations, :seconds, :allocations_per_op) do
+    def ops_per_sec
+      iterations / seconds
+    end
+
+    def ns_per_op
+      seconds * 1e9 / iterations
+    end
+
+    def as_json
+      {
+        "suite"              => suite,
+        "name"               => name,
+        "iterations"         => iterations,
+        "ops_per_sec"        => ops_per_sec.round(1),
+        "ns_per_op"          => ns_per_op.round(1),
+        "allocations_per_op" => allocations_per_op.round(2),
+      }
+    end
+  end
+
+  class Suite
+    attr_reader :name
+    attr_reader :benches
+    attr_reader :teardowns
+
+    def initialize(name)
+      @name = name
+      @benches = []
+      @teardowns = []
+    end
+
+    # Adds a benchmark of the block. Options:
+    #
+    #   :setup  - called before each op, outside the timing, and its result
+    #             passed to the block. For ops that consume their input.
+    #   :before - called once before the benchmark runs
+    #   :after  - called once after it ran
+    def bench(name, options = {}, &block)
+      @benches << [name, options, block]
+    end
+
+    # Called once after all of the suite's benchmarks ran, to clean up what
+    # the suite set up
+    def teardown(&block)
+      @teardowns << block
+    end
+  end
+
+  def self.suites
+    @suites ||= []
+  end
+
+  def self.suite(name)
+    suite = Suite.new(name)
+    yield suite
+    suites << suite
+  end
+
+  def self.seconds
+    Float(ENV['BENCH_TIME'] || 1.0)
+  end
+
+  def self.filter
+    ENV['BENCH_FILTER'] && Regexp.new(ENV['BENCH_FILTER'])
+  end
+
+  def self.now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  def self.allocated
+    GC.stat(:total_allocated_objects)
+  end
+
+  # Runs the block, in growing batches, until +seconds+ have passed.
+  # Returns [iterations, elapsed seconds].
+  def self.run_for(seconds, setup, block)
+    return run_each_for(seconds, setup, block) if setup
+
+    iterations = 0
+    elapsed = 0.0
+    batch = 1
+
+    while elapsed < seconds
+      start = now
+      i = 0
+      while i < batch
+        block.call
+        i += 1
+      end
+      taken = now - start
+
+      elapsed += taken
+      iterations += batch
+      batch *= 2 if taken < 0.05
+    end
+
+    [iterations, elapsed]
+  end
+
+  # Times each op on its own, leaving the setup out. Gives up after 3 times
+  # +seconds+ of wall time, for setups far slower than the op.
+  def self.run_each_for(seconds, setup, block)
+    iterations = 0
+    elapsed = 0.0
+    deadline = now + seconds * 3
+
+    while elapsed < seconds && (iterations == 0 || now < deadline)
+      input = setup.call
+      start = now
+      block.call(input)
+      elapsed += now - start
+      iterations += 1
+    end
+
+    [iterations, elapsed]
+  end
+
+  def self.allocations_per_op(count, setup, block)
+    total = 0
+
+    count.times do
+      input = setup.call if setup
+      before = allocated
+      setup ? block.call(input) : block.call
+      total += allocated - before
+    end
+
+    total.to_f / count
+  end
+
+  def self.measure(suite, name, options, block)
+    setup = options[:setup]
+    options[:before].call if options[:before]
+
+    run_for(seconds * 0.2, setup, block) # warm up
+    iterations, elapsed = run_for(seconds, setup, block)
+    allocations = allocations_per_op([[iterations / 10, 1].max, 1000].min, setup, block)
+
+    Result.new(suite.name, name, iterations, elapsed, allocations)
+  ensure
+    options[:after].call if options[:after]
+  end
+
+  def self.run
+    return if @ran
+    @ran = true
+
+    results = []
+    puts format("%-20s %-46s %14s %12s %10s", "suite", "benchmark", "ops/sec", "ns/op", "allocs/op")
+
+    suites.each do |suite|
+      suite.benches.each do |name, options, block|
+        next if filter && "#{suite.name} #{name}" !~ filter
+
+        result = measure(suite, name, options, block)
+        results << result
+        puts format("%-20s %-46s %14.1f %12.1f %10.2f", result.suite, result.name, result.ops_per_sec, result.ns_per_op, result.allocations_per_op)
+      end
+
+      suite.teardowns.each(&:call)
+    end
+
+    write_json(ENV['BENCH_OUTPUT'], results) if ENV['BENCH_OUTPUT']
+    results
+  end
+
+  def self.write_json(path, results)
+    report = {
+      "time"          => Time.now.utc.iso8601,
+      "ruby"          => RUBY_DESCRIPTION,
+      "agent_version" => ScoutApm::VERSION,
+      "bench_time"    => seconds,
+      "native"        => {
+        "allocations"       => ScoutApm::Instruments::Allocations::ENABLED,
+        "numeric_histogram" => defined?(ScoutApm::NumericHistogram::NATIVE) ? true : false,
+        "sql_sanitizer"     => ScoutApm::Utils::SqlSanitizer::NATIVE,
+        "layaway_format"    => ScoutApm::LayawayFile::NATIVE,
+      },
+      "results"       => results.map(&:as_json),
+    }
+    File.open(path, "w") { |f| f.write(JSON.pretty_generate(report)) }
+    puts "Wrote #{results.size} results to #{path}"
+  end
+end
+
+at_exit { ScoutBench.run if $!.nil? }
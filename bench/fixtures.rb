@@ -0,0 +1,53 @@
+require 'bench_helper'
+
+module ScoutBench
+  # Requests and reporting periods shaped like a typical Rails app's: a
+  # middleware stack around a controller, nested view partials, and an N+1
+  # heavy mix of ActiveRecord queries.
+  module Fixtures
+    MIDDLEWARE_DEPTH = 8
+    MODELS = %w(User Post Comment Account Plan Tag Photo Invoice Order Product)
+
+    # A web request with every layer stopped except the outermost
+    # middleware. Stopping that one (TrackedRequest#stop_layer) records it.
+    def self.request(queries, store = ScoutApm::Agent.instance.store, endpoint = "users/index")
+      req = ScoutApm::TrackedRequest.new(store)
+      req.web!
+      req.annotate_request(:uri => "/#{endpoint}")
+
+      MIDDLEWARE_DEPTH.times { |i| req.start_layer(ScoutApm::Layer.new("Middleware", "Rack::Middleware#{i}")) }
+      req.start_layer(ScoutApm::Layer.new("Controller", endpoint))
+
+      req.start_layer(ScoutApm::Layer.new("View", "users/index"))
+      queries.times do |i|
+        req.start_layer(ScoutApm::Layer.new("View", "users/_user")) if i % 10 == 0
+        query(req, MODELS[i % MODELS.size], i)
+        req.stop_layer if i % 10 == 9 || i == queries - 1
+      end
+      req.stop_layer # users/index
+      req.stop_layer # Controller
+
+      (MIDDLEWARE_DEPTH - 1).times { req.stop_layer }
+      req
+    end
+
+    def self.query(req, model, i)
+      layer = ScoutApm::Layer.new("ActiveRecord", ScoutApm::Utils::ActiveRecordMetricName.new("SELECT", "#{model} Load"))
+      layer.desc = ScoutApm::Utils::SqlSanitizer.new(%Q|SELECT "#{model.downcase}s".* FROM "#{model.downcase}s" WHERE "#{model.downcase}s"."id" = #{i} LIMIT 1|)
+      layer.annotate_layer(:record_count => 1)
+      req.start_layer(layer)
+      req.stop_layer
+    end
+
+    # A reporting period as one process writes it to the layaway: +requests+
+    # recorded requests, spread over +endpoints+ controllers.
+    def self.reporting_period(requests = 200, endpoints = 20, queries = 30)
+      store = ScoutApm::Store.new
+      requests.times do |i|
+        request(queries, store, "endpoint#{i % endpoints}/show").stop_layer
+      end
+      store.merge_thread_buffers
+      store.instance_variable_get(:@reporting_periods).values.first
+    end
+  end
+end
@@ -0,0 +1,22 @@
+require 'bench_helper'
+
+ScoutBench.suite "NumericHistogram" do |s|
+  pure = Class.new { include ScoutApm::PureNumericHistogram }
+  random = Random.new(42)
+  values = Array.new(10_000) { random.rand * 2.0 }
+
+  [10, 50, 200].each do |bins|
+    { "" => ScoutApm::NumericHistogram, ", pure Ruby" => pure }.each do |label, klass|
+      histogram = klass.new(bins)
+      i = 0
+      s.bench("add (#{bins} bins#{label})") { histogram.add(values[i = (i + 1) % values.size]) }
+
+      full = klass.new(bins)
+      other = klass.new(bins)
+      values.each { |v| full.add(v); other.add(v * 1.5) }
+      s.bench("combine! (#{bins} bins#{label})", :setup => lambda { full.dup }) { |h| h.combine!(other) }
+
+      s.bench("quantile (#{bins} bins#{label})") { full.quantile(95) }
+    end
+  end
+end
@@ -0,0 +1,45 @@
+require 'fixtures'
+require 'tmpdir'
+require 'fileutils'
+
+ScoutBench.suite "Layaway" do |s|
+  dir = Dir.mktmpdir("scout_apm_bench")
+  s.teardown { FileUtils.remove_entry(dir) }
+
+  previous, ENV['SCOUT_DATA_FILE'] = ENV['SCOUT_DATA_FILE'], dir
+  layaway = ScoutApm::Layaway.new(ScoutApm::Config.without_file, ScoutApm::Agent.instance.environment)
+  layaway.directory # resolved once, then kept
+  ENV['SCOUT_DATA_FILE'] = previous
+
+  rp = ScoutBench::Fixtures.reporting_period
+  formats = { "marshal" => false }
+  formats["native"] = true if ScoutApm::LayawayFile::NATIVE
+
+  formats.each do |format, native|
+    file = ScoutApm::LayawayFile.new(layaway.send(:glob_pattern, rp.timestamp, 1), native)
+    file.write(rp)
+    serialized = file.serialize(rp)
+
+    s.bench("serialize (#{format})") { file.serialize(rp) }
+    s.bench("deserialize (#{format})") { file.deserialize(serialized) }
+    s.bench("write (#{format})") { file.write(rp) }
+    s.bench("load (#{format})") { file.load }
+  end
+
+  merge_from = Marshal.dump(rp)
+  s.bench("merge 2 periods", :setup => lambda { Marshal.load(merge_from) }) { |loaded| loaded.merge(rp) }
+
+  # What the reporting process does each minute: claim, load and merge every
+  # worker's file
+  [4, 16, 64].each do |workers|
+    write_files = lambda do
+      layaway.delete_files_for(:all)
+      workers.times { |pid| ScoutApm::LayawayFile.new(layaway.send(:glob_pattern, rp.timestamp, pid + 1)).write(rp) }
+      rp.timestamp
+    end
+
+    s.bench("with_merged_claim (#{workers} worker files)", :setup => write_files) do |timestamp|
+      layaway.with_merged_claim(timestamp) { |merged, count| merged }
+    end
+  end
+end
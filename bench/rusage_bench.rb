@@ -0,0 +1,13 @@
+require 'bench_helper'
+
+ScoutBench.suite "Rusage" do |s|
+  usage = Process.rusage
+  cpu_times = [0.0, 0.0]
+
+  s.bench("Process.rusage") { Process.rusage }
+  s.bench("Process.rusage_into") { Process.rusage_into(usage) }
+  s.bench("Process.rusage_cpu_times(buffer)") { Process.rusage_cpu_times(cpu_times) }
+  s.bench("Process.rusage_maxrss") { Process.rusage_maxrss }
+  s.bench("Process.current_rss") { Process.current_rss }
+  s.bench("Process.thread_cpu_ns") { Process.thread_cpu_ns }
+end
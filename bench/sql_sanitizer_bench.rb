@@ -0,0 +1,23 @@
+require 'bench_helper'
+
+ScoutBench.suite "SqlSanitizer" do |s|
+  statements = {
+    :postgres => %q|SELECT "users".* FROM "users" WHERE "users"."id" = $1 AND "users"."email" = 'someone@example.com' AND "users"."plan_id" IN (10, 20, 30) ORDER BY "users"."created_at" DESC LIMIT 1|,
+    :mysql    => %q|SELECT `users`.* FROM `users` WHERE `users`.`id` = 1 AND `users`.`email` = 'someone@example.com' AND `users`.`plan_id` IN (10, 20, 30) ORDER BY `users`.`created_at` DESC LIMIT 1|,
+    :sqlite   => %q|SELECT "users".* FROM "users" WHERE "users"."id" = ? AND "users"."email" = 'someone@example.com' AND "users"."plan_id" IN (10, 20, 30) ORDER BY "users"."created_at" DESC LIMIT 1|,
+  }
+  cache = ScoutApm::Utils::SqlSanitizer.fingerprint_cache
+
+  statements.each do |engine, sql|
+    sanitizer = lambda do
+      san = ScoutApm::Utils::SqlSanitizer.new(sql)
+      san.database_engine = engine
+      san
+    end
+
+    # A fresh statement each time, as when every query has different values
+    s.bench("to_s (#{engine}, uncached)", :setup => lambda { cache.clear; sanitizer.call }) { |san| san.to_s }
+    s.bench("to_s (#{engine}, cached)", :before => lambda { sanitizer.call.to_s }) { sanitizer.call.to_s }
+    s.bench("fingerprint (#{engine})") { sanitizer.call.fingerprint }
+  end
+end
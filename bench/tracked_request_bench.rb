@@ -0,0 +1,12 @@
+require 'fixtures'
+
+ScoutBench.suite "TrackedRequest" do |s|
+  [10, 100, 1000].each do |queries|
+    layers = ScoutBench::Fixtures::MIDDLEWARE_DEPTH + 2 + queries + (queries + 9) / 10
+
+    s.bench("build (#{layers} layers)") { ScoutBench::Fixtures.request(queries) }
+
+    # Stopping the last layer records the request through the agent's recorder
+    s.bench("record! (#{layers} layers)", :setup => lambda { ScoutBench::Fixtures.request(queries) }) { |req| req.stop_layer }
+  end
+end
@@ -7,47 +7,761 @@
 VALUE mScoutApm;
 VALUE mInstruments;
 VALUE cAllocations;
+VALUE mClock;
+VALUE mNativeOverhead;
 
 #if defined(RUBY_INTERNAL_EVENT_NEWOBJ) && !defined(_WIN32)
 
 #include <sys/resource.h> // is this needed?
 #include <sys/time.h>
+#include <time.h>
 #include <ruby/debug.h>
 
+// Sampling. With a sample rate of N, only every Nth allocation on a thread
+// does any counting, and it counts as N, so counts are already scaled back up
+// by the time they're read. See tracepoint_handler.
+static uint32_t sample_rate = 1;
+static __thread uint32_t sample_countdown;
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocation sites
+//
+// While a thread has a site profile attached, each counted allocation is also
+// charged to the file:line (and method owner) that made it, and to the class
+// of the new object. Both tables are fixed-size open-addressed hashes,
+// allocated once per thread and reused, so recording is a handful of probes
+// and never creates a Ruby object. An allocation that finds no slot within
+// SITE_MAX_PROBES probes is counted as dropped instead.
+////////////////////////////////////////////////////////////////////////////////
+
+#define SITE_TABLE_SIZE 1024  // must be a power of 2
+#define CLASS_TABLE_SIZE 256  // must be a power of 2
+#define SITE_MAX_PROBES 8
+
+typedef struct {
+    VALUE path;
+    VALUE defined_class;
+    long line;
+    uint64_t count;
+} site_entry_t;
+
+typedef struct {
+    VALUE klass;
+    uint64_t count;
+} class_entry_t;
+
+typedef struct {
+    site_entry_t sites[SITE_TABLE_SIZE];
+    class_entry_t classes[CLASS_TABLE_SIZE];
+    uint64_t dropped;
+} site_profile_t;
+
+static __thread site_profile_t *current_site_profile;
+static ID id_site_profile;
+
+// Paths and classes are held as raw VALUEs, so the GC has to know about them
+// for as long as they sit in the table.
+static void
+site_profile_mark(void *ptr)
+{
+    site_profile_t *profile = (site_profile_t *)ptr;
+    int i;
+
+    for (i = 0; i < SITE_TABLE_SIZE; i++) {
+        if (profile->sites[i].count) {
+            rb_gc_mark(profile->sites[i].path);
+            rb_gc_mark(profile->sites[i].defined_class);
+        }
+    }
+    for (i = 0; i < CLASS_TABLE_SIZE; i++) {
+        if (profile->classes[i].count) {
+            rb_gc_mark(profile->classes[i].klass);
+        }
+    }
+}
+
+static size_t
+site_profile_memsize(const void *ptr)
+{
+    return sizeof(site_profile_t);
+}
+
+static const rb_data_type_t site_profile_type = {
+    "ScoutApm::Instruments::Allocations/site_profile",
+    { site_profile_mark, RUBY_TYPED_DEFAULT_FREE, site_profile_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static inline uint32_t
+hash_value(VALUE v)
+{
+    return (uint32_t)((((uint64_t)v >> 3) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static inline void
+count_site(site_profile_t *profile, VALUE path, long line, VALUE defined_class, uint32_t n)
+{
+    uint32_t i = (hash_value(path) ^ hash_value(defined_class) ^ ((uint32_t)line * 0x9E3779B1U)) & (SITE_TABLE_SIZE - 1);
+    int probe;
+
+    for (probe = 0; probe < SITE_MAX_PROBES; probe++, i = (i + 1) & (SITE_TABLE_SIZE - 1)) {
+        site_entry_t *entry = &profile->sites[i];
+        if (!entry->count) {
+            entry->path = path;
+            entry->line = line;
+            entry->defined_class = defined_class;
+            entry->count = n;
+            return;
+        }
+        if (entry->path == path && entry->line == line && entry->defined_class == defined_class) {
+            entry->count += n;
+            return;
+        }
+    }
+    profile->dropped += n;
+}
+
+static inline void
+count_class(site_profile_t *profile, VALUE klass, uint32_t n)
+{
+    uint32_t i = hash_value(klass) & (CLASS_TABLE_SIZE - 1);
+    int probe;
+
+    for (probe = 0; probe < SITE_MAX_PROBES; probe++, i = (i + 1) & (CLASS_TABLE_SIZE - 1)) {
+        class_entry_t *entry = &profile->classes[i];
+        if (!entry->count) {
+            entry->klass = klass;
+            entry->count = n;
+            return;
+        }
+        if (entry->klass == klass) {
+            entry->count += n;
+            return;
+        }
+    }
+    profile->dropped += n;
+}
+
+// Called from inside the NEWOBJ hook: must not allocate. The path is the
+// iseq's existing path string, and the new object is only half built, so its
+// class is read only for the ordinary object types - internal objects keep
+// other data in that slot.
+static void
+record_allocation_site(site_profile_t *profile, VALUE tpval, uint32_t n)
+{
+    rb_trace_arg_t *tparg = rb_tracearg_from_tracepoint(tpval);
+    VALUE path = rb_tracearg_path(tparg);
+    VALUE obj = rb_tracearg_object(tparg);
+
+    if (!NIL_P(path)) {
+        count_site(profile, path, FIX2LONG(rb_tracearg_lineno(tparg)), rb_tracearg_defined_class(tparg), n);
+    }
+
+    switch (BUILTIN_TYPE(obj)) {
+      case T_OBJECT: case T_CLASS: case T_MODULE: case T_FLOAT:
+      case T_STRING: case T_REGEXP: case T_ARRAY: case T_HASH:
+      case T_STRUCT: case T_BIGNUM: case T_FILE: case T_DATA:
+      case T_MATCH: case T_COMPLEX: case T_RATIONAL: case T_SYMBOL:
+        if (RBASIC(obj)->klass) {
+            count_class(profile, RBASIC(obj)->klass, n);
+        }
+        break;
+      default:
+        break;
+    }
+}
+
+static site_profile_t *
+thread_site_profile()
+{
+    VALUE thread = rb_thread_current();
+    VALUE obj = rb_attr_get(thread, id_site_profile);
+    site_profile_t *profile;
+
+    if (NIL_P(obj) || !rb_typeddata_is_kind_of(obj, &site_profile_type)) {
+        obj = TypedData_Make_Struct(rb_cObject, site_profile_t, &site_profile_type, profile);
+        rb_ivar_set(thread, id_site_profile, obj);
+        return profile;
+    }
+    return (site_profile_t *)DATA_PTR(obj);
+}
+
+static VALUE
+class_label(VALUE klass)
+{
+    if (NIL_P(klass) || !klass) {
+        return Qnil;
+    }
+#ifdef T_ICLASS
+    if (BUILTIN_TYPE(klass) == T_ICLASS) {
+        klass = RBASIC(klass)->klass; // the included module
+    }
+#endif
+    if (!RB_TYPE_P(klass, T_CLASS) && !RB_TYPE_P(klass, T_MODULE)) {
+        return Qnil;
+    }
+    return rb_class_name(klass);
+}
+
+static int
+compare_sites(const void *a, const void *b)
+{
+    uint64_t ca = (*(const site_entry_t **)a)->count, cb = (*(const site_entry_t **)b)->count;
+    return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+static int
+compare_classes(const void *a, const void *b)
+{
+    uint64_t ca = (*(const class_entry_t **)a)->count, cb = (*(const class_entry_t **)b)->count;
+    return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+// [[[path, line, method owner, count], ...], [[class, count], ...], dropped],
+// each list sorted by count and cut to the top `limit`.
+static VALUE
+site_profile_results(site_profile_t *profile, long limit)
+{
+    site_entry_t *sites[SITE_TABLE_SIZE];
+    class_entry_t *classes[CLASS_TABLE_SIZE];
+    long site_count = 0, class_count = 0, i;
+    VALUE site_ary, class_ary;
+
+    for (i = 0; i < SITE_TABLE_SIZE; i++) {
+        if (profile->sites[i].count) sites[site_count++] = &profile->sites[i];
+    }
+    for (i = 0; i < CLASS_TABLE_SIZE; i++) {
+        if (profile->classes[i].count) classes[class_count++] = &profile->classes[i];
+    }
+    qsort(sites, site_count, sizeof(site_entry_t *), compare_sites);
+    qsort(classes, class_count, sizeof(class_entry_t *), compare_classes);
+
+    if (site_count > limit) site_count = limit;
+    if (class_count > limit) class_count = limit;
+
+    site_ary = rb_ary_new2(site_count);
+    for (i = 0; i < site_count; i++) {
+        rb_ary_push(site_ary, rb_ary_new3(4, sites[i]->path, LONG2NUM(sites[i]->line),
+                                          class_label(sites[i]->defined_class), ULL2NUM(sites[i]->count)));
+    }
+    class_ary = rb_ary_new2(class_count);
+    for (i = 0; i < class_count; i++) {
+        rb_ary_push(class_ary, rb_ary_new3(2, class_label(classes[i]->klass), ULL2NUM(classes[i]->count)));
+    }
+    return rb_ary_new3(3, site_ary, class_ary, ULL2NUM(profile->dropped));
+}
+
+// Starts (or restarts) profiling allocation sites on the current thread.
+static VALUE
+start_site_profile(VALUE klass)
+{
+    site_profile_t *profile = thread_site_profile();
+    if (current_site_profile == profile) {
+        MEMZERO(profile, site_profile_t, 1);
+    }
+    current_site_profile = profile;
+    return Qnil;
+}
+
+// Stops profiling on the current thread and returns the top `limit` sites
+// and classes, or nil if no profile was running. The table is cleared so it
+// doesn't hold on to paths and classes between requests.
+static VALUE
+stop_site_profile(VALUE klass, VALUE limit)
+{
+    site_profile_t *profile = current_site_profile;
+    VALUE results;
+
+    if (!profile) {
+        return Qnil;
+    }
+    current_site_profile = NULL;
+    results = site_profile_results(profile, NUM2LONG(limit));
+    MEMZERO(profile, site_profile_t, 1);
+    return results;
+}
+
+#ifdef RUBY_EVENT_FIBER_SWITCH
+
+// Allocations are charged to the fiber that made them, not just the OS
+// thread, so fiber-based servers and async code don't leak counts into
+// whatever request happens to be live on the thread.
+//
+// Each fiber that uses this API gets a counter, stored in its fiber-local
+// storage so it's freed along with the fiber. `current_counter` points at the
+// counter of the fiber running on this thread, and is swapped by the
+// FIBER_SWITCH hook, keeping the NEWOBJ path a single lock-free increment.
+// Fibers that never take a mark have no counter, and their allocations aren't
+// charged to anybody.
+typedef struct {
+    uint64_t count;
+} allocation_counter_t;
+
+static __thread allocation_counter_t *current_counter;
+static ID id_allocation_counter;
+
+static const rb_data_type_t allocation_counter_type = {
+    "ScoutApm::Instruments::Allocations/counter",
+    { 0, RUBY_TYPED_DEFAULT_FREE, 0, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static inline void
+increment_allocations(uint32_t n) {
+  allocation_counter_t *counter = current_counter;
+  if (counter) {
+    counter->count += n;
+  }
+}
+
+static allocation_counter_t *
+lookup_fiber_counter() {
+  VALUE obj = rb_thread_local_aref(rb_thread_current(), id_allocation_counter);
+  if (NIL_P(obj) || !rb_typeddata_is_kind_of(obj, &allocation_counter_type)) {
+    return NULL;
+  }
+  return (allocation_counter_t *)DATA_PTR(obj);
+}
+
+static allocation_counter_t *
+attach_fiber_counter() {
+  allocation_counter_t *counter = lookup_fiber_counter();
+  if (!counter) {
+    VALUE obj = TypedData_Make_Struct(rb_cObject, allocation_counter_t, &allocation_counter_type, counter);
+    counter->count = 0;
+    rb_thread_local_aset(rb_thread_current(), id_allocation_counter, obj);
+  }
+  current_counter = counter;
+  return counter;
+}
+
+static inline uint64_t
+current_allocation_count() {
+  allocation_counter_t *counter = current_counter;
+  if (!counter) {
+    counter = attach_fiber_counter();
+  }
+  return counter->count;
+}
+
+static void
+context_switch_handler(VALUE tpval, void *data)
+{
+    rb_trace_arg_t *tparg = rb_tracearg_from_tracepoint(tpval);
+    if (rb_tracearg_event_flag(tparg) == RUBY_EVENT_FIBER_SWITCH) {
+        current_counter = lookup_fiber_counter();
+    } else {
+        // Thread begin / end. Native threads can be reused, so never let a
+        // pointer into the previous thread's counter or profile survive.
+        current_counter = NULL;
+        current_site_profile = NULL;
+    }
+}
+
+static void
+Init_context_hooks()
+{
+    id_allocation_counter = rb_intern("__scout_apm_allocation_counter");
+    id_site_profile = rb_intern("__scout_apm_site_profile");
+    rb_tracepoint_enable(rb_tracepoint_new(0, RUBY_EVENT_FIBER_SWITCH | RUBY_EVENT_THREAD_BEGIN | RUBY_EVENT_THREAD_END, context_switch_handler, 0));
+}
+
+#else // Without fiber switch events, count per OS thread.
+
 static __thread uint64_t endpoint_allocations;
-void increment_allocations() {
-  endpoint_allocations++;
+
+static inline void
+increment_allocations(uint32_t n) {
+  endpoint_allocations += n;
+}
+
+static inline uint64_t
+current_allocation_count() {
+  return endpoint_allocations;
+}
+
+static void
+thread_switch_handler(VALUE tpval, void *data)
+{
+    current_site_profile = NULL;
+}
+
+static void
+Init_context_hooks()
+{
+    id_site_profile = rb_intern("__scout_apm_site_profile");
+    rb_tracepoint_enable(rb_tracepoint_new(0, RUBY_EVENT_THREAD_BEGIN | RUBY_EVENT_THREAD_END, thread_switch_handler, 0));
 }
 
+#endif // RUBY_EVENT_FIBER_SWITCH
+
 static VALUE
 get_allocation_count() {
-  return ULL2NUM(endpoint_allocations);
+  return ULL2NUM(current_allocation_count());
+}
+
+// Allocation spans. A mark is the current count wrapped into the Fixnum range,
+// so taking one never creates a Bignum, and delta does the subtraction in C.
+// A delta that comes out negative (a mark taken on a different thread or
+// fiber) is reported as 0.
+#define ALLOCATION_MARK_MASK ((uint64_t)FIXNUM_MAX)
+
+static VALUE
+get_allocation_mark(VALUE klass) {
+  return LONG2FIX((long)(current_allocation_count() & ALLOCATION_MARK_MASK));
+}
+
+static VALUE
+get_allocation_delta(VALUE klass, VALUE mark) {
+  uint64_t start = (uint64_t)NUM2LONG(mark);
+  uint64_t delta = ((current_allocation_count() & ALLOCATION_MARK_MASK) - start) & ALLOCATION_MARK_MASK;
+
+  if (delta > (ALLOCATION_MARK_MASK >> 1)) {
+    delta = 0;
+  }
+  return LONG2FIX((long)delta);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GC time
+//
+// GC runs on whichever thread triggered it, and that thread is stalled for
+// the whole of it, so GC counts and wall time are kept per thread. These
+// hooks only do clock reads and additions - no allocation, no GC.stat Hash.
+//
+// Lazy sweeping and incremental marking interleave GC work with the program,
+// so wall time between GC_START and GC_END_SWEEP would include non-GC time.
+// Where Ruby has GC_ENTER / GC_EXIT, time is taken between those, which
+// bracket each actual stretch of GC work. Otherwise it's GC_START to
+// GC_END_MARK, with sweeping unaccounted for.
+////////////////////////////////////////////////////////////////////////////////
+
+static __thread uint64_t gc_count;
+static __thread uint64_t gc_time_ns;
+static __thread uint64_t gc_entered_ns;
+
+static inline uint64_t
+monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void
+gc_entered() {
+  gc_entered_ns = monotonic_ns();
+}
+
+static inline void
+gc_exited() {
+  if (gc_entered_ns) {
+    gc_time_ns += monotonic_ns() - gc_entered_ns;
+    gc_entered_ns = 0;
+  }
 }
 
 static void
-tracepoint_handler(VALUE tpval, void *data)
+gc_event_handler(VALUE tpval, void *data)
 {
     rb_trace_arg_t *tparg = rb_tracearg_from_tracepoint(tpval);
-    if (rb_tracearg_event_flag(tparg) == RUBY_INTERNAL_EVENT_NEWOBJ) {
-        increment_allocations();
+
+    switch (rb_tracearg_event_flag(tparg)) {
+      case RUBY_INTERNAL_EVENT_GC_START:
+        gc_count++;
+#ifndef RUBY_INTERNAL_EVENT_GC_ENTER
+        gc_entered();
+#endif
+        break;
+#ifdef RUBY_INTERNAL_EVENT_GC_ENTER
+      case RUBY_INTERNAL_EVENT_GC_ENTER:
+        gc_entered();
+        break;
+      case RUBY_INTERNAL_EVENT_GC_EXIT:
+        gc_exited();
+        break;
+#else
+      case RUBY_INTERNAL_EVENT_GC_END_MARK:
+        gc_exited();
+        break;
+#endif
+      default:
+        break;
     }
 }
 
+static void
+Init_gc_hooks()
+{
+    rb_event_flag_t events = RUBY_INTERNAL_EVENT_GC_START;
+#ifdef RUBY_INTERNAL_EVENT_GC_ENTER
+    events |= RUBY_INTERNAL_EVENT_GC_ENTER | RUBY_INTERNAL_EVENT_GC_EXIT;
+#else
+    events |= RUBY_INTERNAL_EVENT_GC_END_MARK;
+#endif
+    rb_tracepoint_enable(rb_tracepoint_new(0, events, gc_event_handler, 0));
+}
+
+// The number of GCs started on the current thread.
+static VALUE
+get_gc_count(VALUE klass) {
+  return ULL2NUM(gc_count);
+}
+
+// Seconds of wall time the current thread has spent in GC, as a Float.
+static VALUE
+get_gc_time(VALUE klass) {
+  return DBL2NUM((double)gc_time_ns / 1e9);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Layer spans
+//
+// A layer records allocations, GC count and GC time between its start and
+// stop. A span reads all three counters in one call, and span_delta! turns
+// it into the deltas in place, so each layer boundary is a single native call
+// and the stop allocates nothing.
+//
+//   span = Allocations.span        # [allocation mark, gc count, gc time ns]
+//   Allocations.span_delta!(span)  # => [allocations, gcs, gc seconds]
+////////////////////////////////////////////////////////////////////////////////
+
+static VALUE
+get_span(VALUE klass) {
+  // Allocated before the counters are read, so the span itself isn't charged
+  // to the layer
+  VALUE span = rb_ary_new2(3);
+  rb_ary_store(span, 0, get_allocation_mark(klass));
+  rb_ary_store(span, 1, ULL2NUM(gc_count));
+  rb_ary_store(span, 2, ULL2NUM(gc_time_ns));
+  return span;
+}
+
+static VALUE
+span_delta_bang(VALUE klass, VALUE span) {
+  uint64_t gc_count_start, gc_time_start;
+
+  Check_Type(span, T_ARRAY);
+  if (RARRAY_LEN(span) != 3) {
+    rb_raise(rb_eArgError, "not an allocation span");
+  }
+  gc_count_start = NUM2ULL(rb_ary_entry(span, 1));
+  gc_time_start = NUM2ULL(rb_ary_entry(span, 2));
+
+  rb_ary_store(span, 0, get_allocation_delta(klass, rb_ary_entry(span, 0)));
+  rb_ary_store(span, 1, ULL2NUM(gc_count - gc_count_start));
+  rb_ary_store(span, 2, DBL2NUM((double)(gc_time_ns - gc_time_start) / 1e9));
+  return span;
+}
+
+// ScoutApm::Clock.monotonic_ns - see lib/scout_apm/clock.rb
+static VALUE
+get_monotonic_ns(VALUE klass) {
+  return ULL2NUM(monotonic_ns());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Agent overhead
+//
+// Counters for the agent's own hot paths, read by ScoutApm::Overhead. A
+// section's slot is a fixed index, so recording one is a clock read and a few
+// additions, with no Hash lookup and no allocation. Callers hold the GVL.
+////////////////////////////////////////////////////////////////////////////////
+
+#define OVERHEAD_SLOTS 64
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+} overhead_slot_t;
+
+static overhead_slot_t overhead_slots[OVERHEAD_SLOTS];
+
+// NativeOverhead.record(slot, mark) - charges the time since `mark` (a
+// Clock.monotonic_ns reading) to `slot`.
+static VALUE
+overhead_record(VALUE klass, VALUE slot, VALUE mark) {
+  long i = NUM2LONG(slot);
+  uint64_t start = NUM2ULL(mark), now = monotonic_ns(), elapsed;
+  overhead_slot_t *s;
+
+  if (i < 0 || i >= OVERHEAD_SLOTS) {
+    rb_raise(rb_eArgError, "overhead slot out of range: %ld", i);
+  }
+  elapsed = now > start ? now - start : 0;
+
+  s = &overhead_slots[i];
+  if (!s->count || elapsed < s->min_ns) s->min_ns = elapsed;
+  if (elapsed > s->max_ns) s->max_ns = elapsed;
+  s->count++;
+  s->total_ns += elapsed;
+  return Qnil;
+}
+
+// NativeOverhead.drain(count) - [[count, total_ns, min_ns, max_ns], ...] for
+// the first `count` slots, zeroing them.
+static VALUE
+overhead_drain(VALUE klass, VALUE count) {
+  long n = NUM2LONG(count), i;
+  VALUE result;
+
+  if (n > OVERHEAD_SLOTS) n = OVERHEAD_SLOTS;
+  if (n < 0) n = 0;
+
+  result = rb_ary_new2(n);
+  for (i = 0; i < n; i++) {
+    overhead_slot_t *s = &overhead_slots[i];
+    rb_ary_push(result, rb_ary_new3(4, ULL2NUM(s->count), ULL2NUM(s->total_ns), ULL2NUM(s->min_ns), ULL2NUM(s->max_ns)));
+  }
+  MEMZERO(overhead_slots, overhead_slot_t, n);
+  return result;
+}
+
+// The hook is only registered for NEWOBJ, so there's no need to inspect the
+// trace arg - keep the per-allocation work to the increment, unless a site
+// profile is running on this thread.
+static void
+tracepoint_handler(VALUE tpval, void *data)
+{
+    site_profile_t *profile;
+
+    if (sample_countdown > 1) {
+        sample_countdown--;
+        return;
+    }
+    sample_countdown = sample_rate;
+
+    increment_allocations(sample_rate);
+    profile = current_site_profile;
+    if (profile) {
+        record_allocation_site(profile, tpval, sample_rate);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Turning tracking on and off at runtime
+//
+// Modes:
+//   :always  - the NEWOBJ hook is installed for the life of the process
+//   :request - the hook is installed only while at least one request is
+//              being tracked (see request_started / request_finished)
+//   :off     - never installed
+////////////////////////////////////////////////////////////////////////////////
+
+#define ALLOCATION_MODE_ALWAYS 0
+#define ALLOCATION_MODE_REQUEST 1
+#define ALLOCATION_MODE_OFF 2
+
+static VALUE newobj_tracepoint = Qnil;
+static int allocation_mode = ALLOCATION_MODE_ALWAYS;
+static long active_requests = 0;
+
 static VALUE
 set_gc_hook(rb_event_flag_t event)
 {
     VALUE tpval;
-    // TODO - need to prevent applying the same tracepoint multiple times?
     tpval = rb_tracepoint_new(0, event, tracepoint_handler, 0);
     rb_tracepoint_enable(tpval);
 
     return tpval;
 }
 
+// Installs or removes the NEWOBJ hook to match the mode. Callers hold the
+// GVL, so the mode and request count need no extra locking.
+static void
+update_gc_hook() {
+    int wanted = allocation_mode == ALLOCATION_MODE_ALWAYS ||
+      (allocation_mode == ALLOCATION_MODE_REQUEST && active_requests > 0);
+
+    if (NIL_P(newobj_tracepoint)) {
+        if (wanted) {
+            newobj_tracepoint = set_gc_hook(RUBY_INTERNAL_EVENT_NEWOBJ);
+        }
+    } else if (wanted && !RTEST(rb_tracepoint_enabled_p(newobj_tracepoint))) {
+        rb_tracepoint_enable(newobj_tracepoint);
+    } else if (!wanted && RTEST(rb_tracepoint_enabled_p(newobj_tracepoint))) {
+        rb_tracepoint_disable(newobj_tracepoint);
+    }
+}
+
+static VALUE
+get_mode(VALUE klass) {
+  switch (allocation_mode) {
+    case ALLOCATION_MODE_REQUEST: return ID2SYM(rb_intern("request"));
+    case ALLOCATION_MODE_OFF: return ID2SYM(rb_intern("off"));
+    default: return ID2SYM(rb_intern("always"));
+  }
+}
+
+static VALUE
+set_mode(VALUE klass, VALUE mode) {
+  ID id = rb_to_id(mode);
+
+  if (id == rb_intern("always")) {
+    allocation_mode = ALLOCATION_MODE_ALWAYS;
+  } else if (id == rb_intern("request")) {
+    allocation_mode = ALLOCATION_MODE_REQUEST;
+  } else if (id == rb_intern("off")) {
+    allocation_mode = ALLOCATION_MODE_OFF;
+  } else {
+    rb_raise(rb_eArgError, "unknown allocation tracking mode: %"PRIsVALUE, mode);
+  }
+  update_gc_hook();
+  return mode;
+}
+
+static VALUE
+is_enabled(VALUE klass) {
+  return allocation_mode == ALLOCATION_MODE_OFF ? Qfalse : Qtrue;
+}
+
+static VALUE
+request_started(VALUE klass) {
+  active_requests++;
+  if (allocation_mode == ALLOCATION_MODE_REQUEST) {
+    update_gc_hook();
+  }
+  return Qnil;
+}
+
+static VALUE
+request_finished(VALUE klass) {
+  if (active_requests > 0) {
+    active_requests--;
+  }
+  if (allocation_mode == ALLOCATION_MODE_REQUEST) {
+    update_gc_hook();
+  }
+  return Qnil;
+}
+
+static VALUE
+get_sample_rate(VALUE klass) {
+  return UINT2NUM(sample_rate);
+}
+
+static VALUE
+set_sample_rate(VALUE klass, VALUE rate) {
+  long n = NUM2LONG(rate);
+  if (n < 1 || n > UINT32_MAX) {
+    rb_raise(rb_eArgError, "sample rate must be a positive integer");
+  }
+  sample_rate = (uint32_t)n;
+  return rate;
+}
+
 void
 Init_hooks(VALUE module)
 {
-    set_gc_hook(RUBY_INTERNAL_EVENT_NEWOBJ);
+    rb_global_variable(&newobj_tracepoint);
+    Init_context_hooks();
+    Init_gc_hooks();
+    update_gc_hook();
 }
 
 void Init_allocations()
@@ -56,8 +770,30 @@ void Init_allocations()
     mInstruments = rb_define_module_under(mScoutApm, "Instruments");
     cAllocations = rb_define_class_under(mInstruments, "Allocations", rb_cObject);
     rb_define_singleton_method(cAllocations, "count", get_allocation_count, 0);
-    rb_define_singleton_method(cAllocations, "count", get_allocation_count, 0);
+    rb_define_singleton_method(cAllocations, "mark", get_allocation_mark, 0);
+    rb_define_singleton_method(cAllocations, "delta", get_allocation_delta, 1);
+    rb_define_singleton_method(cAllocations, "mode", get_mode, 0);
+    rb_define_singleton_method(cAllocations, "mode=", set_mode, 1);
+    rb_define_singleton_method(cAllocations, "enabled?", is_enabled, 0);
+    rb_define_singleton_method(cAllocations, "request_started", request_started, 0);
+    rb_define_singleton_method(cAllocations, "request_finished", request_finished, 0);
+    rb_define_singleton_method(cAllocations, "sample_rate", get_sample_rate, 0);
+    rb_define_singleton_method(cAllocations, "sample_rate=", set_sample_rate, 1);
+    rb_define_singleton_method(cAllocations, "start_site_profile", start_site_profile, 0);
+    rb_define_singleton_method(cAllocations, "stop_site_profile", stop_site_profile, 1);
+    rb_define_singleton_method(cAllocations, "gc_count", get_gc_count, 0);
+    rb_define_singleton_method(cAllocations, "gc_time", get_gc_time, 0);
+    rb_define_singleton_method(cAllocations, "span", get_span, 0);
+    rb_define_singleton_method(cAllocations, "span_delta!", span_delta_bang, 1);
     rb_define_const(cAllocations, "ENABLED", Qtrue);
+
+    mClock = rb_define_module_under(mScoutApm, "Clock");
+    rb_define_singleton_method(mClock, "monotonic_ns", get_monotonic_ns, 0);
+
+    mNativeOverhead = rb_define_module_under(mScoutApm, "NativeOverhead");
+    rb_define_singleton_method(mNativeOverhead, "record", overhead_record, 2);
+    rb_define_singleton_method(mNativeOverhead, "drain", overhead_drain, 1);
+    rb_define_const(mNativeOverhead, "SLOTS", INT2FIX(OVERHEAD_SLOTS));
     Init_hooks(mScoutApm);
 }
 
@@ -68,6 +804,75 @@ get_allocation_count() {
   return ULL2NUM(0);
 }
 
+static VALUE
+get_allocation_mark(VALUE klass) {
+  return INT2FIX(0);
+}
+
+static VALUE
+get_allocation_delta(VALUE klass, VALUE mark) {
+  return INT2FIX(0);
+}
+
+static VALUE
+get_mode(VALUE klass) {
+  return ID2SYM(rb_intern("off"));
+}
+
+static VALUE
+set_mode(VALUE klass, VALUE mode) {
+  return mode;
+}
+
+static VALUE
+is_enabled(VALUE klass) {
+  return Qfalse;
+}
+
+static VALUE
+noop(VALUE klass) {
+  return Qnil;
+}
+
+static VALUE
+stop_site_profile(VALUE klass, VALUE limit) {
+  return Qnil;
+}
+
+static VALUE
+get_gc_count(VALUE klass) {
+  return INT2FIX(0);
+}
+
+static VALUE
+get_gc_time(VALUE klass) {
+  return DBL2NUM(0.0);
+}
+
+static VALUE
+get_span(VALUE klass) {
+  return rb_ary_new3(3, INT2FIX(0), INT2FIX(0), INT2FIX(0));
+}
+
+static VALUE
+span_delta_bang(VALUE klass, VALUE span) {
+  Check_Type(span, T_ARRAY);
+  rb_ary_store(span, 0, INT2FIX(0));
+  rb_ary_store(span, 1, INT2FIX(0));
+  rb_ary_store(span, 2, DBL2NUM(0.0));
+  return span;
+}
+
+static VALUE
+get_sample_rate(VALUE klass) {
+  return INT2FIX(1);
+}
+
+static VALUE
+set_sample_rate(VALUE klass, VALUE rate) {
+  return rate;
+}
+
 void
 Init_hooks(VALUE module)
 {
@@ -79,7 +884,21 @@ void Init_allocations()
     mInstruments = rb_define_module_under(mScoutApm, "Instruments");
     cAllocations = rb_define_class_under(mInstruments, "Allocations", rb_cObject);
     rb_define_singleton_method(cAllocations, "count", get_allocation_count, 0);
-    rb_define_singleton_method(cAllocations, "count", get_allocation_count, 0);
+    rb_define_singleton_method(cAllocations, "mark", get_allocation_mark, 0);
+    rb_define_singleton_method(cAllocations, "delta", get_allocation_delta, 1);
+    rb_define_singleton_method(cAllocations, "mode", get_mode, 0);
+    rb_define_singleton_method(cAllocations, "mode=", set_mode, 1);
+    rb_define_singleton_method(cAllocations, "enabled?", is_enabled, 0);
+    rb_define_singleton_method(cAllocations, "request_started", noop, 0);
+    rb_define_singleton_method(cAllocations, "request_finished", noop, 0);
+    rb_define_singleton_method(cAllocations, "sample_rate", get_sample_rate, 0);
+    rb_define_singleton_method(cAllocations, "sample_rate=", set_sample_rate, 1);
+    rb_define_singleton_method(cAllocations, "start_site_profile", noop, 0);
+    rb_define_singleton_method(cAllocations, "stop_site_profile", stop_site_profile, 1);
+    rb_define_singleton_method(cAllocations, "gc_count", get_gc_count, 0);
+    rb_define_singleton_method(cAllocations, "gc_time", get_gc_time, 0);
+    rb_define_singleton_method(cAllocations, "span", get_span, 0);
+    rb_define_singleton_method(cAllocations, "span_delta!", span_delta_bang, 1);
     rb_define_const(cAllocations, "ENABLED", Qfalse);
     Init_hooks(mScoutApm);
 }
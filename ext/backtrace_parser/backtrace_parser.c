@@ -0,0 +1,141 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Native counterpart to ScoutApm::Utils::BacktraceParser. Rather than
+// building the `caller` Array (a String per frame) and matching a regex
+// against each one, this walks the frames of the current thread with
+// rb_profile_frames, checks each file path against the app root by prefix,
+// and only builds Strings for the app frames it keeps.
+//
+// Frames are formatted like BacktraceParser#call's output: the path under the
+// app root, then `:line:in `label'`. C function frames have no file of their
+// own, so unlike `caller` they never show up, and on newer Rubies a block
+// frame is labelled with its method's name rather than "block in ...".
+
+static VALUE mScoutApm;
+static VALUE mUtils;
+static VALUE mNativeBacktraceParser;
+
+#if defined(HAVE_RUBY_RUBY_H) && defined(HAVE_RB_PROFILE_FRAMES)
+
+#include <ruby/debug.h>
+#include <string.h>
+
+// The most frames we'll look through, whatever depth is asked for.
+#define MAX_FRAMES 256
+
+// Directories under the app root that count as app code.
+static const char *app_dirs[] = {"lib/", "app/", "config/", NULL};
+
+// If +path+ is a file in one of the app_dirs under +root+, returns the offset
+// of the path relative to root. Otherwise -1.
+static long
+app_path_offset(const char *path, long path_len, const char *root, long root_len)
+{
+    const char **dir;
+    const char *rest;
+    long rest_len;
+
+    if (path_len <= root_len + 1) return -1;
+    if (memcmp(path, root, root_len) != 0 || path[root_len] != '/') return -1;
+
+    rest = path + root_len + 1;
+    rest_len = path_len - root_len - 1;
+    for (dir = app_dirs; *dir; dir++) {
+        long dir_len = (long)strlen(*dir);
+        if (rest_len > dir_len && memcmp(rest, *dir, dir_len) == 0) {
+            return root_len + 1;
+        }
+    }
+    return -1;
+}
+
+static VALUE
+frame_path(VALUE frame)
+{
+    VALUE path = rb_profile_frame_absolute_path(frame);
+    if (!RB_TYPE_P(path, T_STRING)) path = rb_profile_frame_path(frame);
+    return path;
+}
+
+// NativeBacktraceParser.app_frames(root, skip, depth, limit) => Array
+//
+// Looks at most +depth+ frames up the stack, starting +skip+ frames up from
+// the calling method (counted like `caller(skip)`, so 0 is the caller
+// itself), and returns the first +limit+ that are app frames.
+static VALUE
+app_frames(VALUE self, VALUE root, VALUE rb_skip, VALUE rb_depth, VALUE rb_limit)
+{
+    VALUE frames[MAX_FRAMES];
+    int lines[MAX_FRAMES];
+    const char *root_ptr;
+    long root_len;
+    int skip = NUM2INT(rb_skip);
+    int depth = NUM2INT(rb_depth);
+    long limit = NUM2LONG(rb_limit);
+    int count, i;
+    VALUE result;
+
+    StringValue(root);
+    root_ptr = RSTRING_PTR(root);
+    root_len = RSTRING_LEN(root);
+    while (root_len > 0 && root_ptr[root_len - 1] == '/') root_len--;
+
+    result = rb_ary_new();
+    if (skip < 0 || depth <= 0 || limit <= 0) return result;
+    if (skip >= MAX_FRAMES - 1) return result;
+    if (depth > MAX_FRAMES - 1 - skip) depth = MAX_FRAMES - 1 - skip;
+
+    // Many Rubies ignore rb_profile_frames' start argument, so always read
+    // from the top and skip frames ourselves. Read one extra: newer Rubies
+    // include C function frames, starting with this one, and we count from
+    // the method that called us, like `caller` does.
+    count = rb_profile_frames(0, skip + depth + 1, frames, lines);
+    if (count > 0 && lines[0] == 0) skip++; // C frames have no line
+    if (count > skip + depth) count = skip + depth;
+
+    for (i = skip; i < count; i++) {
+        VALUE path = frame_path(frames[i]);
+        VALUE label, entry;
+        long offset;
+
+        if (lines[i] == 0 || !RB_TYPE_P(path, T_STRING)) continue;
+
+        offset = app_path_offset(RSTRING_PTR(path), RSTRING_LEN(path), root_ptr, root_len);
+        if (offset < 0) continue;
+
+        label = rb_profile_frame_label(frames[i]);
+        entry = rb_str_new(RSTRING_PTR(path) + offset, RSTRING_LEN(path) - offset);
+        if (RB_TYPE_P(label, T_STRING)) {
+            rb_str_catf(entry, ":%d:in `%"PRIsVALUE"'", lines[i], label);
+        } else {
+            rb_str_catf(entry, ":%d", lines[i]);
+        }
+        rb_ary_push(result, entry);
+
+        if (RARRAY_LEN(result) >= limit) break;
+    }
+
+    return result;
+}
+
+void Init_backtrace_parser()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+    mUtils = rb_define_module_under(mScoutApm, "Utils");
+    mNativeBacktraceParser = rb_define_module_under(mUtils, "NativeBacktraceParser");
+
+    rb_define_singleton_method(mNativeBacktraceParser, "app_frames", app_frames, 4);
+}
+
+#else
+
+// Without rb_profile_frames, BacktraceParser parses `caller` in Ruby.
+void Init_backtrace_parser()
+{
+}
+
+#endif
@@ -0,0 +1,617 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Native JSON encoder for the reporting payload. See
+// lib/scout_apm/serializers/payload_serializer_to_json.rb, whose
+// jsonify_hash / format_by_type this matches byte for byte, including its
+// quirks: only \b \t \n \f \r and " are escaped, Symbols and anything else
+// unknown are written as quoted to_s, other Numerics are written bare.
+//
+// Metric sets (wrapped in NativeJsonEncoder::Metrics) and DbQueryMetricStats
+// are written straight from their instance variables, producing what
+// rearrange_the_metrics and DbQueryMetricStats#as_json would, without
+// building those intermediate Hashes.
+//
+// Everything is written into one String. Given an IO, the String is handed to
+// its #write every time it passes FLUSH_SIZE, so the whole payload never has
+// to be in memory at once.
+
+static VALUE mScoutApm;
+static VALUE mSerializers;
+static VALUE mNativeJsonEncoder;
+static VALUE cMetrics;
+
+#ifdef HAVE_RUBY_RUBY_H
+
+#include <ruby/encoding.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLUSH_SIZE (64 * 1024)
+
+static VALUE cMetricMeta, cMetricStats, cDbQueryMetricStats;
+static int classes_looked_up = 0;
+
+static ID id_as_json, id_iso8601, id_to_s, id_to_a, id_write, id_merge;
+static ID id_metric_name, id_scope, id_desc, id_extra, id_metrics;
+static VALUE sym_key;
+
+// MetricStats#as_json, in order
+static const char *metric_stats_fields[] = {
+    "call_count", "max_call_time", "min_call_time", "total_call_time", "total_exclusive_time", NULL
+};
+static ID metric_stats_ids[8];
+
+// DbQueryMetricStats#as_json, in order
+static const char *db_query_metric_stats_fields[] = {
+    "model_name", "operation", "scope", "transaction_count", "call_count", "histogram",
+    "call_time", "max_call_time", "min_call_time", "max_rows_returned", "min_rows_returned",
+    "rows_returned", NULL
+};
+static ID db_query_metric_stats_ids[16];
+
+typedef struct {
+    VALUE buf;
+    VALUE io; // Qnil when building a single String
+    long written;
+} encoder_t;
+
+// Passed through rb_hash_foreach
+typedef struct {
+    encoder_t *e;
+    int first;
+} iteration_t;
+
+static void put_value(encoder_t *e, VALUE v);
+
+////////////////////////////////////////////////////////////////////////////////
+// Buffer
+////////////////////////////////////////////////////////////////////////////////
+
+static VALUE
+new_buffer(long capa)
+{
+    VALUE buf = rb_str_buf_new(capa);
+    rb_enc_associate(buf, rb_utf8_encoding());
+    return buf;
+}
+
+static void
+flush(encoder_t *e)
+{
+    if (NIL_P(e->io) || RSTRING_LEN(e->buf) == 0) return;
+
+    e->written += RSTRING_LEN(e->buf);
+    rb_funcall(e->io, id_write, 1, e->buf);
+    e->buf = new_buffer(FLUSH_SIZE + 1024);
+}
+
+static inline void
+put_bytes(encoder_t *e, const char *ptr, long len)
+{
+    rb_str_buf_cat(e->buf, ptr, len);
+    if (!NIL_P(e->io) && RSTRING_LEN(e->buf) >= FLUSH_SIZE) flush(e);
+}
+
+#define PUT_LITERAL(e, lit) put_bytes((e), (lit), sizeof(lit) - 1)
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalars
+////////////////////////////////////////////////////////////////////////////////
+
+// PayloadSerializerToJson.escape
+static void
+put_escaped(encoder_t *e, const char *ptr, long len)
+{
+    long i, start = 0;
+    const char *rep;
+
+    for (i = 0; i < len; i++) {
+        switch (ptr[i]) {
+          case '\b': rep = "\\b"; break;
+          case '\t': rep = "\\t"; break;
+          case '\n': rep = "\\n"; break;
+          case '\f': rep = "\\f"; break;
+          case '\r': rep = "\\r"; break;
+          case '"':  rep = "\\\""; break;
+          default: continue;
+        }
+        if (i > start) put_bytes(e, ptr + start, i - start);
+        put_bytes(e, rep, 2);
+        start = i + 1;
+    }
+    if (len > start) put_bytes(e, ptr + start, len - start);
+}
+
+static void
+put_quoted(encoder_t *e, VALUE str)
+{
+    PUT_LITERAL(e, "\"");
+    put_escaped(e, RSTRING_PTR(str), RSTRING_LEN(str));
+    PUT_LITERAL(e, "\"");
+}
+
+static void
+put_long(encoder_t *e, long n)
+{
+    char tmp[32];
+    int len = snprintf(tmp, sizeof(tmp), "%ld", n);
+    put_bytes(e, tmp, len);
+}
+
+// Float#to_s. The shortest digits that read back as the same double, laid
+// out like flo_to_s: fixed notation when the point falls inside the digits,
+// or needs at most DBL_DIG digits of zero padding, or for decpt > -4; else
+// d.ddde+XX.
+//
+// The correctly rounded digits are the shortest ones everywhere but exact
+// powers of two, whose neighbours aren't evenly spaced, and subnormals, which
+// can need fewer than DBL_DIG digits, so those are left to Ruby.
+static void
+put_float(encoder_t *e, VALUE v)
+{
+    double d = RFLOAT_VALUE(v);
+    char tmp[40], digits[20], out[48];
+    int precision, ndigits, decpt, i, len = 0;
+    int mantissa_exp;
+    char *p, *exp_part;
+
+    if (isnan(d) || isinf(d) || (d != 0.0 && fabs(d) < DBL_MIN) ||
+        (d != 0.0 && frexp(d, &mantissa_exp) == (d < 0 ? -0.5 : 0.5))) {
+        VALUE s = rb_funcall(v, id_to_s, 0);
+        put_bytes(e, RSTRING_PTR(s), RSTRING_LEN(s));
+        return;
+    }
+
+    if (d == 0.0) {
+        if (signbit(d)) PUT_LITERAL(e, "-0.0");
+        else PUT_LITERAL(e, "0.0");
+        return;
+    }
+
+    for (precision = 15; precision <= 17; precision++) {
+        snprintf(tmp, sizeof(tmp), "%.*e", precision - 1, d);
+        if (strtod(tmp, NULL) == d) break;
+    }
+
+    // tmp is [-]d.ddde[+-]XX
+    p = tmp;
+    if (*p == '-') {
+        out[len++] = '-';
+        p++;
+    }
+    exp_part = strchr(p, 'e');
+    ndigits = 0;
+    for (; p < exp_part; p++) {
+        if (*p != '.') digits[ndigits++] = *p;
+    }
+    while (ndigits > 1 && digits[ndigits - 1] == '0') ndigits--;
+    decpt = atoi(exp_part + 1) + 1;
+
+    if (decpt > 0 && (decpt < ndigits || decpt <= DBL_DIG)) {
+        if (decpt < ndigits) {
+            memcpy(out + len, digits, decpt);
+            len += decpt;
+            out[len++] = '.';
+            memcpy(out + len, digits + decpt, ndigits - decpt);
+            len += ndigits - decpt;
+        }
+        else {
+            memcpy(out + len, digits, ndigits);
+            len += ndigits;
+            for (i = ndigits; i < decpt; i++) out[len++] = '0';
+            out[len++] = '.';
+            out[len++] = '0';
+        }
+    }
+    else if (decpt <= 0 && decpt > -4) {
+        out[len++] = '0';
+        out[len++] = '.';
+        for (i = 0; i < -decpt; i++) out[len++] = '0';
+        memcpy(out + len, digits, ndigits);
+        len += ndigits;
+    }
+    else {
+        out[len++] = digits[0];
+        out[len++] = '.';
+        if (ndigits > 1) {
+            memcpy(out + len, digits + 1, ndigits - 1);
+            len += ndigits - 1;
+        }
+        else {
+            out[len++] = '0';
+        }
+        len += snprintf(out + len, sizeof(out) - len, "e%+03d", decpt - 1);
+    }
+
+    put_bytes(e, out, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Values
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+lookup_classes()
+{
+    if (classes_looked_up) return;
+    cMetricMeta = rb_path2class("ScoutApm::MetricMeta");
+    cMetricStats = rb_path2class("ScoutApm::MetricStats");
+    cDbQueryMetricStats = rb_path2class("ScoutApm::DbQueryMetricStats");
+    classes_looked_up = 1;
+}
+
+static int
+put_hash_pair(VALUE key, VALUE value, VALUE arg)
+{
+    iteration_t *it = (iteration_t *)arg;
+
+    if (!it->first) PUT_LITERAL(it->e, ",");
+    it->first = 0;
+    put_value(it->e, key);
+    PUT_LITERAL(it->e, ":");
+    put_value(it->e, value);
+    return ST_CONTINUE;
+}
+
+static void
+put_hash(encoder_t *e, VALUE hash)
+{
+    iteration_t it;
+    it.e = e;
+    it.first = 1;
+
+    PUT_LITERAL(e, "{");
+    rb_hash_foreach(hash, put_hash_pair, (VALUE)&it);
+    PUT_LITERAL(e, "}");
+}
+
+static void
+put_array(encoder_t *e, VALUE ary)
+{
+    long i;
+    PUT_LITERAL(e, "[");
+    for (i = 0; i < RARRAY_LEN(ary); i++) {
+        if (i > 0) PUT_LITERAL(e, ",");
+        put_value(e, rb_ary_entry(ary, i));
+    }
+    PUT_LITERAL(e, "]");
+}
+
+// A value read by AttributeArranger: as_json'd if it responds to it (and
+// isn't a Time). Values as_json would hand back unchanged skip the call.
+static void
+put_attribute(encoder_t *e, VALUE v)
+{
+    switch (TYPE(v)) {
+      case T_NIL:
+      case T_TRUE:
+      case T_FALSE:
+      case T_FIXNUM:
+        put_value(e, v);
+        return;
+      case T_FLOAT:
+        if (isfinite(RFLOAT_VALUE(v))) {
+            put_value(e, v);
+            return;
+        }
+        break;
+      case T_STRING:
+        if (rb_obj_class(v) == rb_cString) {
+            put_value(e, v);
+            return;
+        }
+        break;
+      case T_HASH:
+        if (RHASH_SIZE(v) == 0 && rb_obj_class(v) == rb_cHash) {
+            PUT_LITERAL(e, "{}");
+            return;
+        }
+        break;
+    }
+
+    if (!rb_obj_is_kind_of(v, rb_cTime) && rb_respond_to(v, id_as_json)) {
+        v = rb_funcall(v, id_as_json, 0);
+    }
+    put_value(e, v);
+}
+
+static void
+put_field_name(encoder_t *e, const char *name, int first)
+{
+    if (!first) PUT_LITERAL(e, ",");
+    PUT_LITERAL(e, "\"");
+    put_bytes(e, name, strlen(name));
+    PUT_LITERAL(e, "\":");
+}
+
+// metric_name.to_s.split(/\//, 2) as [bucket, name]
+static void
+split_metric_name(VALUE metric_name, VALUE *bucket, VALUE *name)
+{
+    VALUE str = rb_obj_as_string(metric_name);
+    const char *ptr = RSTRING_PTR(str);
+    long len = RSTRING_LEN(str);
+    const char *slash;
+
+    if (len == 0) {
+        *bucket = *name = Qnil;
+        return;
+    }
+
+    slash = memchr(ptr, '/', len);
+    if (!slash) {
+        *bucket = *name = str;
+        return;
+    }
+
+    *bucket = rb_enc_str_new(ptr, slash - ptr, rb_enc_get(str));
+    *name = rb_enc_str_new(slash + 1, len - (slash - ptr) - 1, rb_enc_get(str));
+}
+
+// MetricMeta#as_json
+static void
+put_metric_meta(encoder_t *e, VALUE meta)
+{
+    VALUE bucket, name, scope;
+
+    split_metric_name(rb_ivar_get(meta, id_metric_name), &bucket, &name);
+
+    put_field_name(e, "bucket", 1);
+    put_value(e, bucket);
+    put_field_name(e, "name", 0);
+    put_value(e, name);
+    put_field_name(e, "desc", 0);
+    put_attribute(e, rb_ivar_get(meta, id_desc));
+    put_field_name(e, "extra", 0);
+    put_attribute(e, rb_ivar_get(meta, id_extra));
+
+    put_field_name(e, "scope", 0);
+    scope = rb_ivar_get(meta, id_scope);
+    if (RTEST(scope)) {
+        split_metric_name(scope, &bucket, &name);
+        PUT_LITERAL(e, "{\"bucket\":");
+        put_value(e, bucket);
+        PUT_LITERAL(e, ",\"name\":");
+        put_value(e, name);
+        PUT_LITERAL(e, "}");
+    }
+    else {
+        PUT_LITERAL(e, "null");
+    }
+}
+
+// One element of rearrange_the_metrics: stats.as_json.merge(:key => meta.as_json)
+static void
+put_metric(encoder_t *e, VALUE meta, VALUE stats)
+{
+    int i;
+
+    if (rb_obj_class(meta) != cMetricMeta || rb_obj_class(stats) != cMetricStats) {
+        VALUE key = rb_hash_new();
+        rb_hash_aset(key, sym_key, rb_funcall(meta, id_as_json, 0));
+        put_value(e, rb_funcall(rb_funcall(stats, id_as_json, 0), id_merge, 1, key));
+        return;
+    }
+
+    PUT_LITERAL(e, "{");
+    for (i = 0; metric_stats_fields[i]; i++) {
+        put_field_name(e, metric_stats_fields[i], i == 0);
+        put_attribute(e, rb_ivar_get(stats, metric_stats_ids[i]));
+    }
+    PUT_LITERAL(e, ",\"key\":{");
+    put_metric_meta(e, meta);
+    PUT_LITERAL(e, "}}");
+}
+
+static int
+put_metrics_pair(VALUE meta, VALUE stats, VALUE arg)
+{
+    iteration_t *it = (iteration_t *)arg;
+
+    if (!it->first) PUT_LITERAL(it->e, ",");
+    it->first = 0;
+    put_metric(it->e, meta, stats);
+    return ST_CONTINUE;
+}
+
+// rearrange_the_metrics
+static void
+put_metrics(encoder_t *e, VALUE metrics)
+{
+    iteration_t it;
+    long i;
+
+    PUT_LITERAL(e, "[");
+    if (TYPE(metrics) == T_HASH) {
+        it.e = e;
+        it.first = 1;
+        rb_hash_foreach(metrics, put_metrics_pair, (VALUE)&it);
+    }
+    else {
+        VALUE pairs = NIL_P(metrics) ? rb_ary_new() : rb_funcall(metrics, id_to_a, 0);
+        for (i = 0; i < RARRAY_LEN(pairs); i++) {
+            VALUE pair = rb_Array(rb_ary_entry(pairs, i));
+            if (i > 0) PUT_LITERAL(e, ",");
+            put_metric(e, rb_ary_entry(pair, 0), rb_ary_entry(pair, 1));
+        }
+    }
+    PUT_LITERAL(e, "]");
+}
+
+// DbQueryMetricStats#as_json
+static void
+put_db_query_metric_stats(encoder_t *e, VALUE stats)
+{
+    int i;
+
+    PUT_LITERAL(e, "{");
+    for (i = 0; db_query_metric_stats_fields[i]; i++) {
+        put_field_name(e, db_query_metric_stats_fields[i], i == 0);
+        put_attribute(e, rb_ivar_get(stats, db_query_metric_stats_ids[i]));
+    }
+    PUT_LITERAL(e, "}");
+}
+
+// PayloadSerializerToJson.format_by_type
+static void
+put_value(encoder_t *e, VALUE v)
+{
+    VALUE s;
+
+    switch (TYPE(v)) {
+      case T_HASH:
+        put_hash(e, v);
+        return;
+      case T_ARRAY:
+        put_array(e, v);
+        return;
+      case T_FIXNUM:
+        put_long(e, FIX2LONG(v));
+        return;
+      case T_FLOAT:
+        put_float(e, v);
+        return;
+      case T_NIL:
+        PUT_LITERAL(e, "null");
+        return;
+      case T_STRING:
+        put_quoted(e, v);
+        return;
+      case T_TRUE:
+        PUT_LITERAL(e, "\"true\"");
+        return;
+      case T_FALSE:
+        PUT_LITERAL(e, "\"false\"");
+        return;
+    }
+
+    if (rb_obj_class(v) == cMetrics) {
+        put_metrics(e, rb_ivar_get(v, id_metrics));
+        return;
+    }
+
+    lookup_classes();
+    if (rb_obj_class(v) == cDbQueryMetricStats) {
+        put_db_query_metric_stats(e, v);
+        return;
+    }
+
+    if (rb_obj_is_kind_of(v, rb_cNumeric)) {
+        s = rb_obj_as_string(v);
+        put_bytes(e, RSTRING_PTR(s), RSTRING_LEN(s));
+    }
+    else if (rb_obj_is_kind_of(v, rb_cTime)) {
+        s = rb_obj_as_string(rb_funcall(v, id_iso8601, 0));
+        PUT_LITERAL(e, "\"");
+        put_bytes(e, RSTRING_PTR(s), RSTRING_LEN(s));
+        PUT_LITERAL(e, "\"");
+    }
+    else {
+        put_quoted(e, rb_obj_as_string(v));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Ruby API
+////////////////////////////////////////////////////////////////////////////////
+
+// NativeJsonEncoder.encode(value) => String
+// NativeJsonEncoder.encode(value, io) => bytes written to io
+static VALUE
+encode(int argc, VALUE *argv, VALUE self)
+{
+    encoder_t e;
+    VALUE value, io;
+
+    rb_scan_args(argc, argv, "11", &value, &io);
+
+    lookup_classes();
+
+    e.io = io;
+    e.written = 0;
+    e.buf = new_buffer(NIL_P(io) ? 4096 : FLUSH_SIZE + 1024);
+
+    put_value(&e, value);
+
+    if (NIL_P(io)) return e.buf;
+
+    flush(&e);
+    RB_GC_GUARD(e.buf);
+    return LONG2NUM(e.written);
+}
+
+static VALUE
+metrics_initialize(VALUE self, VALUE metrics)
+{
+    rb_ivar_set(self, id_metrics, metrics);
+    return self;
+}
+
+static VALUE
+metrics_metrics(VALUE self)
+{
+    return rb_ivar_get(self, id_metrics);
+}
+
+static void
+intern_fields(const char **names, ID *ids)
+{
+    char ivar[64];
+    int i;
+    for (i = 0; names[i]; i++) {
+        snprintf(ivar, sizeof(ivar), "@%s", names[i]);
+        ids[i] = rb_intern(ivar);
+    }
+    ids[i] = 0;
+}
+
+void Init_json_encoder()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+    mSerializers = rb_define_module_under(mScoutApm, "Serializers");
+    mNativeJsonEncoder = rb_define_module_under(mSerializers, "NativeJsonEncoder");
+
+    id_as_json = rb_intern("as_json");
+    id_iso8601 = rb_intern("iso8601");
+    id_to_s = rb_intern("to_s");
+    id_to_a = rb_intern("to_a");
+    id_write = rb_intern("write");
+    id_merge = rb_intern("merge");
+    id_metric_name = rb_intern("@metric_name");
+    id_scope = rb_intern("@scope");
+    id_desc = rb_intern("@desc");
+    id_extra = rb_intern("@extra");
+    id_metrics = rb_intern("@metrics");
+    sym_key = ID2SYM(rb_intern("key"));
+
+    intern_fields(metric_stats_fields, metric_stats_ids);
+    intern_fields(db_query_metric_stats_fields, db_query_metric_stats_ids);
+
+    rb_global_variable(&cMetricMeta);
+    rb_global_variable(&cMetricStats);
+    rb_global_variable(&cDbQueryMetricStats);
+
+    rb_define_const(mNativeJsonEncoder, "FLUSH_SIZE", INT2NUM(FLUSH_SIZE));
+    rb_define_singleton_method(mNativeJsonEncoder, "encode", encode, -1);
+
+    // A metric Hash (or Array of [meta, stats] pairs), written the way
+    // rearrange_the_metrics lays it out.
+    cMetrics = rb_define_class_under(mNativeJsonEncoder, "Metrics", rb_cObject);
+    rb_define_method(cMetrics, "initialize", metrics_initialize, 1);
+    rb_define_method(cMetrics, "metrics", metrics_metrics, 0);
+}
+
+#else
+
+void Init_json_encoder()
+{
+}
+
+#endif // HAVE_RUBY_RUBY_H
@@ -0,0 +1,5 @@
+require 'mkmf'
+
+have_header("ruby/ruby.h") # Needed to check for Ruby <= 1.8.7
+have_func("posix_fallocate", "fcntl.h")
+create_makefile('layaway_format')
@@ -0,0 +1,1368 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Native reader and writer for the binary layaway file format. See
+// lib/scout_apm/layaway_file.rb, which falls back to Marshal for files
+// written without this extension (or by older agents).
+//
+// A file is a header followed by sections:
+//
+//   "SCOUTLW\0" u32 version
+//   u8 section id, u32 length, payload...
+//
+// all integers little-endian. The timestamp section always comes first, so
+// readers can build the period around it, and readers reject files where it
+// doesn't. They skip any other sections they don't know, so sections can be
+// added without bumping the version.
+//
+// The metric set, db query metrics and histograms are written field by field.
+// Each field is a tagged value, and anything that isn't a nil, boolean,
+// 64 bit Integer, Float, plain String, empty Hash or NumericHistogram is
+// embedded as a Marshal blob, so odd values still round trip exactly.
+// Slow transactions and jobs are whole object graphs, and are kept as one
+// Marshal section.
+//
+// Records are only written field by field while they hold no instance
+// variables but the ones listed below (and caches, which are rebuilt). A set
+// holding any record with another attribute is embedded whole as Marshal, as
+// are any other instance variables of the period, so nothing is dropped.
+//
+// Loading maps the file and builds the reporting period directly from the
+// mapped bytes, without reading it into a String first.
+
+static VALUE mScoutApm;
+static VALUE mNativeLayawayFormat;
+
+#ifdef HAVE_RUBY_RUBY_H
+
+#include <ruby/encoding.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LAYAWAY_MAGIC "SCOUTLW"
+#define LAYAWAY_MAGIC_LEN 8 // Including the NUL
+#define LAYAWAY_VERSION 1
+
+// Sections
+#define SECTION_TIMESTAMP 1
+#define SECTION_METRICS 2
+#define SECTION_DB_QUERY_METRICS 3
+#define SECTION_HISTOGRAMS 4
+#define SECTION_TRACES 5 // [request_traces, job_traces, jobs], as Marshal
+#define SECTION_IVARS 6  // Any other instance variables of the period, as a Hash
+
+// A section payload starts with its form
+#define FORM_RECORDS 0 // u32 count, then records
+#define FORM_VALUE 1   // the whole attribute as a single value
+
+// Value tags
+#define TAG_UNDEF 0 // Instance variable wasn't set
+#define TAG_NIL 1
+#define TAG_TRUE 2
+#define TAG_FALSE 3
+#define TAG_INT 4
+#define TAG_FLOAT 5
+#define TAG_STRING 6
+#define TAG_EMPTY_HASH 7
+#define TAG_HISTOGRAM 8
+#define TAG_MARSHAL 9
+
+// String encodings
+#define STR_BINARY 0
+#define STR_UTF8 1
+#define STR_USASCII 2
+
+// Instance variables written for each record, in order.
+static const char *metric_meta_ivars[] = {
+    "@metric_name", "@metric_id", "@scope", "@desc", "@extra", "@client_id", NULL
+};
+static const char *metric_stats_ivars[] = {
+    "@scoped", "@call_count", "@min_call_time", "@max_call_time", "@total_call_time",
+    "@total_exclusive_time", "@sum_of_squares", "@queue", "@latency", NULL
+};
+static const char *db_query_metric_stats_ivars[] = {
+    "@model_name", "@operation", "@scope", "@transaction_count", "@call_count", "@call_time",
+    "@min_call_time", "@max_call_time", "@rows_returned", "@min_rows_returned", "@max_rows_returned",
+    "@histogram", NULL
+};
+static const char *histogram_report_ivars[] = {"@name", "@histogram", NULL};
+
+// Instance variables that aren't written, because they're caches or are set
+// up again when the period is read.
+static const char *metric_meta_cached_ivars[] = {"@hash_value", "@type", NULL};
+static const char *db_query_metric_stats_cached_ivars[] = {"@key", NULL};
+static const char *metric_set_ivars[] = {"@metrics", "@combine_in_progress", NULL};
+static const char *db_query_metric_set_ivars[] = {"@metrics", "@config", "@limit", NULL};
+
+// The period's own instance variables, each written in its own section
+static const char *store_reporting_period_ivars[] = {
+    "@timestamp", "@metric_set", "@db_query_metric_set", "@histograms",
+    "@request_traces", "@job_traces", "@jobs", NULL
+};
+
+#define MAX_IVARS 16
+static ID metric_meta_ids[MAX_IVARS];
+static ID metric_stats_ids[MAX_IVARS];
+static ID db_query_metric_stats_ids[MAX_IVARS];
+static ID histogram_report_ids[MAX_IVARS];
+static ID metric_meta_cached_ids[MAX_IVARS];
+static ID db_query_metric_stats_cached_ids[MAX_IVARS];
+static ID metric_set_ids[MAX_IVARS];
+static ID db_query_metric_set_ids[MAX_IVARS];
+static ID store_reporting_period_ids[MAX_IVARS];
+static const ID no_ids[1] = {0};
+
+static ID id_timestamp, id_metric_set, id_db_query_metric_set, id_histograms, id_metrics;
+static ID id_request_traces, id_job_traces, id_jobs;
+static ID id_marshal_dump, id_marshal_load, id_key, id_default, id_default_proc;
+
+// The agent's classes aren't loaded yet when this extension is, so they're
+// looked up the first time they're needed.
+static VALUE cStoreReportingPeriod = Qnil;
+static VALUE cMetricSet, cMetricMeta, cMetricStats;
+static VALUE cDbQueryMetricSet, cDbQueryMetricStats;
+static VALUE cHistogramReport, cNumericHistogram, cHistogramBin;
+
+static void
+load_classes()
+{
+    if (!NIL_P(cStoreReportingPeriod)) return;
+
+    cMetricSet = rb_path2class("ScoutApm::MetricSet");
+    cMetricMeta = rb_path2class("ScoutApm::MetricMeta");
+    cMetricStats = rb_path2class("ScoutApm::MetricStats");
+    cDbQueryMetricSet = rb_path2class("ScoutApm::DbQueryMetricSet");
+    cDbQueryMetricStats = rb_path2class("ScoutApm::DbQueryMetricStats");
+    cHistogramReport = rb_path2class("ScoutApm::Instruments::HistogramReport");
+    cNumericHistogram = rb_path2class("ScoutApm::NumericHistogram");
+    cHistogramBin = rb_path2class("ScoutApm::HistogramBin");
+    cStoreReportingPeriod = rb_path2class("ScoutApm::StoreReportingPeriod");
+}
+
+static void
+intern_ivars(const char **names, ID *ids)
+{
+    int i;
+    for (i = 0; names[i]; i++) {
+        ids[i] = rb_intern(names[i]);
+    }
+    ids[i] = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writing
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+put_bytes(VALUE buf, const void *ptr, long len)
+{
+    rb_str_buf_cat(buf, (const char *)ptr, len);
+}
+
+static void
+put_u8(VALUE buf, uint8_t v)
+{
+    put_bytes(buf, &v, 1);
+}
+
+static void
+put_u32(VALUE buf, uint32_t v)
+{
+    unsigned char b[4];
+    b[0] = v; b[1] = v >> 8; b[2] = v >> 16; b[3] = v >> 24;
+    put_bytes(buf, b, 4);
+}
+
+static void
+put_u64(VALUE buf, uint64_t v)
+{
+    unsigned char b[8];
+    int i;
+    for (i = 0; i < 8; i++) b[i] = (unsigned char)(v >> (8 * i));
+    put_bytes(buf, b, 8);
+}
+
+static void
+put_f64(VALUE buf, double d)
+{
+    uint64_t v;
+    memcpy(&v, &d, sizeof(v));
+    put_u64(buf, v);
+}
+
+static void
+patch_u32(VALUE buf, long offset, uint32_t v)
+{
+    unsigned char *p = (unsigned char *)RSTRING_PTR(buf) + offset;
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void
+put_blob(VALUE buf, VALUE str)
+{
+    if (RSTRING_LEN(str) > UINT32_MAX) rb_raise(rb_eArgError, "Value too large for layaway file");
+    put_u32(buf, (uint32_t)RSTRING_LEN(str));
+    put_bytes(buf, RSTRING_PTR(str), RSTRING_LEN(str));
+}
+
+static void
+put_marshal(VALUE buf, VALUE obj)
+{
+    put_u8(buf, TAG_MARSHAL);
+    put_blob(buf, rb_marshal_dump(obj, Qnil));
+}
+
+// Returns 0 if the histogram can't be written bin by bin
+static int
+put_histogram(VALUE buf, VALUE hist)
+{
+    VALUE dumped = rb_funcall(hist, id_marshal_dump, 0);
+    VALUE max_bins, bins, total;
+    long i, len;
+
+    if (!RB_TYPE_P(dumped, T_ARRAY) || RARRAY_LEN(dumped) != 3) return 0;
+    max_bins = rb_ary_entry(dumped, 0);
+    bins = rb_ary_entry(dumped, 1);
+    total = rb_ary_entry(dumped, 2);
+    if (!FIXNUM_P(max_bins) || !FIXNUM_P(total) || !RB_TYPE_P(bins, T_ARRAY)) return 0;
+
+    len = RARRAY_LEN(bins);
+    for (i = 0; i < len; i++) {
+        VALUE bin = rb_ary_entry(bins, i);
+        if (!rb_obj_is_kind_of(bin, cHistogramBin) ||
+            !RB_FLOAT_TYPE_P(rb_struct_aref(bin, INT2FIX(0))) ||
+            !FIXNUM_P(rb_struct_aref(bin, INT2FIX(1)))) {
+            return 0;
+        }
+    }
+
+    put_u8(buf, TAG_HISTOGRAM);
+    put_u64(buf, (uint64_t)FIX2LONG(max_bins));
+    put_u64(buf, (uint64_t)FIX2LONG(total));
+    put_u32(buf, (uint32_t)len);
+    for (i = 0; i < len; i++) {
+        VALUE bin = rb_ary_entry(bins, i);
+        put_f64(buf, RFLOAT_VALUE(rb_struct_aref(bin, INT2FIX(0))));
+        put_u64(buf, (uint64_t)FIX2LONG(rb_struct_aref(bin, INT2FIX(1))));
+    }
+    return 1;
+}
+
+static int
+string_encoding_tag(VALUE str)
+{
+    int idx = ENCODING_GET(str);
+    if (idx == rb_utf8_encindex()) return STR_UTF8;
+    if (idx == rb_usascii_encindex()) return STR_USASCII;
+    if (idx == rb_ascii8bit_encindex()) return STR_BINARY;
+    return -1;
+}
+
+static void
+put_value(VALUE buf, VALUE v)
+{
+    if (v == Qundef) {
+        put_u8(buf, TAG_UNDEF);
+    } else if (NIL_P(v)) {
+        put_u8(buf, TAG_NIL);
+    } else if (v == Qtrue) {
+        put_u8(buf, TAG_TRUE);
+    } else if (v == Qfalse) {
+        put_u8(buf, TAG_FALSE);
+    } else if (FIXNUM_P(v)) {
+        put_u8(buf, TAG_INT);
+        put_u64(buf, (uint64_t)FIX2LONG(v));
+    } else if (RB_FLOAT_TYPE_P(v)) {
+        put_u8(buf, TAG_FLOAT);
+        put_f64(buf, RFLOAT_VALUE(v));
+    } else if (rb_obj_class(v) == rb_cString && string_encoding_tag(v) >= 0 &&
+               !FL_TEST(v, FL_EXIVAR)) {
+        put_u8(buf, TAG_STRING);
+        put_u8(buf, (uint8_t)string_encoding_tag(v));
+        put_blob(buf, v);
+    } else if (rb_obj_class(v) == rb_cHash && RHASH_SIZE(v) == 0 && !FL_TEST(v, FL_EXIVAR) &&
+               NIL_P(rb_funcall(v, id_default, 0)) && NIL_P(rb_funcall(v, id_default_proc, 0))) {
+        put_u8(buf, TAG_EMPTY_HASH);
+    } else if (rb_obj_class(v) == cNumericHistogram) {
+        long start = RSTRING_LEN(buf);
+        if (!put_histogram(buf, v)) {
+            rb_str_set_len(buf, start);
+            put_marshal(buf, v);
+        }
+    } else {
+        put_marshal(buf, v);
+    }
+}
+
+static int
+listed_id(const ID *ids, ID id)
+{
+    int i;
+    for (i = 0; ids[i]; i++) {
+        if (ids[i] == id) return 1;
+    }
+    return 0;
+}
+
+// True if every instance variable +obj+ has is in +ids+ or +cached+
+static int
+only_listed_ivars(VALUE obj, const ID *ids, const ID *cached)
+{
+    st_index_t listed = 0;
+    int i;
+
+    for (i = 0; ids[i]; i++) {
+        if (rb_ivar_defined(obj, ids[i])) listed++;
+    }
+    for (i = 0; cached[i]; i++) {
+        if (rb_ivar_defined(obj, cached[i])) listed++;
+    }
+    return rb_ivar_count(obj) == listed;
+}
+
+static VALUE
+ivar_or_undef(VALUE obj, ID id)
+{
+    if (rb_ivar_defined(obj, id)) return rb_ivar_get(obj, id);
+    return Qundef;
+}
+
+static void
+put_ivars(VALUE buf, VALUE obj, const ID *ids)
+{
+    int i;
+    for (i = 0; ids[i]; i++) {
+        put_value(buf, ivar_or_undef(obj, ids[i]));
+    }
+}
+
+// Reserves the section header, returning where the length goes
+static long
+begin_section(VALUE buf, uint8_t id, uint8_t form)
+{
+    long length_offset;
+
+    put_u8(buf, id);
+    length_offset = RSTRING_LEN(buf);
+    put_u32(buf, 0);
+    put_u8(buf, form);
+    return length_offset;
+}
+
+static void
+end_section(VALUE buf, long length_offset)
+{
+    long len = RSTRING_LEN(buf) - length_offset - 4;
+    if (len > UINT32_MAX) rb_raise(rb_eArgError, "Section too large for layaway file");
+    patch_u32(buf, length_offset, (uint32_t)len);
+}
+
+static void
+put_value_section(VALUE buf, uint8_t id, VALUE v)
+{
+    long offset = begin_section(buf, id, FORM_VALUE);
+    put_value(buf, v);
+    end_section(buf, offset);
+}
+
+typedef struct {
+    VALUE buf;
+    int ok;
+} hash_write_t;
+
+static int
+metric_record_check(VALUE meta, VALUE stats, VALUE arg)
+{
+    hash_write_t *w = (hash_write_t *)arg;
+    if (rb_obj_class(meta) != cMetricMeta || rb_obj_class(stats) != cMetricStats ||
+        !only_listed_ivars(meta, metric_meta_ids, metric_meta_cached_ids) ||
+        !only_listed_ivars(stats, metric_stats_ids, no_ids)) {
+        w->ok = 0;
+        return ST_STOP;
+    }
+    return ST_CONTINUE;
+}
+
+static int
+metric_record_write(VALUE meta, VALUE stats, VALUE arg)
+{
+    hash_write_t *w = (hash_write_t *)arg;
+    put_ivars(w->buf, meta, metric_meta_ids);
+    put_ivars(w->buf, stats, metric_stats_ids);
+    return ST_CONTINUE;
+}
+
+static int
+db_query_record_check(VALUE key, VALUE stats, VALUE arg)
+{
+    hash_write_t *w = (hash_write_t *)arg;
+    if (rb_obj_class(stats) != cDbQueryMetricStats ||
+        !only_listed_ivars(stats, db_query_metric_stats_ids, db_query_metric_stats_cached_ids)) {
+        w->ok = 0;
+        return ST_STOP;
+    }
+    return ST_CONTINUE;
+}
+
+static int
+db_query_record_write(VALUE key, VALUE stats, VALUE arg)
+{
+    hash_write_t *w = (hash_write_t *)arg;
+    put_ivars(w->buf, stats, db_query_metric_stats_ids);
+    return ST_CONTINUE;
+}
+
+// Writes the Hash held in +set+'s @metrics record by record, or the whole
+// set if it isn't the shape we expect.
+static void
+put_hash_section(VALUE buf, uint8_t id, VALUE set, VALUE set_class, const ID *set_ids,
+                 int (*check)(VALUE, VALUE, VALUE), int (*write)(VALUE, VALUE, VALUE))
+{
+    VALUE metrics = rb_obj_class(set) == set_class && only_listed_ivars(set, set_ids, no_ids) ?
+        rb_ivar_get(set, id_metrics) : Qnil;
+    hash_write_t w;
+    long offset;
+
+    w.buf = buf;
+    w.ok = RB_TYPE_P(metrics, T_HASH);
+    if (w.ok) rb_hash_foreach(metrics, check, (VALUE)&w);
+
+    if (!w.ok) {
+        put_value_section(buf, id, set);
+        return;
+    }
+
+    offset = begin_section(buf, id, FORM_RECORDS);
+    put_u32(buf, (uint32_t)RHASH_SIZE(metrics));
+    rb_hash_foreach(metrics, write, (VALUE)&w);
+    end_section(buf, offset);
+}
+
+static void
+put_histograms_section(VALUE buf, VALUE histograms)
+{
+    long i, len, offset;
+
+    if (!RB_TYPE_P(histograms, T_ARRAY)) {
+        put_value_section(buf, SECTION_HISTOGRAMS, histograms);
+        return;
+    }
+    len = RARRAY_LEN(histograms);
+    for (i = 0; i < len; i++) {
+        VALUE report = rb_ary_entry(histograms, i);
+        if (rb_obj_class(report) != cHistogramReport || !only_listed_ivars(report, histogram_report_ids, no_ids)) {
+            put_value_section(buf, SECTION_HISTOGRAMS, histograms);
+            return;
+        }
+    }
+
+    offset = begin_section(buf, SECTION_HISTOGRAMS, FORM_RECORDS);
+    put_u32(buf, (uint32_t)len);
+    for (i = 0; i < len; i++) {
+        put_ivars(buf, rb_ary_entry(histograms, i), histogram_report_ids);
+    }
+    end_section(buf, offset);
+}
+
+// Writes the period's instance variables that no other section holds, if it
+// has any
+static void
+put_ivars_section(VALUE buf, VALUE rp)
+{
+    VALUE names, others = Qnil;
+    long i;
+
+    if (only_listed_ivars(rp, store_reporting_period_ids, no_ids)) return;
+
+    names = rb_obj_instance_variables(rp);
+    others = rb_hash_new();
+    for (i = 0; i < RARRAY_LEN(names); i++) {
+        VALUE name = rb_ary_entry(names, i);
+        ID id = SYM2ID(name);
+        if (!listed_id(store_reporting_period_ids, id)) rb_hash_aset(others, name, rb_ivar_get(rp, id));
+    }
+    put_value_section(buf, SECTION_IVARS, others);
+}
+
+// NativeLayawayFormat.dump(reporting_period) => String
+static VALUE
+layaway_dump(VALUE self, VALUE rp)
+{
+    VALUE buf, traces;
+    char magic[LAYAWAY_MAGIC_LEN] = LAYAWAY_MAGIC;
+
+    load_classes();
+    if (!rb_obj_is_kind_of(rp, cStoreReportingPeriod)) {
+        rb_raise(rb_eTypeError, "Expected a StoreReportingPeriod");
+    }
+
+    buf = rb_str_buf_new(4096);
+    rb_enc_associate_index(buf, rb_ascii8bit_encindex());
+    put_bytes(buf, magic, LAYAWAY_MAGIC_LEN);
+    put_u32(buf, LAYAWAY_VERSION);
+
+    put_value_section(buf, SECTION_TIMESTAMP, rb_ivar_get(rp, id_timestamp));
+    put_hash_section(buf, SECTION_METRICS, rb_ivar_get(rp, id_metric_set), cMetricSet, metric_set_ids,
+                     metric_record_check, metric_record_write);
+    put_hash_section(buf, SECTION_DB_QUERY_METRICS, rb_ivar_get(rp, id_db_query_metric_set), cDbQueryMetricSet,
+                     db_query_metric_set_ids, db_query_record_check, db_query_record_write);
+    put_histograms_section(buf, rb_ivar_get(rp, id_histograms));
+
+    traces = rb_ary_new3(3, rb_ivar_get(rp, id_request_traces), rb_ivar_get(rp, id_job_traces), rb_ivar_get(rp, id_jobs));
+    put_value_section(buf, SECTION_TRACES, traces);
+    put_ivars_section(buf, rp);
+
+    return buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const unsigned char *ptr;
+    const unsigned char *end;
+} reader_t;
+
+static void
+corrupt()
+{
+    rb_raise(rb_eArgError, "Corrupt layaway file");
+}
+
+static const unsigned char *
+take(reader_t *r, size_t len)
+{
+    const unsigned char *p = r->ptr;
+    if ((size_t)(r->end - r->ptr) < len) corrupt();
+    r->ptr += len;
+    return p;
+}
+
+static uint8_t
+get_u8(reader_t *r)
+{
+    return *take(r, 1);
+}
+
+static uint32_t
+get_u32(reader_t *r)
+{
+    const unsigned char *p = take(r, 4);
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get_u64(reader_t *r)
+{
+    const unsigned char *p = take(r, 8);
+    uint64_t v = 0;
+    int i;
+    for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static double
+get_f64(reader_t *r)
+{
+    uint64_t v = get_u64(r);
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static VALUE
+get_histogram(reader_t *r)
+{
+    long max_bins = (long)(int64_t)get_u64(r);
+    long total = (long)(int64_t)get_u64(r);
+    uint32_t len = get_u32(r);
+    uint32_t i;
+    VALUE bins, hist;
+
+    if ((size_t)(r->end - r->ptr) < (size_t)len * 16) corrupt();
+
+    bins = rb_ary_new2(len);
+    for (i = 0; i < len; i++) {
+        VALUE value = DBL2NUM(get_f64(r));
+        VALUE count = LONG2NUM((long)(int64_t)get_u64(r));
+        rb_ary_push(bins, rb_struct_new(cHistogramBin, value, count));
+    }
+
+    hist = rb_obj_alloc(cNumericHistogram);
+    rb_funcall(hist, id_marshal_load, 1, rb_ary_new3(3, LONG2NUM(max_bins), bins, LONG2NUM(total)));
+    return hist;
+}
+
+static VALUE
+get_value(reader_t *r)
+{
+    uint8_t tag = get_u8(r);
+    uint32_t len;
+    const unsigned char *p;
+    VALUE str, loaded;
+
+    switch (tag) {
+    case TAG_UNDEF: return Qundef;
+    case TAG_NIL: return Qnil;
+    case TAG_TRUE: return Qtrue;
+    case TAG_FALSE: return Qfalse;
+    case TAG_INT: return LL2NUM((int64_t)get_u64(r));
+    case TAG_FLOAT: return DBL2NUM(get_f64(r));
+    case TAG_STRING: {
+        uint8_t enc = get_u8(r);
+        len = get_u32(r);
+        p = take(r, len);
+        str = rb_str_new((const char *)p, len);
+        switch (enc) {
+        case STR_UTF8: rb_enc_associate_index(str, rb_utf8_encindex()); break;
+        case STR_USASCII: rb_enc_associate_index(str, rb_usascii_encindex()); break;
+        case STR_BINARY: rb_enc_associate_index(str, rb_ascii8bit_encindex()); break;
+        default: corrupt();
+        }
+        return str;
+    }
+    case TAG_EMPTY_HASH: return rb_hash_new();
+    case TAG_HISTOGRAM: return get_histogram(r);
+    case TAG_MARSHAL:
+        len = get_u32(r);
+        p = take(r, len);
+        str = rb_str_new((const char *)p, len);
+        loaded = rb_marshal_load(str);
+        RB_GC_GUARD(str); // Marshal doesn't mark the string it reads from
+        return loaded;
+    default:
+        corrupt();
+    }
+    return Qnil; // Not reached
+}
+
+static void
+get_ivars(reader_t *r, VALUE obj, const ID *ids)
+{
+    int i;
+    for (i = 0; ids[i]; i++) {
+        VALUE v = get_value(r);
+        if (v != Qundef) rb_ivar_set(obj, ids[i], v);
+    }
+}
+
+static void
+read_metrics(reader_t *r, VALUE rp)
+{
+    VALUE metrics = rb_ivar_get(rb_ivar_get(rp, id_metric_set), id_metrics);
+    uint32_t count = get_u32(r);
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        VALUE meta = rb_obj_alloc(cMetricMeta);
+        VALUE stats = rb_obj_alloc(cMetricStats);
+        get_ivars(r, meta, metric_meta_ids);
+        get_ivars(r, stats, metric_stats_ids);
+        rb_hash_aset(metrics, meta, stats);
+    }
+}
+
+static void
+read_db_query_metrics(reader_t *r, VALUE rp)
+{
+    VALUE metrics = rb_ivar_get(rb_ivar_get(rp, id_db_query_metric_set), id_metrics);
+    uint32_t count = get_u32(r);
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        VALUE stats = rb_obj_alloc(cDbQueryMetricStats);
+        get_ivars(r, stats, db_query_metric_stats_ids);
+        rb_hash_aset(metrics, rb_funcall(stats, id_key, 0), stats);
+    }
+}
+
+static void
+read_histograms(reader_t *r, VALUE rp)
+{
+    uint32_t count = get_u32(r);
+    uint32_t i;
+    VALUE histograms = rb_ary_new2(count);
+
+    for (i = 0; i < count; i++) {
+        VALUE report = rb_obj_alloc(cHistogramReport);
+        get_ivars(r, report, histogram_report_ids);
+        rb_ary_push(histograms, report);
+    }
+    rb_ivar_set(rp, id_histograms, histograms);
+}
+
+static void
+read_traces(VALUE rp, VALUE traces)
+{
+    if (!RB_TYPE_P(traces, T_ARRAY) || RARRAY_LEN(traces) != 3) corrupt();
+    rb_ivar_set(rp, id_request_traces, rb_ary_entry(traces, 0));
+    rb_ivar_set(rp, id_job_traces, rb_ary_entry(traces, 1));
+    rb_ivar_set(rp, id_jobs, rb_ary_entry(traces, 2));
+}
+
+static int
+set_ivar(VALUE name, VALUE value, VALUE rp)
+{
+    if (!SYMBOL_P(name)) corrupt();
+    rb_ivar_set(rp, SYM2ID(name), value);
+    return ST_CONTINUE;
+}
+
+static void
+read_ivars(VALUE rp, VALUE ivars)
+{
+    if (!RB_TYPE_P(ivars, T_HASH)) corrupt();
+    rb_hash_foreach(ivars, set_ivar, rp);
+}
+
+static ID
+section_ivar(uint8_t id)
+{
+    switch (id) {
+    case SECTION_METRICS: return id_metric_set;
+    case SECTION_DB_QUERY_METRICS: return id_db_query_metric_set;
+    case SECTION_HISTOGRAMS: return id_histograms;
+    }
+    return 0;
+}
+
+typedef struct {
+    const unsigned char *ptr;
+    size_t len;
+} layaway_buffer_t;
+
+// Returns false if the buffer isn't in this format at all
+static VALUE
+read_layaway(VALUE arg)
+{
+    layaway_buffer_t *b = (layaway_buffer_t *)arg;
+    reader_t r;
+    VALUE rp = Qnil;
+
+    r.ptr = b->ptr;
+    r.end = b->ptr + b->len;
+
+    if (b->len < LAYAWAY_MAGIC_LEN || memcmp(b->ptr, LAYAWAY_MAGIC, LAYAWAY_MAGIC_LEN) != 0) {
+        return Qfalse;
+    }
+    take(&r, LAYAWAY_MAGIC_LEN);
+    if (get_u32(&r) != LAYAWAY_VERSION) {
+        rb_raise(rb_eArgError, "Unsupported layaway file version");
+    }
+
+    load_classes();
+
+    // The timestamp always comes first, so we can build the period around it.
+    while (r.ptr < r.end) {
+        uint8_t id = get_u8(&r);
+        uint32_t len = get_u32(&r);
+        reader_t section;
+        uint8_t form;
+
+        section.ptr = take(&r, len);
+        section.end = section.ptr + len;
+
+        if (id != SECTION_TIMESTAMP && NIL_P(rp)) corrupt();
+
+        switch (id) {
+        case SECTION_TIMESTAMP:
+        case SECTION_METRICS:
+        case SECTION_DB_QUERY_METRICS:
+        case SECTION_HISTOGRAMS:
+        case SECTION_TRACES:
+        case SECTION_IVARS:
+            break;
+        default:
+            continue; // From a newer writer
+        }
+
+        form = get_u8(&section);
+        if (form == FORM_VALUE) {
+            VALUE v = get_value(&section);
+            if (id == SECTION_TIMESTAMP) {
+                rp = rb_class_new_instance(1, &v, cStoreReportingPeriod);
+            } else if (id == SECTION_TRACES) {
+                read_traces(rp, v);
+            } else if (id == SECTION_IVARS) {
+                read_ivars(rp, v);
+            } else {
+                rb_ivar_set(rp, section_ivar(id), v);
+            }
+        } else if (form == FORM_RECORDS) {
+            switch (id) {
+            case SECTION_METRICS: read_metrics(&section, rp); break;
+            case SECTION_DB_QUERY_METRICS: read_db_query_metrics(&section, rp); break;
+            case SECTION_HISTOGRAMS: read_histograms(&section, rp); break;
+            default: corrupt();
+            }
+        } else {
+            corrupt();
+        }
+        if (section.ptr != section.end) corrupt();
+    }
+
+    if (NIL_P(rp)) corrupt();
+    return rp;
+}
+
+// NativeLayawayFormat.load(string) => StoreReportingPeriod, or false if
+// +string+ isn't in this format.
+static VALUE
+layaway_load(VALUE self, VALUE str)
+{
+    layaway_buffer_t b;
+    VALUE rp;
+
+    StringValue(str);
+    str = rb_str_new_frozen(str); // Must not move while we read it
+    b.ptr = (const unsigned char *)RSTRING_PTR(str);
+    b.len = RSTRING_LEN(str);
+    rp = read_layaway((VALUE)&b);
+    RB_GC_GUARD(str);
+    return rp;
+}
+
+typedef struct {
+    void *map;
+    size_t len;
+    int fd;
+} layaway_map_t;
+
+static VALUE
+unmap_layaway(VALUE arg)
+{
+    layaway_map_t *m = (layaway_map_t *)arg;
+    if (m->map) munmap(m->map, m->len);
+    close(m->fd);
+    return Qnil;
+}
+
+static VALUE
+read_mapped_layaway(VALUE arg)
+{
+    layaway_map_t *m = (layaway_map_t *)arg;
+    layaway_buffer_t b;
+
+    b.ptr = (const unsigned char *)m->map;
+    b.len = m->len;
+    return read_layaway((VALUE)&b);
+}
+
+// NativeLayawayFormat.load_file(path) => StoreReportingPeriod, or false if
+// the file isn't in this format (so is probably Marshal).
+static VALUE
+layaway_load_file(VALUE self, VALUE path)
+{
+    layaway_map_t m;
+    struct stat st;
+
+    FilePathValue(path);
+    m.fd = open(RSTRING_PTR(path), O_RDONLY);
+    if (m.fd < 0) rb_sys_fail(RSTRING_PTR(path));
+
+    if (fstat(m.fd, &st) != 0) {
+        int e = errno;
+        close(m.fd);
+        errno = e;
+        rb_sys_fail(RSTRING_PTR(path));
+    }
+
+    m.len = (size_t)st.st_size;
+    m.map = NULL;
+    if (m.len == 0) {
+        close(m.fd);
+        return Qfalse;
+    }
+
+    m.map = mmap(NULL, m.len, PROT_READ, MAP_PRIVATE, m.fd, 0);
+    if (m.map == MAP_FAILED) {
+        int e = errno;
+        close(m.fd);
+        errno = e;
+        rb_sys_fail(RSTRING_PTR(path));
+    }
+
+    return rb_ensure(read_mapped_layaway, (VALUE)&m, unmap_layaway, (VALUE)&m);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared memory layaway
+//
+// A file mapped MAP_SHARED by every process of the app (ideally on tmpfs, so
+// there's no disk behind it), holding a fixed number of slots. Each process
+// writes a finished reporting period, in the format above, into a free slot
+// instead of a layaway file, and the reporting process reads them straight
+// back out of the mapping.
+//
+// Slots move FREE -> WRITING -> READY -> READING -> FREE, each step a
+// compare-and-swap on the slot's state, so no locks are taken. Which process
+// reports a minute is decided by a compare-and-swap on the header's
+// claimed_timestamp.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <signal.h>
+#include <sys/file.h>
+
+#define SHARED_MAGIC "SCOUTSHM"
+#define SHARED_VERSION 1
+#define SHARED_HEADER_SIZE 4096
+#define SLOT_HEADER_SIZE 64
+
+#define SLOT_FREE 0
+#define SLOT_WRITING 1
+#define SLOT_READY 2
+#define SLOT_READING 3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    int64_t claimed_timestamp;
+} shared_header_t;
+
+typedef struct {
+    uint32_t state;
+    int32_t pid;
+    int64_t timestamp;
+    uint64_t length;
+} slot_header_t;
+
+typedef struct {
+    unsigned char *map;
+    size_t map_len;
+    uint32_t slot_count;
+    uint64_t slot_size;
+} shared_layaway_t;
+
+static VALUE cSharedLayaway;
+
+static void
+shared_layaway_free(void *ptr)
+{
+    shared_layaway_t *shared = ptr;
+    if (shared->map) munmap(shared->map, shared->map_len);
+    xfree(shared);
+}
+
+static size_t
+shared_layaway_memsize(const void *ptr)
+{
+    return sizeof(shared_layaway_t);
+}
+
+static const rb_data_type_t shared_layaway_type = {
+    "ScoutApm::NativeLayawayFormat::SharedLayaway",
+    { 0, shared_layaway_free, shared_layaway_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static VALUE
+shared_layaway_alloc(VALUE klass)
+{
+    shared_layaway_t *shared;
+    VALUE obj = TypedData_Make_Struct(klass, shared_layaway_t, &shared_layaway_type, shared);
+    shared->map = NULL;
+    return obj;
+}
+
+static shared_layaway_t *
+get_shared(VALUE self)
+{
+    shared_layaway_t *shared;
+    TypedData_Get_Struct(self, shared_layaway_t, &shared_layaway_type, shared);
+    if (!shared->map) rb_raise(rb_eIOError, "Shared layaway is closed");
+    return shared;
+}
+
+static shared_header_t *
+shared_header(shared_layaway_t *shared)
+{
+    return (shared_header_t *)shared->map;
+}
+
+static slot_header_t *
+shared_slot(shared_layaway_t *shared, uint32_t i)
+{
+    return (slot_header_t *)(shared->map + SHARED_HEADER_SIZE + (size_t)i * shared->slot_size);
+}
+
+static unsigned char *
+slot_data(slot_header_t *slot)
+{
+    return (unsigned char *)slot + SLOT_HEADER_SIZE;
+}
+
+static int
+slot_transition(slot_header_t *slot, uint32_t from, uint32_t to)
+{
+    return __atomic_compare_exchange_n(&slot->state, &from, to, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void
+slot_release(slot_header_t *slot, uint32_t to)
+{
+    __atomic_store_n(&slot->state, to, __ATOMIC_RELEASE);
+}
+
+static uint32_t
+slot_state(slot_header_t *slot)
+{
+    return __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+}
+
+static void
+fail_with_fd(int fd, VALUE path)
+{
+    int e = errno;
+    close(fd);
+    errno = e;
+    rb_sys_fail(RSTRING_PTR(path));
+}
+
+// Backs every page of the first +len+ bytes of +fd+ now. The region is
+// written through a MAP_SHARED mapping, and a page tmpfs can't supply when
+// it's first touched is a SIGBUS, not an error, so the space is reserved up
+// front. Returns 0, or the errno of the failure.
+static int
+reserve_region(int fd, size_t len)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+    return posix_fallocate(fd, 0, (off_t)len);
+#else
+    static const char zeros[4096];
+    size_t off;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) return errno;
+    // Only the bytes beyond the current end can be holes we made
+    for (off = (size_t)st.st_size; off < len; off += sizeof(zeros)) {
+        size_t n = len - off < sizeof(zeros) ? len - off : sizeof(zeros);
+        if (pwrite(fd, zeros, n, (off_t)off) != (ssize_t)n) return errno ? errno : ENOSPC;
+    }
+    return 0;
+#endif
+}
+
+// SharedLayaway.new(path, slot_count, slot_size)
+//
+// Opens the region at +path+, creating it if needed. Raises ArgumentError if
+// it exists with a different layout, and SystemCallError (Errno::ENOSPC, say)
+// if the space for it can't be reserved.
+static VALUE
+shared_layaway_initialize(VALUE self, VALUE path, VALUE rb_slot_count, VALUE rb_slot_size)
+{
+    shared_layaway_t *shared;
+    shared_header_t header;
+    struct stat st;
+    uint32_t slot_count = NUM2UINT(rb_slot_count);
+    uint64_t slot_size = NUM2ULL(rb_slot_size);
+    size_t map_len;
+    void *map;
+    int fd, err;
+
+    TypedData_Get_Struct(self, shared_layaway_t, &shared_layaway_type, shared);
+
+    if (slot_count == 0 || slot_size <= SLOT_HEADER_SIZE || slot_size % SLOT_HEADER_SIZE != 0) {
+        rb_raise(rb_eArgError, "Invalid shared layaway slot layout");
+    }
+    map_len = SHARED_HEADER_SIZE + (size_t)slot_count * slot_size;
+
+    FilePathValue(path);
+    fd = open(RSTRING_PTR(path), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) rb_sys_fail(RSTRING_PTR(path));
+
+    // Whoever gets here first lays out the file. Everyone else checks it.
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) fail_with_fd(fd, path);
+
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SHARED_MAGIC, sizeof(header.magic));
+        header.version = SHARED_VERSION;
+        header.slot_count = slot_count;
+        header.slot_size = slot_size;
+        if ((err = reserve_region(fd, map_len)) != 0) {
+            // Leave it empty, so the next process tries afresh
+            if (ftruncate(fd, 0) != 0) { /* raising for err regardless */ }
+            errno = err;
+            fail_with_fd(fd, path);
+        }
+        if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) fail_with_fd(fd, path);
+    } else {
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) fail_with_fd(fd, path);
+        if (memcmp(header.magic, SHARED_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SHARED_VERSION ||
+            header.slot_count != slot_count ||
+            header.slot_size != slot_size ||
+            (size_t)st.st_size < map_len) {
+            flock(fd, LOCK_UN);
+            close(fd);
+            rb_raise(rb_eArgError, "Shared layaway at %s has a different layout", RSTRING_PTR(path));
+        }
+        // Laid out by an agent that left it sparse. Cheap if it's all backed.
+        if ((err = reserve_region(fd, map_len)) != 0) {
+            errno = err;
+            fail_with_fd(fd, path);
+        }
+    }
+
+    map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) fail_with_fd(fd, path);
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if (shared->map) munmap(shared->map, shared->map_len);
+    shared->map = map;
+    shared->map_len = map_len;
+    shared->slot_count = slot_count;
+    shared->slot_size = slot_size;
+
+    return self;
+}
+
+// SharedLayaway#write(timestamp, pid, data) => true, or false if there's no
+// room. Replaces a period the same process already wrote for +timestamp+.
+static VALUE
+shared_layaway_write(VALUE self, VALUE rb_timestamp, VALUE rb_pid, VALUE data)
+{
+    shared_layaway_t *shared = get_shared(self);
+    int64_t timestamp = NUM2LL(rb_timestamp);
+    int32_t pid = NUM2INT(rb_pid);
+    slot_header_t *slot = NULL;
+    uint32_t i;
+
+    StringValue(data);
+    if ((uint64_t)RSTRING_LEN(data) > shared->slot_size - SLOT_HEADER_SIZE) return Qfalse;
+
+    for (i = 0; i < shared->slot_count && !slot; i++) {
+        slot_header_t *s = shared_slot(shared, i);
+        if (slot_state(s) == SLOT_READY && s->pid == pid && s->timestamp == timestamp &&
+            slot_transition(s, SLOT_READY, SLOT_WRITING)) {
+            slot = s;
+        }
+    }
+    for (i = 0; i < shared->slot_count && !slot; i++) {
+        slot_header_t *s = shared_slot(shared, i);
+        if (slot_transition(s, SLOT_FREE, SLOT_WRITING)) slot = s;
+    }
+    if (!slot) return Qfalse;
+
+    slot->pid = pid;
+    slot->timestamp = timestamp;
+    slot->length = RSTRING_LEN(data);
+    memcpy(slot_data(slot), RSTRING_PTR(data), RSTRING_LEN(data));
+    slot_release(slot, SLOT_READY);
+
+    return Qtrue;
+}
+
+// SharedLayaway#claim(timestamp) => true if this process gets to report
+// +timestamp+. Each timestamp is only claimed once, and never after a later
+// one.
+static VALUE
+shared_layaway_claim(VALUE self, VALUE rb_timestamp)
+{
+    shared_header_t *header = shared_header(get_shared(self));
+    int64_t timestamp = NUM2LL(rb_timestamp);
+    int64_t current = __atomic_load_n(&header->claimed_timestamp, __ATOMIC_ACQUIRE);
+
+    while (current < timestamp) {
+        if (__atomic_compare_exchange_n(&header->claimed_timestamp, &current, timestamp, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return Qtrue;
+        }
+    }
+    return Qfalse;
+}
+
+typedef struct {
+    shared_layaway_t *shared;
+    slot_header_t *slot;
+} slot_read_t;
+
+static VALUE
+read_slot(VALUE arg)
+{
+    slot_read_t *sr = (slot_read_t *)arg;
+    layaway_buffer_t b;
+    VALUE rp;
+
+    if (sr->slot->length > sr->shared->slot_size - SLOT_HEADER_SIZE) corrupt();
+    b.ptr = slot_data(sr->slot);
+    b.len = (size_t)sr->slot->length;
+    rp = read_layaway((VALUE)&b);
+    if (!RTEST(rp)) corrupt();
+    return rp;
+}
+
+static VALUE
+free_slot(VALUE arg)
+{
+    slot_read_t *sr = (slot_read_t *)arg;
+    slot_release(sr->slot, SLOT_FREE);
+    return Qnil;
+}
+
+// SharedLayaway#take(timestamp) => StoreReportingPeriod or nil
+//
+// Reads one of the periods written for +timestamp+ and frees its slot, or
+// returns nil once there are none left. A slot that fails to load is freed
+// before the error is raised.
+static VALUE
+shared_layaway_take(VALUE self, VALUE rb_timestamp)
+{
+    shared_layaway_t *shared = get_shared(self);
+    int64_t timestamp = NUM2LL(rb_timestamp);
+    uint32_t i;
+
+    for (i = 0; i < shared->slot_count; i++) {
+        slot_header_t *slot = shared_slot(shared, i);
+        if (slot_state(slot) == SLOT_READY && slot->timestamp == timestamp &&
+            slot_transition(slot, SLOT_READY, SLOT_READING)) {
+            slot_read_t sr;
+            sr.shared = shared;
+            sr.slot = slot;
+            return rb_ensure(read_slot, (VALUE)&sr, free_slot, (VALUE)&sr);
+        }
+    }
+    return Qnil;
+}
+
+static int
+process_alive(int32_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// SharedLayaway#sweep(older_than) => number of slots freed
+//
+// Frees periods for timestamps before +older_than+, and slots left mid-write
+// or mid-read by a process that has since died.
+static VALUE
+shared_layaway_sweep(VALUE self, VALUE rb_older_than)
+{
+    shared_layaway_t *shared = get_shared(self);
+    int64_t older_than = NUM2LL(rb_older_than);
+    long freed = 0;
+    uint32_t i;
+
+    for (i = 0; i < shared->slot_count; i++) {
+        slot_header_t *slot = shared_slot(shared, i);
+        uint32_t state = slot_state(slot);
+
+        if (state == SLOT_READY && slot->timestamp < older_than) {
+            if (slot_transition(slot, SLOT_READY, SLOT_FREE)) freed++;
+        } else if ((state == SLOT_WRITING || state == SLOT_READING) && !process_alive(slot->pid)) {
+            if (slot_transition(slot, state, SLOT_FREE)) freed++;
+        }
+    }
+    return LONG2NUM(freed);
+}
+
+// SharedLayaway#stats => {:slots, :free, :ready}
+static VALUE
+shared_layaway_stats(VALUE self)
+{
+    shared_layaway_t *shared = get_shared(self);
+    long free_slots = 0, ready = 0;
+    uint32_t i;
+    VALUE stats = rb_hash_new();
+
+    for (i = 0; i < shared->slot_count; i++) {
+        uint32_t state = slot_state(shared_slot(shared, i));
+        if (state == SLOT_FREE) free_slots++;
+        if (state == SLOT_READY) ready++;
+    }
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("slots")), UINT2NUM(shared->slot_count));
+    rb_hash_aset(stats, ID2SYM(rb_intern("free")), LONG2NUM(free_slots));
+    rb_hash_aset(stats, ID2SYM(rb_intern("ready")), LONG2NUM(ready));
+    return stats;
+}
+
+static VALUE
+shared_layaway_close(VALUE self)
+{
+    shared_layaway_t *shared;
+    TypedData_Get_Struct(self, shared_layaway_t, &shared_layaway_type, shared);
+    if (shared->map) munmap(shared->map, shared->map_len);
+    shared->map = NULL;
+    return Qnil;
+}
+
+void Init_layaway_format()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+    mNativeLayawayFormat = rb_define_module_under(mScoutApm, "NativeLayawayFormat");
+
+    intern_ivars(metric_meta_ivars, metric_meta_ids);
+    intern_ivars(metric_stats_ivars, metric_stats_ids);
+    intern_ivars(db_query_metric_stats_ivars, db_query_metric_stats_ids);
+    intern_ivars(histogram_report_ivars, histogram_report_ids);
+    intern_ivars(metric_meta_cached_ivars, metric_meta_cached_ids);
+    intern_ivars(db_query_metric_stats_cached_ivars, db_query_metric_stats_cached_ids);
+    intern_ivars(metric_set_ivars, metric_set_ids);
+    intern_ivars(db_query_metric_set_ivars, db_query_metric_set_ids);
+    intern_ivars(store_reporting_period_ivars, store_reporting_period_ids);
+
+    id_timestamp = rb_intern("@timestamp");
+    id_metric_set = rb_intern("@metric_set");
+    id_db_query_metric_set = rb_intern("@db_query_metric_set");
+    id_histograms = rb_intern("@histograms");
+    id_metrics = rb_intern("@metrics");
+    id_request_traces = rb_intern("@request_traces");
+    id_job_traces = rb_intern("@job_traces");
+    id_jobs = rb_intern("@jobs");
+    id_marshal_dump = rb_intern("marshal_dump");
+    id_marshal_load = rb_intern("marshal_load");
+    id_key = rb_intern("key");
+    id_default = rb_intern("default");
+    id_default_proc = rb_intern("default_proc");
+
+    rb_global_variable(&cStoreReportingPeriod);
+    rb_global_variable(&cMetricSet);
+    rb_global_variable(&cMetricMeta);
+    rb_global_variable(&cMetricStats);
+    rb_global_variable(&cDbQueryMetricSet);
+    rb_global_variable(&cDbQueryMetricStats);
+    rb_global_variable(&cHistogramReport);
+    rb_global_variable(&cNumericHistogram);
+    rb_global_variable(&cHistogramBin);
+
+    rb_define_const(mNativeLayawayFormat, "MAGIC", rb_str_new(LAYAWAY_MAGIC, LAYAWAY_MAGIC_LEN));
+    rb_define_const(mNativeLayawayFormat, "VERSION", INT2FIX(LAYAWAY_VERSION));
+
+    rb_define_singleton_method(mNativeLayawayFormat, "dump", layaway_dump, 1);
+    rb_define_singleton_method(mNativeLayawayFormat, "load", layaway_load, 1);
+    rb_define_singleton_method(mNativeLayawayFormat, "load_file", layaway_load_file, 1);
+
+    cSharedLayaway = rb_define_class_under(mNativeLayawayFormat, "SharedLayaway", rb_cObject);
+    rb_define_alloc_func(cSharedLayaway, shared_layaway_alloc);
+    rb_define_method(cSharedLayaway, "initialize", shared_layaway_initialize, 3);
+    rb_define_method(cSharedLayaway, "write", shared_layaway_write, 3);
+    rb_define_method(cSharedLayaway, "claim", shared_layaway_claim, 1);
+    rb_define_method(cSharedLayaway, "take", shared_layaway_take, 1);
+    rb_define_method(cSharedLayaway, "sweep", shared_layaway_sweep, 1);
+    rb_define_method(cSharedLayaway, "stats", shared_layaway_stats, 0);
+    rb_define_method(cSharedLayaway, "close", shared_layaway_close, 0);
+}
+
+#else
+
+// Ruby <= 1.8.7 keeps writing Marshal layaway files.
+void Init_layaway_format()
+{
+}
+
+#endif // HAVE_RUBY_RUBY_H
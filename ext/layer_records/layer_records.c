@@ -0,0 +1,453 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Native implementation of ScoutApm::LayerRecords, the numeric half of a
+// request's LayerArena. See lib/scout_apm/layer_records.rb for the pure-Ruby
+// version, which this must match, and which is used when this extension isn't
+// available.
+//
+// A record is one layer of a request. Its fields are kept as a struct of
+// arrays - one C array per field, indexed by the record's number - so a
+// request's layers are a handful of buffers that are never scanned by the GC,
+// and are freed together when the request is done with them.
+
+static VALUE mScoutApm;
+static VALUE cLayerRecords;
+
+#ifdef HAVE_RUBY_RUBY_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define FLAG_SUBSCOPABLE      1
+#define FLAG_BACKTRACE_PARSED 2
+#define FLAG_STOPPED          4
+
+typedef struct {
+    long len;
+    long capa;
+
+    int32_t *type_ids;
+    int32_t *parents;            // -1 for the root
+    uint8_t *flags;
+
+    int64_t *start_ns;
+    int64_t *stop_ns;
+    int64_t *child_ns;           // summed call time of the record's children
+
+    int64_t *allocations;
+    int64_t *child_allocations;  // summed allocations of the record's children
+    int64_t *gc_count;
+    double *gc_time;
+} layer_records_t;
+
+// Each field's buffer, with the size of one of its elements. Growing,
+// freeing and marshaling go through these, so every field is handled alike.
+#define EACH_COLUMN(records, COLUMN) \
+    COLUMN((records)->type_ids, int32_t) \
+    COLUMN((records)->parents, int32_t) \
+    COLUMN((records)->flags, uint8_t) \
+    COLUMN((records)->start_ns, int64_t) \
+    COLUMN((records)->stop_ns, int64_t) \
+    COLUMN((records)->child_ns, int64_t) \
+    COLUMN((records)->allocations, int64_t) \
+    COLUMN((records)->child_allocations, int64_t) \
+    COLUMN((records)->gc_count, int64_t) \
+    COLUMN((records)->gc_time, double)
+
+#define RECORD_SIZE (4 + 4 + 1 + 8 * 7)
+
+static void
+free_columns(layer_records_t *records)
+{
+#define FREE_COLUMN(column, type) xfree(column); column = NULL;
+    EACH_COLUMN(records, FREE_COLUMN)
+#undef FREE_COLUMN
+    records->len = 0;
+    records->capa = 0;
+}
+
+static void
+records_free(void *ptr)
+{
+    layer_records_t *records = ptr;
+    free_columns(records);
+    xfree(records);
+}
+
+static size_t
+records_memsize(const void *ptr)
+{
+    const layer_records_t *records = ptr;
+    return sizeof(layer_records_t) + records->capa * RECORD_SIZE;
+}
+
+static const rb_data_type_t records_type = {
+    "ScoutApm::LayerRecords",
+    { 0, records_free, records_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static layer_records_t *
+get_records(VALUE self)
+{
+    layer_records_t *records;
+    TypedData_Get_Struct(self, layer_records_t, &records_type, records);
+    return records;
+}
+
+static VALUE
+records_alloc(VALUE klass)
+{
+    layer_records_t *records;
+    VALUE obj = TypedData_Make_Struct(klass, layer_records_t, &records_type, records);
+    memset(records, 0, sizeof(layer_records_t));
+    return obj;
+}
+
+static void
+ensure_capacity(layer_records_t *records, long needed)
+{
+    long capa;
+
+    if (needed <= records->capa) {
+        return;
+    }
+
+    capa = records->capa > 0 ? records->capa : 16;
+    while (capa < needed) {
+        capa *= 2;
+    }
+#define GROW_COLUMN(column, type) REALLOC_N(column, type, capa);
+    EACH_COLUMN(records, GROW_COLUMN)
+#undef GROW_COLUMN
+    records->capa = capa;
+}
+
+// The record numbered `index`, raising IndexError unless there is one
+static long
+record_index(layer_records_t *records, VALUE index)
+{
+    long i = NUM2LONG(index);
+    if (i < 0 || i >= records->len) {
+        rb_raise(rb_eIndexError, "no layer record %ld", i);
+    }
+    return i;
+}
+
+static int64_t
+call_ns(layer_records_t *records, long i)
+{
+    if (!(records->flags[i] & FLAG_STOPPED)) {
+        return 0;
+    }
+    return records->stop_ns[i] - records->start_ns[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writing records
+////////////////////////////////////////////////////////////////////////////////
+
+// open(type_id, parent, start_ns) - adds a record for a layer that's just
+// started, under the record numbered `parent` (nil for the root). Returns the
+// new record's number.
+static VALUE
+records_open(VALUE self, VALUE type_id, VALUE parent, VALUE start_ns)
+{
+    layer_records_t *records = get_records(self);
+    long i = records->len;
+    int32_t parent_index = NIL_P(parent) ? -1 : (int32_t)record_index(records, parent);
+
+    ensure_capacity(records, i + 1);
+    records->type_ids[i] = NUM2INT(type_id);
+    records->parents[i] = parent_index;
+    records->flags[i] = 0;
+    records->start_ns[i] = NUM2LL(start_ns);
+    records->stop_ns[i] = 0;
+    records->child_ns[i] = 0;
+    records->allocations[i] = 0;
+    records->child_allocations[i] = 0;
+    records->gc_count[i] = 0;
+    records->gc_time[i] = 0.0;
+    records->len++;
+
+    return LONG2NUM(i);
+}
+
+// stop(index, stop_ns, allocations, gc_count, gc_time) - fills in a record
+// once its layer has stopped, and adds its time and allocations to its
+// parent's children.
+static VALUE
+records_stop(VALUE self, VALUE index, VALUE stop_ns, VALUE allocations, VALUE gc_count, VALUE gc_time)
+{
+    layer_records_t *records = get_records(self);
+    long i = record_index(records, index);
+    int32_t parent;
+
+    records->stop_ns[i] = NUM2LL(stop_ns);
+    records->allocations[i] = NUM2LL(allocations);
+    records->gc_count[i] = NUM2LL(gc_count);
+    records->gc_time[i] = NUM2DBL(gc_time);
+    records->flags[i] |= FLAG_STOPPED;
+
+    parent = records->parents[i];
+    if (parent >= 0) {
+        records->child_ns[parent] += call_ns(records, i);
+        records->child_allocations[parent] += records->allocations[i];
+    }
+
+    return Qnil;
+}
+
+static VALUE
+records_set_flag(VALUE self, VALUE index, VALUE flag)
+{
+    layer_records_t *records = get_records(self);
+    records->flags[record_index(records, index)] |= (uint8_t)NUM2INT(flag);
+    return Qnil;
+}
+
+// truncate(len) - drops every record numbered len and over
+static VALUE
+records_truncate(VALUE self, VALUE len)
+{
+    layer_records_t *records = get_records(self);
+    long n = NUM2LONG(len);
+
+    if (n >= 0 && n < records->len) {
+        records->len = n;
+    }
+    return self;
+}
+
+// Frees every record at once
+static VALUE
+records_clear(VALUE self)
+{
+    free_columns(get_records(self));
+    return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading records
+////////////////////////////////////////////////////////////////////////////////
+
+static VALUE
+records_size(VALUE self)
+{
+    return LONG2NUM(get_records(self)->len);
+}
+
+static VALUE
+records_type_id(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    return INT2NUM(records->type_ids[record_index(records, index)]);
+}
+
+static VALUE
+records_parent(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    int32_t parent = records->parents[record_index(records, index)];
+    return parent < 0 ? Qnil : INT2NUM(parent);
+}
+
+static VALUE
+records_flag_p(VALUE self, VALUE index, VALUE flag)
+{
+    layer_records_t *records = get_records(self);
+    return (records->flags[record_index(records, index)] & NUM2INT(flag)) ? Qtrue : Qfalse;
+}
+
+static VALUE
+records_start_ns(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    return LL2NUM(records->start_ns[record_index(records, index)]);
+}
+
+static VALUE
+records_stop_ns(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    long i = record_index(records, index);
+    return (records->flags[i] & FLAG_STOPPED) ? LL2NUM(records->stop_ns[i]) : Qnil;
+}
+
+// Seconds, computed as ScoutApm::Clock.elapsed does
+static VALUE
+records_total_call_time(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    return DBL2NUM((double)call_ns(records, record_index(records, index)) / 1e9);
+}
+
+static VALUE
+records_total_exclusive_time(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    long i = record_index(records, index);
+    return DBL2NUM((double)(call_ns(records, i) - records->child_ns[i]) / 1e9);
+}
+
+static VALUE
+records_total_allocations(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    return LL2NUM(records->allocations[record_index(records, index)]);
+}
+
+static VALUE
+records_total_exclusive_allocations(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    long i = record_index(records, index);
+    return LL2NUM(records->allocations[i] - records->child_allocations[i]);
+}
+
+static VALUE
+records_total_gc_count(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    return LL2NUM(records->gc_count[record_index(records, index)]);
+}
+
+static VALUE
+records_total_gc_time(VALUE self, VALUE index)
+{
+    layer_records_t *records = get_records(self);
+    return DBL2NUM(records->gc_time[record_index(records, index)]);
+}
+
+// The number of the first record whose type id is in the Array `type_ids`,
+// or nil if there's none
+static VALUE
+records_index_of_type(VALUE self, VALUE type_ids)
+{
+    layer_records_t *records = get_records(self);
+    long n, i, j;
+
+    Check_Type(type_ids, T_ARRAY);
+    n = RARRAY_LEN(type_ids);
+
+    for (i = 0; i < records->len; i++) {
+        for (j = 0; j < n; j++) {
+            if (records->type_ids[i] == NUM2INT(rb_ary_entry(type_ids, j))) {
+                return LONG2NUM(i);
+            }
+        }
+    }
+    return Qnil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Marshaling
+//
+// A request is marshaled to be recorded by another process (see
+// ScoutApm::Remote). The records dump as one String: the record count, then
+// each field's buffer in turn, in the format the Ruby version packs.
+////////////////////////////////////////////////////////////////////////////////
+
+static VALUE
+records_marshal_dump(VALUE self)
+{
+    layer_records_t *records = get_records(self);
+    int64_t len = records->len;
+    VALUE data = rb_str_buf_new(sizeof(int64_t) + records->len * RECORD_SIZE);
+
+    rb_str_buf_cat(data, (const char *)&len, sizeof(int64_t));
+#define DUMP_COLUMN(column, type) \
+    if (records->len > 0) rb_str_buf_cat(data, (const char *)column, records->len * sizeof(type));
+    EACH_COLUMN(records, DUMP_COLUMN)
+#undef DUMP_COLUMN
+
+    return data;
+}
+
+static VALUE
+records_marshal_load(VALUE self, VALUE data)
+{
+    layer_records_t *records = get_records(self);
+    const char *ptr;
+    int64_t len, i;
+
+    StringValue(data);
+    ptr = RSTRING_PTR(data);
+    if (RSTRING_LEN(data) < (long)sizeof(int64_t)) {
+        rb_raise(rb_eArgError, "not dumped layer records");
+    }
+    memcpy(&len, ptr, sizeof(int64_t));
+    if (len < 0 || len > (RSTRING_LEN(data) / RECORD_SIZE) ||
+        RSTRING_LEN(data) != (long)(sizeof(int64_t) + len * RECORD_SIZE)) {
+        rb_raise(rb_eArgError, "not dumped layer records");
+    }
+    ptr += sizeof(int64_t);
+
+    // Walkers index by parent, so every parent must be an earlier record (or
+    // -1, for none). Checked before anything is replaced. The parents column
+    // follows the type ids.
+    for (i = 0; i < len; i++) {
+        int32_t parent;
+        memcpy(&parent, ptr + len * sizeof(int32_t) + i * sizeof(int32_t), sizeof(int32_t));
+        if (parent < -1 || parent >= i) {
+            rb_raise(rb_eArgError, "not dumped layer records: record %ld has parent %d", (long)i, (int)parent);
+        }
+    }
+
+    free_columns(records);
+    ensure_capacity(records, len > 0 ? (long)len : 1);
+#define LOAD_COLUMN(column, type) \
+    memcpy(column, ptr, len * sizeof(type)); ptr += len * sizeof(type);
+    EACH_COLUMN(records, LOAD_COLUMN)
+#undef LOAD_COLUMN
+    records->len = (long)len;
+
+    return self;
+}
+
+void Init_layer_records()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+
+    cLayerRecords = rb_define_class_under(mScoutApm, "LayerRecords", rb_cObject);
+    rb_define_alloc_func(cLayerRecords, records_alloc);
+    rb_define_method(cLayerRecords, "open", records_open, 3);
+    rb_define_method(cLayerRecords, "stop", records_stop, 5);
+    rb_define_method(cLayerRecords, "flag!", records_set_flag, 2);
+    rb_define_method(cLayerRecords, "truncate", records_truncate, 1);
+    rb_define_method(cLayerRecords, "clear", records_clear, 0);
+    rb_define_method(cLayerRecords, "size", records_size, 0);
+    rb_define_method(cLayerRecords, "type_id", records_type_id, 1);
+    rb_define_method(cLayerRecords, "parent", records_parent, 1);
+    rb_define_method(cLayerRecords, "flag?", records_flag_p, 2);
+    rb_define_method(cLayerRecords, "start_ns", records_start_ns, 1);
+    rb_define_method(cLayerRecords, "stop_ns", records_stop_ns, 1);
+    rb_define_method(cLayerRecords, "total_call_time", records_total_call_time, 1);
+    rb_define_method(cLayerRecords, "total_exclusive_time", records_total_exclusive_time, 1);
+    rb_define_method(cLayerRecords, "total_allocations", records_total_allocations, 1);
+    rb_define_method(cLayerRecords, "total_exclusive_allocations", records_total_exclusive_allocations, 1);
+    rb_define_method(cLayerRecords, "total_gc_count", records_total_gc_count, 1);
+    rb_define_method(cLayerRecords, "total_gc_time", records_total_gc_time, 1);
+    rb_define_method(cLayerRecords, "index_of_type", records_index_of_type, 1);
+    rb_define_method(cLayerRecords, "marshal_dump", records_marshal_dump, 0);
+    rb_define_method(cLayerRecords, "marshal_load", records_marshal_load, 1);
+    rb_define_const(cLayerRecords, "SUBSCOPABLE", INT2FIX(FLAG_SUBSCOPABLE));
+    rb_define_const(cLayerRecords, "BACKTRACE_PARSED", INT2FIX(FLAG_BACKTRACE_PARSED));
+    rb_define_const(cLayerRecords, "NATIVE", Qtrue);
+}
+
+#else
+
+// Without the typed data API, leave ScoutApm::LayerRecords undefined, and the
+// pure-Ruby implementation is used instead.
+void Init_layer_records()
+{
+}
+
+#endif //#ifdef HAVE_RUBY_RUBY_H
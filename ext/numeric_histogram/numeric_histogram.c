@@ -0,0 +1,518 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Native implementation of ScoutApm::NumericHistogram. See
+// lib/scout_apm/histogram.rb for the pure-Ruby version, which this must match
+// exactly (including float rounding), and which is used when this extension
+// isn't available.
+//
+// Bins are kept in a contiguous, sorted array of (value, count) pairs. All the
+// work happens while holding the GVL without calling back into Ruby, so unlike
+// the Ruby version no Mutex is needed.
+
+static VALUE mScoutApm;
+static VALUE cNumericHistogram;
+static VALUE cHistogramBin;
+
+#ifdef HAVE_RUBY_RUBY_H
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    double value;
+    uint64_t count;
+} histogram_bin_t;
+
+typedef struct {
+    long max_bins;
+    long len;
+    long capa;
+    uint64_t total;
+    histogram_bin_t *bins;
+} numeric_histogram_t;
+
+static void
+histogram_free(void *ptr)
+{
+    numeric_histogram_t *hist = ptr;
+    xfree(hist->bins);
+    xfree(hist);
+}
+
+static size_t
+histogram_memsize(const void *ptr)
+{
+    const numeric_histogram_t *hist = ptr;
+    return sizeof(numeric_histogram_t) + hist->capa * sizeof(histogram_bin_t);
+}
+
+static const rb_data_type_t histogram_type = {
+    "ScoutApm::NumericHistogram",
+    { 0, histogram_free, histogram_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static numeric_histogram_t *
+get_histogram(VALUE self)
+{
+    numeric_histogram_t *hist;
+    TypedData_Get_Struct(self, numeric_histogram_t, &histogram_type, hist);
+    return hist;
+}
+
+static VALUE
+histogram_alloc(VALUE klass)
+{
+    numeric_histogram_t *hist;
+    VALUE obj = TypedData_Make_Struct(klass, numeric_histogram_t, &histogram_type, hist);
+    hist->max_bins = 0;
+    hist->len = 0;
+    hist->capa = 0;
+    hist->total = 0;
+    hist->bins = NULL;
+    return obj;
+}
+
+static void
+ensure_capacity(numeric_histogram_t *hist, long needed)
+{
+    long capa;
+
+    if (needed <= hist->capa) {
+        return;
+    }
+
+    capa = hist->capa > 0 ? hist->capa : 8;
+    while (capa < needed) {
+        capa *= 2;
+    }
+    REALLOC_N(hist->bins, histogram_bin_t, capa);
+    hist->capa = capa;
+}
+
+// Mirrors `new_value.to_f` from the Ruby implementation, without a method
+// dispatch for the common Float and Integer cases.
+static double
+value_to_double(VALUE v)
+{
+    if (FIXNUM_P(v) || TYPE(v) == T_FLOAT || TYPE(v) == T_BIGNUM) {
+        return NUM2DBL(v);
+    }
+    return NUM2DBL(rb_funcall(v, rb_intern("to_f"), 0));
+}
+
+// Index of the first bin whose value is >= the given value, or len if there
+// is none. The same place the linear scan in the Ruby version would stop.
+static long
+lower_bound(const numeric_histogram_t *hist, double value)
+{
+    long lo = 0;
+    long hi = hist->len;
+
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (hist->bins[mid].value < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// If we exactly match an existing bin, add to it, otherwise create a new bin
+// holding a count for the new value.
+static void
+create_new_bin(numeric_histogram_t *hist, double value)
+{
+    long index = lower_bound(hist, value);
+
+    if (index < hist->len && hist->bins[index].value == value) {
+        hist->bins[index].count++;
+        return;
+    }
+
+    ensure_capacity(hist, hist->len + 1);
+    memmove(&hist->bins[index + 1], &hist->bins[index], (hist->len - index) * sizeof(histogram_bin_t));
+    hist->bins[index].value = value;
+    hist->bins[index].count = 1;
+    hist->len++;
+}
+
+// Merges the two closest neighboring bins into one, with a summed count and a
+// weighted value.
+static void
+trim_one(numeric_histogram_t *hist)
+{
+    double min_delta = DBL_MAX;
+    long min_delta_index = 1;
+    long i;
+    histogram_bin_t *left, *right;
+    uint64_t merged_count;
+    double merged_value;
+
+    for (i = 1; i < hist->len; i++) {
+        double delta = hist->bins[i].value - hist->bins[i - 1].value;
+        if (delta < min_delta) {
+            min_delta = delta;
+            min_delta_index = i;
+        }
+    }
+
+    left = &hist->bins[min_delta_index - 1];
+    right = &hist->bins[min_delta_index];
+
+    merged_count = left->count + right->count;
+    merged_value = (left->value * (double)left->count + right->value * (double)right->count) / (double)merged_count;
+
+    left->value = merged_value;
+    left->count = merged_count;
+
+    memmove(right, right + 1, (hist->len - min_delta_index - 1) * sizeof(histogram_bin_t));
+    hist->len--;
+}
+
+static void
+trim(numeric_histogram_t *hist)
+{
+    while (hist->len > hist->max_bins && hist->len > 1) {
+        trim_one(hist);
+    }
+}
+
+static void
+replace_bins(numeric_histogram_t *hist, histogram_bin_t *bins, long len, long capa)
+{
+    xfree(hist->bins);
+    hist->bins = bins;
+    hist->len = len;
+    hist->capa = capa;
+}
+
+// Fills a freshly allocated, sorted bin buffer from an Array of HistogramBin
+// (or anything responding to value & count). Used when loading Marshal data,
+// and when combining with a non-native histogram.
+static histogram_bin_t *
+bins_from_ary(VALUE ary, long *len_out)
+{
+    long len = RARRAY_LEN(ary);
+    long i;
+    histogram_bin_t *bins = ALLOC_N(histogram_bin_t, len > 0 ? len : 1);
+
+    for (i = 0; i < len; i++) {
+        VALUE bin = rb_ary_entry(ary, i);
+        bins[i].value = value_to_double(rb_funcall(bin, rb_intern("value"), 0));
+        bins[i].count = NUM2ULL(rb_funcall(bin, rb_intern("count"), 0));
+    }
+
+    *len_out = len;
+    return bins;
+}
+
+static VALUE
+histogram_initialize(VALUE self, VALUE max_bins)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+
+    hist->max_bins = NUM2LONG(max_bins);
+    hist->len = 0;
+    hist->total = 0;
+    ensure_capacity(hist, hist->max_bins + 1);
+
+    return self;
+}
+
+static VALUE
+histogram_initialize_copy(VALUE self, VALUE orig)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    numeric_histogram_t *other = get_histogram(orig);
+
+    if (hist == other) {
+        return self;
+    }
+
+    hist->max_bins = other->max_bins;
+    hist->total = other->total;
+    hist->len = 0;
+    ensure_capacity(hist, other->len);
+    if (other->len > 0) {
+        MEMCPY(hist->bins, other->bins, histogram_bin_t, other->len);
+    }
+    hist->len = other->len;
+
+    return self;
+}
+
+static VALUE
+histogram_max_bins(VALUE self)
+{
+    return LONG2NUM(get_histogram(self)->max_bins);
+}
+
+static VALUE
+histogram_total(VALUE self)
+{
+    return ULL2NUM(get_histogram(self)->total);
+}
+
+static VALUE
+histogram_set_total(VALUE self, VALUE total)
+{
+    get_histogram(self)->total = NUM2ULL(total);
+    return total;
+}
+
+static VALUE
+histogram_add(VALUE self, VALUE new_value)
+{
+    double value = value_to_double(new_value);
+    numeric_histogram_t *hist = get_histogram(self);
+
+    hist->total++;
+    create_new_bin(hist, value);
+    trim(hist);
+
+    return Qnil;
+}
+
+static VALUE
+histogram_quantile(VALUE self, VALUE q)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    double quantile = NUM2DBL(q);
+    double count;
+    long i;
+
+    if (hist->total == 0) {
+        return INT2FIX(0);
+    }
+
+    if (hist->len == 0) {
+        return Qnil;
+    }
+
+    if (quantile > 1) {
+        quantile = quantile / 100.0;
+    }
+
+    count = quantile * (double)hist->total;
+
+    for (i = 0; i < hist->len; i++) {
+        count -= (double)hist->bins[i].count;
+
+        if (count <= 0) {
+            return DBL2NUM(hist->bins[i].value);
+        }
+    }
+
+    // If we fell through, we were asking for the last (max) value
+    return DBL2NUM(hist->bins[hist->len - 1].value);
+}
+
+// Given a value, where in this histogram does it fall?
+// Returns a float between 0 and 1
+static VALUE
+histogram_approximate_quantile_of_value(VALUE self, VALUE v)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    double value = NUM2DBL(v);
+    uint64_t count_examined = 0;
+    long i;
+
+    if (hist->total == 0) {
+        return INT2FIX(100);
+    }
+
+    for (i = 0; i < hist->len; i++) {
+        if (value <= hist->bins[i].value) {
+            break;
+        }
+        count_examined += hist->bins[i].count;
+    }
+
+    return DBL2NUM((double)count_examined / (double)hist->total);
+}
+
+static VALUE
+histogram_mean(VALUE self)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    double sum = 0;
+    long i;
+
+    if (hist->total == 0) {
+        return INT2FIX(0);
+    }
+
+    for (i = 0; i < hist->len; i++) {
+        sum += hist->bins[i].value * (double)hist->bins[i].count;
+    }
+
+    return DBL2NUM(sum / (double)hist->total);
+}
+
+// Merges the two sorted bin arrays with a single linear pass, summing the
+// counts of identical values.
+static VALUE
+histogram_combine(VALUE self, VALUE other)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    histogram_bin_t *other_bins;
+    histogram_bin_t *merged;
+    histogram_bin_t *converted = NULL;
+    long other_len;
+    uint64_t other_total;
+    long i = 0, j = 0, n = 0, capa;
+
+    if (rb_typeddata_is_kind_of(other, &histogram_type)) {
+        numeric_histogram_t *o = get_histogram(other);
+        other_bins = o->bins;
+        other_len = o->len;
+        other_total = o->total;
+    } else {
+        other_total = NUM2ULL(rb_funcall(other, rb_intern("total"), 0));
+        converted = bins_from_ary(rb_funcall(other, rb_intern("bins"), 0), &other_len);
+        other_bins = converted;
+    }
+
+    capa = other_len + hist->len;
+    if (capa < hist->max_bins + 1) {
+        capa = hist->max_bins + 1;
+    }
+    merged = ALLOC_N(histogram_bin_t, capa);
+
+    while (i < other_len || j < hist->len) {
+        histogram_bin_t next;
+
+        if (j >= hist->len || (i < other_len && other_bins[i].value <= hist->bins[j].value)) {
+            next = other_bins[i++];
+        } else {
+            next = hist->bins[j++];
+        }
+
+        if (n > 0 && merged[n - 1].value == next.value) {
+            merged[n - 1].count += next.count;
+        } else {
+            merged[n++] = next;
+        }
+    }
+
+    if (converted) {
+        xfree(converted);
+    }
+
+    replace_bins(hist, merged, n, capa);
+    hist->total += other_total;
+    trim(hist);
+
+    return self;
+}
+
+static VALUE
+bin_to_struct(const histogram_bin_t *bin)
+{
+    return rb_struct_new(cHistogramBin, DBL2NUM(bin->value), ULL2NUM(bin->count));
+}
+
+static VALUE
+histogram_bins(VALUE self)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    VALUE ary = rb_ary_new2(hist->len);
+    long i;
+
+    for (i = 0; i < hist->len; i++) {
+        rb_ary_push(ary, bin_to_struct(&hist->bins[i]));
+    }
+    return ary;
+}
+
+// Same as ScoutApm::Utils::Numbers.round(value, 4)
+static double
+round_4(double value)
+{
+    return round(value * 10000) / 10000.0;
+}
+
+static VALUE
+histogram_as_json(VALUE self)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    VALUE ary = rb_ary_new2(hist->len);
+    long i;
+
+    for (i = 0; i < hist->len; i++) {
+        rb_ary_push(ary, rb_assoc_new(DBL2NUM(round_4(hist->bins[i].value)), ULL2NUM(hist->bins[i].count)));
+    }
+    return ary;
+}
+
+// Dumps in exactly the same shape as the Ruby version, so layaway files can
+// be read by either implementation.
+static VALUE
+histogram_marshal_dump(VALUE self)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    return rb_ary_new3(3, LONG2NUM(hist->max_bins), histogram_bins(self), ULL2NUM(hist->total));
+}
+
+static VALUE
+histogram_marshal_load(VALUE self, VALUE array)
+{
+    numeric_histogram_t *hist = get_histogram(self);
+    long max_bins = NUM2LONG(rb_ary_entry(array, 0));
+    uint64_t total = NUM2ULL(rb_ary_entry(array, 2));
+    long len;
+    histogram_bin_t *bins = bins_from_ary(rb_ary_entry(array, 1), &len);
+
+    replace_bins(hist, bins, len, len > 0 ? len : 1);
+    hist->max_bins = max_bins;
+    hist->total = total;
+    ensure_capacity(hist, hist->max_bins + 1);
+
+    return self;
+}
+
+void Init_numeric_histogram()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+    cHistogramBin = rb_const_get(mScoutApm, rb_intern("HistogramBin"));
+    rb_global_variable(&cHistogramBin);
+
+    cNumericHistogram = rb_define_class_under(mScoutApm, "NumericHistogram", rb_cObject);
+    rb_define_alloc_func(cNumericHistogram, histogram_alloc);
+    rb_define_method(cNumericHistogram, "initialize", histogram_initialize, 1);
+    rb_define_method(cNumericHistogram, "initialize_copy", histogram_initialize_copy, 1);
+    rb_define_method(cNumericHistogram, "max_bins", histogram_max_bins, 0);
+    rb_define_method(cNumericHistogram, "total", histogram_total, 0);
+    rb_define_method(cNumericHistogram, "total=", histogram_set_total, 1);
+    rb_define_method(cNumericHistogram, "bins", histogram_bins, 0);
+    rb_define_method(cNumericHistogram, "add", histogram_add, 1);
+    rb_define_method(cNumericHistogram, "quantile", histogram_quantile, 1);
+    rb_define_method(cNumericHistogram, "approximate_quantile_of_value", histogram_approximate_quantile_of_value, 1);
+    rb_define_method(cNumericHistogram, "mean", histogram_mean, 0);
+    rb_define_method(cNumericHistogram, "combine!", histogram_combine, 1);
+    rb_define_method(cNumericHistogram, "as_json", histogram_as_json, 0);
+    rb_define_method(cNumericHistogram, "marshal_dump", histogram_marshal_dump, 0);
+    rb_define_method(cNumericHistogram, "marshal_load", histogram_marshal_load, 1);
+    rb_define_const(cNumericHistogram, "NATIVE", Qtrue);
+}
+
+#else
+
+// Without the typed data API, leave ScoutApm::NumericHistogram undefined, and
+// the pure-Ruby implementation is used instead.
+void Init_numeric_histogram()
+{
+}
+
+#endif //#ifdef HAVE_RUBY_RUBY_H
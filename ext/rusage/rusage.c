@@ -7,6 +7,21 @@
 #include <sys/resource.h>
 #endif
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
 VALUE v_usage_struct;
 
 static VALUE do_rusage_get(int who){
@@ -58,6 +73,202 @@ static VALUE do_rusage_get(int who){
 #endif // _WIN32
 }
 
+// Single-field readers and in-place fills, so callers that only want one or
+// two numbers (once per request, say) don't pay for a new 16-field RUsage
+// Struct each time.
+
+#ifndef _WIN32
+static void rusage_self(struct rusage *r){
+  if(getrusage(RUSAGE_SELF, r) == -1)
+    rb_sys_fail("getrusage");
+}
+#endif // _WIN32
+
+// Process.rusage_maxrss => Integer
+static VALUE rusage_maxrss(VALUE mod){
+#ifdef _WIN32
+  return LONG2NUM(0);
+#else
+  struct rusage r;
+  rusage_self(&r);
+  return LONG2NUM(r.ru_maxrss);
+#endif // _WIN32
+}
+
+// Process.rusage_cpu_times(buffer = nil) => [utime, stime]
+//
+// Writes into +buffer+ (an Array) when given, otherwise into a new Array.
+static VALUE rusage_cpu_times(int argc, VALUE* argv, VALUE mod){
+  VALUE buffer;
+  double utime = 0, stime = 0;
+#ifndef _WIN32
+  struct rusage r;
+#endif
+
+  rb_scan_args(argc, argv, "01", &buffer);
+  if(NIL_P(buffer))
+    buffer = rb_ary_new2(2);
+  else
+    Check_Type(buffer, T_ARRAY);
+
+#ifndef _WIN32
+  rusage_self(&r);
+  utime = (double)r.ru_utime.tv_sec+(double)r.ru_utime.tv_usec/1e6;
+  stime = (double)r.ru_stime.tv_sec+(double)r.ru_stime.tv_usec/1e6;
+#endif // _WIN32
+
+  rb_ary_store(buffer, 0, rb_float_new(utime));
+  rb_ary_store(buffer, 1, rb_float_new(stime));
+  return buffer;
+}
+
+// Process.rusage_into(usage) => usage
+//
+// Refreshes every field of an existing RUsage Struct in place.
+static VALUE rusage_into(VALUE mod, VALUE usage){
+  VALUE values[16];
+  int i;
+#ifndef _WIN32
+  struct rusage r;
+#endif
+
+  if(rb_obj_class(usage) != v_usage_struct)
+    rb_raise(rb_eTypeError, "expected a Struct::RUsage");
+
+#ifdef _WIN32
+  values[0] = values[1] = rb_float_new(0);
+  for(i = 2; i < 16; i++)
+    values[i] = LONG2NUM(0);
+#else
+  rusage_self(&r);
+  values[0] = rb_float_new((double)r.ru_utime.tv_sec+(double)r.ru_utime.tv_usec/1e6);
+  values[1] = rb_float_new((double)r.ru_stime.tv_sec+(double)r.ru_stime.tv_usec/1e6);
+  values[2] = LONG2NUM(r.ru_maxrss);
+  values[3] = LONG2NUM(r.ru_ixrss);
+  values[4] = LONG2NUM(r.ru_idrss);
+  values[5] = LONG2NUM(r.ru_isrss);
+  values[6] = LONG2NUM(r.ru_minflt);
+  values[7] = LONG2NUM(r.ru_majflt);
+  values[8] = LONG2NUM(r.ru_nswap);
+  values[9] = LONG2NUM(r.ru_inblock);
+  values[10] = LONG2NUM(r.ru_oublock);
+  values[11] = LONG2NUM(r.ru_msgsnd);
+  values[12] = LONG2NUM(r.ru_msgrcv);
+  values[13] = LONG2NUM(r.ru_nsignals);
+  values[14] = LONG2NUM(r.ru_nvcsw);
+  values[15] = LONG2NUM(r.ru_nivcsw);
+#endif // _WIN32
+
+  for(i = 0; i < 16; i++)
+    rb_struct_aset(usage, INT2FIX(i), values[i]);
+  return usage;
+}
+
+// Current resident set size, as opposed to ru_maxrss which only ever grows.
+// Reported in the same units as ru_maxrss on the platform (KB on Linux, bytes
+// on Darwin) so the two are interchangeable. Falls back to ru_maxrss where
+// there's no cheap way to read it.
+
+#if defined(__linux__)
+// /proc/self/statm stays open, and is re-read with pread, so each sample is
+// one syscall. /proc/self is resolved at open, so a forked child must reopen.
+static int statm_fd = -1;
+static long page_kb = 0;
+
+static void statm_after_fork(void){
+  if(statm_fd >= 0)
+    close(statm_fd);
+  statm_fd = -1;
+}
+
+static long read_current_rss(void){
+  static int atfork_registered = 0;
+  char buf[128];
+  char *resident;
+  ssize_t len;
+
+  if(statm_fd < 0){
+    if(!atfork_registered){
+      pthread_atfork(NULL, NULL, statm_after_fork);
+      atfork_registered = 1;
+    }
+    page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if(statm_fd < 0)
+      return -1;
+  }
+
+  len = pread(statm_fd, buf, sizeof(buf) - 1, 0);
+  if(len <= 0)
+    return -1;
+  buf[len] = '\0';
+
+  // "size resident shared text lib data dt", in pages
+  resident = strchr(buf, ' ');
+  if(!resident)
+    return -1;
+  return strtol(resident + 1, NULL, 10) * page_kb;
+}
+#elif defined(__APPLE__)
+static long read_current_rss(void){
+  struct mach_task_basic_info info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+  if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+    return -1;
+  return (long)info.resident_size;
+}
+#else
+static long read_current_rss(void){
+  return -1;
+}
+#endif
+
+// Process.current_rss => Integer
+static VALUE current_rss(VALUE mod){
+  long rss = read_current_rss();
+  if(rss < 0)
+    return rusage_maxrss(mod);
+  return LONG2NUM(rss);
+}
+
+// CPU time used by the calling thread alone, for splitting a request's wall
+// time into CPU and waiting. One syscall: the thread CPU clock where there is
+// one, RUSAGE_THREAD or mach thread_info otherwise. Returns -1 if there's no
+// way to read it.
+static long long read_thread_cpu_ns(void){
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+  if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+#if defined(RUSAGE_THREAD)
+  {
+    struct rusage r;
+    if(getrusage(RUSAGE_THREAD, &r) == 0)
+      return ((long long)r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000000LL +
+        ((long long)r.ru_utime.tv_usec + r.ru_stime.tv_usec) * 1000LL;
+  }
+#elif defined(__APPLE__)
+  {
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if(thread_info(pthread_mach_thread_np(pthread_self()), THREAD_BASIC_INFO, (thread_info_t)&info, &count) == KERN_SUCCESS)
+      return ((long long)info.user_time.seconds + info.system_time.seconds) * 1000000000LL +
+        ((long long)info.user_time.microseconds + info.system_time.microseconds) * 1000LL;
+  }
+#endif
+  return -1;
+}
+
+// Process.thread_cpu_ns => Integer nanoseconds, or nil if unsupported
+static VALUE thread_cpu_ns(VALUE mod){
+  long long ns = read_thread_cpu_ns();
+  if(ns < 0)
+    return Qnil;
+  return LL2NUM(ns);
+}
+
 static VALUE rusage_get(int argc, VALUE* argv, VALUE mod){
   return do_rusage_get(RUSAGE_SELF);
 }
@@ -75,4 +286,9 @@ void Init_rusage(){
 
   rb_define_module_function(rb_mProcess, "rusage", rusage_get, -1);
   rb_define_module_function(rb_mProcess, "crusage", crusage_get, -1);
+  rb_define_module_function(rb_mProcess, "rusage_maxrss", rusage_maxrss, 0);
+  rb_define_module_function(rb_mProcess, "rusage_cpu_times", rusage_cpu_times, -1);
+  rb_define_module_function(rb_mProcess, "rusage_into", rusage_into, 1);
+  rb_define_module_function(rb_mProcess, "current_rss", current_rss, 0);
+  rb_define_module_function(rb_mProcess, "thread_cpu_ns", thread_cpu_ns, 0);
 }
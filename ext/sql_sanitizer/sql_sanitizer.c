@@ -0,0 +1,687 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Native implementation of the SqlSanitizer passes in
+// lib/scout_apm/utils/sql_sanitizer.rb. The output must be byte for byte what
+// the chain of gsub! calls there produces, so each regex in
+// sql_sanitizer_regex.rb has a hand-written matcher below that follows the
+// regex engine's leftmost-first, greedy-with-backtracking semantics,
+// including its quirks (`IN` matching the end of `JOIN`, `$` matching before
+// any newline, and so on).
+//
+// All the passes for a dialect run back to back over two scratch buffers, so
+// a query costs one call and one result String instead of a copy, a
+// MatchData per match and a String per pass.
+//
+// Only ASCII SQL is handled. Word and space characters differ for non-ASCII
+// text, and those queries are rare (binds are usually placeholders), so they
+// return nil and the caller falls back to the regex passes.
+
+static VALUE mScoutApm;
+static VALUE mUtils;
+static VALUE mNativeSqlSanitizer;
+
+#ifdef HAVE_RUBY_RUBY_H
+
+#include <ruby/encoding.h>
+#include <stdint.h>
+#include <string.h>
+
+// Character classes, read from the regex engine at load time so \s, \w and
+// \d mean exactly what they do in the Ruby regexes.
+static unsigned char space_chars[256];
+static unsigned char word_chars[256];
+static unsigned char digit_chars[256];
+
+#define IS_SPACE(c) space_chars[(unsigned char)(c)]
+#define IS_WORD(c) word_chars[(unsigned char)(c)]
+#define IS_DIGIT(c) digit_chars[(unsigned char)(c)]
+
+// Queries over 4000 characters are never sanitized, so the scratch space
+// almost always fits on the stack.
+#define STACK_SQL_SIZE 4096
+
+typedef struct sanitizer_pass sanitizer_pass_t;
+
+// Returns the end of a match starting at i, or -1.
+typedef long (*match_fn)(const char *s, long len, long i, const int32_t *memo);
+
+// Fills memo for an entire source before matching, for matchers that
+// need it.
+typedef void (*prepare_fn)(const char *s, long len, int32_t *memo);
+
+struct sanitizer_pass {
+    // Bytes a match can start with, so most positions are skipped without a
+    // call. May be a superset; the matcher has the final say.
+    const char *starts;
+    match_fn match;
+    prepare_fn prepare;
+    const char *replacement;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Matchers
+////////////////////////////////////////////////////////////////////////////////
+
+// \[\[.*\]\]\s*$
+//
+// `.` stops at a newline and `$` is the end of any line, so the match is the
+// last `]]` on the line after which \s* can reach an end of line, with \s*
+// taking as much as it can.
+static long
+space_to_end_of_line(const char *s, long len, long q)
+{
+    long r = q, i;
+
+    while (r < len && IS_SPACE(s[r])) r++;
+    if (r == len) {
+        return len;
+    }
+    for (i = r - 1; i >= q; i--) {
+        if (s[i] == '\n') return i;
+    }
+    return -1;
+}
+
+static long
+match_var_interpolation(const char *s, long len, long i, const int32_t *memo)
+{
+    long line_end = i + 2, k;
+
+    if (i + 1 >= len || s[i + 1] != '[') {
+        return -1;
+    }
+    while (line_end < len && s[line_end] != '\n') line_end++;
+
+    for (k = line_end - 2; k >= i + 2; k--) {
+        if (s[k] == ']' && s[k + 1] == ']') {
+            long end = space_to_end_of_line(s, len, k + 2);
+            if (end >= 0) return end;
+        }
+    }
+    return -1;
+}
+
+// \$\d+
+static long
+match_placeholder(const char *s, long len, long i, const int32_t *memo)
+{
+    long j = i + 1;
+
+    while (j < len && IS_DIGIT(s[j])) j++;
+    return j > i + 1 ? j : -1;
+}
+
+// (?<!LIMIT )\b\d+\b
+static long
+match_integer(const char *s, long len, long i, const int32_t *memo)
+{
+    long j = i;
+
+    if (!IS_DIGIT(s[i]) || (i > 0 && IS_WORD(s[i - 1]))) {
+        return -1;
+    }
+    if (i >= 6 && memcmp(s + i - 6, "LIMIT ", 6) == 0) {
+        return -1;
+    }
+    while (j < len && IS_DIGIT(s[j])) j++;
+
+    // Backing off \d+ only ever lands between two digits, which is never a
+    // word boundary, so it's this or nothing.
+    if (j < len && IS_WORD(s[j])) {
+        return -1;
+    }
+    return j;
+}
+
+// IN\s+\(\?[^\)]*\)
+static long
+match_in_clause(const char *s, long len, long i, const int32_t *memo)
+{
+    long j = i + 2;
+    const char *close;
+
+    if (j > len || s[i + 1] != 'N') {
+        return -1;
+    }
+    while (j < len && IS_SPACE(s[j])) j++;
+    if (j == i + 2 || j + 1 >= len || s[j] != '(' || s[j + 1] != '?') {
+        return -1;
+    }
+    close = memchr(s + j + 2, ')', len - j - 2);
+    return close ? (close - s) + 1 : -1;
+}
+
+// \s+
+static long
+match_spaces(const char *s, long len, long i, const int32_t *memo)
+{
+    long j = i + 1;
+
+    if (!IS_SPACE(s[i])) {
+        return -1;
+    }
+    while (j < len && IS_SPACE(s[j])) j++;
+    return j;
+}
+
+// \?(,\?)+
+static long
+match_multiple_questions(const char *s, long len, long i, const int32_t *memo)
+{
+    long j = i + 1;
+
+    while (j + 1 < len && s[j] == ',' && s[j + 1] == '?') j += 2;
+    return j > i + 1 ? j : -1;
+}
+
+// Quoted strings. The regex engine tries the alternatives of the repeated
+// group in order, and backs off the repetition when the closing quote is
+// missing. memo[i] is where a match ends if the group starts repeating at i
+// (-1 for no match), worked out right to left so each position is visited
+// once, no matter how backtracking would have gone.
+
+// '(?:[^']|'')*'
+static void
+prepare_quoted(const char *s, long len, int32_t *memo, char quote, int backslash_escapes)
+{
+    long i;
+
+    memo[len] = -1;
+    memo[len + 1] = -1;
+    for (i = len - 1; i >= 0; i--) {
+        int32_t end = -1;
+
+        // \\' (mysql only)
+        if (backslash_escapes && s[i] == '\\' && i + 1 < len && s[i + 1] == quote) {
+            end = memo[i + 2];
+        }
+        // [^']
+        if (end < 0 && s[i] != quote) {
+            end = memo[i + 1];
+        }
+        if (end < 0 && s[i] == quote) {
+            // ''
+            if (i + 1 < len && s[i + 1] == quote) {
+                end = memo[i + 2];
+            }
+            // or the closing quote
+            if (end < 0) {
+                end = (int32_t)(i + 1);
+            }
+        }
+        memo[i] = end;
+    }
+}
+
+static void
+prepare_single_quoted(const char *s, long len, int32_t *memo)
+{
+    prepare_quoted(s, len, memo, '\'', 0);
+}
+
+// '(?:\\'|[^']|'')*'
+static void
+prepare_mysql_single_quoted(const char *s, long len, int32_t *memo)
+{
+    prepare_quoted(s, len, memo, '\'', 1);
+}
+
+// "(?:\\"|[^"]|"")*"
+static void
+prepare_mysql_double_quoted(const char *s, long len, int32_t *memo)
+{
+    prepare_quoted(s, len, memo, '"', 1);
+}
+
+static long
+match_quoted(const char *s, long len, long i, const int32_t *memo)
+{
+    return memo[i + 1];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Passes
+////////////////////////////////////////////////////////////////////////////////
+
+static const sanitizer_pass_t VAR_INTERPOLATION = { "[", match_var_interpolation, 0, "" };
+static const sanitizer_pass_t PSQL_PLACEHOLDER = { "$", match_placeholder, 0, "?" };
+static const sanitizer_pass_t REMOVE_STRINGS = { "'", match_quoted, prepare_single_quoted, "?" };
+static const sanitizer_pass_t MYSQL_REMOVE_SINGLE_QUOTE_STRINGS = { "'", match_quoted, prepare_mysql_single_quoted, "?" };
+static const sanitizer_pass_t MYSQL_REMOVE_DOUBLE_QUOTE_STRINGS = { "\"", match_quoted, prepare_mysql_double_quoted, "?" };
+static const sanitizer_pass_t REMOVE_INTEGERS = { "0123456789", match_integer, 0, "?" };
+static const sanitizer_pass_t IN_CLAUSE = { "I", match_in_clause, 0, "IN (?)" };
+static const sanitizer_pass_t MULTIPLE_SPACES = { " \t\n\v\f\r", match_spaces, 0, " " };
+static const sanitizer_pass_t MULTIPLE_QUESTIONS = { "?", match_multiple_questions, 0, "?" };
+
+static const sanitizer_pass_t *POSTGRES_PASSES[] = {
+    &PSQL_PLACEHOLDER, &VAR_INTERPOLATION, &REMOVE_STRINGS, &REMOVE_INTEGERS,
+    &IN_CLAUSE, &MULTIPLE_SPACES, 0
+};
+
+static const sanitizer_pass_t *MYSQL_PASSES[] = {
+    &VAR_INTERPOLATION, &MYSQL_REMOVE_SINGLE_QUOTE_STRINGS, &MYSQL_REMOVE_DOUBLE_QUOTE_STRINGS,
+    &REMOVE_INTEGERS, &IN_CLAUSE, &MULTIPLE_QUESTIONS, 0
+};
+
+static const sanitizer_pass_t *SQLITE_PASSES[] = {
+    &VAR_INTERPOLATION, &REMOVE_STRINGS, &REMOVE_INTEGERS, &MULTIPLE_SPACES, 0
+};
+
+// What gsub does: copy s to d, replacing each leftmost, non-overlapping match.
+// No pass's replacement is longer than its shortest match, so d never needs
+// more room than s.
+static long
+run_pass(const sanitizer_pass_t *pass, const unsigned char *starts, const char *s, long len, char *d, int32_t *memo)
+{
+    long i = 0, copied = 0, out = 0;
+    long replacement_len = (long)strlen(pass->replacement);
+
+    if (pass->prepare) {
+        pass->prepare(s, len, memo);
+    }
+
+    while (i < len) {
+        long end;
+
+        if (!starts[(unsigned char)s[i]] || (end = pass->match(s, len, i, memo)) < 0) {
+            i++;
+            continue;
+        }
+
+        memcpy(d + out, s + copied, i - copied);
+        out += i - copied;
+        memcpy(d + out, pass->replacement, replacement_len);
+        out += replacement_len;
+        i = copied = end;
+    }
+
+    memcpy(d + out, s + copied, len - copied);
+    return out + len - copied;
+}
+
+static VALUE
+sanitize(VALUE str, const sanitizer_pass_t **passes)
+{
+    char stack_buffers[2][STACK_SQL_SIZE];
+    int32_t stack_memo[STACK_SQL_SIZE + 2];
+    char *buffers[2];
+    int32_t *memo;
+    const char *src;
+    long len;
+    int current = 0;
+    VALUE result;
+
+    StringValue(str);
+    if (!rb_enc_str_asciionly_p(str)) {
+        return Qnil;
+    }
+
+    len = RSTRING_LEN(str);
+    if (len <= STACK_SQL_SIZE) {
+        buffers[0] = stack_buffers[0];
+        buffers[1] = stack_buffers[1];
+        memo = stack_memo;
+    } else {
+        buffers[0] = ALLOC_N(char, len);
+        buffers[1] = ALLOC_N(char, len);
+        memo = ALLOC_N(int32_t, len + 2);
+    }
+
+    src = RSTRING_PTR(str);
+    for (; *passes; passes++) {
+        unsigned char starts[256];
+        const char *c;
+
+        memset(starts, 0, sizeof(starts));
+        for (c = (*passes)->starts; *c; c++) {
+            starts[(unsigned char)*c] = 1;
+        }
+        len = run_pass(*passes, starts, src, len, buffers[current], memo);
+        src = buffers[current];
+        current = !current;
+    }
+
+    result = rb_str_new(src, len);
+    rb_enc_copy(result, str);
+
+    if (buffers[0] != stack_buffers[0]) {
+        xfree(buffers[0]);
+        xfree(buffers[1]);
+        xfree(memo);
+    }
+
+    rb_funcall(result, rb_intern("strip!"), 0);
+    return result;
+}
+
+// NativeSqlSanitizer.postgres(sql) => sanitized String, or nil if sql isn't ASCII
+static VALUE
+sanitize_postgres(VALUE self, VALUE str)
+{
+    return sanitize(str, POSTGRES_PASSES);
+}
+
+// NativeSqlSanitizer.mysql(sql) => sanitized String, or nil if sql isn't ASCII
+static VALUE
+sanitize_mysql(VALUE self, VALUE str)
+{
+    return sanitize(str, MYSQL_PASSES);
+}
+
+// NativeSqlSanitizer.sqlite(sql) => sanitized String, or nil if sql isn't ASCII
+static VALUE
+sanitize_sqlite(VALUE self, VALUE str)
+{
+    return sanitize(str, SQLITE_PASSES);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fingerprints
+//
+// XXH64 of the raw SQL, for keying the cache of sanitized statements (see
+// SqlFingerprintCache). Cut down to the Fixnum range so it never allocates.
+////////////////////////////////////////////////////////////////////////////////
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define XXH_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+xxh_read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(WORDS_BIGENDIAN)
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t
+xxh_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(WORDS_BIGENDIAN)
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = XXH_ROTL64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static uint64_t
+xxh64(const unsigned char *p, size_t len, uint64_t seed)
+{
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, xxh_read64(p)); p += 8;
+            v2 = xxh64_round(v2, xxh_read64(p)); p += 8;
+            v3 = xxh64_round(v3, xxh_read64(p)); p += 8;
+            v4 = xxh64_round(v4, xxh_read64(p)); p += 8;
+        } while (p <= limit);
+
+        h = XXH_ROTL64(v1, 1) + XXH_ROTL64(v2, 7) + XXH_ROTL64(v3, 12) + XXH_ROTL64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, xxh_read64(p));
+        h = XXH_ROTL64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+        h = XXH_ROTL64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = XXH_ROTL64(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// NativeSqlSanitizer.fingerprint(sql) => Integer
+static VALUE
+fingerprint(VALUE self, VALUE str)
+{
+    StringValue(str);
+    return LONG2FIX((long)(xxh64((const unsigned char *)RSTRING_PTR(str), RSTRING_LEN(str), 0) & (uint64_t)FIXNUM_MAX));
+}
+
+// NativeSqlSanitizer.xxh64(string) => Integer, the full 64 bit hash. For tests.
+static VALUE
+full_xxh64(VALUE self, VALUE str)
+{
+    StringValue(str);
+    return ULL2NUM(xxh64((const unsigned char *)RSTRING_PTR(str), RSTRING_LEN(str), 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Structural fingerprints
+//
+// A hash of a statement's shape, for counting repeated queries (see
+// CallSet). One pass over the raw SQL hashes it roughly as if it had been
+// sanitized, without building the sanitized String: each literal (a quoted
+// string, number, ? or $n placeholder) hashes as ?, a comma separated list of
+// them (IN (1, 2, 3)) as a single ?, a run of whitespace as one space, and
+// comments not at all. Letters are folded to lower case. Statements that
+// differ only in their values get the same fingerprint.
+////////////////////////////////////////////////////////////////////////////////
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct {
+    uint64_t h;
+    int started;        // anything hashed yet
+    int pending_space;  // whitespace seen, hashed before the next token
+    int pending_comma;  // a comma after a literal, dropped if a literal follows
+    int after_literal;  // the last token hashed was a literal
+} shape_t;
+
+static inline void
+shape_byte(shape_t *sh, unsigned char c)
+{
+    sh->h ^= c;
+    sh->h *= FNV_PRIME;
+}
+
+static inline void
+shape_flush(shape_t *sh)
+{
+    if (sh->pending_comma) {
+        shape_byte(sh, ',');
+        sh->pending_comma = 0;
+    }
+    if (sh->pending_space) {
+        shape_byte(sh, ' ');
+        sh->pending_space = 0;
+    }
+}
+
+static inline void
+shape_literal(shape_t *sh)
+{
+    if (sh->after_literal && sh->pending_comma) {
+        // Another item of a list, which already hashed as ?
+        sh->pending_comma = 0;
+        sh->pending_space = 0;
+        return;
+    }
+    shape_flush(sh);
+    shape_byte(sh, '?');
+    sh->started = 1;
+    sh->after_literal = 1;
+}
+
+static inline void
+shape_other(shape_t *sh, unsigned char c)
+{
+    shape_flush(sh);
+    shape_byte(sh, (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+    sh->started = 1;
+    sh->after_literal = 0;
+}
+
+// Skips a quoted literal starting at i, returning the index after it. A
+// doubled quote or a backslash escapes the next character.
+static long
+skip_quoted(const char *s, long len, long i)
+{
+    char quote = s[i++];
+
+    while (i < len) {
+        if (s[i] == '\\') {
+            i += 2;
+        } else if (s[i] == quote) {
+            if (i + 1 < len && s[i + 1] == quote) {
+                i += 2;
+            } else {
+                return i + 1;
+            }
+        } else {
+            i++;
+        }
+    }
+    return len;
+}
+
+// NativeSqlSanitizer.structural_fingerprint(sql) => Integer
+static VALUE
+structural_fingerprint(VALUE self, VALUE str)
+{
+    const char *s;
+    long len, i = 0;
+    shape_t sh = { FNV_OFFSET_BASIS, 0, 0, 0, 0 };
+
+    StringValue(str);
+    s = RSTRING_PTR(str);
+    len = RSTRING_LEN(str);
+
+    while (i < len) {
+        unsigned char c = (unsigned char)s[i];
+
+        if (IS_SPACE(c)) {
+            sh.pending_space = sh.started;
+            i++;
+        } else if (c == '/' && i + 1 < len && s[i + 1] == '*') {
+            for (i += 2; i + 1 < len && !(s[i] == '*' && s[i + 1] == '/'); i++);
+            i = (i + 1 < len) ? i + 2 : len;
+            sh.pending_space = sh.started;
+        } else if (c == '-' && i + 1 < len && s[i + 1] == '-') {
+            while (i < len && s[i] != '\n') i++;
+            sh.pending_space = sh.started;
+        } else if (c == '\'') {
+            i = skip_quoted(s, len, i);
+            shape_literal(&sh);
+        } else if (c == ',' && sh.after_literal && !sh.pending_comma) {
+            sh.pending_comma = 1;
+            sh.pending_space = 0;
+            i++;
+        } else if (c == '?') {
+            i++;
+            shape_literal(&sh);
+        } else if (c == '$' && i + 1 < len && IS_DIGIT(s[i + 1])) {
+            for (i++; i < len && IS_DIGIT(s[i]); i++);
+            shape_literal(&sh);
+        } else if (IS_DIGIT(c) && (i == 0 || !IS_WORD(s[i - 1]))) {
+            for (; i < len && (IS_DIGIT(s[i]) || s[i] == '.'); i++);
+            shape_literal(&sh);
+        } else if (IS_WORD(c)) {
+            // Take the whole identifier, so digits inside it aren't literals
+            for (; i < len && IS_WORD(s[i]); i++) {
+                shape_other(&sh, (unsigned char)s[i]);
+            }
+        } else {
+            shape_other(&sh, c);
+            i++;
+        }
+    }
+
+    return LONG2FIX((long)(sh.h & (uint64_t)FIXNUM_MAX));
+}
+
+static void
+load_character_class(const char *source, unsigned char *table)
+{
+    VALUE regex = rb_reg_new(source, (long)strlen(source), 0);
+    int c;
+
+    for (c = 0; c < 128; c++) {
+        char byte = (char)c;
+        table[c] = !NIL_P(rb_funcall(regex, rb_intern("=~"), 1, rb_usascii_str_new(&byte, 1)));
+    }
+}
+
+void Init_sql_sanitizer()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+    mUtils = rb_define_module_under(mScoutApm, "Utils");
+    mNativeSqlSanitizer = rb_define_module_under(mUtils, "NativeSqlSanitizer");
+
+    load_character_class("\\s", space_chars);
+    load_character_class("\\w", word_chars);
+    load_character_class("\\d", digit_chars);
+
+    rb_define_singleton_method(mNativeSqlSanitizer, "postgres", sanitize_postgres, 1);
+    rb_define_singleton_method(mNativeSqlSanitizer, "mysql", sanitize_mysql, 1);
+    rb_define_singleton_method(mNativeSqlSanitizer, "sqlite", sanitize_sqlite, 1);
+    rb_define_singleton_method(mNativeSqlSanitizer, "fingerprint", fingerprint, 1);
+    rb_define_singleton_method(mNativeSqlSanitizer, "xxh64", full_xxh64, 1);
+    rb_define_singleton_method(mNativeSqlSanitizer, "structural_fingerprint", structural_fingerprint, 1);
+}
+
+#else
+
+// Ruby <= 1.8.7 uses a different set of regexes, and sticks to them.
+void Init_sql_sanitizer()
+{
+}
+
+#endif // HAVE_RUBY_RUBY_H
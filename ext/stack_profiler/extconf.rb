@@ -0,0 +1,9 @@
+require 'mkmf'
+
+have_header("ruby/ruby.h") # Needed to check for Ruby <= 1.8.7
+have_header("ruby/debug.h")
+have_func("rb_profile_frames", "ruby/debug.h") # Ruby >= 2.1
+have_func("rb_postponed_job_preregister", "ruby/debug.h") # Ruby >= 3.3
+have_func("setitimer", "sys/time.h")
+have_func("pthread_atfork", "pthread.h")
+create_makefile('stack_profiler')
@@ -0,0 +1,484 @@
+#ifdef HAVE_RUBY_RUBY_H
+#include <ruby/ruby.h>
+#else // Ruby <= 1.8.7
+#include <ruby.h>
+#endif
+
+// Stack sampling for tracked requests.
+//
+// While at least one thread has a profile running, a SIGPROF interval timer
+// fires every `interval_us` of process CPU time. The signal handler only
+// triggers a postponed job. Ruby runs that job on whichever thread holds the
+// GVL at its next interrupt check, which is the thread that was running Ruby
+// code. If that thread has a profile running, the job reads the thread's
+// stack with rb_profile_frames into the profile's preallocated frame buffer.
+// It then counts each frame in a fixed-size table, so taking a sample never
+// allocates. Samples that land on a thread without a running profile are
+// discarded, which is how they're tagged to request threads.
+//
+// Profiles belong to fibers, not threads, so requests served by fibers of one
+// thread each sample only themselves. `current_stack_profile` is the running
+// profile of the fiber on this thread, swapped on each fiber switch. Without
+// fiber switch events, a thread runs one profile at a time, and a fiber can't
+// start another while it's running.
+//
+// Frames are counted per method: `self` is the number of samples with the
+// method on top of the stack, `total` the samples with it anywhere on it.
+
+static VALUE mScoutApm;
+static VALUE mInstruments;
+static VALUE mNativeStackProfiler;
+
+#if defined(HAVE_RUBY_RUBY_H) && defined(HAVE_RB_PROFILE_FRAMES) && defined(HAVE_SETITIMER) && !defined(_WIN32)
+
+#include <ruby/debug.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD_ATFORK
+#include <pthread.h>
+#endif
+
+// Frames from the top of the stack we'll look at. Deeper ones are counted as
+// dropped.
+#define MAX_DEPTH 128
+
+#define FRAME_TABLE_SIZE 2048  // must be a power of 2
+#define FRAME_MAX_PROBES 8
+
+#define DEFAULT_INTERVAL_US 10000 // 100 samples per second of CPU time
+
+typedef struct {
+    VALUE frame;
+    uint32_t self;
+    uint32_t total;
+    uint32_t last_sample; // the sample that last counted total, so recursion counts once
+} frame_entry_t;
+
+typedef struct {
+    VALUE buffer[MAX_DEPTH];
+    int lines[MAX_DEPTH];
+    frame_entry_t frames[FRAME_TABLE_SIZE];
+    uint32_t samples;
+    uint32_t dropped;
+    int running;
+    long generation; // fork_generation when started, see reset_after_fork
+} stack_profile_t;
+
+static __thread stack_profile_t *current_stack_profile;
+static ID id_stack_profile;
+
+static long interval_us = DEFAULT_INTERVAL_US;
+static long active_profiles = 0;
+static long fork_generation = 0;
+static int handler_installed = 0;
+
+static void release_profile(stack_profile_t *profile);
+
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+static rb_postponed_job_handle_t sample_job_handle;
+#endif
+
+// Frames are held as raw VALUEs, so the GC has to know about them for as long
+// as they sit in the table.
+static void
+stack_profile_mark(void *ptr)
+{
+    stack_profile_t *profile = (stack_profile_t *)ptr;
+    int i;
+
+    for (i = 0; i < FRAME_TABLE_SIZE; i++) {
+        if (profile->frames[i].total) {
+            rb_gc_mark(profile->frames[i].frame);
+        }
+    }
+}
+
+// A fiber that ended, or was dropped, mid-profile mustn't keep the timer
+// running.
+static void
+stack_profile_free(void *ptr)
+{
+    stack_profile_t *profile = (stack_profile_t *)ptr;
+
+    if (profile->running) {
+        release_profile(profile);
+    }
+    xfree(profile);
+}
+
+static size_t
+stack_profile_memsize(const void *ptr)
+{
+    return sizeof(stack_profile_t);
+}
+
+static const rb_data_type_t stack_profile_type = {
+    "ScoutApm::Instruments::NativeStackProfiler/profile",
+    { stack_profile_mark, stack_profile_free, stack_profile_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static void
+clear_profile(stack_profile_t *profile)
+{
+    MEMZERO(profile->frames, frame_entry_t, FRAME_TABLE_SIZE);
+    profile->samples = 0;
+    profile->dropped = 0;
+}
+
+static inline uint32_t
+hash_value(VALUE v)
+{
+    return (uint32_t)((((uint64_t)v >> 3) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static inline void
+count_frame(stack_profile_t *profile, VALUE frame, int top)
+{
+    uint32_t i = hash_value(frame) & (FRAME_TABLE_SIZE - 1);
+    int probe;
+
+    for (probe = 0; probe < FRAME_MAX_PROBES; probe++, i = (i + 1) & (FRAME_TABLE_SIZE - 1)) {
+        frame_entry_t *entry = &profile->frames[i];
+        if (!entry->total) {
+            entry->frame = frame;
+            entry->self = top;
+            entry->total = 1;
+            entry->last_sample = profile->samples;
+            return;
+        }
+        if (entry->frame == frame) {
+            entry->self += top;
+            if (entry->last_sample != profile->samples) {
+                entry->total++;
+                entry->last_sample = profile->samples;
+            }
+            return;
+        }
+    }
+    profile->dropped++;
+}
+
+// The postponed job: runs on the thread holding the GVL, outside the signal
+// handler, so rb_profile_frames is safe to call.
+static void
+sample_job(void *data)
+{
+    stack_profile_t *profile = current_stack_profile;
+    int count, i;
+
+    if (!profile) {
+        return;
+    }
+
+    count = rb_profile_frames(0, MAX_DEPTH, profile->buffer, profile->lines);
+    if (count <= 0) {
+        return;
+    }
+
+    profile->samples++;
+    for (i = 0; i < count; i++) {
+        count_frame(profile, profile->buffer[i], i == 0);
+    }
+    if (count == MAX_DEPTH) {
+        profile->dropped++;
+    }
+}
+
+static void
+sigprof_handler(int sig, siginfo_t *info, void *ucontext)
+{
+    int saved_errno = errno;
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+    rb_postponed_job_trigger(sample_job_handle);
+#else
+    rb_postponed_job_register_one(0, sample_job, 0);
+#endif
+    errno = saved_errno;
+}
+
+// Installs the SIGPROF handler, unless something else (another profiler)
+// already has one. Returns whether ours is in place.
+static int
+install_handler()
+{
+    struct sigaction sa, old;
+
+    if (handler_installed) {
+        return 1;
+    }
+
+    if (sigaction(SIGPROF, NULL, &old) != 0) {
+        return 0;
+    }
+    if ((old.sa_flags & SA_SIGINFO) ? old.sa_sigaction != NULL
+                                    : (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN)) {
+        return 0;
+    }
+
+    sa.sa_sigaction = sigprof_handler;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) != 0) {
+        return 0;
+    }
+
+    handler_installed = 1;
+    return 1;
+}
+
+// Runs the timer only while some fiber is profiling. Callers hold the GVL,
+// so the count needs no extra locking.
+static void
+update_timer()
+{
+    struct itimerval timer;
+
+    MEMZERO(&timer, struct itimerval, 1);
+    if (active_profiles > 0) {
+        timer.it_interval.tv_sec = interval_us / 1000000;
+        timer.it_interval.tv_usec = interval_us % 1000000;
+        timer.it_value = timer.it_interval;
+    }
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Profiles started before a fork were counted by the parent, so only ones
+// from this process's generation are uncounted.
+static void
+release_profile(stack_profile_t *profile)
+{
+    if (current_stack_profile == profile) {
+        current_stack_profile = NULL;
+    }
+    profile->running = 0;
+    if (profile->generation == fork_generation && active_profiles > 0) {
+        active_profiles--;
+        update_timer();
+    }
+}
+
+// The current fiber's profile, kept in its fiber-local storage so it's freed
+// with the fiber. NULL if it has none and `create` is false.
+static stack_profile_t *
+fiber_stack_profile(int create)
+{
+    VALUE thread = rb_thread_current();
+    VALUE obj = rb_thread_local_aref(thread, id_stack_profile);
+    stack_profile_t *profile;
+
+    if (NIL_P(obj) || !rb_typeddata_is_kind_of(obj, &stack_profile_type)) {
+        if (!create) {
+            return NULL;
+        }
+        obj = TypedData_Make_Struct(rb_cObject, stack_profile_t, &stack_profile_type, profile);
+        rb_thread_local_aset(thread, id_stack_profile, obj);
+        return profile;
+    }
+    return (stack_profile_t *)DATA_PTR(obj);
+}
+
+static VALUE
+frame_path(VALUE frame)
+{
+    VALUE path = rb_profile_frame_absolute_path(frame);
+    if (!RB_TYPE_P(path, T_STRING)) path = rb_profile_frame_path(frame);
+    return path;
+}
+
+static int
+compare_frames(const void *a, const void *b)
+{
+    const frame_entry_t *fa = *(const frame_entry_t **)a, *fb = *(const frame_entry_t **)b;
+    if (fa->self != fb->self) return fa->self < fb->self ? 1 : -1;
+    if (fa->total != fb->total) return fa->total < fb->total ? 1 : -1;
+    return 0;
+}
+
+// [[[label, path, line, self, total], ...], samples, dropped], the frames
+// sorted by self then total samples, and cut to the top `limit`.
+static VALUE
+stack_profile_results(stack_profile_t *profile, long limit)
+{
+    frame_entry_t *frames[FRAME_TABLE_SIZE];
+    long frame_count = 0, i;
+    VALUE frame_ary;
+
+    for (i = 0; i < FRAME_TABLE_SIZE; i++) {
+        if (profile->frames[i].total) frames[frame_count++] = &profile->frames[i];
+    }
+    qsort(frames, frame_count, sizeof(frame_entry_t *), compare_frames);
+
+    if (frame_count > limit) frame_count = limit;
+
+    frame_ary = rb_ary_new2(frame_count);
+    for (i = 0; i < frame_count; i++) {
+        VALUE frame = frames[i]->frame;
+        rb_ary_push(frame_ary, rb_ary_new3(5, rb_profile_frame_full_label(frame), frame_path(frame),
+                                           rb_profile_frame_first_lineno(frame),
+                                           UINT2NUM(frames[i]->self), UINT2NUM(frames[i]->total)));
+    }
+    return rb_ary_new3(3, frame_ary, UINT2NUM(profile->samples), UINT2NUM(profile->dropped));
+}
+
+// NativeStackProfiler.start => true or false
+//
+// Starts (or restarts) sampling the current fiber. Returns false if another
+// SIGPROF handler is installed, as we'd take its signals, or if another fiber
+// of this thread is being sampled and fibers can't be told apart.
+static VALUE
+start_profile(VALUE mod)
+{
+    stack_profile_t *profile;
+
+    if (!install_handler()) {
+        return Qfalse;
+    }
+
+    profile = fiber_stack_profile(1);
+#ifndef RUBY_EVENT_FIBER_SWITCH
+    if (current_stack_profile && current_stack_profile != profile) {
+        return Qfalse;
+    }
+#endif
+    clear_profile(profile);
+    current_stack_profile = profile;
+    if (!profile->running) {
+        profile->running = 1;
+        profile->generation = fork_generation;
+        active_profiles++;
+        if (active_profiles == 1) update_timer();
+    }
+    return Qtrue;
+}
+
+// NativeStackProfiler.stop(limit) => Array or nil
+//
+// Stops sampling the current fiber and returns the top `limit` frames, or
+// nil if it wasn't being sampled. The table is cleared so it doesn't hold on
+// to frames between requests.
+static VALUE
+stop_profile(VALUE mod, VALUE limit)
+{
+    stack_profile_t *profile = fiber_stack_profile(0);
+    VALUE results;
+
+    if (!profile || !profile->running) {
+        return Qnil;
+    }
+    release_profile(profile);
+    results = stack_profile_results(profile, NUM2LONG(limit));
+    clear_profile(profile);
+    return results;
+}
+
+static VALUE
+is_running(VALUE mod)
+{
+    stack_profile_t *profile = fiber_stack_profile(0);
+    return profile && profile->running ? Qtrue : Qfalse;
+}
+
+static VALUE
+get_interval_us(VALUE mod)
+{
+    return LONG2NUM(interval_us);
+}
+
+static VALUE
+set_interval_us(VALUE mod, VALUE interval)
+{
+    long n = NUM2LONG(interval);
+    if (n < 1) {
+        rb_raise(rb_eArgError, "sampling interval must be a positive number of microseconds");
+    }
+    interval_us = n;
+    if (active_profiles > 0) update_timer();
+    return interval;
+}
+
+// Native threads can be reused, so never let a pointer into the previous
+// thread's profile survive, and don't leave the timer running for a thread
+// that ended mid-profile. On a fiber switch, samples go to the incoming
+// fiber's profile, if it's running one.
+static void
+context_event_handler(VALUE tpval, void *data)
+{
+    rb_trace_arg_t *tparg = rb_tracearg_from_tracepoint(tpval);
+    stack_profile_t *profile;
+
+    switch (rb_tracearg_event_flag(tparg)) {
+#ifdef RUBY_EVENT_FIBER_SWITCH
+      case RUBY_EVENT_FIBER_SWITCH:
+        profile = fiber_stack_profile(0);
+        current_stack_profile = profile && profile->running ? profile : NULL;
+        return;
+#endif
+      case RUBY_EVENT_THREAD_END:
+        if (current_stack_profile) {
+            release_profile(current_stack_profile);
+        }
+        break;
+      default:
+        break;
+    }
+    current_stack_profile = NULL;
+}
+
+#ifdef HAVE_PTHREAD_ATFORK
+// Interval timers aren't inherited by a fork child, and of the parent's
+// threads only the forking one survives. Count only its profile, if it's
+// running one, and start the timer again for it. Profiles from before the
+// fork that belong to threads that are gone are never counted again (see
+// release_profile).
+static void
+reset_after_fork()
+{
+    fork_generation++;
+    active_profiles = 0;
+    if (current_stack_profile && current_stack_profile->running) {
+        current_stack_profile->generation = fork_generation;
+        active_profiles = 1;
+    }
+    update_timer();
+}
+#endif
+
+void Init_stack_profiler()
+{
+    mScoutApm = rb_define_module("ScoutApm");
+    mInstruments = rb_define_module_under(mScoutApm, "Instruments");
+    mNativeStackProfiler = rb_define_module_under(mInstruments, "NativeStackProfiler");
+
+    id_stack_profile = rb_intern("__scout_apm_stack_profile");
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+    sample_job_handle = rb_postponed_job_preregister(0, sample_job, NULL);
+#endif
+    rb_tracepoint_enable(rb_tracepoint_new(0, RUBY_EVENT_THREAD_BEGIN | RUBY_EVENT_THREAD_END
+#ifdef RUBY_EVENT_FIBER_SWITCH
+                                              | RUBY_EVENT_FIBER_SWITCH
+#endif
+                                              , context_event_handler, 0));
+#ifdef HAVE_PTHREAD_ATFORK
+    pthread_atfork(NULL, NULL, reset_after_fork);
+#endif
+
+    rb_define_singleton_method(mNativeStackProfiler, "start", start_profile, 0);
+    rb_define_singleton_method(mNativeStackProfiler, "stop", stop_profile, 1);
+    rb_define_singleton_method(mNativeStackProfiler, "running?", is_running, 0);
+    rb_define_singleton_method(mNativeStackProfiler, "interval_us", get_interval_us, 0);
+    rb_define_singleton_method(mNativeStackProfiler, "interval_us=", set_interval_us, 1);
+}
+
+#else
+
+// Without rb_profile_frames or interval timers, requests just aren't sampled.
+void Init_stack_profiler()
+{
+}
+
+#endif
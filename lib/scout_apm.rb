@@ -15,6 +15,7 @@ require 'thread'
 require 'time'
 require 'yaml'
 require 'webrick'
+require 'zlib'
 
 #####################################
 # Gem Requires
@@ -30,7 +31,11 @@ require 'scout_apm/debug'
 require 'scout_apm/tracked_request'
 require 'scout_apm/layer'
 require 'scout_apm/limited_layer'
+require 'scout_apm/merged_layer'
 require 'scout_apm/layer_children_set'
+require 'scout_apm/layer_records'
+require 'scout_apm/layer_arena'
+require 'scout_apm/arena_layer'
 require 'scout_apm/request_manager'
 require 'scout_apm/call_set'
 
@@ -44,6 +49,7 @@ require 'scout_apm/layer_converters/database_converter'
 require 'scout_apm/layer_converters/slow_request_converter'
 require 'scout_apm/layer_converters/request_queue_time_converter'
 require 'scout_apm/layer_converters/allocation_metric_converter'
+require 'scout_apm/layer_converters/cpu_time_converter'
 require 'scout_apm/layer_converters/histograms'
 require 'scout_apm/layer_converters/find_layer_by_type'
 
@@ -88,8 +94,12 @@ require 'scout_apm/instruments/sinatra'
 require 'scout_apm/instruments/process/process_cpu'
 require 'scout_apm/instruments/process/process_memory'
 require 'scout_apm/instruments/percentile_sampler'
+require 'scout_apm/instruments/agent_overhead'
 require 'scout_apm/instruments/action_view'
 require 'allocations'
+require 'scout_apm/instruments/stack_profiler'
+require 'scout_apm/clock'
+require 'scout_apm/overhead'
 
 require 'scout_apm/app_server_load'
 
@@ -113,6 +123,7 @@ require 'scout_apm/agent/logging'
 require 'scout_apm/agent/reporting'
 require 'scout_apm/layaway'
 require 'scout_apm/layaway_file'
+require 'scout_apm/shared_layaway'
 require 'scout_apm/reporter'
 require 'scout_apm/background_worker'
 require 'scout_apm/bucket_name_splitter'
@@ -161,6 +172,8 @@ require 'scout_apm/remote/server'
 require 'scout_apm/remote/router'
 require 'scout_apm/remote/message'
 require 'scout_apm/remote/recorder'
+require 'scout_apm/remote/socket_server'
+require 'scout_apm/remote/socket_recorder'
 require 'scout_apm/instruments/resque'
 
 if defined?(Rails) && defined?(Rails::VERSION) && defined?(Rails::VERSION::MAJOR) && Rails::VERSION::MAJOR >= 3 && defined?(Rails::Railtie)
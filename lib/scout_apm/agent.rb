@@ -127,12 +127,17 @@ module ScoutApm
       init_logger
       logger.info "Attempting to start Scout Agent [#{ScoutApm::VERSION}] on [#{environment.hostname}]"
 
+      configure_layaway_backend
+
       @recorder = create_recorder
 
       @config.log_settings
 
       @ignored_uris = ScoutApm::IgnoredUris.new(config.value('ignore'))
 
+      configure_allocation_tracking
+      configure_stack_profiling
+
       load_instruments if should_load_instruments?(options)
 
       if !@config.any_keys_found?
@@ -148,6 +153,7 @@ module ScoutApm
       [ ScoutApm::Instruments::Process::ProcessCpu.new(environment.processors, logger),
         ScoutApm::Instruments::Process::ProcessMemory.new(logger),
         ScoutApm::Instruments::PercentileSampler.new(logger, request_histograms_by_time),
+        ScoutApm::Instruments::AgentOverhead.new(logger),
       ].each { |s| store.add_sampler(s) }
 
       app_server_load_hook
@@ -169,6 +175,32 @@ module ScoutApm
       end
     end
 
+    # Switches to the shared memory layaway when configured and available.
+    # Happens before forking in preloading servers, so workers inherit it.
+    def configure_layaway_backend
+      return unless config.value('layaway_backend').to_s.strip.downcase == 'shared_memory'
+      return if layaway.is_a?(ScoutApm::SharedLayaway)
+
+      if shared = ScoutApm::SharedLayaway.open(config, environment)
+        @layaway = shared
+        logger.info "Using shared memory layaway at #{shared.region_path}"
+      end
+    end
+
+    # Applies the allocation tracking mode & sample rate from the config to the
+    # native allocations extension.
+    def configure_allocation_tracking
+      ScoutApm::Instruments::Allocations.mode = config.value('allocation_tracking').to_s.strip.downcase.to_sym
+      ScoutApm::Instruments::Allocations.sample_rate = [config.value('allocation_sample_rate'), 1].max
+    rescue ArgumentError => e
+      logger.warn "Invalid allocation tracking setting, leaving allocation tracking as-is: #{e.message}"
+    end
+
+    # Applies the stack sampling rate from the config to the stack profiler.
+    def configure_stack_profiling
+      ScoutApm::Instruments::StackProfiler.rate = config.value('stack_profiling_rate')
+    end
+
     # Sends a ping to APM right away, smoothes out onboarding
     # Collects up any relevant info (framework, app server, system time, ruby version, etc)
     def app_server_load_hook
@@ -361,7 +393,7 @@ module ScoutApm
 
       if config.value("async_recording")
         logger.debug("Using asynchronous recording")
-        ScoutApm::BackgroundRecorder.new(logger).start
+        ScoutApm::BackgroundRecorder.new(logger, config.value("async_recording_queue_size")).start
       else
         logger.debug("Using synchronous recording")
         ScoutApm::SynchronousRecorder.new(logger).start
@@ -373,13 +405,14 @@ module ScoutApm
 
       logger.info("Starting Remote Agent Server")
 
-      # Start the listening web server only in parent process.
-      @remote_server = ScoutApm::Remote::Server.new(
-        bind,
-        port,
-        ScoutApm::Remote::Router.new(ScoutApm::SynchronousRecorder.new(logger), logger),
-        logger
-      )
+      router = ScoutApm::Remote::Router.new(ScoutApm::SynchronousRecorder.new(logger), logger)
+
+      # Start the listening server only in parent process.
+      @remote_server = if (path = config.value('remote_agent_socket'))
+                         ScoutApm::Remote::SocketServer.new(path, router, logger)
+                       else
+                         ScoutApm::Remote::Server.new(bind, port, router, logger)
+                       end
 
       @remote_server.start
     end
@@ -387,8 +420,13 @@ module ScoutApm
     # Execute this in the child process of a remote agent. The parent is
     # expected to have its accepting webserver up and running
     def use_remote_recorder(host, port)
-      logger.debug("Becoming Remote Agent (reporting to: #{host}:#{port})")
-      @recorder = ScoutApm::Remote::Recorder.new(host, port, logger)
+      if (path = config.value('remote_agent_socket'))
+        logger.debug("Becoming Remote Agent (reporting to: #{path})")
+        @recorder = ScoutApm::Remote::SocketRecorder.new(path, logger)
+      else
+        logger.debug("Becoming Remote Agent (reporting to: #{host}:#{port})")
+        @recorder = ScoutApm::Remote::Recorder.new(host, port, logger)
+      end
       @store = ScoutApm::FakeStore.new
     end
   end
@@ -30,20 +30,10 @@ module ScoutApm
 
         logger.debug("Attempting to claim #{period_to_report.to_s}")
 
-        did_write = layaway.with_claim(period_to_report) do |rps|
+        did_write = layaway.with_merged_claim(period_to_report) do |merged, count|
           logger.debug("Succeeded claiming #{period_to_report.to_s}")
-
-          begin
-            merged = rps.inject { |memo, rp| memo.merge(rp) }
-            logger.debug("Merged #{rps.length} reporting periods, delivering")
-            deliver_period(merged)
-            true
-          rescue => e
-            logger.debug("Error merging reporting periods #{e.message}")
-            logger.debug("Error merging reporting periods #{e.backtrace}")
-            false
-          end
-
+          logger.debug("Merged #{count} reporting periods, delivering")
+          deliver_period(merged)
         end
 
         if !did_write
@@ -72,10 +62,13 @@ module ScoutApm
 
         log_deliver(metrics, slow_transactions, metadata, slow_jobs, histograms)
 
-        payload = ScoutApm::Serializers::PayloadSerializer.serialize(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
         logger.debug("Sending payload w/ Headers: #{headers.inspect}")
 
-        reporter.report(payload, headers)
+        reporter.report_stream(headers) do |io|
+          ScoutApm::Overhead.measure(ScoutApm::Overhead::PAYLOAD_SERIALIZE) {
+            ScoutApm::Serializers::PayloadSerializer.serialize_to(io, metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+          }
+        end
       rescue => e
         logger.warn "Error on checkin"
         logger.info e.message
@@ -0,0 +1,128 @@
+module ScoutApm
+  # A stopped layer, read from its record in a request's LayerArena. It
+  # answers what converters ask of a layer, the same as the Layer did while
+  # it ran.
+  #
+  # Walking the arena moves one ArenaLayer from record to record (see
+  # move_to), rather than creating one per layer, so don't hold on to a layer
+  # you're handed by a walker: keep a dup of it, which stays on its record.
+  # Two ArenaLayers are == when they're on the same record.
+  class ArenaLayer
+    attr_reader :arena
+
+    # The number of the record this reads
+    attr_reader :index
+
+    def initialize(arena, index)
+      @arena = arena
+      @records = arena.records
+      @index = index
+    end
+
+    def move_to(index)
+      @index = index
+      self
+    end
+
+    def type
+      @arena.type(@index)
+    end
+
+    def name
+      @arena.name(@index)
+    end
+
+    def desc
+      @arena.desc(@index)
+    end
+
+    def annotations
+      @arena.annotations(@index)
+    end
+
+    def backtrace
+      @arena.backtrace(@index)
+    end
+
+    def backtrace_parsed?
+      @records.flag?(@index, LayerRecords::BACKTRACE_PARSED)
+    end
+
+    def subscopable?
+      @records.flag?(@index, LayerRecords::SUBSCOPABLE)
+    end
+
+    def limited?
+      false
+    end
+
+    # The layer's cpu time, only recorded on the root
+    def cpu_time
+      @arena.cpu_time if @index == 0
+    end
+
+    def children
+      @arena.children(@index)
+    end
+
+    def legacy_metric_name
+      "#{type}/#{name}"
+    end
+
+    def start_ns
+      @records.start_ns(@index)
+    end
+
+    def stop_ns
+      @records.stop_ns(@index)
+    end
+
+    # Wall time of the start of this layer. Builds a new Time; only call this
+    # when reporting.
+    def start_time
+      ScoutApm::Clock.to_time(start_ns)
+    end
+
+    def stop_time
+      ns = stop_ns
+      ns && ScoutApm::Clock.to_time(ns)
+    end
+
+    def total_call_time
+      @records.total_call_time(@index)
+    end
+
+    def total_exclusive_time
+      @records.total_exclusive_time(@index)
+    end
+
+    def total_allocations
+      @records.total_allocations(@index)
+    end
+
+    def total_exclusive_allocations
+      @records.total_exclusive_allocations(@index)
+    end
+
+    def total_gc_time
+      @records.total_gc_time(@index)
+    end
+
+    def total_gc_count
+      @records.total_gc_count(@index)
+    end
+
+    def ==(other)
+      ArenaLayer === other && other.arena.equal?(@arena) && other.index == @index
+    end
+    alias_method :eql?, :==
+
+    def hash
+      @arena.object_id ^ @index
+    end
+
+    def to_s
+      "<ArenaLayer #{index}: #{legacy_metric_name} (Total: #{total_call_time}, Self: #{total_exclusive_time}) Description: #{desc.inspect}>"
+    end
+  end
+end
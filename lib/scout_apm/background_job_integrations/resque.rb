@@ -30,7 +30,11 @@ module ScoutApm
             ScoutApm::Agent.instance.start_background_worker
             ScoutApm::Agent.instance.start_remote_server(bind, port)
           rescue Errno::EADDRINUSE
-            ScoutApm::Agent.instance.logger.warn "Error while Installing Resque Instruments, Port #{port} already in use. Set via the `remote_agent_port` configuration option"
+            if (path = ScoutApm::Agent.instance.config.value('remote_agent_socket'))
+              ScoutApm::Agent.instance.logger.warn "Error while Installing Resque Instruments, Socket #{path} already in use. Set via the `remote_agent_socket` configuration option"
+            else
+              ScoutApm::Agent.instance.logger.warn "Error while Installing Resque Instruments, Port #{port} already in use. Set via the `remote_agent_port` configuration option"
+            end
           rescue => e
             ScoutApm::Agent.instance.logger.warn "Error while Installing Resque before_first_fork: #{e.inspect}"
           end
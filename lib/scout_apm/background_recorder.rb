@@ -1,20 +1,31 @@
 # Provide a background thread queue to do the processing of
 # TrackedRequest objects, to remove it from the hot-path of returning a
 # web response
+#
+# The queue is bounded (async_recording_queue_size). If the thread falls that
+# far behind, further requests are dropped rather than blocking the request
+# threads or growing without limit, and counted in +dropped+.
 
 module ScoutApm
   class BackgroundRecorder
+    DEFAULT_QUEUE_SIZE = 1000
+
     attr_reader :queue
     attr_reader :thread
     attr_reader :logger
 
-    def initialize(logger)
+    def initialize(logger, queue_size = DEFAULT_QUEUE_SIZE)
       @logger = logger
-      @queue = Queue.new
+      @queue_size = [queue_size.to_i, 1].max
+      @queue = SizedQueue.new(@queue_size)
+      @lock = Mutex.new
+      @recorded = 0
+      @dropped = 0
     end
 
     def start
       logger.info("Starting BackgroundRecorder")
+      @pid = Process.pid
       @thread = Thread.new(&method(:thread_func))
       self
     end
@@ -23,9 +34,39 @@ module ScoutApm
       @thread.kill
     end
 
+    # Never blocks. The request is dropped if the queue is full.
     def record!(request)
-      start unless @thread.alive?
-      @queue.push(request)
+      restart unless running?
+
+      begin
+        @queue.push(request, true)
+      rescue ThreadError
+        dropped = @lock.synchronize { @dropped += 1 }
+        if dropped == 1
+          logger.warn("BackgroundRecorder queue is full (#{@queue_size} requests), dropping requests until it catches up")
+        end
+      end
+    end
+
+    # Number of requests dropped because the queue was full
+    def dropped
+      @lock.synchronize { @dropped }
+    end
+
+    # Number of requests recorded by the thread
+    def recorded
+      @lock.synchronize { @recorded }
+    end
+
+    def stats
+      @lock.synchronize do
+        {
+          :queued => @queue.size,
+          :queue_size => @queue_size,
+          :recorded => @recorded,
+          :dropped => @dropped,
+        }
+      end
     end
 
     def thread_func
@@ -36,8 +77,26 @@ module ScoutApm
           req.record!
         rescue => e
           logger.warn("Error in BackgroundRecorder - #{e.message} : #{e.backtrace}")
+        ensure
+          @lock.synchronize { @recorded += 1 }
         end
       end
     end
+
+    private
+
+    def running?
+      @pid == Process.pid && @thread && @thread.alive?
+    end
+
+    # After a fork the thread is gone, and anything still queued belongs to
+    # the parent, which records it itself.
+    def restart
+      @lock.synchronize do
+        return if running?
+        @queue.clear if @pid && @pid != Process.pid
+        start
+      end
+    end
   end
 end
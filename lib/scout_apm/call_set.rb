@@ -8,34 +8,33 @@ module ScoutApm
     attr_reader :call_count
 
     def initialize
-      @items = [] # An array of Layer descriptions that are associated w/a single Layer name (ex: User/find). Note this may contain nil items.
-      @grouped_items = Hash.new { |h, k| h[k] = [] } # items groups by their normalized name since multiple layers could have the same layer name.
+      @counts = Hash.new(0) # Calls by the fingerprint of their description, since multiple layers could have the same layer name.
+      @last_key = nil
       @call_count = 0
       @captured = false # cached for performance
-      @start_time = Time.now
+      @start_ns = ScoutApm::Clock.monotonic_ns
       @past_start_time = false # cached for performance
     end
 
+    # Only the count is kept, not the item, so a long N+1 doesn't hold every
+    # description it ran with.
     def update!(item = nil)
       if @captured # No need to do any work if we've already captured a backtrace.
         return
       end
       @call_count += 1
-      @items << item
-      if @grouped_items.any? # lazy grouping as normalizing items can be expensive.
-        @grouped_items[unique_name_for(item)] << item
-      end
+      @last_key = fingerprint_for(item)
+      @counts[@last_key] += 1
     end
 
     # Limit our workload if time across this set of calls is small.
     def past_time_threshold?
       return true if @past_time_threshold # no need to check again once past
-      @past_time_threshold = (Time.now-@start_time) >= N_PLUS_ONE_TIME_THRESHOLD
+      @past_time_threshold = ScoutApm::Clock.elapsed(@start_ns) >= N_PLUS_ONE_TIME_THRESHOLD
     end
 
-    # We're selective on capturing a backtrace for two reasons:
-    # * Grouping ActiveRecord calls requires us to sanitize the SQL. This isn't cheap.
-    # * Capturing backtraces isn't cheap.
+    # We're selective on capturing a backtrace because capturing backtraces
+    # isn't cheap.
     def capture_backtrace?
       if !@captured && @call_count >= N_PLUS_ONE_MAGIC_NUMBER && past_time_threshold? && at_magic_number?
         @captured = true
@@ -43,20 +42,18 @@ module ScoutApm
     end
 
     def at_magic_number?
-      grouped_items[unique_name_for(@items.last)].size >= N_PLUS_ONE_MAGIC_NUMBER
+      @counts[@last_key] >= N_PLUS_ONE_MAGIC_NUMBER
     end
 
-    def grouped_items
-      if @grouped_items.any? 
-        @grouped_items
+    # Determine this items' "hash key". SQL is keyed by its structural
+    # fingerprint (see SqlSanitizer#fingerprint), so queries differing only
+    # in their values count together, as they do once sanitized.
+    def fingerprint_for(item)
+      if item.respond_to?(:fingerprint)
+        item.fingerprint
       else
-        @grouped_items.merge!(@items.group_by { |item| unique_name_for(item) })
+        item.to_s.hash
       end
     end
-
-    # Determine this items' "hash key"
-    def unique_name_for(item)
-      item.to_s
-    end
   end
 end
@@ -0,0 +1,34 @@
+module ScoutApm
+  # A monotonic clock for measuring durations. Readings are Integer
+  # nanoseconds from an arbitrary starting point: they never go backwards when
+  # the system clock is adjusted, and taking one doesn't allocate a Time.
+  #
+  # Only turn a reading into wall time (to_time) when it has to be reported as
+  # a point in time, like the timestamp of a slow transaction.
+  module Clock
+    NANOSECONDS_PER_SECOND = 1_000_000_000.0
+
+    # ext/allocations defines a native monotonic_ns when it's available.
+    unless respond_to?(:monotonic_ns)
+      if defined?(::Process::CLOCK_MONOTONIC)
+        def self.monotonic_ns
+          ::Process.clock_gettime(::Process::CLOCK_MONOTONIC, :nanosecond)
+        end
+      else
+        def self.monotonic_ns
+          (Time.now.to_f * NANOSECONDS_PER_SECOND).to_i
+        end
+      end
+    end
+
+    # Seconds between two readings, as a Float
+    def self.elapsed(start_ns, stop_ns = monotonic_ns)
+      (stop_ns - start_ns) / NANOSECONDS_PER_SECOND
+    end
+
+    # The wall time when a reading was taken
+    def self.to_time(ns)
+      Time.now - elapsed(ns)
+    end
+  end
+end
@@ -9,8 +9,15 @@ require 'scout_apm/environment'
 # scout_apm itself. See the documentation at http://help.apm.scoutapp.com for
 # customer-focused documentation.
 #
+# allocation_tracking - 'always', 'request' (count object allocations only while a request is being tracked) or 'off'. Default: 'always'
+# allocation_sample_rate - count every Nth object allocation, scaling counts back up by N. Default: 1 (count every allocation)
+# allocation_site_profiling - true or false. Attach the top allocating file:line sites and object classes to slow request traces. Default: false
 # application_root - override the detected directory of the application
+# async_recording  - true or false. Convert and store finished requests on a background thread, off the request's own. Default: false
+# async_recording_queue_size - how many finished requests async_recording holds before dropping new ones. Default: 1000
 # compress_payload - true/false to enable gzipping of payload
+# compress_payload_level - gzip level, 1 (fastest) to 9 (smallest). Default: 5
+# compress_payload_strategy - gzip strategy: default, filtered, huffman_only or rle. Default: default
 # data_file        - override the default temporary storage location. Must be a location in a writable directory
 # dev_trace        - true or false. Enables always-on tracing in development environmen only
 # direct_host      - override the default "direct" host. The direct_host bypasses the ingestion pipeline and goes directly to the webserver, and is primarily used for features under development.
@@ -18,6 +25,8 @@ require 'scout_apm/environment'
 # host             - configuration used in development
 # hostname         - override the default hostname detection. Default varies by environment - either system hostname, or PAAS hostname
 # key              - the account key with Scout APM. Found in Settings in the Web UI
+# layaway_backend  - 'file' or 'shared_memory'. How processes pass metrics to the one reporting them. shared_memory needs the native extensions. Default: 'file'
+# layaway_format   - 'marshal' or 'native'. How layaway files are written. native is faster, but agents older than it can't read it, so turn it on once every process runs this version. Both are always read. Default: 'marshal'
 # log_file_path    - either a directory or "STDOUT".
 # log_level        - DEBUG / INFO / WARN as usual
 # monitor          - true or false.  False prevents any instrumentation from starting
@@ -25,10 +34,15 @@ require 'scout_apm/environment'
 # profile          - turn on/off scoutprof (only applicable in Gem versions including scoutprof)
 # proxy            - an http proxy
 # report_format    - 'json' or 'marshal'. Marshal is legacy and will be removed.
+# shared_layaway_slots - with layaway_backend 'shared_memory', how many 1MB periods the region in /dev/shm holds. Reserved up front. Default: 32
 # scm_subdirectory - if the app root lives in source management in a subdirectory. E.g. #{SCM_ROOT}/src
+# sql_fingerprint_cache_size - how many distinct SQL statements to keep sanitized copies of. 0 disables the cache. Default: 500
+# stack_profiling - true or false. Sample the Ruby stack of requests, attaching the methods most often found running to slow request traces. Default: false
+# stack_profiling_rate - stack samples per second of CPU time, with stack_profiling on. Default: 100
 # uri_reporting    - 'path' or 'full_path' default is 'full_path', which reports URL params as well as the path.
 # remote_agent_host - Internal: What host to bind to, and also send messages to for remote. Default: 127.0.0.1.
 # remote_agent_port - What port to bind the remote webserver to
+# remote_agent_socket - Path of a Unix socket to use for remote agent reports instead of the webserver on remote_agent_port. Default: nil (use the webserver)
 #
 # Any of these config settings can be set with an environment variable prefixed
 # by SCOUT_ and uppercasing the key: SCOUT_LOG_LEVEL for instance.
@@ -36,9 +50,15 @@ require 'scout_apm/environment'
 module ScoutApm
   class Config
     KNOWN_CONFIG_OPTIONS = [
+        'allocation_sample_rate',
+        'allocation_site_profiling',
+        'allocation_tracking',
         'application_root',
         'async_recording',
+        'async_recording_queue_size',
         'compress_payload',
+        'compress_payload_level',
+        'compress_payload_strategy',
         'config_file',
         'data_file',
         'database_metric_limit',
@@ -52,6 +72,8 @@ module ScoutApm
         'hostname',
         'ignore',
         'key',
+        'layaway_backend',
+        'layaway_format',
         'log_file_path',
         'log_level',
         'monitor',
@@ -60,8 +82,13 @@ module ScoutApm
         'proxy',
         'remote_agent_host',
         'remote_agent_port',
+        'remote_agent_socket',
         'report_format',
         'scm_subdirectory',
+        'shared_layaway_slots',
+        'sql_fingerprint_cache_size',
+        'stack_profiling',
+        'stack_profiling_rate',
         'uri_reporting',
     ]
 
@@ -142,7 +169,11 @@ module ScoutApm
 
 
     SETTING_COERCIONS = {
+      "allocation_sample_rate" => IntegerCoercion.new,
+      "allocation_site_profiling" => BooleanCoercion.new,
       "async_recording"        => BooleanCoercion.new,
+      "async_recording_queue_size" => IntegerCoercion.new,
+      "compress_payload_level" => IntegerCoercion.new,
       "detailed_middleware"    => BooleanCoercion.new,
       "dev_trace"              => BooleanCoercion.new,
       "enable_background_jobs" => BooleanCoercion.new,
@@ -150,6 +181,10 @@ module ScoutApm
       "monitor"                => BooleanCoercion.new,
       'database_metric_limit'  => IntegerCoercion.new,
       'database_metric_report_limit' => IntegerCoercion.new,
+      'shared_layaway_slots'   => IntegerCoercion.new,
+      'sql_fingerprint_cache_size' => IntegerCoercion.new,
+      'stack_profiling'        => BooleanCoercion.new,
+      'stack_profiling_rate'   => IntegerCoercion.new,
     }
 
 
@@ -222,7 +257,13 @@ module ScoutApm
 
     class ConfigDefaults
       DEFAULTS = {
+        'allocation_sample_rate' => 1,
+        'allocation_site_profiling' => false,
+        'allocation_tracking'    => 'always',
+        'async_recording_queue_size' => 1000,
         'compress_payload'       => true,
+        'compress_payload_level' => 5,
+        'compress_payload_strategy' => 'default',
         'detailed_middleware'    => false,
         'dev_trace'              => false,
         'direct_host'            => 'https://apm.scoutapp.com',
@@ -230,6 +271,8 @@ module ScoutApm
         'enable_background_jobs' => true,
         'host'                   => 'https://checkin.scoutapp.com',
         'ignore'                 => [],
+        'layaway_backend'        => 'file',
+        'layaway_format'         => 'marshal',
         'log_level'              => 'info',
         'profile'                => true, # for scoutprof
         'report_format'          => 'json',
@@ -237,8 +280,13 @@ module ScoutApm
         'uri_reporting'          => 'full_path',
         'remote_agent_host'      => '127.0.0.1',
         'remote_agent_port'      => 7721, # picked at random
+        'remote_agent_socket'    => nil,
         'database_metric_limit'  => 5000, # The hard limit on db metrics
         'database_metric_report_limit' => 1000,
+        'shared_layaway_slots'   => 32,
+        'sql_fingerprint_cache_size' => 500,
+        'stack_profiling'        => false,
+        'stack_profiling_rate'   => 100, # samples per second of CPU time
       }.freeze
 
       def value(key)
@@ -45,6 +45,22 @@ module ScoutApm
       @scope = scope
     end
 
+    # The stats of every query a MergedLayer stands for
+    def self.from_merged_layer(model_name, operation, scope, layer)
+      new(model_name, operation, scope, layer.count, layer.total_call_time, layer.rows_returned).spread_over!(layer)
+    end
+
+    # new treats call_time and rows_returned as a single query's. Take the
+    # min, max and histogram from the MergedLayer's queries instead.
+    def spread_over!(layer)
+      @min_call_time = layer.timing.min_call_time
+      @max_call_time = layer.timing.max_call_time
+      @min_rows_returned = layer.min_rows_returned
+      @max_rows_returned = layer.max_rows_returned
+      @histogram = layer.histogram.dup
+      self
+    end
+
     # Merge data in this scope. Used in DbQueryMetricSet
     def key
       @key ||= [model_name, operation, scope]
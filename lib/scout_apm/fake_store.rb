@@ -32,6 +32,9 @@ module ScoutApm
     def track_slow_job!(job)
     end
 
+    def merge_thread_buffers
+    end
+
     def write_to_layaway(layaway, force=false)
     end
 
@@ -1,7 +1,12 @@
 module ScoutApm
   HistogramBin = Struct.new(:value, :count)
 
-  class NumericHistogram
+  # The pure-Ruby implementation of NumericHistogram. The native extension in
+  # ext/numeric_histogram defines the class directly when it can be loaded,
+  # otherwise NumericHistogram is built from this module below.
+  #
+  # Any change in behavior here must be matched in the native version.
+  module PureNumericHistogram
     # This class should be threadsafe.
     attr_reader :mutex
 
@@ -175,4 +180,16 @@ module ScoutApm
       raise
     end
   end
+
+  # Load the native version if this platform supports it.
+  begin
+    require 'numeric_histogram'
+  rescue LoadError
+  end
+
+  unless defined?(NumericHistogram)
+    class NumericHistogram
+      include PureNumericHistogram
+    end
+  end
 end
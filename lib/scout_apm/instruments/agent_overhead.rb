@@ -0,0 +1,40 @@
+module ScoutApm
+  module Instruments
+    # Reports what ScoutApm::Overhead counted since the last period, as one
+    # Agent/Overhead/<section> metric per section: how often the agent ran it,
+    # and for how long in total.
+    class AgentOverhead
+      attr_reader :logger
+
+      def initialize(logger)
+        @logger = logger
+      end
+
+      def metric_type
+        "Agent"
+      end
+
+      def human_name
+        "Agent Overhead"
+      end
+
+      def metrics(timestamp, store)
+        metrics = {}
+
+        ScoutApm::Overhead.drain.each do |section, (count, total_ns, min_ns, max_ns)|
+          meta = MetricMeta.new("#{metric_type}/Overhead/#{section}")
+          stat = MetricStats.new(false)
+          stat.call_count = count
+          stat.total_call_time = total_ns / ScoutApm::Clock::NANOSECONDS_PER_SECOND
+          stat.total_exclusive_time = stat.total_call_time
+          stat.min_call_time = min_ns / ScoutApm::Clock::NANOSECONDS_PER_SECOND
+          stat.max_call_time = max_ns / ScoutApm::Clock::NANOSECONDS_PER_SECOND
+          metrics[meta] = stat
+        end
+
+        store.track!(metrics, :timestamp => timestamp) if metrics.any?
+        metrics
+      end
+    end
+  end
+end
@@ -11,10 +11,13 @@ module ScoutApm
           @num_processors = [num_processors, 1].compact.max
           @logger = logger
 
-          t = ::Process.times
-          @last_run = Time.now
-          @last_utime = t.utime
-          @last_stime = t.stime
+          # Reused by every run, filled in by Process.rusage_cpu_times
+          @cpu_times = [0.0, 0.0]
+
+          utime, stime = ::Process.rusage_cpu_times(@cpu_times)
+          @last_run = ScoutApm::Clock.monotonic_ns
+          @last_utime = utime
+          @last_stime = stime
         end
 
         def metric_type
@@ -46,17 +49,11 @@ module ScoutApm
         def run
           res = nil
 
-          t = ::Process.times
-          now = Time.now
-          utime = t.utime
-          stime = t.stime
+          utime, stime = ::Process.rusage_cpu_times(@cpu_times)
+          now = ScoutApm::Clock.monotonic_ns
 
-          wall_clock_elapsed  = now - last_run
-          if wall_clock_elapsed < 0
-            save_times(now, utime, stime)
-            logger.info "#{human_name}: Negative time elapsed.  now: #{now}, last_run: #{last_run}, total time: #{wall_clock_elapsed}."
-            return nil
-          end
+          # Monotonic, so this can't go negative when the system clock is adjusted
+          wall_clock_elapsed = ScoutApm::Clock.elapsed(last_run, now)
 
           utime_elapsed   = utime - last_utime
           stime_elapsed   = stime - last_stime
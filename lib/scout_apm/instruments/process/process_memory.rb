@@ -4,13 +4,15 @@ module ScoutApm
       class ProcessMemory
         attr_reader :logger
 
-        # Account for Darwin returning maxrss in bytes and Linux in KB. Used by the slow converters. Doesn't feel like this should go here though...more of a utility.
+        # Account for Darwin returning rss in bytes and Linux in KB. Used by the slow converters. Doesn't feel like this should go here though...more of a utility.
         def self.rss_to_mb(rss)
           rss.to_f/1024/(ScoutApm::Agent.instance.environment.os == 'darwin' ? 1024 : 1)
         end
 
+        # The current resident set size, not the peak, so per-request deltas
+        # can go up and down. Read natively, since this runs for every request.
         def self.rss
-          ::Process.rusage.maxrss
+          ::Process.current_rss
         end
 
         def self.rss_in_mb
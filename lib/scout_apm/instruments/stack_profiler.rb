@@ -0,0 +1,44 @@
+require 'scout_apm/environment'
+
+# Load the native profiler if this platform supports it.
+begin
+  require 'stack_profiler' unless ScoutApm::Environment.instance.ruby_187?
+rescue LoadError
+end
+
+module ScoutApm
+  module Instruments
+    # Samples the Ruby stack of threads running a tracked request, so time
+    # spent in code without an instrument of its own shows up in slow request
+    # traces by method, rather than as opaque controller time. See
+    # ext/stack_profiler for how samples are taken.
+    #
+    # Samples are taken per CPU time, so a request waiting on IO isn't
+    # sampled while it waits - its layers already account for that.
+    class StackProfiler
+      NATIVE = defined?(NativeStackProfiler) ? true : false
+
+      # Samples per second of CPU time. Costs well under 1% of CPU.
+      DEFAULT_RATE = 100
+
+      def self.rate=(hz)
+        return unless NATIVE
+        NativeStackProfiler.interval_us = 1_000_000 / [hz.to_i, 1].max
+      end
+
+      # Starts sampling the current thread. Returns false if it can't, such as
+      # when another profiler owns SIGPROF.
+      def self.start
+        NATIVE && NativeStackProfiler.start
+      end
+
+      # Stops sampling the current thread. Returns nil if it wasn't, otherwise
+      # [[[label, path, line, self, total], ...], samples, dropped]: the top
+      # +limit+ methods by samples with the method on top of the stack (self),
+      # then anywhere on it (total).
+      def self.stop(limit)
+        NATIVE ? NativeStackProfiler.stop(limit) : nil
+      end
+    end
+  end
+end
@@ -1,3 +1,5 @@
+require 'pathname'
+
 # Stores StoreReportingPeriod objects in a per-process file before sending them to the server.
 # Coordinates a single process to collect up all individual files, merge them, then send.
 #
@@ -54,7 +56,7 @@ module ScoutApm
         return false
       end
       filename = file_for(reporting_period.timestamp)
-      layaway_file = LayawayFile.new(filename)
+      layaway_file = LayawayFile.new(filename, native_format?)
       layaway_file.write(reporting_period)
     end
 
@@ -62,6 +64,65 @@ module ScoutApm
     # then yields ReportingPeriods collected up from all the files.
     # If the yield returns truthy, delete the layaway files that made it up.
     def with_claim(timestamp)
+      claim(timestamp) do |files|
+        rps = files.map{ |layaway| LayawayFile.new(layaway).load }.compact
+        yield rps if rps.any?
+        rps.any?
+      end
+    end
+
+    # Like with_claim, but loads the files one at a time, merging each into a
+    # single ReportingPeriod, so only about one period is held in memory no
+    # matter how many processes wrote files. Yields the merged period and the
+    # number of files that went into it.
+    def with_merged_claim(timestamp)
+      claim(timestamp) do |files|
+        merged, count = merge_files(files)
+        yield merged, count if merged
+        !merged.nil?
+      end
+    end
+
+    def delete_files_for(timestamp)
+      all_files_for(timestamp).each { |layaway|
+        ScoutApm::Agent.instance.logger.debug("Deleting layaway file: #{layaway}")
+        File.unlink(layaway)
+      }
+    end
+
+    def delete_stale_files(older_than)
+      all_files_for(:all).
+        map { |filename| timestamp_from_filename(filename) }.
+        compact.
+        uniq.
+        select { |timestamp| timestamp.to_i < older_than.strftime(TIME_FORMAT).to_i }.
+          tap  { |timestamps| ScoutApm::Agent.instance.logger.debug("Deleting stale layaway files with timestamps: #{timestamps.inspect}") }.
+        map    { |timestamp| delete_files_for(timestamp) }
+
+      # Left by processes that died between writing a file and renaming it
+      # into place
+      Dir[glob_pattern(:all, :all).to_s + "*" + LayawayFile::TEMP_SUFFIX].
+        select { |filename| File.mtime(filename) < older_than }.
+        each { |filename|
+          ScoutApm::Agent.instance.logger.debug("Deleting stale layaway temp file: #{filename}")
+          File.unlink(filename)
+        }
+    rescue => e
+      ScoutApm::Agent.instance.logger.debug("Problem deleting stale files: #{e.message}, #{e.backtrace.inspect}")
+    end
+
+    # Whether to write layaway files in the native format. See LayawayFile.
+    def native_format?
+      config.value('layaway_format').to_s.strip.downcase == 'native'
+    end
+
+    private
+
+    # Obtains the reporting lock for +timestamp+ and yields the layaway files
+    # to report. The block returns whether anything was reported, in which
+    # case the files are deleted. Returns false if another process holds the
+    # lock.
+    def claim(timestamp)
       coordinator_file = glob_pattern(timestamp, :coordinator)
 
       begin
@@ -79,10 +140,7 @@ module ScoutApm
             log_layaway_file_information
 
             files = all_files_for(timestamp).reject{|l| l.to_s == coordinator_file.to_s }
-            rps = files.map{ |layaway| LayawayFile.new(layaway).load }.compact
-            if rps.any?
-              yield rps
-
+            if yield(files)
               ScoutApm::Agent.instance.logger.debug("Deleting the now-reported layaway files for #{timestamp.to_s}")
               delete_files_for(timestamp) # also removes the coodinator_file
 
@@ -109,27 +167,28 @@ module ScoutApm
       end
     end
 
-    def delete_files_for(timestamp)
-      all_files_for(timestamp).each { |layaway|
-        ScoutApm::Agent.instance.logger.debug("Deleting layaway file: #{layaway}")
-        File.unlink(layaway)
-      }
-    end
+    # Loads and merges +files+ one at a time. Returns the merged
+    # ReportingPeriod (nil if none could be loaded) and how many went into it.
+    def merge_files(files)
+      merged = nil
+      count = 0
+
+      files.each do |file|
+        rp = LayawayFile.new(file).load
+        next unless rp
+
+        begin
+          merged = merged ? merged.merge(rp) : rp
+          count += 1
+        rescue => e
+          ScoutApm::Agent.instance.logger.debug("Error merging reporting period from #{file}: #{e.message}")
+          ScoutApm::Agent.instance.logger.debug(e.backtrace.inspect)
+        end
+      end
 
-    def delete_stale_files(older_than)
-      all_files_for(:all).
-        map { |filename| timestamp_from_filename(filename) }.
-        compact.
-        uniq.
-        select { |timestamp| timestamp.to_i < older_than.strftime(TIME_FORMAT).to_i }.
-          tap  { |timestamps| ScoutApm::Agent.instance.logger.debug("Deleting stale layaway files with timestamps: #{timestamps.inspect}") }.
-        map    { |timestamp| delete_files_for(timestamp) }
-    rescue => e
-      ScoutApm::Agent.instance.logger.debug("Problem deleting stale files: #{e.message}, #{e.backtrace.inspect}")
+      [merged, count]
     end
 
-    private
-
     ##########################################
     # Looking up files
 
@@ -1,39 +1,88 @@
+# Load the native format if this platform supports it.
+begin
+  require 'layaway_format' unless ScoutApm::Environment.instance.ruby_187?
+rescue LoadError
+end
+
 # A single layaway file.  See Layaway for the management of the group of files.
+#
+# Files in the binary format from ext/layaway_format are read whenever the
+# extension is available, as are files written with Marshal. They are only
+# written in it when asked (layaway_format: native), and Marshal otherwise:
+# agents older than the format can't read it, so while a rolling deploy has
+# both running, the old processes would drop the new processes' periods.
+#
+# The native loader maps the file, so a file must never be truncated while
+# the reporting process could be reading it: that would kill it with SIGBUS.
+# Files are written to a temporary file first and renamed into place, which
+# leaves any reader with the old, intact file.
 module ScoutApm
   class LayawayFile
+    NATIVE = defined?(NativeLayawayFormat) ? true : false
+
+    # Appended to the path of the file being written until it's renamed into
+    # place. See Layaway#delete_stale_files.
+    TEMP_SUFFIX = ".tmp"
+
     attr_reader :path
 
-    def initialize(path)
+    # +native+ writes the binary format rather than Marshal, if the extension
+    # is available.
+    def initialize(path, native = false)
       @path = path
+      @native = native && NATIVE
     end
 
     def load
-      data = File.open(path, "r") { |f| read_raw(f) }
+      mark = ScoutApm::Overhead.mark
+      if NATIVE
+        data = NativeLayawayFormat.load_file(path.to_s)
+        return data if data
+      end
+
+      data = File.open(path, "rb") { |f| read_raw(f) }
       deserialize(data)
     rescue NameError, ArgumentError, TypeError => e
       # Marshal error
       ScoutApm::Agent.instance.logger.info("Unable to load data from Layaway file, resetting.")
       ScoutApm::Agent.instance.logger.debug("#{e.message}, #{e.backtrace.join("\n\t")}")
       nil
+    ensure
+      ScoutApm::Overhead.record(ScoutApm::Overhead::LAYAWAY_LOAD, mark)
     end
 
     def write(data)
       serialized_data = serialize(data)
-      File.open(path, "w") { |f| write_raw(f, serialized_data) }
+      temp_path = "#{path}.#{Process.pid}#{TEMP_SUFFIX}"
+      File.open(temp_path, "wb") { |f| write_raw(f, serialized_data) }
+      File.rename(temp_path, path)
+      renamed = true
+      nil
+    ensure
+      File.unlink(temp_path) if temp_path && !renamed && File.exist?(temp_path)
     end
 
     def serialize(data)
-      Marshal.dump(data)
+      if @native && data.is_a?(StoreReportingPeriod)
+        NativeLayawayFormat.dump(data)
+      else
+        Marshal.dump(data)
+      end
     end
 
     def deserialize(data)
+      if NATIVE
+        loaded = NativeLayawayFormat.load(data)
+        return loaded if loaded
+      end
       Marshal.load(data)
     end
 
     def read_raw(f)
       contents = ""
+      buffer = ""
       while true
-        contents << f.read_nonblock(10_000)
+        contents << f.read_nonblock(64_000, buffer)
       end
     rescue Errno::EAGAIN, Errno::EINTR
       IO.select([f])
@@ -53,4 +102,3 @@ module ScoutApm
     end
   end
 end
-
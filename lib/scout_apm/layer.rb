@@ -13,20 +13,9 @@ module ScoutApm
     #   instrumentation for an example of how this is useful
     attr_accessor :name
 
-    # An array of children layers
-    # For instance, if we are in a middleware, there will likely be only a single
-    # child, which is another middleware.  In a Controller, we may have a handful
-    # of children: [ActiveRecord, ActiveRecord, View, HTTP Call].
-    #
-    # This useful to get actual time spent in this layer vs. children time
-    #
-    # TODO: Check callers for compatibility w/ nil to avoid making an empty array
-    def children
-      @children || LayerChildrenSet.new
-    end
-
-    # Time objects recording the start & stop times of this layer
-    attr_reader :start_time, :stop_time
+    # Monotonic clock readings (see ScoutApm::Clock) of the start & stop of
+    # this layer. Use start_time & stop_time when a Time is needed.
+    attr_reader :start_ns, :stop_ns
 
     # The description of this layer.  Will contain additional details specific to the type of layer.
     # For an ActiveRecord metric, it will contain the SQL run
@@ -46,17 +35,25 @@ module ScoutApm
     # If no annotations are ever set, this will return nil
     attr_reader :annotations
 
+    # Seconds of CPU time the thread used during this layer. Only recorded on
+    # the root layer of a request, nil otherwise or if the platform can't
+    # measure per-thread CPU time.
+    attr_reader :cpu_time
+
     BACKTRACE_CALLER_LIMIT = 50 # maximum number of lines to send thru for backtrace analysis
 
-    def initialize(type, name, start_time = Time.now)
+    def initialize(type, name, start_ns = ScoutApm::Clock.monotonic_ns)
       @type = type
       @name = name
-      @start_time = start_time
-      @allocations_start = ScoutApm::Instruments::Allocations.count
-      @allocations_stop = 0
+      @start_ns = start_ns
+      @stop_ns = nil
+      @span = ScoutApm::Instruments::Allocations.span
+      @allocations = nil
+      @gc_time = nil
+      @gc_count = nil
+      @cpu_time = nil
 
       # initialize these only on first use
-      @children = nil
       @annotations = nil
       @desc = nil
     end
@@ -65,18 +62,30 @@ module ScoutApm
       false
     end
 
-    def add_child(child)
-      @children ||= LayerChildrenSet.new
-      @children << child
+    def record_stop_time!(stop_ns = ScoutApm::Clock.monotonic_ns)
+      @stop_ns = stop_ns
+    end
+
+    # Wall time of the start of this layer. Builds a new Time; only call this
+    # when reporting, never to measure.
+    def start_time
+      ScoutApm::Clock.to_time(@start_ns)
     end
 
-    def record_stop_time!(stop_time = Time.now)
-      @stop_time = stop_time
+    # Wall time of the end of this layer, or nil if it hasn't stopped.
+    def stop_time
+      @stop_ns && ScoutApm::Clock.to_time(@stop_ns)
     end
 
-    # Fetch the current number of allocated objects. This will always increment - we fetch when initializing and when stopping the layer.
-    def record_allocations!
-      @allocations_stop = ScoutApm::Instruments::Allocations.count
+    # Fetch the number of objects allocated, and the GC count and time on this
+    # thread, since this layer was initialized. One native call reads all
+    # three, see Allocations.span.
+    def record_allocations_and_gc!
+      @allocations, @gc_count, @gc_time = ScoutApm::Instruments::Allocations.span_delta!(@span)
+    end
+
+    def record_cpu_time!(cpu_time)
+      @cpu_time = cpu_time
     end
 
     def desc=(desc)
@@ -105,7 +114,19 @@ module ScoutApm
     end
 
     def capture_backtrace!
-      @backtrace = caller_array
+      mark = ScoutApm::Overhead.mark
+      if @backtrace = ScoutApm::Utils::BacktraceParser.capture(2, BACKTRACE_CALLER_LIMIT)
+        @backtrace_parsed = true
+      else
+        @backtrace = caller_array
+      end
+      ScoutApm::Overhead.record(ScoutApm::Overhead::BACKTRACE_CAPTURE, mark)
+    end
+
+    # True if +backtrace+ is already reduced to app frames by
+    # BacktraceParser.capture, rather than being the raw caller array.
+    def backtrace_parsed?
+      @backtrace_parsed
     end
 
     # In Ruby 2.0+, we can pass the range directly to the caller to reduce the memory footprint.
@@ -127,39 +148,29 @@ module ScoutApm
       name_clause = "#{type}/#{name}"
 
       total_string = total_call_time == 0 ? nil : "Total: #{total_call_time}"
-      self_string = total_exclusive_time == 0 ? nil : "Self: #{total_exclusive_time}"
-      timing_string = [total_string, self_string].compact.join(", ")
 
-      time_clause = "(Start: #{start_time.iso8601} / Stop: #{stop_time.try(:iso8601)} [#{timing_string}])"
+      time_clause = "(Start: #{start_time.iso8601} / Stop: #{stop_time.try(:iso8601)} [#{total_string}])"
       desc_clause = "Description: #{desc.inspect}"
-      children_clause = "Children: #{children.length}"
 
-      "<Layer: #{name_clause} #{time_clause} #{desc_clause} #{children_clause}>"
+      "<Layer: #{name_clause} #{time_clause} #{desc_clause}>"
     end
 
     ######################################
     # Time Calculations
     ######################################
 
+    # A Layer doesn't know its children: they're recorded in the request's
+    # LayerArena, which works out exclusive times and allocations. See
+    # ArenaLayer.
+
     def total_call_time
-      if stop_time
-        stop_time - start_time
+      if @stop_ns
+        ScoutApm::Clock.elapsed(@start_ns, @stop_ns)
       else
-        Time.now - start_time
+        ScoutApm::Clock.elapsed(@start_ns)
       end
     end
 
-    def total_exclusive_time
-      total_call_time - child_time
-    end
-
-    def child_time
-      children.
-        map { |child| child.total_call_time }.
-        inject(0) { |sum, time| sum + time }
-    end
-    private :child_time
-
     ######################################
     # Allocation Calculations
     ######################################
@@ -167,23 +178,27 @@ module ScoutApm
     # These are almost identical to the timing metrics.
 
     def total_allocations
-      if @allocations_stop > 0
-        allocations = (@allocations_stop - @allocations_start)
-      else
-        allocations = (ScoutApm::Instruments::Allocations.count - @allocations_start)
-      end
-      allocations < 0 ? 0 : allocations
+      @allocations || running_span[0]
+    end
+
+    ######################################
+    # GC Calculations
+    ######################################
+
+    # Seconds spent in GC while this layer (including its children) ran.
+    def total_gc_time
+      @gc_time || running_span[2]
     end
 
-    def total_exclusive_allocations
-      total_allocations - child_allocations
+    # Number of GCs started while this layer (including its children) ran.
+    def total_gc_count
+      @gc_count || running_span[1]
     end
 
-    def child_allocations
-      children.
-        map { |child| child.total_allocations }.
-        inject(0) { |sum, obj| sum + obj }
+    # The span's deltas so far, for a layer that's still running
+    def running_span
+      ScoutApm::Instruments::Allocations.span_delta!(@span.dup)
     end
-    private :child_allocations
+    private :running_span
   end
 end
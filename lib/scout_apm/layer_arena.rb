@@ -0,0 +1,202 @@
+module ScoutApm
+  # The layers of one TrackedRequest, kept as records rather than as a tree of
+  # Layer objects. A Layer object only lives while its layer runs: as it
+  # starts it gets a record, numbered in the order layers start, and once it
+  # stops everything converters read of it is copied into that record.
+  #
+  # The numbers - times, allocations, GC, parent, flags - are LayerRecords,
+  # one native buffer per field. The Ruby values - names, descs, annotations
+  # and backtraces - are kept in Arrays alongside, indexed by record number,
+  # and types are interned to ids. Since layers start in the order the tree
+  # is walked depth first, a record's children and their children follow it
+  # directly.
+  #
+  # Converters read records through an ArenaLayer, which walkers move along
+  # the records rather than creating an object per layer. See
+  # LayerConverters::DepthFirstWalker.
+  #
+  # The request drops the whole arena at once once it's recorded.
+  class LayerArena
+    # The numeric fields of the records
+    attr_reader :records
+
+    # Seconds of CPU time the request's thread used, reported on the root
+    # layer. See Layer#cpu_time.
+    attr_accessor :cpu_time
+
+    def initialize(unique_cutoff = LayerChildrenSet::DEFAULT_UNIQUE_CUTOFF, merge_after = LayerChildrenSet::DEFAULT_MERGE_AFTER)
+      @records = LayerRecords.new
+      @types = []
+      @type_ids = {}
+      @names = []
+      @descs = []
+      @annotations = []
+      @backtraces = {} # record => backtrace, for the few layers with one
+      @objects = {} # record => the MergedLayer or LimitedLayer reported in its place
+      @children = {} # running layer's record => its LayerChildrenSet
+      @unique_cutoff = unique_cutoff
+      @merge_after = merge_after
+      @cpu_time = nil
+    end
+
+    ######################################
+    # Recording layers
+    ######################################
+
+    # Adds a record for +layer+, which has just started, under the record
+    # numbered +parent+ (nil for the root). Returns the new record's number.
+    def open(layer, parent)
+      @records.open(type_id(layer.type), parent, layer.start_ns)
+    end
+
+    # Records +layer+'s stop time, allocations and GC, once it has stopped.
+    # Its exclusive time can be read from then on.
+    def stop(index, layer)
+      @records.stop(index, layer.stop_ns, layer.total_allocations, layer.total_gc_count, layer.total_gc_time)
+    end
+
+    # Copies the rest of +layer+ into its record once it's complete, backtrace
+    # included, then adds the record to its parent's children, which may fold
+    # it into a sibling (see LayerChildrenSet). The Layer isn't needed after
+    # this.
+    def close(index, layer)
+      @names[index] = layer.name
+      @descs[index] = layer.desc
+      @annotations[index] = layer.annotations
+      if layer.backtrace
+        @backtraces[index] = layer.backtrace
+        @records.flag!(index, LayerRecords::BACKTRACE_PARSED) if layer.backtrace_parsed?
+      end
+      @records.flag!(index, LayerRecords::SUBSCOPABLE) if layer.subscopable?
+
+      @children.delete(index)
+      if parent = @records.parent(index)
+        @children[parent] ||= LayerChildrenSet.new(self, parent, @unique_cutoff, @merge_after)
+        @children[parent] << index
+      end
+    end
+
+    # Drops the record numbered +index+ and everything after it: the record
+    # of the layer that just closed, and its children.
+    def truncate(index)
+      @records.truncate(index)
+      [@names, @descs, @annotations].each do |column|
+        column.pop while column.size > index
+      end
+      @backtraces.delete_if { |i, _| i >= index } unless @backtraces.empty?
+      @objects.delete_if { |i, _| i >= index } unless @objects.empty?
+    end
+
+    # Reports +object+ (a MergedLayer or LimitedLayer) in place of the record
+    # numbered +index+
+    def replace(index, object)
+      @objects[index] = object
+    end
+
+    # Adds a record under +parent+ for +object+ (a LimitedLayer), which
+    # reports it
+    def push(object, parent)
+      index = @records.open(type_id(object.type), parent, 0)
+      @objects[index] = object
+      index
+    end
+
+    ######################################
+    # Reading records
+    ######################################
+
+    def size
+      @records.size
+    end
+
+    def empty?
+      size == 0
+    end
+
+    def type(index)
+      @types[@records.type_id(index)]
+    end
+
+    def name(index)
+      @names[index]
+    end
+
+    def desc(index)
+      @descs[index]
+    end
+
+    def annotations(index)
+      @annotations[index]
+    end
+
+    def backtrace(index)
+      @backtraces[index]
+    end
+
+    def parent(index)
+      @records.parent(index)
+    end
+
+    # True if the record has no children. Only a record's children follow it
+    # while it's the last one open, so this holds for a record just closed.
+    def childless?(index)
+      index == size - 1
+    end
+
+    # The layer of the record numbered +index+, as a new ArenaLayer unless a
+    # MergedLayer or LimitedLayer is reported in its place.
+    def layer(index)
+      @objects[index] || ArenaLayer.new(self, index)
+    end
+
+    # Like layer, but moves +cursor+ (an ArenaLayer) to the record, rather than
+    # creating a new one.
+    def layer_at(index, cursor)
+      @objects[index] || cursor.move_to(index)
+    end
+
+    def root
+      layer(0) unless empty?
+    end
+
+    # The layers with parent +index+, in the order they started
+    def children(index)
+      layers = []
+      i = index + 1
+      while i < size && (parent = @records.parent(i)) && parent >= index
+        layers << layer(i) if parent == index
+        i += 1
+      end
+      layers
+    end
+
+    # The first layer, depth first, of any of +types+, or nil
+    def find(types)
+      ids = types.map { |type| @type_ids[type] }.compact
+      return nil if ids.empty?
+
+      index = @records.index_of_type(ids)
+      index && layer(index)
+    end
+
+    # Frees the records at once, rather than whenever the arena is collected
+    def clear
+      @records.clear
+      @names = []
+      @descs = []
+      @annotations = []
+      @backtraces = {}
+      @objects = {}
+      @children = {}
+    end
+
+    private
+
+    def type_id(type)
+      @type_ids[type] ||= begin
+                            @types << type
+                            @types.size - 1
+                          end
+    end
+  end
+end
@@ -1,6 +1,6 @@
 module ScoutApm
-  # A set of children records for any given Layer.  This implements some
-  # rate-limiting logic.
+  # The children records of a running layer, in its request's LayerArena.
+  # This implements some rate-limiting logic, as each child closes.
   #
   # We store the first `unique_cutoff` count of each layer type. So if cutoff
   # is 1000, we'd store 1000 HTTP layers, and 1000 ActiveRecord calls, and 1000
@@ -10,63 +10,99 @@ module ScoutApm
   # counts, without any detail about the SQL called)
   #
   # When the set of children is small, keep them unique
+  # When the set of children gets larger, merge them without data loss
   # When the set of children gets large enough, stop keeping details
   #
-  # The next optimization, which is not yet implemented:
-  #   when the set of children gets larger, attempt to merge them without data loss
+  # Merging: once there are `merge_after` children of a type, each further
+  # childless child with the same name, desc and ignorable flag as an earlier
+  # one is folded into a MergedLayer in that one's place. Only the distinct
+  # call shapes count towards `unique_cutoff`, so an N+1 of one query
+  # takes one slot, however many times it runs.
+  #
+  # A child that's folded into a MergedLayer or LimitedLayer is dropped from
+  # the arena, along with its own children. It's always the last record when
+  # it closes, so this frees its records for the layers that follow.
   class LayerChildrenSet
-    include Enumerable
-
     # By default, how many unique children of a type do we store before
     # flipping over to storing only aggregate info.
     DEFAULT_UNIQUE_CUTOFF = 2000
     attr_reader :unique_cutoff
 
-    # The Set of children objects
-    attr_reader :children
-    private :children
+    # By default, how many children of a type are kept as they are before
+    # identical ones are merged. Below this, working out which are identical
+    # (sanitizing their SQL, say) costs more than it saves.
+    DEFAULT_MERGE_AFTER = 50
+    attr_reader :merge_after
 
-    def initialize(unique_cutoff = DEFAULT_UNIQUE_CUTOFF)
-      @children = Hash.new
+    def initialize(arena, parent, unique_cutoff = DEFAULT_UNIQUE_CUTOFF, merge_after = DEFAULT_MERGE_AFTER)
+      @arena = arena
+      @parent = parent
+      @counts = Hash.new(0) # type => children kept as they are
       @limited_layers = nil # populated when needed
+      @shapes = nil # populated when needed
       @unique_cutoff = unique_cutoff
+      @merge_after = merge_after
     end
 
-    def child_set(metric_type)
-      children[metric_type] = Set.new if !children.has_key?(metric_type)
-      children[metric_type]
-    end
+    # Add the child record numbered +index+, once its layer has closed. Only
+    # add completed layers - otherwise this will collect up incorrect info
+    # into the created LimitedLayer, since it will "freeze" any current data
+    # for total_call_time and similar methods.
+    def <<(index)
+      metric_type = @arena.type(index)
+      kept = @counts[metric_type]
+
+      if kept >= merge_after && (key = merge_key(index))
+        shapes = shapes_for(metric_type)
 
-    # Add a new layer into this set
-    # Only add completed layers - otherwise this will collect up incorrect info
-    # into the created LimitedLayer, since it will "freeze" any current data for
-    # total_call_time and similar methods.
-    def <<(child)
-      metric_type = child.type
-      set = child_set(metric_type)
+        if i = shapes[key]
+          # the same call as an earlier child, merge it into that one
+          merged = @arena.layer(i)
+          merged = @arena.replace(i, MergedLayer.new(merged)) unless MergedLayer === merged
+          fold(merged, index)
+          return
+        end
+      end
 
-      if set.size >= unique_cutoff
+      if kept >= unique_cutoff
         # find limited_layer
         @limited_layers || init_limited_layers
-        @limited_layers[metric_type].absorb(child)
+        limited_layer = @limited_layers[metric_type]
+        fold(limited_layer, index)
+        @arena.push(limited_layer, @parent) if limited_layer.count == 1
       else
-        # we have space just add it
-        set << child
+        # we have space just keep it
+        shapes[key] = index if key
+        @counts[metric_type] = kept + 1
       end
     end
 
-    def each
-      children.each do |_type, set|
-        set.each do |child_layer|
-          yield child_layer
-        end
-      end
+    private
 
-      if @limited_layers
-        @limited_layers.each do |_type, limited_layer|
-          yield limited_layer
-        end
-      end
+    # Absorbs the child into +layer+, and drops its records. Neither kind of
+    # layer keeps what it absorbs, so one ArenaLayer reads every child.
+    def fold(layer, index)
+      @cursor ||= ArenaLayer.new(@arena, index)
+      layer.absorb(@cursor.move_to(index))
+      @arena.truncate(index)
+    end
+
+    # What makes two children the same call. Only plain childless layers are
+    # merged, nil for anything else.
+    def merge_key(index)
+      return nil unless @arena.childless?(index)
+      return nil if @arena.records.flag?(index, LayerRecords::SUBSCOPABLE)
+
+      desc = @arena.desc(index)
+      annotations = @arena.annotations(index)
+      ignorable = annotations && annotations[:ignorable]
+      [@arena.name(index).to_s, desc && desc.to_s, ignorable]
+    end
+
+    # type => { merge_key => record number of the child }
+    def shapes_for(metric_type)
+      @shapes ||= Hash.new
+      @shapes[metric_type] ||= Hash.new
     end
 
     # hold off initializing this until we know we need it
@@ -3,9 +3,9 @@ module ScoutApm
     class AllocationMetricConverter < ConverterBase
       def record!
         return unless scope_layer
-        return unless ScoutApm::Instruments::Allocations::ENABLED
+        return unless ScoutApm::Instruments::Allocations.enabled?
 
-        meta = MetricMeta.new("ObjectAllocations", {:scope => scope_layer.legacy_metric_name})
+        meta = MetricMeta.intern("ObjectAllocations", scope_layer.legacy_metric_name)
         stat = MetricStats.new
         stat.update!(root_layer.total_allocations)
 
@@ -20,6 +20,17 @@ module ScoutApm
         layer_finder.scope
       end
 
+      # The ScoutApm::Overhead section this converter's record! is counted in
+      def self.overhead_slot
+        @overhead_slot ||= ScoutApm::Overhead.slot("LayerConverter/#{name.split('::').last}")
+      end
+
+      # Called with the walker shared by every converter of a request, which
+      # walks the layer tree once. Converters that need to see each layer add
+      # their blocks here; the rest have nothing to do until record!.
+      def register_hooks(walker)
+      end
+
       ################################################################################
       # Subscoping
       ################################################################################
@@ -27,12 +38,16 @@ module ScoutApm
       # Keep a list of subscopes, but only ever use the front one.  The rest
       # get pushed/popped in cases when we have many levels of subscopable
       # layers.  This lets us push/pop without otherwise keeping track very closely.
-      def register_hooks(walker)
+      #
+      # Only the metrics of traces are subscoped, so only their walks need
+      # these hooks. The walker moves the layer it hands out along the
+      # request's records, so a subscope is kept as a copy.
+      def register_subscope_hooks(walker)
         @subscope_layers = []
 
         walker.before do |layer|
           if layer.subscopable?
-            @subscope_layers.push(layer)
+            @subscope_layers.push(layer.dup)
           end
         end
 
@@ -72,7 +87,11 @@ module ScoutApm
       def store_backtrace(layer, meta)
         return unless layer.backtrace
 
-        bt = ScoutApm::Utils::BacktraceParser.new(layer.backtrace).call
+        bt = if layer.backtrace_parsed?
+               layer.backtrace
+             else
+               ScoutApm::Utils::BacktraceParser.new(layer.backtrace).call
+             end
         if bt.any?
           meta.backtrace = bt
           @backtraces << meta
@@ -174,11 +193,11 @@ module ScoutApm
 
         # timing
         stat = metric_hash[meta]
-        stat.update!(layer.total_call_time, layer.total_exclusive_time)
+        update_timing!(stat, layer)
 
         # allocations
         stat = allocation_metric_hash[meta]
-        stat.update!(layer.total_allocations, layer.total_exclusive_allocations)
+        update_allocations!(stat, layer)
 
         if LimitedLayer === layer
           metric_hash[meta].call_count = layer.count
@@ -188,18 +207,36 @@ module ScoutApm
 
       # Merged Metric - no specifics, just sum up by type (ActiveRecord, View, HTTP, etc)
       def store_aggregate_metric(layer, metric_hash, allocation_metric_hash)
-          meta = MetricMeta.new("#{layer.type}/all")
+          meta = MetricMeta.intern("#{layer.type}/all")
 
           metric_hash[meta] ||= MetricStats.new(false)
           allocation_metric_hash[meta] ||= MetricStats.new(false)
 
           # timing
           stat = metric_hash[meta]
-          stat.update!(layer.total_call_time, layer.total_exclusive_time)
+          update_timing!(stat, layer)
 
           # allocations
           stat = allocation_metric_hash[meta]
+          update_allocations!(stat, layer)
+      end
+
+      # Adds a layer's time into stat. A MergedLayer is added as every call
+      # it stands for.
+      def update_timing!(stat, layer)
+        if MergedLayer === layer
+          stat.combine!(layer.timing)
+        else
+          stat.update!(layer.total_call_time, layer.total_exclusive_time)
+        end
+      end
+
+      def update_allocations!(stat, layer)
+        if MergedLayer === layer
+          stat.combine!(layer.allocations)
+        else
           stat.update!(layer.total_allocations, layer.total_exclusive_allocations)
+        end
       end
 
       ################################################################################
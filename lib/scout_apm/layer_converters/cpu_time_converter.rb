@@ -0,0 +1,18 @@
+module ScoutApm
+  module LayerConverters
+    # Records the CPU time the request's thread used, next to its wall time,
+    # to tell endpoints that burn CPU from those that wait on IO.
+    class CpuTimeConverter < ConverterBase
+      def record!
+        return unless scope_layer
+        return unless root_layer.cpu_time
+
+        meta = MetricMeta.intern("CpuTime", scope_layer.legacy_metric_name)
+        stat = MetricStats.new
+        stat.update!(root_layer.cpu_time)
+
+        @store.track!({ meta => stat })
+      end
+    end
+  end
+end
@@ -11,17 +11,23 @@ module ScoutApm
 
         return unless scope_layer
 
+        scope_name = scope_layer.legacy_metric_name
+
         walker.on do |layer|
           next if skip_layer?(layer)
 
-          stat = DbQueryMetricStats.new(
-            model_name(layer),
-            operation_name(layer),
-            scope_layer.legacy_metric_name, # controller_scope
-            1,                              # count, this is a single query, so 1
-            layer.total_call_time,
-            records_returned(layer)
-          )
+          stat = if MergedLayer === layer
+                   DbQueryMetricStats.from_merged_layer(model_name(layer), operation_name(layer), scope_name, layer)
+                 else
+                   DbQueryMetricStats.new(
+                     model_name(layer),
+                     operation_name(layer),
+                     scope_name,                     # controller_scope
+                     1,                              # count, this is a single query, so 1
+                     layer.total_call_time,
+                     records_returned(layer)
+                   )
+                 end
           @db_query_metric_set << stat
         end
       end
@@ -1,10 +1,10 @@
 module ScoutApm
   module LayerConverters
     class DepthFirstWalker
-      attr_reader :root_layer
+      attr_reader :arena
 
-      def initialize(root_layer)
-        @root_layer = root_layer
+      def initialize(arena)
+        @arena = arena
 
         @on_blocks = []
         @before_blocks = []
@@ -23,26 +23,44 @@ module ScoutApm
         @on_blocks << block
       end
 
-      def walk(layer=root_layer)
-        # Need to run this for the root layer the first time through.
-        if layer == root_layer
-          @before_blocks.each{|b| b.call(layer) }
-          @on_blocks.each{|b| b.call(layer) }
-        end
+      # Walks a request's LayerArena. Its records are already in depth first
+      # order, so this is a loop over them, with a stack of the record numbers
+      # entered but not yet left. Every layer, the root included, gets its
+      # before and on blocks, then its children, then its after blocks.
+      #
+      # The blocks are handed one ArenaLayer, moved from record to record.
+      # See ArenaLayer before holding on to it.
+      def walk
+        return nil if arena.nil?
 
-        layer.children.each do |child|
-          @before_blocks.each{|b| b.call(child) }
-          @on_blocks.each{|b| b.call(child) }
-          walk(child)
-          @after_blocks.each{|b| b.call(child) }
-        end
+        cursor = ArenaLayer.new(arena, 0)
+        open = []
+        size = arena.size
+        i = 0
 
-        if layer == root_layer
-          @after_blocks.each{|b| b.call(layer) }
+        while i < size
+          parent = arena.parent(i)
+          leave(arena.layer_at(open.pop, cursor)) until open.empty? || open.last == parent
+
+          enter(arena.layer_at(i, cursor))
+          open.push(i)
+          i += 1
         end
+        leave(arena.layer_at(open.pop, cursor)) until open.empty?
 
         nil
       end
+
+      private
+
+      def enter(layer)
+        @before_blocks.each{|b| b.call(layer) }
+        @on_blocks.each{|b| b.call(layer) }
+      end
+
+      def leave(layer)
+        @after_blocks.each{|b| b.call(layer) }
+      end
     end
   end
 end
@@ -7,7 +7,7 @@ module ScoutApm
         return unless scope_layer
         return unless request.error?
 
-        meta = MetricMeta.new("Errors/#{scope_layer.legacy_metric_name}", {})
+        meta = MetricMeta.intern("Errors/#{scope_layer.legacy_metric_name}")
         stat = MetricStats.new
         stat.update!(1)
 
@@ -24,10 +24,11 @@ module ScoutApm
         @queue ||= call(["Queue"])
       end
 
+      # The first layer of any of layer_types, depth first. Found from the
+      # type ids in the request's LayerArena, without walking it.
       def call(layer_types)
-        walker = DepthFirstWalker.new(@request.root_layer)
-        walker.on {|l| return l if layer_types.include?(l.type) }
-        walker.walk
+        arena = @request.layer_arena
+        arena && arena.find(layer_types)
       end
     end
   end
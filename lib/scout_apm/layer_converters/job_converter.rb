@@ -30,11 +30,11 @@ module ScoutApm
           # or similar.
           metric_name = layer.type
 
-          meta = MetricMeta.new(metric_name, meta_options)
+          meta = MetricMeta.intern(metric_name, meta_options[:scope])
           @metrics[meta] ||= MetricStats.new( meta_options.has_key?(:scope) )
 
           stat = @metrics[meta]
-          stat.update!(layer.total_call_time, layer.total_exclusive_time)
+          update_timing!(stat, layer)
         end
 
       end
@@ -61,7 +61,7 @@ module ScoutApm
       # walker callbacks
       def add_latency_metric!
         latency = request.annotations[:queue_latency] || 0
-        meta = MetricMeta.new("Latency", meta_options)
+        meta = MetricMeta.intern("Latency", meta_options[:scope])
         stat = MetricStats.new
         stat.update!(latency)
         @metrics[meta] = stat
@@ -15,24 +15,26 @@ module ScoutApm
 
         return unless scope_layer
 
+        scope = scope_layer
+        scope_name = scope.legacy_metric_name
+
         walker.on do |layer|
           next if skip_layer?(layer)
 
-          meta_options = if layer == scope_layer # We don't scope the controller under itself
-                          {}
-                        else
-                          {:scope => scope_layer.legacy_metric_name}
-                        end
+          # We don't scope the controller under itself
+          scoped = layer != scope
 
           # we don't need to use the full metric name for scoped metrics as we only display metrics aggregrated
           # by type.
-          metric_name = meta_options.has_key?(:scope) ? layer.type : layer.legacy_metric_name
-
-          meta = MetricMeta.new(metric_name, meta_options)
-          @metrics[meta] ||= MetricStats.new( meta_options.has_key?(:scope) )
+          meta = if scoped
+                   MetricMeta.intern(layer.type, scope_name)
+                 else
+                   MetricMeta.intern(layer.legacy_metric_name)
+                 end
+          @metrics[meta] ||= MetricStats.new(scoped)
 
           stat = @metrics[meta]
-          stat.update!(layer.total_call_time, layer.total_exclusive_time)
+          update_timing!(stat, layer)
         end
       end
 
@@ -33,7 +33,7 @@ module ScoutApm
         # If we end up with a negative value, just bail out and don't report anything
         return if queue_time < 0
 
-        meta = MetricMeta.new("QueueTime/Request", {:scope => scope_layer.legacy_metric_name})
+        meta = MetricMeta.intern("QueueTime/Request", scope_layer.legacy_metric_name)
         stat = MetricStats.new(true)
         stat.update!(queue_time)
 
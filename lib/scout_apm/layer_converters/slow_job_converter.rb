@@ -36,7 +36,7 @@ module ScoutApm
 
         timing_metrics, allocation_metrics = create_metrics
 
-        unless ScoutApm::Instruments::Allocations::ENABLED
+        unless ScoutApm::Instruments::Allocations.enabled?
           allocation_metrics = {}
         end
 
@@ -58,8 +58,8 @@ module ScoutApm
 
       def create_metrics
         # Create a new walker, and wire up the subscope stuff
-        walker = LayerConverters::DepthFirstWalker.new(self.root_layer)
-        register_hooks(walker)
+        walker = LayerConverters::DepthFirstWalker.new(request.layer_arena)
+        register_subscope_hooks(walker)
 
         metric_hash = Hash.new
         allocation_metric_hash = Hash.new
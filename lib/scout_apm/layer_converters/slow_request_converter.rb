@@ -34,7 +34,7 @@ module ScoutApm
 
         timing_metrics, allocation_metrics = create_metrics
 
-        unless ScoutApm::Instruments::Allocations::ENABLED
+        unless ScoutApm::Instruments::Allocations.enabled?
           allocation_metrics = {}
         end
 
@@ -49,9 +49,49 @@ module ScoutApm
                             mem_delta,
                             root_layer.total_allocations,
                             @points,
-                            limited?)
+                            limited?,
+                            allocation_sites,
+                            root_layer.total_gc_time,
+                            root_layer.total_gc_count,
+                            root_layer.cpu_time,
+                            stack_profile)
       end
 
+      # The request's allocation site profile, if it took one, with paths
+      # under the application root made relative the same way backtraces are.
+      def allocation_sites
+        sites, classes, dropped = request.allocation_sites
+        return nil unless sites
+
+        sites = sites.map do |path, line, owner, count|
+          [relative_app_path(path), line, owner, count]
+        end
+
+        [sites, classes, dropped]
+      end
+
+      # The request's stack profile, if it took one, with paths under the
+      # application root made relative.
+      def stack_profile
+        frames, samples, dropped = request.stack_profile
+        return nil unless frames
+
+        frames = frames.map do |label, path, line, self_count, total_count|
+          [label, relative_app_path(path), line, self_count, total_count]
+        end
+
+        [frames, samples, dropped]
+      end
+
+      # +path+ relative to the application root, as in backtraces, if it's
+      # under the root
+      def relative_app_path(path)
+        root = "#{ScoutApm::Environment.instance.root}/"
+        return path unless path && path.start_with?(root)
+        ScoutApm::Utils::Scm.relative_scm_path(path[root.length..-1])
+      end
+      private :relative_app_path
+
       # Full metrics from this request. These get stored permanently in a SlowTransaction.
       # Some merging of metrics will happen here, so if a request calls the same
       # ActiveRecord or View repeatedly, it'll get merged.
@@ -59,8 +99,8 @@ module ScoutApm
       # This returns a 2-element of Metric Hashes (the first element is timing metrics, the second element is allocation metrics)
       def create_metrics
         # Create a new walker, and wire up the subscope stuff
-        walker = LayerConverters::DepthFirstWalker.new(self.root_layer)
-        register_hooks(walker)
+        walker = LayerConverters::DepthFirstWalker.new(request.layer_arena)
+        register_subscope_hooks(walker)
 
         metric_hash = Hash.new
         allocation_metric_hash = Hash.new
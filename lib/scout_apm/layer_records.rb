@@ -0,0 +1,233 @@
+module ScoutApm
+  # The pure-Ruby implementation of LayerRecords, the numeric half of a
+  # request's LayerArena: one record per layer, numbered in the order the
+  # layers started, kept as a struct of arrays. The native extension in
+  # ext/layer_records defines the class directly when it can be loaded,
+  # otherwise LayerRecords is built from this module below.
+  #
+  # Times are Integer monotonic nanoseconds in, and Float seconds out, as
+  # ScoutApm::Clock.elapsed computes them. A record's times read as 0 until it
+  # has stopped.
+  #
+  # Any change in behavior here must be matched in the native version.
+  module PureLayerRecords
+    SUBSCOPABLE = 1
+    BACKTRACE_PARSED = 2
+    STOPPED = 4
+
+    # Bytes per record in marshal_dump: the type id and parent (l), flags (C),
+    # six 64 bit integers (q) and the GC time (d)
+    RECORD_SIZE = 4 + 4 + 1 + 8 * 7
+
+    def initialize
+      clear
+    end
+
+    ######################################
+    # Writing records
+    ######################################
+
+    # Adds a record for a layer that's just started, under the record
+    # numbered +parent+ (nil for the root). Returns the new record's number.
+    def open(type_id, parent, start_ns)
+      check_index(parent) if parent
+      @type_ids << type_id
+      @parents << parent
+      @flags << 0
+      @start_ns << start_ns
+      @stop_ns << 0
+      @child_ns << 0
+      @allocations << 0
+      @child_allocations << 0
+      @gc_count << 0
+      @gc_time << 0.0
+      @type_ids.size - 1
+    end
+
+    # Fills in a record once its layer has stopped, and adds its time and
+    # allocations to its parent's children.
+    def stop(index, stop_ns, allocations, gc_count, gc_time)
+      check_index(index)
+      @stop_ns[index] = stop_ns
+      @allocations[index] = allocations
+      @gc_count[index] = gc_count
+      @gc_time[index] = gc_time.to_f
+      @flags[index] |= STOPPED
+
+      if parent = @parents[index]
+        @child_ns[parent] += call_ns(index)
+        @child_allocations[parent] += allocations
+      end
+      nil
+    end
+
+    def flag!(index, flag)
+      check_index(index)
+      @flags[index] |= flag
+      nil
+    end
+
+    # Drops every record numbered +len+ and over
+    def truncate(len)
+      columns.each { |column| column.pop while column.size > len } if len >= 0
+      self
+    end
+
+    # Drops every record at once
+    def clear
+      @type_ids = []
+      @parents = []
+      @flags = []
+      @start_ns = []
+      @stop_ns = []
+      @child_ns = []
+      @allocations = []
+      @child_allocations = []
+      @gc_count = []
+      @gc_time = []
+      self
+    end
+
+    ######################################
+    # Reading records
+    ######################################
+
+    def size
+      @type_ids.size
+    end
+
+    def type_id(index)
+      check_index(index)
+      @type_ids[index]
+    end
+
+    def parent(index)
+      check_index(index)
+      @parents[index]
+    end
+
+    def flag?(index, flag)
+      check_index(index)
+      @flags[index] & flag != 0
+    end
+
+    def start_ns(index)
+      check_index(index)
+      @start_ns[index]
+    end
+
+    def stop_ns(index)
+      check_index(index)
+      @flags[index] & STOPPED != 0 ? @stop_ns[index] : nil
+    end
+
+    def total_call_time(index)
+      check_index(index)
+      call_ns(index) / Clock::NANOSECONDS_PER_SECOND
+    end
+
+    def total_exclusive_time(index)
+      check_index(index)
+      (call_ns(index) - @child_ns[index]) / Clock::NANOSECONDS_PER_SECOND
+    end
+
+    def total_allocations(index)
+      check_index(index)
+      @allocations[index]
+    end
+
+    def total_exclusive_allocations(index)
+      check_index(index)
+      @allocations[index] - @child_allocations[index]
+    end
+
+    def total_gc_count(index)
+      check_index(index)
+      @gc_count[index]
+    end
+
+    def total_gc_time(index)
+      check_index(index)
+      @gc_time[index]
+    end
+
+    # The number of the first record whose type id is in +type_ids+, or nil
+    def index_of_type(type_ids)
+      @type_ids.index { |type_id| type_ids.include?(type_id) }
+    end
+
+    ######################################
+    # Marshaling
+    ######################################
+
+    # The record count, then each field in turn, packed as the native
+    # version dumps its buffers.
+    def marshal_dump
+      [size].pack("q") +
+        @type_ids.pack("l*") +
+        @parents.map { |parent| parent || -1 }.pack("l*") +
+        @flags.pack("C*") +
+        @start_ns.pack("q*") +
+        @stop_ns.pack("q*") +
+        @child_ns.pack("q*") +
+        @allocations.pack("q*") +
+        @child_allocations.pack("q*") +
+        @gc_count.pack("q*") +
+        @gc_time.pack("d*")
+    end
+
+    def marshal_load(data)
+      len = data.bytesize >= 8 ? data.unpack("q").first : -1
+      if len < 0 || data.bytesize != 8 + len * RECORD_SIZE
+        raise ArgumentError, "not dumped layer records"
+      end
+      fields = data.unpack("x8 l#{len} l#{len} C#{len} q#{len * 6} d#{len}")
+
+      # Walkers index by parent, so every parent must be an earlier record
+      # (or -1, for none)
+      fields[len, len].each_with_index do |parent, i|
+        if parent < -1 || parent >= i
+          raise ArgumentError, "not dumped layer records: record #{i} has parent #{parent}"
+        end
+      end
+
+      clear
+      @type_ids = fields.shift(len)
+      @parents = fields.shift(len).map { |parent| parent < 0 ? nil : parent }
+      @flags = fields.shift(len)
+      @start_ns = fields.shift(len)
+      @stop_ns = fields.shift(len)
+      @child_ns = fields.shift(len)
+      @allocations = fields.shift(len)
+      @child_allocations = fields.shift(len)
+      @gc_count = fields.shift(len)
+      @gc_time = fields.shift(len)
+    end
+
+    private
+
+    def columns
+      [@type_ids, @parents, @flags, @start_ns, @stop_ns, @child_ns, @allocations, @child_allocations, @gc_count, @gc_time]
+    end
+
+    def call_ns(index)
+      @flags[index] & STOPPED != 0 ? @stop_ns[index] - @start_ns[index] : 0
+    end
+
+    def check_index(index)
+      raise IndexError, "no layer record #{index}" unless index >= 0 && index < size
+    end
+  end
+
+  # Load the native version if this platform supports it.
+  begin
+    require 'layer_records'
+  rescue LoadError
+  end
+
+  unless defined?(LayerRecords)
+    class LayerRecords
+      include PureLayerRecords
+    end
+  end
+end
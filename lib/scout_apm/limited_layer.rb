@@ -14,6 +14,8 @@ module ScoutApm
       @total_exclusive_time = 0
       @total_allocations = 0
       @total_exclusive_allocations = 0
+      @total_gc_time = 0
+      @total_gc_count = 0
       @total_layers = 0
     end
 
@@ -25,6 +27,9 @@ module ScoutApm
 
       @total_allocations += layer.total_allocations
       @total_exclusive_allocations += layer.total_exclusive_allocations
+
+      @total_gc_time += layer.total_gc_time
+      @total_gc_count += layer.total_gc_count
     end
 
     def total_call_time
@@ -43,6 +48,14 @@ module ScoutApm
       @total_exclusive_allocations
     end
 
+    def total_gc_time
+      @total_gc_time
+    end
+
+    def total_gc_count
+      @total_gc_count
+    end
+
     def count
       @total_layers
     end
@@ -55,7 +68,7 @@ module ScoutApm
     end
 
     def children
-      Set.new
+      LayerChildrenSet::EMPTY
     end
 
     def annotations
@@ -85,6 +98,10 @@ module ScoutApm
       nil
     end
 
+    def backtrace_parsed?
+      false
+    end
+
 
     #######################################################################
     #  Many methods don't make any sense on a limited layer. Raise errors  #
@@ -99,8 +116,12 @@ module ScoutApm
       raise "Should never call record_stop_time! on a limited_layer"
     end
 
-    def record_allocations!
-      raise "Should never call record_allocations! on a limited_layer"
+    def record_allocations_and_gc!
+      raise "Should never call record_allocations_and_gc! on a limited_layer"
+    end
+
+    def record_cpu_time!(*)
+      raise "Should never call record_cpu_time! on a limited_layer"
     end
 
     def desc=(*)
@@ -0,0 +1,130 @@
+module ScoutApm
+  # A MergedLayer stands in for several childless sibling layers of the same
+  # type, name and desc - typically an N+1 query. LayerChildrenSet folds them
+  # together as they're added, once a layer has many children of a type. See
+  # LayerChildrenSet for when that happens.
+  #
+  # Unlike a LimitedLayer nothing is lost: the first layer is kept for its
+  # details (name, desc, annotations), along with the first captured
+  # backtrace, and the call count, total/min/max times and allocations of all
+  # of them are summed up as they're absorbed. Converters add a MergedLayer's
+  # stats in with MetricStats#combine!, as if it were each of its layers.
+  class MergedLayer
+    # The first layer merged, whose details this reports
+    attr_reader :layer
+
+    # MetricStats of the calls' times, and of their allocations
+    attr_reader :timing
+    attr_reader :allocations
+
+    # Call times, for DbQueryMetricStats
+    attr_reader :histogram
+
+    attr_reader :total_gc_time
+    attr_reader :total_gc_count
+
+    # Rows returned (the :record_count annotation), summed over the calls
+    attr_reader :rows_returned
+    attr_reader :min_rows_returned
+    attr_reader :max_rows_returned
+
+    def initialize(layer)
+      @layer = layer
+      @timing = MetricStats.new(true)
+      @allocations = MetricStats.new(true)
+      @histogram = NumericHistogram.new(DbQueryMetricStats::DEFAULT_HISTOGRAM_SIZE)
+      @total_gc_time = 0
+      @total_gc_count = 0
+      @rows_returned = 0
+      @min_rows_returned = nil
+      @max_rows_returned = nil
+      @backtrace = nil
+      @backtrace_parsed = false
+
+      absorb(layer)
+    end
+
+    def absorb(layer)
+      @timing.update!(layer.total_call_time, layer.total_exclusive_time)
+      @allocations.update!(layer.total_allocations, layer.total_exclusive_allocations)
+      @histogram.add(layer.total_call_time)
+
+      @total_gc_time += layer.total_gc_time
+      @total_gc_count += layer.total_gc_count
+
+      rows = layer.annotations ? layer.annotations.fetch(:record_count, 0) : 0
+      @rows_returned += rows
+      @min_rows_returned = rows if @min_rows_returned.nil? || rows < @min_rows_returned
+      @max_rows_returned = rows if @max_rows_returned.nil? || rows > @max_rows_returned
+
+      # Copied, since the layers absorbed are dropped (see LayerChildrenSet)
+      if @backtrace.nil? && layer.backtrace
+        @backtrace = layer.backtrace
+        @backtrace_parsed = layer.backtrace_parsed?
+      end
+    end
+
+    def count
+      @timing.call_count
+    end
+
+    def type
+      @layer.type
+    end
+
+    def name
+      @layer.name
+    end
+
+    def desc
+      @layer.desc
+    end
+
+    def annotations
+      @layer.annotations
+    end
+
+    def legacy_metric_name
+      @layer.legacy_metric_name
+    end
+
+    attr_reader :backtrace
+
+    def backtrace_parsed?
+      @backtrace_parsed
+    end
+
+    def total_call_time
+      @timing.total_call_time
+    end
+
+    def total_exclusive_time
+      @timing.total_exclusive_time
+    end
+
+    def total_allocations
+      @allocations.total_call_time
+    end
+
+    def total_exclusive_allocations
+      @allocations.total_exclusive_time
+    end
+
+    # Only childless layers are merged
+    def children
+      LayerChildrenSet::EMPTY
+    end
+
+    def subscopable?
+      false
+    end
+
+    def limited?
+      false
+    end
+
+    def to_s
+      "<MergedLayer #{legacy_metric_name} count=#{count}>"
+    end
+  end
+end
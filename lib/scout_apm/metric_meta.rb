@@ -10,14 +10,82 @@ class MetricMeta
     @desc = options[:desc]
     @extra = {}
   end
-  attr_accessor :metric_id, :metric_name
-  attr_accessor :scope
+  attr_accessor :metric_id
+  attr_reader :metric_name, :scope, :desc
   attr_accessor :client_id
-  attr_accessor :desc, :extra
+  attr_accessor :extra
+
+  # The hash is cached, so changing anything it's computed from resets it.
+  def metric_name=(metric_name)
+    @hash_value = nil
+    @type = nil
+    @metric_name = metric_name
+  end
+
+  def scope=(scope)
+    @hash_value = nil
+    @scope = scope
+  end
+
+  def desc=(desc)
+    @hash_value = nil
+    @desc = desc
+  end
+
+  ######################################
+  # Interning
+  #
+  # Converters build the same handful of metas (ActiveRecord/all scoped to a
+  # controller, ObjectAllocations, CpuTime...) on every request. Interned metas
+  # are built once, frozen, and handed back for every later request, so
+  # tracking them costs an identity compare rather than rehashing and
+  # comparing their strings.
+  #
+  # Only metas without a desc or extras (backtraces, annotations) can be shared
+  # this way; anything else should still be made with new.
+
+  MAX_INTERNED = 10_000
+
+  @interned = {} # scope => { metric_name => meta }
+  @interned_count = 0
+  @intern_lock = Mutex.new
+
+  # Returns the shared, frozen meta for +metric_name+ under +scope+. Once
+  # MAX_INTERNED metas have been interned, returns a new (unshared) meta
+  # instead, so an app with unbounded metric names can't grow the table
+  # forever.
+  def self.intern(metric_name, scope = nil)
+    by_name = @interned[scope]
+    meta = by_name && by_name[metric_name]
+    return meta if meta
+
+    @intern_lock.synchronize do
+      by_name = (@interned[scope] ||= {})
+      meta = by_name[metric_name]
+      return meta if meta
+      return new(metric_name, :scope => scope) if @interned_count >= MAX_INTERNED
+
+      meta = new(metric_name.dup.freeze, :scope => scope && scope.dup.freeze).intern!
+      @interned_count += 1
+      by_name[metric_name] = meta
+    end
+  end
+
+  def self.interned_count
+    @interned_count
+  end
+
+  # For tests
+  def self.clear_interned!
+    @intern_lock.synchronize do
+      @interned.clear
+      @interned_count = 0
+    end
+  end
 
   # Unsure if type or bucket is a better name.
   def type
-    bucket_type
+    @type || bucket_type
   end
 
   def name
@@ -46,15 +114,18 @@ class MetricMeta
     extra[:backtrace]
   end
 
+  # Computed from the strings' bytes rather than String#hash, which is seeded
+  # per process, so a cached value stays correct for metas Marshal loads from
+  # another process's layaway file.
   def hash
-    h = metric_name.downcase.hash
-    h ^= scope.downcase.hash unless scope.nil?
-    h ^= desc.downcase.hash unless desc.nil?
-    h
+    @hash_value || compute_hash
   end
 
   def eql?(o)
+    return true if equal?(o)
+
    self.class             == o.class                &&
+     hash                 == o.hash                 &&
      metric_name.downcase == o.metric_name.downcase &&
      scope                == o.scope                &&
      client_id            == o.client_id            &&
@@ -66,5 +137,24 @@ class MetricMeta
     # query, stack_trace
     ScoutApm::AttributeArranger.call(self, json_attributes)
   end
+
+  # Precomputes the hash and type, then freezes. Used by MetricMeta.intern.
+  def intern!
+    hash
+    @type = bucket_type
+    @extra.freeze
+    freeze
+  end
+
+  private
+
+  def compute_hash
+    key = metric_name.downcase
+    key = "#{key}\0#{scope.downcase}" unless scope.nil?
+    key = "#{key}\1#{desc.downcase}" unless desc.nil?
+    h = Zlib.crc32(key)
+    @hash_value = h unless frozen?
+    h
+  end
 end
 end
@@ -4,7 +4,7 @@ module ScoutApm
     # Controller, and Percentiles so pass through these metrics directly
     #
     # TODO: Figure out a way to not have this duplicate what's in Samplers, and also on server's ingest
-    PASSTHROUGH_METRICS = ["CPU", "Memory", "Instance", "Controller", "SlowTransaction", "Percentile", "Job"]
+    PASSTHROUGH_METRICS = ["CPU", "Memory", "Instance", "Controller", "SlowTransaction", "Percentile", "Job", "Agent"]
 
     attr_reader :metrics
 
@@ -30,13 +30,13 @@ module ScoutApm
           @metrics[meta].combine!(stat)
 
         if !@combine_in_progress
-          agg_meta = MetricMeta.new("Errors/Request", :scope => meta.scope)
+          agg_meta = MetricMeta.intern("Errors/Request", meta.scope)
           @metrics[agg_meta] ||= MetricStats.new
           @metrics[agg_meta].combine!(stat)
         end
 
       else # Combine down to a single /all key
-        agg_meta = MetricMeta.new("#{meta.type}/all", :scope => meta.scope)
+        agg_meta = MetricMeta.intern("#{meta.type}/all", meta.scope)
         @metrics[agg_meta] ||= MetricStats.new
         @metrics[agg_meta].combine!(stat)
       end
@@ -0,0 +1,104 @@
+module ScoutApm
+  # Counts and times the agent's own work on its hot paths, so what the agent
+  # costs an app shows up next to the app's own metrics. Instruments::
+  # AgentOverhead reports each section as an Agent/Overhead/<section> metric.
+  #
+  # A section is a slot number, registered once with +slot+. Timing one is a
+  # Clock reading at the start, and +record+ at the end:
+  #
+  #   mark = Overhead.mark
+  #   ...
+  #   Overhead.record(Overhead::LAYAWAY_WRITE, mark)
+  #
+  # The counters live in ext/allocations when it's available, so recording
+  # doesn't allocate. Otherwise they're kept here, behind a Mutex.
+  module Overhead
+    NATIVE = defined?(NativeOverhead) ? true : false
+
+    MAX_SLOTS = NATIVE ? NativeOverhead::SLOTS : 64
+
+    @lock = Mutex.new
+    @names = []
+    @stats = []
+
+    # The slot for the section +name+, registering it on first use. Sections
+    # past MAX_SLOTS share the last slot.
+    def self.slot(name)
+      @lock.synchronize do
+        index = @names.index(name)
+        return index if index
+        return MAX_SLOTS - 1 if @names.size >= MAX_SLOTS
+
+        @names << name
+        @names.size - 1
+      end
+    end
+
+    def self.names
+      @names
+    end
+
+    def self.mark
+      Clock.monotonic_ns
+    end
+
+    # Charges the time since +mark+ to +slot+
+    def self.record(slot, mark)
+      if NATIVE
+        NativeOverhead.record(slot, mark)
+      else
+        elapsed = [Clock.monotonic_ns - mark, 0].max
+        @lock.synchronize do
+          stat = (@stats[slot] ||= [0, 0, nil, 0])
+          stat[0] += 1
+          stat[1] += elapsed
+          stat[2] = elapsed if stat[2].nil? || elapsed < stat[2]
+          stat[3] = elapsed if elapsed > stat[3]
+        end
+      end
+    end
+
+    # Times the block as +slot+. Use mark and record where adding a block
+    # frame would get in the way, such as when capturing a backtrace.
+    def self.measure(slot)
+      mark = self.mark
+      yield
+    ensure
+      record(slot, mark)
+    end
+
+    # Returns {name => [count, total_ns, min_ns, max_ns]} for each section
+    # recorded since the last drain, and starts counting afresh.
+    def self.drain
+      names = @lock.synchronize { @names.dup }
+
+      stats = if NATIVE
+                NativeOverhead.drain(names.size)
+              else
+                @lock.synchronize do
+                  drained = @stats
+                  @stats = []
+                  drained
+                end
+              end
+
+      result = {}
+      names.each_with_index do |name, i|
+        count, total_ns, min_ns, max_ns = stats[i]
+        result[name] = [count, total_ns, min_ns, max_ns] if count && count > 0
+      end
+      result
+    end
+
+    TRACKED_REQUEST_RECORD = slot("TrackedRequest/record")
+    LAYER_WALK             = slot("LayerConverter/walk")
+    SQL_SANITIZE           = slot("SqlSanitizer/to_s")
+    BACKTRACE_CAPTURE      = slot("BacktraceParser/capture")
+    BACKTRACE_PARSE        = slot("BacktraceParser/call")
+    STORE_TRACK            = slot("Store/track")
+    LAYAWAY_WRITE          = slot("Layaway/write")
+    LAYAWAY_LOAD           = slot("Layaway/load")
+    PAYLOAD_SERIALIZE      = slot("Payload/serialize") # including compression
+    PAYLOAD_GZIP           = slot("Payload/gzip")
+  end
+end
@@ -18,6 +18,26 @@ module ScoutApm
       def encode
         Marshal.dump(self)
       end
+
+      # Framing for stream transports (see SocketServer): each encoded
+      # message is preceded by its length, a 32 bit big endian integer.
+      FRAME_HEADER_SIZE = 4
+
+      def self.frame(encoded)
+        [encoded.bytesize].pack("N") << encoded
+      end
+
+      # Removes every complete frame from the front of +buffer+, yielding
+      # each encoded message. A partial frame is left for more bytes.
+      def self.each_frame!(buffer)
+        while buffer.bytesize >= FRAME_HEADER_SIZE
+          length = buffer.unpack("N").first
+          break if buffer.bytesize < FRAME_HEADER_SIZE + length
+
+          frame = buffer.slice!(0, FRAME_HEADER_SIZE + length)
+          yield frame[FRAME_HEADER_SIZE, length]
+        end
+      end
     end
   end
 end
@@ -0,0 +1,118 @@
+# Sends recorded requests to a Remote::SocketServer over a Unix socket, in
+# place of Remote::Recorder's HTTP post per request.
+#
+# Writes are batched group commit style: a request recorded while another
+# thread is writing is appended to the pending buffer, and the writing thread
+# sends it along with anything else that queued up, in one write. The socket
+# is opened lazily and reopened after a fork, so the parent's connection is
+# never shared.
+module ScoutApm
+  module Remote
+    class SocketRecorder
+      attr_reader :logger
+      attr_reader :path
+
+      def initialize(path, logger)
+        @path = path
+        @logger = logger
+        @lock = Mutex.new
+        @pending = String.new
+        @writing = false
+        @socket = nil
+        @socket_pid = nil
+      end
+
+      def start
+        # connects on the first record!
+        self
+      end
+
+      def stop
+        flush
+        @lock.synchronize { close_socket }
+      end
+
+      def record!(request)
+        begin
+          # Mark this request as recorded, so the next lookup on this thread, it
+          # can be recreated
+          request.recorded!
+
+          # Only send requests that we actually want. Incidental http &
+          # background thread stuff can just be dropped
+          unless request.job? || request.web?
+            return
+          end
+
+          request.prepare_to_dump!
+          message = ScoutApm::Remote::Message.new('record', 'record!', request)
+          frame = Message.frame(message.encode)
+
+          @lock.synchronize { @pending << frame }
+          flush
+        rescue => e
+          logger.debug "Remote: Error while sending to socket server: #{e.inspect}, #{e.backtrace.join("\n")}"
+        end
+      end
+
+      # Writes the pending buffer, unless another thread already is, in which
+      # case that thread picks up what's been appended when it's done.
+      def flush
+        @lock.synchronize do
+          return if @writing || @pending.empty?
+          @writing = true
+        end
+
+        begin
+          loop do
+            batch = @lock.synchronize { swap_pending unless @pending.empty? }
+            break unless batch
+
+            write(batch)
+          end
+        ensure
+          @lock.synchronize { @writing = false }
+        end
+      end
+
+      private
+
+      def swap_pending
+        batch = @pending
+        @pending = String.new
+        batch
+      end
+
+      # Retries once on a fresh connection, as the server may have restarted
+      # since the last write.
+      def write(batch)
+        attempts = 0
+        begin
+          attempts += 1
+          socket.write(batch)
+        rescue Errno::EPIPE, Errno::ECONNRESET, Errno::ECONNREFUSED, Errno::ENOENT, IOError => e
+          @lock.synchronize { close_socket }
+          retry if attempts < 2
+          logger.debug "Remote: Dropping #{batch.bytesize} bytes, socket server unavailable: #{e.inspect}"
+        end
+      end
+
+      def socket
+        @lock.synchronize do
+          close_socket if @socket_pid != Process.pid
+          @socket ||= begin
+                        @socket_pid = Process.pid
+                        UNIXSocket.new(path)
+                      end
+        end
+      end
+
+      def close_socket
+        # A socket inherited across a fork belongs to the parent; only drop
+        # our reference to it.
+        @socket.close if @socket && @socket_pid == Process.pid && !@socket.closed?
+        @socket = nil
+      end
+    end
+  end
+end
@@ -0,0 +1,145 @@
+# Unix socket server that listens for remote agent reports, the lighter
+# alternative to Remote::Server's HTTP. Clients (Remote::SocketRecorder) send
+# length prefixed frames (see Message.frame), possibly several per write.
+#
+# One thread accepts connections and reads from all of them, cutting the
+# bytes into frames. A second thread decodes each frame and forwards it to the
+# router, so a slow record! never holds up reading.
+module ScoutApm
+  module Remote
+    class SocketServer
+      # Larger than any real TrackedRequest. A bigger length means the stream
+      # is garbled, so the connection is dropped.
+      MAX_FRAME_SIZE = 64 * 1024 * 1024
+
+      READ_SIZE = 64 * 1024
+
+      attr_reader :router
+      attr_reader :path
+      attr_reader :logger
+
+      def initialize(path, router, logger)
+        @router = router
+        @logger = logger
+        @path = path
+        @server = nil
+        @frames = Queue.new
+      end
+
+      def start
+        remove_stale_socket
+        @server = bind
+
+        @reader = Thread.new do
+          begin
+            logger.debug("Remote: Starting Socket Server on #{path}")
+            read_loop
+          rescue IOError
+            # closed by stop
+          rescue => e
+            logger.debug("Remote: Socket Server Exception, #{e}")
+          end
+        end
+
+        @decoder = Thread.new do
+          while frame = @frames.pop
+            begin
+              router.handle(frame)
+            rescue => e
+              logger.debug("Remote: Error handling message, #{e.inspect}")
+            end
+          end
+        end
+
+        self
+      end
+
+      def running?
+        !!(@reader && @reader.alive? && @decoder.alive?)
+      end
+
+      def stop
+        @server.close if @server && !@server.closed?
+        @reader.kill if @reader
+        @decoder.kill if @decoder
+        File.unlink(path) if File.socket?(path)
+      end
+
+      private
+
+      def read_loop
+        buffers = {} # connection => bytes read, not yet framed
+
+        loop do
+          readable, = IO.select([@server] + buffers.keys)
+
+          readable.each do |io|
+            if io == @server
+              accept(buffers)
+            else
+              read(io, buffers)
+            end
+          end
+        end
+      end
+
+      def accept(buffers)
+        connection = @server.accept_nonblock
+        buffers[connection] = String.new
+      rescue IO::WaitReadable, Errno::EINTR
+      end
+
+      def read(connection, buffers)
+        buffer = buffers[connection]
+        buffer << connection.read_nonblock(READ_SIZE)
+
+        Message.each_frame!(buffer) { |frame| @frames << frame }
+
+        if buffer.bytesize >= Message::FRAME_HEADER_SIZE && buffer.unpack("N").first > MAX_FRAME_SIZE
+          logger.debug("Remote: Dropping connection sending a frame of #{buffer.unpack("N").first} bytes")
+          close(connection, buffers)
+        end
+      rescue IO::WaitReadable, Errno::EINTR
+      rescue EOFError, IOError, SystemCallError
+        close(connection, buffers)
+      end
+
+      def close(connection, buffers)
+        buffers.delete(connection)
+        connection.close unless connection.closed?
+      end
+
+      # Every frame is unmarshaled, so only this user may connect. The socket
+      # is bound under a temporary name and renamed into place once it's
+      # private, so it's never reachable with the umask's permissions.
+      def bind
+        temp_path = "#{path}.#{Process.pid}.tmp"
+        File.unlink(temp_path) if File.socket?(temp_path)
+
+        server = UNIXServer.new(temp_path)
+        begin
+          File.chmod(0600, temp_path)
+          File.rename(temp_path, path)
+        rescue
+          server.close
+          File.unlink(temp_path) rescue nil
+          raise
+        end
+        server
+      end
+
+      # A socket file left by a server that's gone would make bind fail. One
+      # that something still answers on belongs to a live server, so leave it.
+      def remove_stale_socket
+        return unless File.socket?(path)
+
+        begin
+          UNIXSocket.new(path).close
+          raise Errno::EADDRINUSE, path
+        rescue Errno::ECONNREFUSED, Errno::ENOENT
+          File.unlink(path) rescue nil
+        end
+      end
+    end
+  end
+end
@@ -33,6 +33,30 @@ module ScoutApm
       post_payload(hosts, payload, headers)
     end
 
+    # Like report, but the payload is whatever the block writes to the io
+    # it's given. With compress_payload, it's compressed as it's written,
+    # so the whole uncompressed payload never has to be held.
+    def report_stream(headers = {})
+      hosts = determine_hosts
+
+      if config.value('compress_payload')
+        original_payload_size = 0
+        payload = compressor.stream do |io|
+          yield io
+          original_payload_size = io.bytes_in
+        end
+        headers.merge!(COMPRESSION_HEADERS)
+
+        ScoutApm::Agent.instance.logger.debug("Original Size: #{original_payload_size} Compressed Size: #{payload.length}")
+      else
+        payload = StringIO.new
+        yield payload
+        payload = payload.string
+      end
+
+      post_payload(hosts, payload, headers)
+    end
+
     def uri(host)
       encoded_app_name = CGI.escape(Environment.instance.application_name)
       key = config.value('key')
@@ -123,13 +147,20 @@ module ScoutApm
       http
     end
 
+    COMPRESSION_HEADERS = { 'Content-Encoding' => 'gzip' }
+
     def compress_payload(payload)
       [
-        ScoutApm::Utils::GzipHelper.new.deflate(payload),
-        { 'Content-Encoding' => 'gzip' }
+        compressor.deflate(payload),
+        COMPRESSION_HEADERS.dup
       ]
     end
 
+    # Kept for the life of the reporter, so its deflate stream is reused.
+    def compressor
+      @compressor ||= ScoutApm::Utils::GzipHelper.new(config.value('compress_payload_level'), config.value('compress_payload_strategy'))
+    end
+
     # Some posts (typically ones under development) bypass the ingestion
     # pipeline and go directly to the webserver. They use direct_host instead
     # of host
@@ -4,13 +4,13 @@
 #   #call to get the storable item
 #   #name to get a unique identifier of the storable
 #   #score to get a numeric score, where higher is better
+#
+# The names are also kept in a min-heap by score, so finding (and evicting)
+# the lowest scored item when the set is full doesn't scan every item.
 module ScoutApm
   class ScoredItemSet
     include Enumerable
 
-    # A number larger than any score we will actually get.
-    ARBITRARILY_LARGE = 100000000
-
     # Without otherwise saying, default the size to this
     DEFAULT_MAX_SIZE = 10
 
@@ -20,6 +20,8 @@ module ScoutApm
     def initialize(max_size = DEFAULT_MAX_SIZE)
       @items = {}
       @max_size = max_size
+      @heap = []       # names, lowest score first
+      @positions = {}  # name => index in @heap
     end
 
     def each
@@ -30,36 +32,35 @@ module ScoutApm
 
     # This function is a large if statement, with a few branches. See inline comments for each branch.
     def <<(new_item)
-      return if new_item.name == :unknown
+      name = new_item.name
+      return if name == :unknown
+      return if name.nil? # Never store a nil name.
 
       # If we have this item in the hash already, compare the new & old ones, and store
       # the new one only if it's higher score.
-      if items.has_key?(new_item.name)
-        if new_item.score > items[new_item.name].first
+      if items.has_key?(name)
+        if new_item.score > items[name].first
           store!(new_item)
+          sift_down(positions[name])
         end
 
 
       # If the set is full, then we have to see if we evict anything to store
       # this one
       elsif full?
-        smallest_name, smallest_score = items.inject([nil, ARBITRARILY_LARGE]) do |(memo_name, memo_score), (name, (stored_score, _))|
-          if stored_score < memo_score
-            [name, stored_score]
-          else
-            [memo_name, memo_score]
-          end
-        end
+        smallest_name = heap.first
 
-        if smallest_score < new_item.score
-          items.delete(smallest_name)
+        if items[smallest_name].first < new_item.score
+          remove_smallest!
           store!(new_item)
+          heap_push(name)
         end
 
 
       # Set isn't full, and we've not seen this new_item, so go ahead and store it.
       else
         store!(new_item)
+        heap_push(name)
       end
     end
 
@@ -77,10 +78,82 @@ module ScoutApm
     end
 
     def store!(new_item)
-      if !new_item.name.nil? # Never store a nil name.
-        items[new_item.name] = [new_item.score, new_item.call]
+      items[new_item.name] = [new_item.score, new_item.call]
+    end
+
+    ######################################
+    # Min-heap of names, ordered by their stored score
+
+    # Sets loaded from layaway files written before the heap existed don't
+    # have one, so build it from the items the first time it's needed.
+    def heap
+      rebuild_heap! if @heap.nil?
+      @heap
+    end
+
+    def positions
+      rebuild_heap! if @positions.nil?
+      @positions
+    end
+
+    def rebuild_heap!
+      @heap = []
+      @positions = {}
+      items.each_key { |name| heap_push(name) }
+    end
+
+    def heap_push(name)
+      heap << name
+      positions[name] = heap.size - 1
+      sift_up(heap.size - 1)
+    end
+
+    def remove_smallest!
+      smallest = heap.first
+      last = heap.pop
+      positions.delete(smallest)
+
+      unless heap.empty?
+        heap[0] = last
+        positions[last] = 0
+        sift_down(0)
+      end
+
+      items.delete(smallest)
+    end
+
+    def score_at(i)
+      items[@heap[i]].first
+    end
+
+    def sift_up(i)
+      while i > 0
+        parent = (i - 1) / 2
+        break if score_at(parent) <= score_at(i)
+        swap(i, parent)
+        i = parent
       end
     end
 
+    def sift_down(i)
+      size = heap.size
+      while true
+        left = 2 * i + 1
+        break if left >= size
+
+        right = left + 1
+        child = (right < size && score_at(right) < score_at(left)) ? right : left
+        break if score_at(i) <= score_at(child)
+
+        swap(i, child)
+        i = child
+      end
+    end
+
+    def swap(a, b)
+      @heap[a], @heap[b] = @heap[b], @heap[a]
+      @positions[@heap[a]] = a
+      @positions[@heap[b]] = b
+    end
   end
 end
@@ -6,26 +6,42 @@ module ScoutApm
         if ScoutApm::Agent.instance.config.value("report_format") == 'json'
           ScoutApm::Serializers::PayloadSerializerToJson.serialize(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
         else
-          metadata = metadata.dup
-          metadata.default = nil
-
-          metrics = metrics.dup
-          metrics.default = nil
-          Marshal.dump(:metadata          => metadata,
-                       :metrics           => metrics,
-                       :slow_transactions => slow_transactions,
-                       :jobs              => jobs,
-                       :slow_jobs         => slow_jobs,
+          Marshal.dump(marshal_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics))
+        end
+      end
 
-                       # as_json returns a ruby object. Since it's not a simple
-                       # array, use this to maintain compatibility with json
-                       # payloads. At this point, the marshal code branch is
-                       # very rarely used anyway.
-                       :histograms        => HistogramsSerializerToJson.new(histograms).as_json,
-                       :db_query_metrics  => db_query_metrics)
+      # Writes the serialized payload to io (anything with #write) as it's
+      # produced. Returns io.
+      def self.serialize_to(io, metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+        if ScoutApm::Agent.instance.config.value("report_format") == 'json'
+          ScoutApm::Serializers::PayloadSerializerToJson.serialize_to(io, metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+        else
+          Marshal.dump(marshal_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics), io)
+          io
         end
       end
 
+      def self.marshal_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+        metadata = metadata.dup
+        metadata.default = nil
+
+        metrics = metrics.dup
+        metrics.default = nil
+
+        {:metadata          => metadata,
+         :metrics           => metrics,
+         :slow_transactions => slow_transactions,
+         :jobs              => jobs,
+         :slow_jobs         => slow_jobs,
+
+         # as_json returns a ruby object. Since it's not a simple
+         # array, use this to maintain compatibility with json
+         # payloads. At this point, the marshal code branch is
+         # very rarely used anyway.
+         :histograms        => HistogramsSerializerToJson.new(histograms).as_json,
+         :db_query_metrics  => db_query_metrics}
+      end
+
       def self.deserialize(data)
         Marshal.load(data)
       end
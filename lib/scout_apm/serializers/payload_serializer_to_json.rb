@@ -1,20 +1,78 @@
+# Load the native encoder if this platform supports it.
+begin
+  require 'json_encoder' unless ScoutApm::Environment.instance.ruby_187?
+rescue LoadError
+end
+
 module ScoutApm
   module Serializers
     module PayloadSerializerToJson
+      # With ext/json_encoder, the payload is written by NativeJsonEncoder,
+      # which produces the same JSON as jsonify_hash below, but reads metrics
+      # and db query metrics directly rather than from their as_json Hashes.
+      NATIVE = defined?(NativeJsonEncoder) ? true : false
+
       class << self
         def serialize(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
           metadata.merge!({:payload_version => 2})
 
-          jsonify_hash({:metadata => metadata,
-                        :metrics => rearrange_the_metrics(metrics),
-                        :slow_transactions => rearrange_the_slow_transactions(slow_transactions),
-                        :jobs => JobsSerializerToJson.new(jobs).as_json,
-                        :slow_jobs => SlowJobsSerializerToJson.new(slow_jobs).as_json,
-                        :histograms => HistogramsSerializerToJson.new(histograms).as_json,
-                        :db_metrics => {
-                          :query => DbQuerySerializerToJson.new(db_query_metrics).as_json,
-                        },
-          })
+          if NATIVE
+            return NativeJsonEncoder.encode(native_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics))
+          end
+
+          jsonify_hash(ruby_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics))
+        end
+
+        # Like serialize, but writes the JSON to io as it goes, rather than
+        # building the whole String. Returns io.
+        def serialize_to(io, metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+          metadata.merge!({:payload_version => 2})
+
+          if NATIVE
+            NativeJsonEncoder.encode(native_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics), io)
+            return io
+          end
+
+          # One top level key at a time, so only that section is ever held uncompressed
+          io.write("{")
+          ruby_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics).each_with_index do |(key, value), i|
+            io.write(",") if i > 0
+            io.write("#{format_by_type(key)}:#{format_by_type(value)}")
+          end
+          io.write("}")
+          io
+        end
+
+        def ruby_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+          {:metadata => metadata,
+           :metrics => rearrange_the_metrics(metrics),
+           :slow_transactions => rearrange_the_slow_transactions(slow_transactions),
+           :jobs => JobsSerializerToJson.new(jobs).as_json,
+           :slow_jobs => SlowJobsSerializerToJson.new(slow_jobs).as_json,
+           :histograms => HistogramsSerializerToJson.new(histograms).as_json,
+           :db_metrics => {
+             :query => DbQuerySerializerToJson.new(db_query_metrics).as_json,
+           },
+          }
+        end
+
+        # The same layout as ruby_payload, with the metrics left for
+        # NativeJsonEncoder to write itself.
+        def native_payload(metadata, metrics, slow_transactions, jobs, slow_jobs, histograms, db_query_metrics)
+          {:metadata => metadata,
+           :metrics => NativeJsonEncoder::Metrics.new(metrics),
+           :slow_transactions => slow_transactions.to_a.map { |t| native_slow_transaction(t) },
+           :jobs => JobsSerializerToJson.new(jobs).as_json,
+           :slow_jobs => SlowJobsSerializerToJson.new(slow_jobs).as_json,
+           :histograms => HistogramsSerializerToJson.new(histograms).as_json,
+           :db_metrics => {
+             :query => db_query_metrics.to_a,
+           },
+          }
+        end
+
+        def native_slow_transaction(slow_t)
+          slow_t.as_json.merge(:metrics => NativeJsonEncoder::Metrics.new(slow_t.metrics), :allocation_metrics => NativeJsonEncoder::Metrics.new(slow_t.allocation_metrics))
         end
 
         # For the old style of metric serializing.
@@ -0,0 +1,121 @@
+require 'zlib'
+
+# An optional Layaway backend (layaway_backend: shared_memory) that passes
+# reporting periods between processes through a shared memory region rather
+# than a file per process.
+#
+# The region is a file in /dev/shm mapped by every process of the app, so
+# nothing touches the disk. Without a writable /dev/shm the agent stays with
+# layaway files rather than put the region on disk. Opening it in a preloading
+# server's master means forked workers inherit the mapping; workers that open
+# it themselves share the same memory all the same.
+#
+# Each process writes its periods into a free slot of the region, and the
+# process that claims a minute reads them back one at a time, merging as it
+# goes. Periods that don't fit, or find no free slot, are written to regular
+# layaway files, which are merged in as well.
+module ScoutApm
+  class SharedLayaway < Layaway
+    # The region is reserved up front, all SLOT_COUNT * SLOT_SIZE of it, so it
+    # has to fit in /dev/shm. The default 32MB leaves room in Docker's 64MB.
+    # Set shared_layaway_slots for apps with more processes.
+    SLOT_COUNT = 32
+    SLOT_SIZE = 1024 * 1024 # Bytes, including a 64 byte slot header
+
+    SHM_DIRECTORY = "/dev/shm"
+
+    attr_reader :region
+
+    # Returns nil (and the caller should stay with file based layaway) if the
+    # shared region isn't available.
+    def self.open(config, environment)
+      return nil unless ScoutApm::LayawayFile::NATIVE
+
+      unless shm_available?
+        ScoutApm::Agent.instance.logger.warn("#{SHM_DIRECTORY} isn't a writable directory, so shared memory layaway isn't available. Using layaway files.")
+        return nil
+      end
+
+      layaway = new(config, environment)
+      layaway.region
+      layaway
+    rescue SystemCallError, ArgumentError => e
+      ScoutApm::Agent.instance.logger.warn("Unable to open shared memory layaway, using layaway files: #{e.message}")
+      ScoutApm::Agent.instance.logger.warn("Free up #{SHM_DIRECTORY}, or lower shared_layaway_slots, to use it") if e.is_a?(Errno::ENOSPC)
+      nil
+    end
+
+    def region
+      @region ||= NativeLayawayFormat::SharedLayaway.new(region_path.to_s, slot_count, SLOT_SIZE)
+    end
+
+    def slot_count
+      count = config.value('shared_layaway_slots').to_i
+      count > 0 ? count : SLOT_COUNT
+    end
+
+    # Where the region lives. One per layaway directory, so apps sharing a
+    # host don't share a region, and per slot count, so changing it doesn't
+    # leave every process unable to open the old region.
+    def region_path
+      Pathname.new(SHM_DIRECTORY) + "scout_apm_#{Zlib.crc32(directory.to_s)}_#{slot_count}.shm"
+    end
+
+    def self.shm_available?
+      File.directory?(SHM_DIRECTORY) && File.writable?(SHM_DIRECTORY)
+    end
+
+    def write_reporting_period(reporting_period, files_limit = MAX_FILES_LIMIT)
+      data = NativeLayawayFormat.dump(reporting_period)
+      return true if region.write(reporting_period.timestamp.timestamp, Process.pid, data)
+
+      ScoutApm::Agent.instance.logger.debug("No room in shared memory layaway (#{data.bytesize} bytes, #{region.stats.inspect}), writing a layaway file")
+      super
+    end
+
+    # Claims +timestamp+ in the shared region, then merges every period
+    # written for it, from the region and from any overflow files.
+    def with_merged_claim(timestamp)
+      return false unless region.claim(timestamp.timestamp)
+
+      ScoutApm::Agent.instance.logger.debug("Obtained shared memory reporting claim")
+
+      merged = nil
+      count = 0
+      each_shared_period(timestamp) do |rp|
+        merged = merged ? merged.merge(rp) : rp
+        count += 1
+      end
+
+      if Dir[glob_pattern(timestamp, :all)].any?
+        super(timestamp) do |file_merged, file_count|
+          merged = merged ? merged.merge(file_merged) : file_merged
+          count += file_count
+        end
+      end
+
+      yield merged, count if merged
+
+      freed = region.sweep((timestamp.to_time - STALE_AGE).to_i)
+      ScoutApm::Agent.instance.logger.debug("Freed #{freed} stale shared memory layaway slots") if freed > 0
+
+      true
+    end
+
+    private
+
+    def each_shared_period(timestamp)
+      while true
+        begin
+          rp = ScoutApm::Overhead.measure(ScoutApm::Overhead::LAYAWAY_LOAD) { region.take(timestamp.timestamp) }
+        rescue NameError, ArgumentError, TypeError => e
+          ScoutApm::Agent.instance.logger.info("Unable to load data from shared memory layaway, skipping it.")
+          ScoutApm::Agent.instance.logger.debug("#{e.message}, #{e.backtrace.join("\n\t")}")
+          next
+        end
+        break unless rp
+        yield rp
+      end
+    end
+  end
+end
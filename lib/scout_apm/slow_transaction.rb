@@ -13,13 +13,18 @@ module ScoutApm
     attr_reader :prof
     attr_reader :mem_delta
     attr_reader :allocations
+    attr_reader :allocation_sites
+    attr_reader :gc_time
+    attr_reader :gc_count
+    attr_reader :cpu_time
+    attr_reader :stack_profile
     attr_accessor :hostname # hack - we need to reset these server side.
     attr_accessor :seconds_since_startup # hack - we need to reset these server side.
     attr_accessor :git_sha # hack - we need to reset these server side.
 
     attr_reader :truncated_metrics # True/False that says if we had to truncate the metrics of this trace
 
-    def initialize(uri, metric_name, total_call_time, metrics, allocation_metrics, context, time, raw_stackprof, mem_delta, allocations, score, truncated_metrics)
+    def initialize(uri, metric_name, total_call_time, metrics, allocation_metrics, context, time, raw_stackprof, mem_delta, allocations, score, truncated_metrics, allocation_sites=nil, gc_time=0, gc_count=0, cpu_time=nil, stack_profile=nil)
       @uri = uri
       @metric_name = metric_name
       @total_call_time = total_call_time
@@ -35,8 +40,13 @@ module ScoutApm
       @score = score
       @git_sha = ScoutApm::Environment.instance.git_revision.sha
       @truncated_metrics = truncated_metrics
+      @allocation_sites = allocation_sites
+      @gc_time = gc_time
+      @gc_count = gc_count
+      @cpu_time = cpu_time
+      @stack_profile = stack_profile
 
-      ScoutApm::Agent.instance.logger.debug { "Slow Request [#{uri}] - Call Time: #{total_call_time} Mem Delta: #{mem_delta} Score: #{score}"}
+      ScoutApm::Agent.instance.logger.debug { "Slow Request [#{uri}] - Call Time: #{total_call_time} Mem Delta: #{mem_delta} GC Time: #{gc_time} Score: #{score}"}
     end
 
     # Used to remove metrics when the payload will be too large.
@@ -59,6 +69,11 @@ module ScoutApm
                          :prof,
                          :mem_delta,
                          :allocations,
+                         :allocation_sites,
+                         :gc_time,
+                         :gc_count,
+                         :cpu_time,
+                         :stack_profile,
                          :seconds_since_startup,
                          :hostname,
                          :git_sha,
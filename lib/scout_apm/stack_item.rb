@@ -1,11 +1,11 @@
 module ScoutApm
   class StackItem
     attr_accessor :children_time
-    attr_reader :metric_name, :start_time
+    attr_reader :metric_name, :start_ns
 
     def initialize(metric_name)
       @metric_name = metric_name
-      @start_time = Time.now
+      @start_ns = ScoutApm::Clock.monotonic_ns
       @children_time = 0
     end
 
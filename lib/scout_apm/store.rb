@@ -3,10 +3,19 @@
 # the layaway file for cross-process aggregation.
 module ScoutApm
   class Store
+    # Thread variables arrived in Ruby 2.0. Older rubies fall back to
+    # Thread#[], which is per fiber on 1.9.
+    THREAD_VARIABLES = Thread.current.respond_to?(:thread_variable_get)
+
     def initialize
       @mutex = Mutex.new
       @reporting_periods = Hash.new { |h,k| h[k] = StoreReportingPeriod.new(k) }
       @samplers = []
+
+      # One StoreThreadBuffer per recording thread, merged into
+      # @reporting_periods when writing to the layaway
+      @thread_buffers = []
+      @thread_buffer_key = :"scout_apm_store_buffer_#{object_id}"
     end
 
     def current_timestamp
@@ -29,28 +38,19 @@ module ScoutApm
 
     # Save newly collected metrics
     def track!(metrics, options={})
-      @mutex.synchronize {
-        period = find_period(options[:timestamp])
-        period.absorb_metrics!(metrics)
-      }
+      track_period(options[:timestamp]) { |period| period.absorb_metrics!(metrics) }
     end
 
     def track_histograms!(histograms, options={})
-      @mutex.synchronize {
-        period = find_period(options[:timestamp])
-        period.merge_histograms!(histograms)
-      }
+      track_period(options[:timestamp]) { |period| period.merge_histograms!(histograms) }
     end
 
     def track_db_query_metrics!(db_query_metric_set, options={})
-      @mutex.synchronize {
-        period = find_period(options[:timestamp])
-        period.merge_db_query_metrics!(db_query_metric_set)
-      }
+      track_period(options[:timestamp]) { |period| period.merge_db_query_metrics!(db_query_metric_set) }
     end
 
     def track_one!(type, name, value, options={})
-      meta = MetricMeta.new("#{type}/#{name}")
+      meta = MetricMeta.intern("#{type}/#{name}")
       stat = MetricStats.new(false)
       stat.update!(value)
       track!({meta => stat}, options)
@@ -59,23 +59,64 @@ module ScoutApm
     # Save a new slow transaction
     def track_slow_transaction!(slow_transaction)
       return unless slow_transaction
-      @mutex.synchronize {
-        current_period.merge_slow_transactions!(slow_transaction)
-      }
+      track_period { |period| period.merge_slow_transactions!(slow_transaction) }
     end
 
     def track_job!(job)
       return if job.nil?
-      @mutex.synchronize {
-        current_period.merge_jobs!(Array(job))
-      }
+      track_period { |period| period.merge_jobs!(Array(job)) }
     end
 
     def track_slow_job!(job)
       return if job.nil?
-      @mutex.synchronize {
-        current_period.merge_slow_jobs!(Array(job))
-      }
+      track_period { |period| period.merge_slow_jobs!(Array(job)) }
+    end
+
+    # Requests are recorded into a buffer owned by the recording thread, so
+    # threads don't contend on the store's mutex per request. Anything for an
+    # explicit timestamp (samplers, run while writing the layaway) goes
+    # straight into the store.
+    def track_period(timestamp = nil)
+      mark = ScoutApm::Overhead.mark
+      if timestamp
+        @mutex.synchronize { yield find_period(timestamp) }
+      else
+        thread_buffer.record(current_timestamp) { |period| yield period }
+      end
+    ensure
+      ScoutApm::Overhead.record(ScoutApm::Overhead::STORE_TRACK, mark)
+    end
+    private :track_period
+
+    # Kept in a thread variable, not Thread#[], which is per fiber: on a
+    # fiber per request server that would be a new buffer for every request,
+    # each kept until its thread exits.
+    def thread_buffer
+      thread = Thread.current
+      buffer = THREAD_VARIABLES ? thread.thread_variable_get(@thread_buffer_key) : thread[@thread_buffer_key]
+      return buffer if buffer
+
+      buffer = StoreThreadBuffer.new(thread)
+      @mutex.synchronize { @thread_buffers << buffer }
+      THREAD_VARIABLES ? thread.thread_variable_set(@thread_buffer_key, buffer) : thread[@thread_buffer_key] = buffer
+      buffer
+    end
+    private :thread_buffer
+
+    # Moves everything the threads have recorded into the store's reporting
+    # periods. Buffers of threads that have exited are dropped once drained.
+    def merge_thread_buffers
+      buffers = @mutex.synchronize { @thread_buffers.dup }
+
+      buffers.each do |buffer|
+        finished = !buffer.thread.alive?
+        periods = buffer.drain
+
+        @mutex.synchronize {
+          periods.each { |timestamp, rp| @reporting_periods[timestamp].merge(rp) }
+          @thread_buffers.delete(buffer) if finished
+        }
+      end
     end
 
     # Take each completed reporting_period, and write it to the layaway passed
@@ -86,6 +127,8 @@ module ScoutApm
     def write_to_layaway(layaway, force=false)
       ScoutApm::Agent.instance.logger.debug("Writing to layaway#{" (Forced)" if force}")
 
+        merge_thread_buffers
+
         @reporting_periods.select { |time, rp| force || (time.timestamp < current_timestamp.timestamp) }.
                           each   { |time, rp| collect_samplers(rp) }.
                           each   { |time, rp| write_reporting_period(layaway, time, rp) }
@@ -93,7 +136,9 @@ module ScoutApm
 
     def write_reporting_period(layaway, time, rp)
       @mutex.synchronize {
-        layaway.write_reporting_period(rp)
+        ScoutApm::Overhead.measure(ScoutApm::Overhead::LAYAWAY_WRITE) {
+          layaway.write_reporting_period(rp)
+        }
       }
     rescue => e
       ScoutApm::Agent.instance.logger.warn("Failed writing data to layaway file: #{e.message} / #{e.backtrace}")
@@ -123,6 +168,35 @@ module ScoutApm
     private :collect_samplers
   end
 
+  # The reporting periods recorded by one thread, not yet merged into the
+  # Store. Only the owning thread records into it, so its lock is only ever
+  # contended by the once-a-period drain.
+  class StoreThreadBuffer
+    attr_reader :thread
+
+    def initialize(thread)
+      @thread = thread
+      @lock = Mutex.new
+      @periods = {}
+    end
+
+    def record(timestamp)
+      @lock.synchronize {
+        yield(@periods[timestamp] ||= StoreReportingPeriod.new(timestamp))
+      }
+    end
+
+    # Returns the recorded {timestamp => StoreReportingPeriod}, leaving the
+    # buffer empty.
+    def drain
+      @lock.synchronize {
+        periods = @periods
+        @periods = {}
+        periods
+      }
+    end
+  end
+
   # A timestamp, normalized to the beginning of a minute. Used as a hash key to
   # bucket metrics into per-minute groups
   class StoreReportingPeriodTimestamp
@@ -1,8 +1,9 @@
 # A TrackedRequest is a stack of layers, where completed layers (go into, then
-# come out of a layer) are forgotten as they finish. Layers are attached to
-# their children as the process goes, building a tree structure within the
-# layer objects. When the last layer is finished (hence the whole request is
-# finished) it hands the root layer off to be recorded.
+# come out of a layer) are forgotten as they finish. Each layer gets a record
+# in the request's LayerArena as it starts, under its parent's, building a
+# tree structure within the arena, and copies itself there as it finishes.
+# When the last layer is finished (hence the whole request is finished) it
+# hands the arena off to be recorded.
 
 module ScoutApm
   class TrackedRequest
@@ -13,9 +14,13 @@ module ScoutApm
     attr_reader :context
 
     # The first layer registered with this request. All other layers will be
-    # children of this layer.
+    # children of this layer. Read from the arena once the request has
+    # stopped, see ArenaLayer.
     attr_reader :root_layer
 
+    # The records of this request's layers, see LayerArena
+    attr_reader :layer_arena
+
     # As we go through a request, instrumentation can mark more general data into the Request
     # Known Keys:
     #   :uri - the full URI requested by the user
@@ -45,9 +50,25 @@ module ScoutApm
     # An object that responds to `record!(TrackedRequest)` to store this tracked request
     attr_reader :recorder
 
+    # The top allocating sites and classes of this request, as returned by
+    # Allocations.stop_site_profile. Only captured with allocation_site_profiling on.
+    attr_reader :allocation_sites
+
+    # How many sites and classes to keep from an allocation site profile
+    ALLOCATION_SITES_LIMIT = 20
+
+    # The methods most often sampled running during this request, as returned
+    # by StackProfiler.stop. Only captured with stack_profiling on.
+    attr_reader :stack_profile
+
+    # How many methods to keep from a stack profile
+    STACK_PROFILE_LIMIT = 50
+
     def initialize(store)
       @store = store #this is passed in so we can use a real store (normal operation) or fake store (instant mode only)
       @layers = []
+      @open_records = [] # the arena's record number of each layer in @layers
+      @layer_arena = LayerArena.new
       @call_set = Hash.new { |h, k| h[k] = CallSet.new }
       @annotations = {}
       @ignoring_children = 0
@@ -58,6 +79,10 @@ module ScoutApm
       @instant_key = nil
       @mem_start = mem_usage
       @dev_trace =  ScoutApm::Agent.instance.config.value('dev_trace') && ScoutApm::Agent.instance.environment.env == "development"
+      @profile_allocation_sites = ScoutApm::Agent.instance.config.value('allocation_site_profiling')
+      @allocation_sites = nil
+      @profile_stacks = ScoutApm::Agent.instance.config.value('stack_profiling')
+      @stack_profile = nil
       @recorder = ScoutApm::Agent.instance.recorder
 
       ignore_request! if @recorder.nil?
@@ -72,6 +97,7 @@ module ScoutApm
       return ignoring_start_layer if ignoring_request?
 
       start_request(layer) unless @root_layer
+      @open_records.push(@layer_arena.open(layer, @open_records.last))
       @layers.push(layer)
     end
 
@@ -84,6 +110,7 @@ module ScoutApm
       return ignoring_stop_layer if ignoring_request?
 
       layer = @layers.pop
+      record = @open_records.pop
 
       # Safeguard against a mismatch in the layer tracking in an instrument.
       # This class works under the assumption that start & stop layers are
@@ -96,17 +123,20 @@ module ScoutApm
       end
 
       layer.record_stop_time!
-      layer.record_allocations!
-
-      @layers[-1].add_child(layer) if @layers.any?
+      layer.record_allocations_and_gc!
+      @layer_arena.stop(record, layer)
 
       # This must be called before checking if a backtrace should be collected as the call count influences our capture logic.
       # We call `#update_call_counts in stop layer to ensure the layer has a final desc. Layer#desc is updated during the AR instrumentation flow.
       update_call_counts!(layer)
-      if capture_backtrace?(layer)
+      if capture_backtrace?(layer, record)
         layer.capture_backtrace!
       end
 
+      # Only once the layer is complete, backtrace included, since the parent
+      # may merge it into an identical sibling (see LayerChildrenSet)
+      @layer_arena.close(record, layer)
+
       if finalized?
         stop_request
       end
@@ -125,7 +155,7 @@ module ScoutApm
     end
 
     BACKTRACE_BLACKLIST = ["Controller", "Job"]
-    def capture_backtrace?(layer)
+    def capture_backtrace?(layer, record)
       return if ignoring_request?
 
       # Never capture backtraces for this kind of layer. The backtrace will
@@ -138,7 +168,7 @@ module ScoutApm
       return false unless (web? || job?)
 
       # Capture any individually slow layer.
-      return true if layer.total_exclusive_time > backtrace_threshold
+      return true if @layer_arena.records.total_exclusive_time(record) > backtrace_threshold
 
       # Capture any layer that we've seen many times. Captures n+1 problems
       return true if @call_set[layer.name].capture_backtrace?
@@ -174,16 +204,49 @@ module ScoutApm
     # Run at the beginning of the whole request
     #
     # * Capture the first layer as the root_layer
+    # * Let allocation tracking know a request is active (when it's only enabled during requests)
+    # * Start profiling allocation sites, if enabled. We can't know yet if
+    #   this will be a slow request, so it's the converter's job to only keep
+    #   the results of those.
+    # * Note the thread's CPU time, to find how much of the request was spent on CPU
+    # * Start sampling the thread's stack, if enabled. Like allocation sites,
+    #   only slow requests keep the results.
     def start_request(layer)
       @root_layer = layer unless @root_layer # capture root layer
+      @cpu_start_ns ||= ::Process.thread_cpu_ns
+      unless @tracking_allocations
+        @tracking_allocations = true
+        ScoutApm::Instruments::Allocations.request_started
+        ScoutApm::Instruments::Allocations.start_site_profile if @profile_allocation_sites
+      end
+      @sampling_stacks ||= @profile_stacks && ScoutApm::Instruments::StackProfiler.start
     end
 
     # Run at the end of the whole request
     #
+    # * Record the thread's CPU time on the root layer
+    # * Read the root layer from the arena from now on, so the Layer can go
     # * Send the request off to be stored
     def stop_request
       @stopping = true
 
+      if @cpu_start_ns && @root_layer
+        @root_layer.record_cpu_time!(ScoutApm::Clock.elapsed(@cpu_start_ns, ::Process.thread_cpu_ns))
+        @layer_arena.cpu_time = @root_layer.cpu_time
+      end
+      @root_layer = @layer_arena.root if @root_layer
+
+      if @tracking_allocations
+        @tracking_allocations = false
+        @allocation_sites = ScoutApm::Instruments::Allocations.stop_site_profile(ALLOCATION_SITES_LIMIT) if @profile_allocation_sites
+        ScoutApm::Instruments::Allocations.request_finished
+      end
+
+      if @sampling_stacks
+        @sampling_stacks = false
+        @stack_profile = ScoutApm::Instruments::StackProfiler.stop(STACK_PROFILE_LIMIT)
+      end
+
       if recorder
         recorder.record!(self)
       end
@@ -219,20 +282,24 @@ module ScoutApm
       @headers = headers
     end
 
+    # Frozen, since web? and job? are asked once per layer
+    JOB = "job".freeze
+    WEB = "web".freeze
+
     def job!
-      @request_type = "job"
+      @request_type = JOB
     end
 
     def job?
-      request_type == "job"
+      request_type == JOB
     end
 
     def web!
-      @request_type = "web"
+      @request_type = WEB
     end
 
     def web?
-      request_type == "web"
+      request_type == WEB
     end
 
     def instant?
@@ -252,6 +319,7 @@ module ScoutApm
     # Convert this request to the appropriate structure, then report it into
     # the peristent Store object
     def record!
+      overhead_mark = ScoutApm::Overhead.mark
       recorded!
 
       return if ignoring_request?
@@ -268,6 +336,7 @@ module ScoutApm
         LayerConverters::MetricConverter,
         LayerConverters::ErrorConverter,
         LayerConverters::AllocationMetricConverter,
+        LayerConverters::CpuTimeConverter,
         LayerConverters::RequestQueueTimeConverter,
         LayerConverters::JobConverter,
         LayerConverters::DatabaseConverter,
@@ -277,14 +346,21 @@ module ScoutApm
       ]
 
       layer_finder = LayerConverters::FindLayerByType.new(self)
-      walker = LayerConverters::DepthFirstWalker.new(self.root_layer)
+      walker = LayerConverters::DepthFirstWalker.new(layer_arena)
       converters = converters.map do |klass|
         instance = klass.new(self, layer_finder, @store)
         instance.register_hooks(walker)
         instance
       end
+      walk_mark = ScoutApm::Overhead.mark
       walker.walk
-      converters.each {|i| i.record! }
+      ScoutApm::Overhead.record(ScoutApm::Overhead::LAYER_WALK, walk_mark)
+
+      converters.each do |converter|
+        converter_mark = ScoutApm::Overhead.mark
+        converter.record!
+        ScoutApm::Overhead.record(converter.class.overhead_slot, converter_mark)
+      end
 
       # If there's an instant_key, it means we need to report this right away
       if web? && instant?
@@ -292,6 +368,23 @@ module ScoutApm
         trace = converter.call
         ScoutApm::InstantReporting.new(trace, instant_key).call
       end
+    ensure
+      release_layers!
+      ScoutApm::Overhead.record(ScoutApm::Overhead::TRACKED_REQUEST_RECORD, overhead_mark)
+    end
+
+    # Once recorded, nothing reads the layers again, but the thread keeps
+    # this request until its next one starts. Free the arena's records at
+    # once, rather than whenever the GC gets to them, and drop the rest so
+    # it's collected young, rather than surviving (and being promoted by) the
+    # GCs in between.
+    def release_layers!
+      @layer_arena.clear if @layer_arena
+      @layer_arena = nil
+      @root_layer = nil
+      @layers = []
+      @open_records = []
+      @call_set = nil
     end
 
     # Only call this after the request is complete
@@ -299,7 +392,7 @@ module ScoutApm
       return nil if ignoring_request?
 
       @unique_name ||= begin
-                         scope_layer = LayerConverters::FindLayerByType.new(self).scope
+                         scope_layer = @root_layer && LayerConverters::FindLayerByType.new(self).scope
                          if scope_layer
                            scope_layer.legacy_metric_name
                          else
@@ -382,8 +475,21 @@ module ScoutApm
       # Store data we'll need
       @ignoring_depth = @layers.length
 
+      # stop_request won't ever be reached, so release allocation tracking now
+      if @tracking_allocations
+        @tracking_allocations = false
+        ScoutApm::Instruments::Allocations.stop_site_profile(0) if @profile_allocation_sites
+        ScoutApm::Instruments::Allocations.request_finished
+      end
+      if @sampling_stacks
+        @sampling_stacks = false
+        ScoutApm::Instruments::StackProfiler.stop(0)
+      end
+
       # Clear data
       @layers = []
+      @open_records = []
+      @layer_arena = nil
       @root_layer = nil
       @call_set = nil
       @annotations = {}
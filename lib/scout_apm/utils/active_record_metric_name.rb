@@ -59,7 +59,7 @@ module ScoutApm
       end
 
       def parts
-        name.split(" ")
+        @parts ||= name.split(" ")
       end
 
       # Returns nil if no match
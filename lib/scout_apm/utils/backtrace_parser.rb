@@ -1,5 +1,11 @@
 require 'scout_apm/environment'
 
+# Load the native version if this platform supports it.
+begin
+  require 'backtrace_parser' unless ScoutApm::Environment.instance.ruby_187?
+rescue LoadError
+end
+
 # Given a call stack Array, grabs the first +APP_FRAMES+ callers within the
 # application root directory.
 #
@@ -9,6 +15,19 @@ module ScoutApm
       # will return this many backtrace frames from the app stack.
       APP_FRAMES = 8
 
+      NATIVE = defined?(NativeBacktraceParser) ? true : false
+
+      # Captures the app frames of the current stack directly, giving the same
+      # result as parsing `caller(skip)`, but without building the full
+      # backtrace. Only looks +depth+ frames deep. Returns nil if the native
+      # extension isn't available.
+      def self.capture(skip, depth, root=ScoutApm::Environment.instance.root)
+        return nil unless NATIVE
+
+        frames = NativeBacktraceParser.app_frames(root.to_s, skip + 1, depth, APP_FRAMES)
+        frames.map! { |frame| ScoutApm::Utils::Scm.relative_scm_path(frame) }
+      end
+
       attr_reader :call_stack
 
       def initialize(call_stack, root=ScoutApm::Environment.instance.root)
@@ -21,6 +40,7 @@ module ScoutApm
       end
 
       def call
+        mark = ScoutApm::Overhead.mark
         stack = []
         call_stack.each do |c|
           if m = c.match(@@app_dir_regex)
@@ -28,6 +48,7 @@ module ScoutApm
             break if stack.size == APP_FRAMES
           end
         end
+        ScoutApm::Overhead.record(ScoutApm::Overhead::BACKTRACE_PARSE, mark)
         stack
       end
     end
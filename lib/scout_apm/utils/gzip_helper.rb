@@ -1,23 +1,80 @@
 module ScoutApm
   module Utils
     # A simple wrapper around Ruby's built-in gzip support.
+    #
+    # One helper keeps a single deflate stream, reset between payloads rather
+    # than allocated for each, so keep one per reporting thread. It isn't safe
+    # to share across threads.
     class GzipHelper
       DEFAULT_GZIP_LEVEL = 5
 
+      # gzip framing, rather than zlib's, for the deflate stream
+      GZIP_WINDOW_BITS = Zlib::MAX_WBITS + 16
+
+      STRATEGIES = {
+        "default"      => Zlib::DEFAULT_STRATEGY,
+        "filtered"     => Zlib::FILTERED,
+        "huffman_only" => Zlib::HUFFMAN_ONLY,
+        "rle"          => Zlib::RLE,
+      }
+
       attr_reader :level
+      attr_reader :strategy
 
-      def initialize(level = DEFAULT_GZIP_LEVEL)
+      # strategy is a Zlib strategy constant, or its name in STRATEGIES.
+      def initialize(level = DEFAULT_GZIP_LEVEL, strategy = Zlib::DEFAULT_STRATEGY)
         @level = level
+        @strategy = STRATEGIES.fetch(strategy.to_s) { strategy }
       end
 
       def deflate(str)
-        strio = StringIO.new
+        stream { |io| io.write(str) }
+      end
+
+      # Yields an io to write the payload into piece by piece, compressing
+      # as it goes, and returns the compressed String. Only the compressed
+      # output is held, never the whole uncompressed payload.
+      def stream
+        writer = Writer.new(deflater)
+        yield writer
+        writer.finish
+      ensure
+        deflater.reset
+      end
+
+      private
+
+      def deflater
+        @deflater ||= Zlib::Deflate.new(level, GZIP_WINDOW_BITS, Zlib::DEF_MEM_LEVEL, strategy)
+      end
+
+      class Writer
+        attr_reader :bytes_in
+
+        def initialize(deflater)
+          @deflater = deflater
+          @out = String.new
+          @bytes_in = 0
+        end
+
+        # Accepts what IO#write would, returns the bytes written.
+        def write(str)
+          str = str.to_s
+          @bytes_in += str.bytesize
+          mark = ScoutApm::Overhead.mark
+          @out << @deflater.deflate(str)
+          ScoutApm::Overhead.record(ScoutApm::Overhead::PAYLOAD_GZIP, mark)
+          str.bytesize
+        end
 
-        gz = Zlib::GzipWriter.new(strio, level)
-        gz.write str
-        gz.close
+        def <<(str)
+          write(str)
+          self
+        end
 
-        strio.string
+        def finish
+          ScoutApm::Overhead.measure(ScoutApm::Overhead::PAYLOAD_GZIP) { @out << @deflater.finish }
+        end
       end
     end
   end
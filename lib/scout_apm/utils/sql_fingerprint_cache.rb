@@ -0,0 +1,102 @@
+# A bounded, process wide LRU of sanitized SQL, keyed by a fingerprint of the
+# raw statement. Apps issue the same handful of statements over and over, so
+# most of the time the sanitized form can be handed back without running the
+# sanitizer at all.
+#
+# Entries keep a frozen copy of the raw SQL, which is compared on every hit, so
+# a fingerprint collision is just a miss.
+#
+# hits / misses / evictions are exposed to help size the cache
+# (sql_fingerprint_cache_size).
+module ScoutApm
+  module Utils
+    class SqlFingerprintCache
+      DEFAULT_SIZE = 500
+
+      Entry = Struct.new(:raw_sql, :database_engine, :sanitized)
+
+      attr_reader :max_size, :hits, :misses, :evictions
+
+      def initialize(max_size = DEFAULT_SIZE)
+        @max_size = max_size.to_i
+        @entries = {} # Insertion ordered, oldest first
+        @lock = Mutex.new
+        @hits = 0
+        @misses = 0
+        @evictions = 0
+      end
+
+      # Returns the sanitized form of +raw_sql+, calling the block to produce it
+      # on a miss. The block runs outside the lock.
+      def fetch(raw_sql, database_engine)
+        return yield if @max_size <= 0
+
+        key = self.class.fingerprint(raw_sql)
+
+        @lock.synchronize do
+          entry = @entries[key]
+          if entry && entry.database_engine == database_engine && entry.raw_sql == raw_sql
+            @hits += 1
+            # Move to the most recently used end
+            @entries.delete(key)
+            @entries[key] = entry
+            return entry.sanitized
+          end
+          @misses += 1
+        end
+
+        sanitized = yield
+        return sanitized unless sanitized.is_a?(String)
+        sanitized.freeze
+        store(key, Entry.new(raw_sql.frozen? ? raw_sql : raw_sql.dup.freeze, database_engine, sanitized))
+        sanitized
+      end
+
+      def size
+        @lock.synchronize { @entries.size }
+      end
+
+      def stats
+        @lock.synchronize do
+          {
+            :size => @entries.size,
+            :max_size => @max_size,
+            :hits => @hits,
+            :misses => @misses,
+            :evictions => @evictions,
+          }
+        end
+      end
+
+      def clear
+        @lock.synchronize do
+          @entries.clear
+          @hits = @misses = @evictions = 0
+        end
+      end
+
+      if defined?(ScoutApm::Utils::NativeSqlSanitizer)
+        def self.fingerprint(sql)
+          NativeSqlSanitizer.fingerprint(sql)
+        end
+      else
+        def self.fingerprint(sql)
+          sql.hash
+        end
+      end
+
+      private
+
+      def store(key, entry)
+        @lock.synchronize do
+          @entries.delete(key)
+          @entries[key] = entry
+          while @entries.size > @max_size
+            @entries.shift
+            @evictions += 1
+          end
+        end
+      end
+    end
+  end
+end
@@ -1,5 +1,13 @@
 require 'scout_apm/environment'
 
+# Load the native version if this platform supports it.
+begin
+  require 'sql_sanitizer' unless ScoutApm::Environment.instance.ruby_187?
+rescue LoadError
+end
+
+require 'scout_apm/utils/sql_fingerprint_cache'
+
 # Removes actual values from SQL. Used to both obfuscate the SQL and group
 # similar queries in the UI.
 module ScoutApm
@@ -12,32 +20,76 @@ module ScoutApm
       end
       include ScoutApm::Utils::SqlRegex
 
+      NATIVE = defined?(NativeSqlSanitizer) ? true : false
+
       attr_accessor :database_engine
 
+      # The process wide cache of sanitized statements. Sized by the
+      # sql_fingerprint_cache_size setting, read the first time it's used.
+      def self.fingerprint_cache
+        @fingerprint_cache ||= SqlFingerprintCache.new(ScoutApm::Agent.instance.config.value('sql_fingerprint_cache_size'))
+      end
+
+      def self.fingerprint_cache=(cache)
+        @fingerprint_cache = cache
+      end
+
       def initialize(sql)
         @raw_sql = sql
         @database_engine = ScoutApm::Environment.instance.database_engine
-        @sanitized = false # only sanitize once.
+        @sanitized = nil # only sanitize once.
       end
 
       def sql
         @sql ||= scrubbed(@raw_sql.dup) # don't do this in initialize as it is extra work that isn't needed unless we have a slow transaction.
       end
 
+      # The sanitized SQL. Frozen, and possibly shared with other instances
+      # sanitizing the same statement.
       def to_s
-        if @sanitized
-          sql
-        else
-          @sanitized = true
-        end
+        return @sanitized if @sanitized
+
+        mark = ScoutApm::Overhead.mark
+        @sanitized = if @raw_sql.is_a?(String)
+                       self.class.fingerprint_cache.fetch(@raw_sql, database_engine) { sanitize }
+                     else
+                       sanitize
+                     end
+      ensure
+        ScoutApm::Overhead.record(ScoutApm::Overhead::SQL_SANITIZE, mark) if mark
+      end
+
+      # An Integer naming the statement's shape, the same for statements that
+      # differ only in their values. The native version hashes the raw SQL in
+      # one pass without sanitizing it, so it's cheap enough to take for every
+      # query. CallSet counts repeated queries by it.
+      def fingerprint
+        @fingerprint ||= if NATIVE && @raw_sql.is_a?(String)
+                           NativeSqlSanitizer.structural_fingerprint(@raw_sql)
+                         else
+                           to_s.hash
+                         end
+      end
+
+      private
+
+      def sanitize
         case database_engine
-        when :postgres then to_s_postgres
-        when :mysql    then to_s_mysql
-        when :sqlite   then to_s_sqlite
+        when :postgres then to_s_native(:postgres) || to_s_postgres
+        when :mysql    then to_s_native(:mysql) || to_s_mysql
+        when :sqlite   then to_s_native(:sqlite) || to_s_sqlite
         end
       end
 
-      private
+      # The native sanitizer produces exactly what the regex passes below
+      # do, in a single call and without copying the raw SQL first. It returns
+      # nil for SQL it doesn't handle (non-ASCII), and we fall back.
+      def to_s_native(engine)
+        return nil unless NATIVE
+
+        sanitized = NativeSqlSanitizer.send(engine, @sql || scrubbed(@raw_sql))
+        @sql = sanitized if sanitized
+      end
 
       def to_s_postgres
         sql.gsub!(PSQL_PLACEHOLDER, '?')
@@ -91,3 +143,4 @@ module ScoutApm
     end
   end
 end
+
@@ -0,0 +1,93 @@
+require 'test_helper'
+
+require 'scout_apm/background_recorder'
+
+class BackgroundRecorderTest < Minitest::Test
+  # Blocks the recording thread until released
+  class FakeRequest
+    def initialize(gate = nil, recorded = nil)
+      @gate = gate
+      @recorded = recorded
+    end
+
+    def record!
+      @gate.pop if @gate
+      @recorded << self if @recorded
+    end
+  end
+
+  def setup
+    @logger = Logger.new(StringIO.new)
+  end
+
+  def teardown
+    @recorder.stop if @recorder && @recorder.thread
+  end
+
+  def test_records_requests_on_its_thread
+    recorded = Queue.new
+    @recorder = ScoutApm::BackgroundRecorder.new(@logger).start
+
+    requests = Array.new(3) { FakeRequest.new(nil, recorded) }
+    requests.each { |r| @recorder.record!(r) }
+
+    assert_equal requests, Array.new(3) { recorded.pop }
+    assert_equal 0, @recorder.dropped
+  end
+
+  def test_drops_requests_when_full
+    gate = Queue.new
+    recorded = Queue.new
+    @recorder = ScoutApm::BackgroundRecorder.new(@logger, 2).start
+
+    # The first is taken by the thread and blocks it, the next two fill the
+    # queue, and the rest are dropped
+    @recorder.record!(FakeRequest.new(gate, recorded))
+    wait_until { @recorder.queue.empty? }
+    4.times { @recorder.record!(FakeRequest.new(gate, recorded)) }
+
+    assert_equal 2, @recorder.dropped
+    assert_equal 2, @recorder.stats[:queued]
+
+    3.times { gate << true }
+    3.times { recorded.pop }
+    wait_until { @recorder.recorded == 3 }
+
+    assert_equal({:queued => 0, :queue_size => 2, :recorded => 3, :dropped => 2}, @recorder.stats)
+  end
+
+  def test_errors_dont_stop_the_thread
+    recorded = Queue.new
+    @recorder = ScoutApm::BackgroundRecorder.new(@logger).start
+
+    failing = Object.new
+    def failing.record!; raise "boom"; end
+
+    @recorder.record!(failing)
+    @recorder.record!(FakeRequest.new(nil, recorded))
+
+    recorded.pop
+    assert @recorder.thread.alive?
+  end
+
+  def test_restarts_a_dead_thread
+    recorded = Queue.new
+    @recorder = ScoutApm::BackgroundRecorder.new(@logger).start
+    @recorder.stop
+    wait_until { !@recorder.thread.alive? }
+
+    @recorder.record!(FakeRequest.new(nil, recorded))
+    recorded.pop
+    assert @recorder.thread.alive?
+  end
+
+  private
+
+  def wait_until
+    100.times do
+      return if yield
+      sleep 0.01
+    end
+    flunk "timed out waiting"
+  end
+end
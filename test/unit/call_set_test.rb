@@ -0,0 +1,57 @@
+require 'test_helper'
+
+class CallSetTest < Minitest::Test
+  def test_captures_on_the_magic_number_of_the_same_call
+    set = past_time_threshold(ScoutApm::CallSet.new)
+
+    (ScoutApm::CallSet::N_PLUS_ONE_MAGIC_NUMBER - 1).times do |i|
+      set.update!(sql("SELECT * FROM users WHERE id = #{i}"))
+      assert !set.capture_backtrace?
+    end
+
+    set.update!(sql("SELECT * FROM users WHERE id = 99"))
+    assert set.capture_backtrace?
+
+    # Only once
+    set.update!(sql("SELECT * FROM users WHERE id = 100"))
+    assert !set.capture_backtrace?
+  end
+
+  def test_counts_different_calls_separately
+    set = past_time_threshold(ScoutApm::CallSet.new)
+
+    # 8 calls, but only 4 of each
+    ((ScoutApm::CallSet::N_PLUS_ONE_MAGIC_NUMBER - 1) * 2).times do |i|
+      set.update!(sql(i.even? ? "SELECT * FROM users WHERE id = #{i}" : "SELECT * FROM posts WHERE id = #{i}"))
+      assert !set.capture_backtrace?
+    end
+
+    set.update!(sql("SELECT * FROM posts WHERE id = 0"))
+    assert set.capture_backtrace?
+  end
+
+  def test_counts_plain_descriptions
+    set = past_time_threshold(ScoutApm::CallSet.new)
+
+    ScoutApm::CallSet::N_PLUS_ONE_MAGIC_NUMBER.times { set.update!("GET https://example.com/") }
+    assert set.capture_backtrace?
+  end
+
+  def test_needs_time_to_pass
+    set = ScoutApm::CallSet.new
+
+    ScoutApm::CallSet::N_PLUS_ONE_MAGIC_NUMBER.times { set.update!(nil) }
+    assert !set.capture_backtrace?
+  end
+
+  private
+
+  def sql(str)
+    ScoutApm::Utils::SqlSanitizer.new(str).tap { |s| s.database_engine = :postgres }
+  end
+
+  def past_time_threshold(set)
+    set.instance_variable_set(:@past_time_threshold, true)
+    set
+  end
+end
@@ -0,0 +1,29 @@
+require 'test_helper'
+
+require 'scout_apm/clock'
+
+class ClockTest < Minitest::Test
+  def test_monotonic_ns_is_an_increasing_integer
+    first = ScoutApm::Clock.monotonic_ns
+    second = ScoutApm::Clock.monotonic_ns
+    assert_kind_of Integer, first
+    assert second >= first
+  end
+
+  def test_elapsed_is_in_seconds
+    assert_in_delta 1.5, ScoutApm::Clock.elapsed(0, 1_500_000_000), 0.0001
+  end
+
+  def test_to_time
+    ns = ScoutApm::Clock.monotonic_ns - 2_000_000_000
+    assert_in_delta Time.now - 2, ScoutApm::Clock.to_time(ns), 0.1
+  end
+
+  def test_layer_times
+    layer = ScoutApm::Layer.new("Test", "clock")
+    layer.record_stop_time!(layer.start_ns + 250_000_000)
+
+    assert_in_delta 0.25, layer.total_call_time, 0.0001
+    assert_in_delta 0.25, layer.stop_time - layer.start_time, 0.01
+  end
+end
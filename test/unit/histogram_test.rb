@@ -103,5 +103,95 @@ class HistogramTest < Minitest::Test
 
     assert_equal 5.5, hist.mean
   end
-end
 
+  def test_marshal_round_trip
+    hist = ScoutApm::NumericHistogram.new(5)
+    (1..20).each { |i| hist.add(i * 1.5) }
+
+    loaded = Marshal.load(Marshal.dump(hist))
+    assert_equal hist.total, loaded.total
+    assert_equal hist.max_bins, loaded.max_bins
+    assert_equal hist.as_json, loaded.as_json
+  end
+
+  ################################################################################
+  # The native extension must behave exactly like the pure-Ruby version
+
+  class PureHistogram
+    include ScoutApm::PureNumericHistogram
+  end
+
+  def test_native_matches_pure_ruby
+    skip "Native histogram not loaded" unless native?
+
+    rng = Random.new(1234)
+    [1, 5, 50].each do |max_bins|
+      native = ScoutApm::NumericHistogram.new(max_bins)
+      pure = PureHistogram.new(max_bins)
+
+      500.times do
+        v = rng.rand(100) < 20 ? rng.rand(10) : rng.rand * 1000
+        native.add(v)
+        pure.add(v)
+      end
+
+      assert_same_histogram pure, native
+      [0, 0.01, 0.5, 0.95, 1, 50, 99, 100].each do |q|
+        assert_equal pure.quantile(q), native.quantile(q)
+      end
+      [-1, 0, 5, 500.5, 2000].each do |v|
+        assert_equal pure.approximate_quantile_of_value(v), native.approximate_quantile_of_value(v)
+      end
+      assert_equal pure.mean, native.mean
+    end
+  end
+
+  def test_native_combine_matches_pure_ruby
+    skip "Native histogram not loaded" unless native?
+
+    natives = [ScoutApm::NumericHistogram.new(10), ScoutApm::NumericHistogram.new(20)]
+    pures = [PureHistogram.new(10), PureHistogram.new(20)]
+    (1..200).each do |i|
+      natives[i % 2].add((i * 7) % 53)
+      pures[i % 2].add((i * 7) % 53)
+    end
+
+    assert_same_histogram pures[0].combine!(pures[1]), natives[0].combine!(natives[1])
+  end
+
+  def test_native_combine_with_pure_ruby
+    skip "Native histogram not loaded" unless native?
+
+    native = ScoutApm::NumericHistogram.new(5)
+    pure = PureHistogram.new(5)
+    native.add(1)
+    pure.add(1)
+    pure.add(2)
+
+    native.combine!(pure)
+    assert_equal 3, native.total
+    assert_equal [[1.0, 2], [2.0, 1]], native.as_json
+  end
+
+  def test_native_loads_marshal_from_pure_ruby
+    skip "Native histogram not loaded" unless native?
+
+    pure = PureHistogram.new(5)
+    (1..20).each { |i| pure.add(i) }
+
+    native = ScoutApm::NumericHistogram.allocate
+    native.marshal_load(pure.marshal_dump)
+    assert_same_histogram pure, native
+    assert_equal pure.marshal_dump, native.marshal_dump
+  end
+
+  def native?
+    defined?(ScoutApm::NumericHistogram::NATIVE)
+  end
+
+  def assert_same_histogram(expected, actual)
+    assert_equal expected.total, actual.total
+    assert_equal expected.bins.map { |b| [b.value, b.count] }, actual.bins.map { |b| [b.value, b.count] }
+    assert_equal expected.as_json, actual.as_json
+  end
+end
@@ -0,0 +1,195 @@
+require 'test_helper'
+
+require 'allocations'
+
+class AllocationsTest < Minitest::Test
+  def test_mark_is_a_fixnum
+    assert_kind_of Integer, ScoutApm::Instruments::Allocations.mark
+  end
+
+  def test_delta_counts_allocations_since_mark
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    mark = ScoutApm::Instruments::Allocations.mark
+    10.times { Object.new }
+    assert ScoutApm::Instruments::Allocations.delta(mark) >= 10
+  end
+
+  def test_delta_never_negative
+    future_mark = ScoutApm::Instruments::Allocations.mark + 1_000_000
+    assert_equal 0, ScoutApm::Instruments::Allocations.delta(future_mark)
+  end
+
+  def test_layer_records_allocations
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    layer = ScoutApm::Layer.new("Test", "allocations")
+    10.times { Object.new }
+    layer.record_allocations_and_gc!
+    recorded = layer.total_allocations
+
+    10.times { Object.new }
+    assert recorded >= 10
+    assert_equal recorded, layer.total_allocations
+  end
+
+  def test_allocations_in_other_fibers_are_not_counted
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+    skip "No fiber switch events" unless RUBY_VERSION >= "2.6"
+
+    fiber = Fiber.new { 1000.times { Object.new }; Fiber.yield; 1000.times { Object.new } }
+
+    mark = ScoutApm::Instruments::Allocations.mark
+    fiber.resume
+    fiber.resume
+    assert ScoutApm::Instruments::Allocations.delta(mark) < 1000
+  end
+
+  def test_allocations_in_other_threads_are_not_counted
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    mark = ScoutApm::Instruments::Allocations.mark
+    Thread.new { ScoutApm::Instruments::Allocations.mark; 1000.times { Object.new } }.join
+    assert ScoutApm::Instruments::Allocations.delta(mark) < 1000
+  end
+
+  def test_sample_rate_scales_counts
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    begin
+      ScoutApm::Instruments::Allocations.sample_rate = 10
+      mark = ScoutApm::Instruments::Allocations.mark
+      1000.times { Object.new }
+      delta = ScoutApm::Instruments::Allocations.delta(mark)
+      assert delta >= 990, "Expected about 1000 allocations, got #{delta}"
+      assert_equal 0, delta % 10
+    ensure
+      ScoutApm::Instruments::Allocations.sample_rate = 1
+    end
+  end
+
+  def test_invalid_sample_rate
+    assert_raises(ArgumentError) { ScoutApm::Instruments::Allocations.sample_rate = 0 }
+  end
+
+  def test_mode_off_stops_counting
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    begin
+      ScoutApm::Instruments::Allocations.mode = :off
+      assert_false ScoutApm::Instruments::Allocations.enabled?
+      mark = ScoutApm::Instruments::Allocations.mark
+      100.times { Object.new }
+      assert_equal 0, ScoutApm::Instruments::Allocations.delta(mark)
+    ensure
+      ScoutApm::Instruments::Allocations.mode = :always
+    end
+  end
+
+  def test_request_mode_counts_only_during_requests
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    begin
+      ScoutApm::Instruments::Allocations.mode = :request
+      assert ScoutApm::Instruments::Allocations.enabled?
+
+      mark = ScoutApm::Instruments::Allocations.mark
+      100.times { Object.new }
+      assert_equal 0, ScoutApm::Instruments::Allocations.delta(mark)
+
+      ScoutApm::Instruments::Allocations.request_started
+      100.times { Object.new }
+      ScoutApm::Instruments::Allocations.request_finished
+      assert ScoutApm::Instruments::Allocations.delta(mark) >= 100
+    ensure
+      ScoutApm::Instruments::Allocations.mode = :always
+    end
+  end
+
+  def test_unknown_mode
+    assert_raises(ArgumentError) { ScoutApm::Instruments::Allocations.mode = :sometimes }
+    assert_equal :always, ScoutApm::Instruments::Allocations.mode
+  end
+
+  def test_site_profile_counts_sites_and_classes
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    ScoutApm::Instruments::Allocations.start_site_profile
+    line = __LINE__; 500.times { Object.new }
+    sites, classes, dropped = ScoutApm::Instruments::Allocations.stop_site_profile(5)
+
+    site = sites.find { |path, l, _, _| path == __FILE__ && l == line }
+    assert site, "Expected a site for #{__FILE__}:#{line} in #{sites.inspect}"
+    assert site[3] >= 500
+    assert_kind_of String, site[2]
+
+    object = classes.find { |name, _| name == "Object" }
+    assert object[1] >= 500
+    assert_equal 0, dropped
+    assert sites.size <= 5
+    assert_equal sites.sort_by { |s| -s[3] }, sites
+  end
+
+  def test_site_profile_is_per_thread_and_cleared
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    assert_nil ScoutApm::Instruments::Allocations.stop_site_profile(5)
+
+    ScoutApm::Instruments::Allocations.start_site_profile
+    Thread.new { 500.times { Object.new } }.join
+    sites, classes, _ = ScoutApm::Instruments::Allocations.stop_site_profile(100)
+    assert classes.none? { |name, count| name == "Object" && count >= 500 }, classes.inspect
+
+    ScoutApm::Instruments::Allocations.start_site_profile
+    sites, _, _ = ScoutApm::Instruments::Allocations.stop_site_profile(100)
+    assert sites.size < 5, "Expected a fresh profile, got #{sites.inspect}"
+  end
+
+  def test_gc_count_and_time
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    count = ScoutApm::Instruments::Allocations.gc_count
+    time = ScoutApm::Instruments::Allocations.gc_time
+    3.times { GC.start }
+
+    assert ScoutApm::Instruments::Allocations.gc_count >= count + 3
+    assert ScoutApm::Instruments::Allocations.gc_time > time
+  end
+
+  def test_gc_in_other_threads_is_not_counted
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    count = ScoutApm::Instruments::Allocations.gc_count
+    Thread.new { 3.times { GC.start } }.join
+    assert ScoutApm::Instruments::Allocations.gc_count < count + 3
+  end
+
+  def test_span_reads_allocations_and_gc_in_one_call
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    span = ScoutApm::Instruments::Allocations.span
+    10.times { Object.new }
+    GC.start
+
+    allocations, gc_count, gc_time = ScoutApm::Instruments::Allocations.span_delta!(span)
+    assert allocations >= 10
+    assert gc_count >= 1
+    assert_kind_of Float, gc_time
+    assert gc_time > 0
+  end
+
+  def test_layer_records_gc
+    skip "Allocation tracking not available" unless ScoutApm::Instruments::Allocations::ENABLED
+
+    layer = ScoutApm::Layer.new("Test", "gc")
+    2.times { GC.start }
+    layer.record_allocations_and_gc!
+
+    recorded = layer.total_gc_count
+    assert recorded >= 2
+    assert layer.total_gc_time > 0
+
+    GC.start
+    assert_equal recorded, layer.total_gc_count
+  end
+end
@@ -0,0 +1,62 @@
+require 'test_helper'
+
+require 'rusage'
+
+class RusageTest < Minitest::Test
+  def test_maxrss_matches_rusage
+    maxrss = Process.rusage_maxrss
+    assert_kind_of Integer, maxrss
+    assert maxrss <= Process.rusage.maxrss
+  end
+
+  def test_cpu_times_fills_the_buffer
+    buffer = [0.0, 0.0]
+    assert_same buffer, Process.rusage_cpu_times(buffer)
+
+    utime, stime = buffer
+    usage = Process.rusage
+    assert utime > 0
+    assert utime <= usage.utime
+    assert stime <= usage.stime
+  end
+
+  def test_cpu_times_without_a_buffer
+    assert_equal 2, Process.rusage_cpu_times.length
+  end
+
+  def test_rusage_into_refreshes_a_struct
+    usage = Process.rusage
+    usage.maxrss = 0
+    assert_same usage, Process.rusage_into(usage)
+    assert usage.maxrss > 0
+  end
+
+  def test_rusage_into_rejects_other_objects
+    assert_raises(TypeError) { Process.rusage_into(Struct.new(:utime).new(0)) }
+  end
+
+  def test_current_rss_tracks_growth
+    before = Process.current_rss
+    assert before > 0
+
+    retained = Array.new(200_000) { "x" * 100 }
+    assert Process.current_rss > before
+    assert_equal 200_000, retained.size
+  end
+
+  def test_current_rss_after_fork
+    skip "fork not available" unless Process.respond_to?(:fork)
+
+    Process.current_rss
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      writer.write(Process.current_rss > 0 ? "ok" : "fail")
+      writer.close
+      exit!(0)
+    end
+    writer.close
+    Process.wait(pid)
+    assert_equal "ok", reader.read
+  end
+end
@@ -0,0 +1,97 @@
+require 'test_helper'
+
+class StackProfilerTest < Minitest::Test
+  def test_samples_the_running_method
+    skip "Stack profiling not available" unless ScoutApm::Instruments::StackProfiler::NATIVE
+
+    assert ScoutApm::Instruments::StackProfiler.start
+    burn_cpu(0.2)
+    frames, samples, dropped = ScoutApm::Instruments::StackProfiler.stop(100)
+
+    assert samples > 0
+    assert_equal 0, dropped
+    label, path, line, self_count, total_count = frames.find { |frame| frame[0] =~ /burn_cpu/ }
+    assert_equal __FILE__, path
+    assert total_count >= self_count
+    assert total_count > 0
+  end
+
+  def test_stop_without_start
+    assert_nil ScoutApm::Instruments::StackProfiler.stop(10)
+  end
+
+  def test_other_threads_are_not_sampled
+    skip "Stack profiling not available" unless ScoutApm::Instruments::StackProfiler::NATIVE
+
+    ScoutApm::Instruments::StackProfiler.start
+    Thread.new { burn_cpu(0.2) }.join
+    frames, samples, _ = ScoutApm::Instruments::StackProfiler.stop(100)
+
+    assert_nil frames.find { |frame| frame[0] =~ /burn_cpu/ }
+  end
+
+  def test_fibers_of_one_thread_are_sampled_apart
+    skip "Stack profiling not available" unless ScoutApm::Instruments::StackProfiler::NATIVE
+
+    other = Fiber.new do
+      ScoutApm::Instruments::StackProfiler.start
+      Fiber.yield
+      ScoutApm::Instruments::StackProfiler.stop(100)
+    end
+
+    ScoutApm::Instruments::StackProfiler.start
+    other.resume
+    burn_cpu(0.2)
+    frames, samples, _ = ScoutApm::Instruments::StackProfiler.stop(100)
+    other_frames, _, _ = other.resume
+
+    assert samples > 0
+    assert frames.find { |frame| frame[0] =~ /burn_cpu/ }
+    assert_nil other_frames.find { |frame| frame[0] =~ /burn_cpu/ }
+  end
+
+  def test_samples_in_a_forked_child
+    skip "Stack profiling not available" unless ScoutApm::Instruments::StackProfiler::NATIVE
+    skip "fork not available" unless Process.respond_to?(:fork)
+
+    # A profile running in another thread at the fork is gone with that
+    # thread in the child
+    started, finish = Queue.new, Queue.new
+    profiling = Thread.new do
+      ScoutApm::Instruments::StackProfiler.start
+      started << true
+      finish.pop
+      ScoutApm::Instruments::StackProfiler.stop(0)
+    end
+    started.pop
+
+    pid = fork do
+      ScoutApm::Instruments::StackProfiler.start
+      burn_cpu(0.2)
+      _, samples, _ = ScoutApm::Instruments::StackProfiler.stop(10)
+      exit!(samples > 0 ? 0 : 1)
+    end
+    Process.wait(pid)
+    finish << true
+    profiling.join
+
+    assert $?.success?, "forked child took no samples"
+  end
+
+  def test_limit
+    skip "Stack profiling not available" unless ScoutApm::Instruments::StackProfiler::NATIVE
+
+    ScoutApm::Instruments::StackProfiler.start
+    burn_cpu(0.05)
+    assert_equal [], ScoutApm::Instruments::StackProfiler.stop(0)[0]
+  end
+
+  private
+
+  def burn_cpu(seconds)
+    stop_at = Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID) + seconds
+    x = 0
+    x += 1 while Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID) < stop_at
+    x
+  end
+end
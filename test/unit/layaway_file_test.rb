@@ -0,0 +1,238 @@
+require 'test_helper'
+
+require 'scout_apm/layaway_file'
+require 'scout_apm/store'
+
+require 'fileutils'
+
+class LayawayFileTest < Minitest::Test
+  ScoredItem = Struct.new(:name, :score) do
+    def call
+      self
+    end
+  end
+
+  def setup
+    FileUtils.mkdir_p '/tmp/scout_apm_test/layaway_file'
+    @path = "/tmp/scout_apm_test/layaway_file/scout_test_#{$$}.data"
+  end
+
+  def teardown
+    FileUtils.rm_f @path
+  end
+
+  def test_round_trips_a_reporting_period
+    [false, true].each do |native|
+      rp = full_reporting_period
+      ScoutApm::LayawayFile.new(@path, native).write(rp)
+
+      assert_same_period rp, ScoutApm::LayawayFile.new(@path).load
+    end
+  end
+
+  # Until every process can read the binary format
+  def test_writes_marshal_by_default
+    rp = full_reporting_period
+    ScoutApm::LayawayFile.new(@path).write(rp)
+
+    assert_same_period rp, Marshal.load(File.binread(@path))
+  end
+
+  def test_writes_the_binary_format
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    ScoutApm::LayawayFile.new(@path, true).write(full_reporting_period)
+
+    assert_equal ScoutApm::NativeLayawayFormat::MAGIC, File.binread(@path, 8)
+  end
+
+  def test_failed_writes_leave_no_temp_file
+    file = ScoutApm::LayawayFile.new(@path)
+    File.stubs(:rename).raises(Errno::EACCES)
+
+    assert_raises(Errno::EACCES) { file.write(full_reporting_period) }
+    assert_equal [], Dir["#{@path}*"]
+  end
+
+  def test_rewriting_replaces_the_file_instead_of_truncating_it
+    file = ScoutApm::LayawayFile.new(@path)
+    file.write(full_reporting_period)
+    opened = File.open(@path, "rb")
+    before = opened.read
+
+    file.write(full_reporting_period)
+
+    opened.rewind
+    assert_equal before, opened.read
+    refute_equal opened.stat.ino, File.stat(@path).ino
+    assert_equal [@path], Dir["#{@path}*"]
+  ensure
+    opened.close if opened
+  end
+
+  def test_reads_marshal_files
+    rp = full_reporting_period
+    File.open(@path, "wb") { |f| f.write(Marshal.dump(rp)) }
+
+    assert_same_period rp, ScoutApm::LayawayFile.new(@path).load
+  end
+
+  def test_unusual_values_round_trip
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    rp = ScoutApm::StoreReportingPeriod.new(Time.at(1_500_000_000).utc)
+    meta = ScoutApm::MetricMeta.new("Controller/users/show".encode("ISO-8859-1"), :scope => :a_symbol)
+    meta.extra[:backtrace] = ["app/models/user.rb:10:in `find'"]
+    stats = ScoutApm::MetricStats.new
+    stats.update!(2**70)
+    rp.absorb_metrics!(meta => stats)
+
+    loaded = ScoutApm::NativeLayawayFormat.load(ScoutApm::NativeLayawayFormat.dump(rp))
+
+    assert_same_period rp, loaded
+    assert_equal Encoding::ISO_8859_1, loaded.metric_set.metrics.keys.first.metric_name.encoding
+  end
+
+  # The native format must keep everything Marshal does
+  def test_native_round_trip_matches_marshal
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    rp = full_reporting_period
+
+    assert_equal normalized(Marshal.load(Marshal.dump(rp))),
+      normalized(ScoutApm::NativeLayawayFormat.load(ScoutApm::NativeLayawayFormat.dump(rp)))
+  end
+
+  # Attributes added after the format are embedded with Marshal, rather than
+  # dropped
+  def test_unlisted_attributes_round_trip
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    rp = full_reporting_period
+    meta, stats = rp.metric_set.metrics.first
+    meta.instance_variable_set(:@later_meta, "meta")
+    stats.instance_variable_set(:@later_stats, 1)
+    rp.db_query_metric_set.metrics.values.first.instance_variable_set(:@later_db, [1, 2])
+    rp.histograms.first.instance_variable_set(:@later_histogram, :h)
+    rp.instance_variable_set(:@later_period, { "a" => 1 })
+
+    loaded = ScoutApm::NativeLayawayFormat.load(ScoutApm::NativeLayawayFormat.dump(rp))
+
+    assert_equal normalized(Marshal.load(Marshal.dump(rp))), normalized(loaded)
+    loaded_meta, loaded_stats = loaded.metric_set.metrics.first
+    assert_equal "meta", loaded_meta.instance_variable_get(:@later_meta)
+    assert_equal 1, loaded_stats.instance_variable_get(:@later_stats)
+    assert_equal [1, 2], loaded.db_query_metric_set.metrics.values.first.instance_variable_get(:@later_db)
+    assert_equal :h, loaded.histograms.first.instance_variable_get(:@later_histogram)
+    assert_equal({ "a" => 1 }, loaded.instance_variable_get(:@later_period))
+  end
+
+  def test_corrupt_files_are_reset
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    data = ScoutApm::NativeLayawayFormat.dump(full_reporting_period)
+    File.open(@path, "wb") { |f| f.write(data[0, data.length / 2]) }
+
+    assert_nil ScoutApm::LayawayFile.new(@path).load
+  end
+
+  def test_skips_unknown_sections
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    rp = full_reporting_period
+    data = ScoutApm::NativeLayawayFormat.dump(rp) + [200, 3].pack("CV") + "abc"
+
+    assert_same_period rp, ScoutApm::NativeLayawayFormat.load(data)
+  end
+
+  def test_load_declines_other_formats
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    assert_equal false, ScoutApm::NativeLayawayFormat.load(Marshal.dump(full_reporting_period))
+  end
+
+  ##############################################################################
+  # Helpers
+  ##############################################################################
+
+  def full_reporting_period
+    rp = ScoutApm::StoreReportingPeriod.new(ScoutApm::StoreReportingPeriodTimestamp.new(Time.at(1_500_000_000)))
+
+    controller = ScoutApm::MetricMeta.new("Controller/users/show")
+    controller_stats = ScoutApm::MetricStats.new(true)
+    controller_stats.update!(0.25, 0.1, :queue => 0.01)
+    sql = ScoutApm::MetricMeta.new("ActiveRecord/User/find", :scope => "Controller/users/show", :desc => "SELECT ?")
+    sql_stats = ScoutApm::MetricStats.new
+    sql_stats.update!(0.05)
+    sql_stats.update!(0.07)
+    rp.absorb_metrics!(controller => controller_stats, sql => sql_stats)
+
+    rp.merge_db_query_metrics!(ScoutApm::DbQueryMetricSet.new.tap { |set|
+      set << ScoutApm::DbQueryMetricStats.new("User", "find", "Controller/users/show", 1, 10.0, 3)
+      set << ScoutApm::DbQueryMetricStats.new("Post", "save", "Controller/users/show", 2, 4.5, 1).tap { |s| s.increment_transaction_count! }
+    })
+
+    histogram = ScoutApm::NumericHistogram.new(20)
+    [1.0, 2.5, 2.5, 9.0].each { |v| histogram.add(v) }
+    rp.merge_histograms!([ScoutApm::Instruments::HistogramReport.new("Controller/users/show", histogram)])
+
+    rp.merge_slow_transactions!([ScoredItem.new("Controller/users/show", 10)])
+    rp.merge_slow_jobs!([ScoredItem.new("Job/default/HardWork", 5)])
+    rp.merge_jobs!([ScoutApm::JobRecord.new("default", "HardWork", 1.5, 1.0, 0, {})])
+    rp
+  end
+
+  def assert_same_period(expected, actual)
+    assert_kind_of ScoutApm::StoreReportingPeriod, actual
+    assert_equal expected.timestamp, actual.timestamp
+    assert_equal dump_metrics(expected), dump_metrics(actual)
+    assert_equal dump_db_query_metrics(expected), dump_db_query_metrics(actual)
+    assert_equal dump_histograms(expected), dump_histograms(actual)
+    assert_equal expected.request_traces, actual.request_traces
+    assert_equal expected.job_traces, actual.job_traces
+    assert_equal expected.jobs, actual.jobs
+  end
+
+  def ivars(obj, except=[])
+    (obj.instance_variables.map(&:to_sym) - except).sort.map { |ivar|
+      value = obj.instance_variable_get(ivar)
+      value = value.marshal_dump if value.is_a?(ScoutApm::NumericHistogram)
+      [ivar, value]
+    }
+  end
+
+  # Caches, and the config a DbQueryMetricSet is made with (and its limit
+  # from it), aren't kept
+  SKIPPED_IVARS = [:@hash_value, :@type, :@key, :@config, :@limit]
+
+  # +obj+ as plain values, to compare everything it holds
+  def normalized(obj)
+    case obj
+    when nil, true, false, Numeric, String, Symbol, Time
+      obj
+    when Array
+      obj.map { |v| normalized(v) }
+    when Hash
+      obj.map { |k, v| [normalized(k), normalized(v)] }.sort_by(&:inspect)
+    when Struct
+      [obj.class, obj.to_a.map { |v| normalized(v) }]
+    when ScoutApm::NumericHistogram
+      [obj.class, obj.marshal_dump]
+    else
+      [obj.class, (obj.instance_variables.map(&:to_sym) - SKIPPED_IVARS).sort.map { |ivar| [ivar, normalized(obj.instance_variable_get(ivar))] }]
+    end
+  end
+
+  def dump_metrics(rp)
+    # The meta's cached hash and type aren't written
+    rp.metric_set.metrics.map { |meta, stats| [ivars(meta, [:@hash_value, :@type]), ivars(stats)] }
+  end
+
+  def dump_db_query_metrics(rp)
+    rp.db_query_metric_set.metrics.map { |key, stats| [key, ivars(stats, [:@key])] }
+  end
+
+  def dump_histograms(rp)
+    rp.histograms.map { |report| [report.name, report.histogram.marshal_dump] }
+  end
+end
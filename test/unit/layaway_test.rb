@@ -41,4 +41,95 @@ class LayawayTest < Minitest::Test
 
     layaway.delete_files_for(:all)
   end
+
+  def test_with_merged_claim_merges_every_file
+    layaway, timestamp = layaway_with_files(3)
+
+    yielded = nil
+    assert layaway.with_merged_claim(timestamp) { |merged, count| yielded = [merged, count] }
+
+    merged, count = yielded
+    assert_equal 3, count
+    assert_equal timestamp, merged.timestamp
+    assert_equal 3, merged.request_count
+    assert_equal [], Dir[layaway.directory + "scout_*.data"]
+  end
+
+  def test_with_merged_claim_skips_unreadable_files
+    layaway, timestamp = layaway_with_files(2)
+    File.open(layaway.directory + "scout_#{timestamp.strftime(ScoutApm::Layaway::TIME_FORMAT)}_99999.data", "wb") { |f| f.write("garbage") }
+
+    count = nil
+    layaway.with_merged_claim(timestamp) { |_, c| count = c }
+
+    assert_equal 2, count
+  end
+
+  def test_with_merged_claim_without_files
+    layaway, timestamp = layaway_with_files(0)
+
+    assert layaway.with_merged_claim(timestamp) { flunk "Nothing to yield" }
+    assert_equal [], Dir[layaway.directory + "scout_*.data"]
+  end
+
+  def test_with_merged_claim_when_another_process_has_the_claim
+    layaway, timestamp = layaway_with_files(1)
+    FileUtils.touch(layaway.directory + "scout_#{timestamp.strftime(ScoutApm::Layaway::TIME_FORMAT)}_coordinator.data")
+
+    assert_equal false, layaway.with_merged_claim(timestamp) { flunk "Shouldn't have the claim" }
+    layaway.delete_files_for(:all)
+  end
+
+  def test_delete_stale_files_removes_abandoned_temp_files
+    layaway, timestamp = layaway_with_files(1)
+    stale = layaway.directory + "scout_#{timestamp.strftime(ScoutApm::Layaway::TIME_FORMAT)}_10001.data.10001.tmp"
+    fresh = layaway.directory + "scout_#{timestamp.strftime(ScoutApm::Layaway::TIME_FORMAT)}_10002.data.10002.tmp"
+    FileUtils.touch(stale, :mtime => Time.now - 3600)
+    FileUtils.touch(fresh)
+
+    layaway.delete_stale_files(Time.now - ScoutApm::Layaway::STALE_AGE)
+
+    assert !File.exist?(stale)
+    assert File.exist?(fresh)
+  ensure
+    FileUtils.rm_f([stale, fresh]) if fresh
+    layaway.delete_files_for(:all) if layaway
+  end
+
+  def test_writes_the_native_format_only_when_configured
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+
+    FileUtils.mkdir_p '/tmp/scout_apm_test/layaway_format'
+    rp = ScoutApm::StoreReportingPeriod.new(ScoutApm::StoreReportingPeriodTimestamp.minutes_ago(2))
+    ["marshal", "native"].each do |format|
+      config = make_fake_config("data_file" => "/tmp/scout_apm_test/layaway_format", "layaway_format" => format)
+      layaway = ScoutApm::Layaway.new(config, ScoutApm::Agent.instance.environment)
+      layaway.delete_files_for(:all)
+      layaway.write_reporting_period(rp)
+
+      written = File.binread(Dir[layaway.directory + "scout_*.data"].first, 8)
+      assert_equal format == "native", written == ScoutApm::NativeLayawayFormat::MAGIC, format
+      layaway.delete_files_for(:all)
+    end
+  end
+
+  # Writes +count+ layaway files for one timestamp, as separate processes
+  # would, each with a single request.
+  def layaway_with_files(count)
+    FileUtils.mkdir_p '/tmp/scout_apm_test/merged_claim'
+    config = make_fake_config("data_file" => "/tmp/scout_apm_test/merged_claim")
+    layaway = ScoutApm::Layaway.new(config, ScoutApm::Agent.instance.environment)
+    layaway.delete_files_for(:all)
+
+    timestamp = ScoutApm::StoreReportingPeriodTimestamp.minutes_ago(2)
+    count.times do |i|
+      rp = ScoutApm::StoreReportingPeriod.new(timestamp)
+      meta = ScoutApm::MetricMeta.new("Controller/users/show")
+      rp.absorb_metrics!(meta => ScoutApm::MetricStats.new.update!(0.1 * (i + 1)))
+      path = layaway.directory + "scout_#{timestamp.strftime(ScoutApm::Layaway::TIME_FORMAT)}_#{10_000 + i}.data"
+      ScoutApm::LayawayFile.new(path).write(rp)
+    end
+
+    [layaway, timestamp]
+  end
 end
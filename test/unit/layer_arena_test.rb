@@ -0,0 +1,117 @@
+require 'test_helper'
+
+class LayerArenaTest < Minitest::Test
+  def test_records_a_closed_layer
+    arena = ScoutApm::LayerArena.new
+    layer = ScoutApm::Layer.new("ActiveRecord", "User/find", 1_000)
+    layer.desc = "SELECT * FROM users"
+    layer.annotate_layer(:record_count => 2)
+    layer.subscopable!
+    record(arena, layer, nil, 251_000)
+
+    recorded = arena.root
+    assert_equal ScoutApm::ArenaLayer, recorded.class
+    assert_equal "ActiveRecord", recorded.type
+    assert_equal "User/find", recorded.name
+    assert_equal "ActiveRecord/User/find", recorded.legacy_metric_name
+    assert_equal "SELECT * FROM users", recorded.desc
+    assert_equal({:record_count => 2}, recorded.annotations)
+    assert recorded.subscopable?
+    assert_nil recorded.backtrace
+    assert_equal 250_000 / 1e9, recorded.total_call_time
+  end
+
+  def test_keeps_backtraces
+    arena = ScoutApm::LayerArena.new
+    layer = ScoutApm::Layer.new("ActiveRecord", "User/find")
+    layer.capture_backtrace!
+    record(arena, layer)
+
+    assert_equal layer.backtrace, arena.root.backtrace
+    assert_equal !!layer.backtrace_parsed?, arena.root.backtrace_parsed?
+  end
+
+  def test_exclusive_times_leave_out_children
+    arena = ScoutApm::LayerArena.new
+    record(arena, ScoutApm::Layer.new("Controller", "users/index", 0), nil, 1_000_000) do |root|
+      record(arena, ScoutApm::Layer.new("View", "users/index", 100_000), root, 700_000) do |view|
+        record(arena, ScoutApm::Layer.new("ActiveRecord", "User/find", 200_000), view, 300_000)
+      end
+      record(arena, ScoutApm::Layer.new("ActiveRecord", "User/find", 800_000), root, 900_000)
+    end
+
+    assert_equal 4, arena.size
+    assert_in_delta 0.0003, arena.root.total_exclusive_time, 1e-12 # 1ms - 0.6ms - 0.1ms
+    assert_in_delta 0.0005, arena.layer(1).total_exclusive_time, 1e-12 # 0.6ms - 0.1ms
+    assert_equal [arena.layer(1), arena.layer(3)], arena.root.children
+    assert_equal [arena.layer(2)], arena.layer(1).children
+  end
+
+  def test_find_the_first_layer_of_a_type
+    arena = ScoutApm::LayerArena.new
+    record(arena, ScoutApm::Layer.new("Middleware", "Rack")) do |root|
+      record(arena, ScoutApm::Layer.new("Controller", "users/index"), root) do |controller|
+        record(arena, ScoutApm::Layer.new("Controller", "users/show"), controller)
+      end
+    end
+
+    assert_equal "users/index", arena.find(["Job", "Controller"]).name
+    assert_nil arena.find(["Job"])
+  end
+
+  def test_layers_on_the_same_record_are_equal
+    arena = ScoutApm::LayerArena.new
+    record(arena, ScoutApm::Layer.new("Controller", "users/index")) do |root|
+      record(arena, ScoutApm::Layer.new("View", "users/index"), root)
+    end
+
+    cursor = arena.layer(0)
+    assert_equal arena.layer(1), cursor.dup.move_to(1)
+    refute_equal arena.layer(1), cursor
+    assert_equal arena.layer(1).hash, arena.layer(0).move_to(1).hash
+
+    other = ScoutApm::LayerArena.new
+    record(other, ScoutApm::Layer.new("Controller", "users/index"))
+    refute_equal arena.layer(0), other.layer(0)
+  end
+
+  def test_marshals
+    arena = ScoutApm::LayerArena.new(10, 0)
+    record(arena, ScoutApm::Layer.new("Controller", "users/index"), nil, 1_000) do |root|
+      3.times { record(arena, ScoutApm::Layer.new("ActiveRecord", "User/find"), root) }
+    end
+    arena.cpu_time = 0.5
+
+    loaded = Marshal.load(Marshal.dump(arena))
+
+    assert_equal arena.size, loaded.size
+    assert_equal "users/index", loaded.root.name
+    assert_equal arena.root.total_call_time, loaded.root.total_call_time
+    assert_equal 0.5, loaded.root.cpu_time
+    assert_equal 3, loaded.layer(1).count
+  end
+
+  def test_clear_drops_every_record
+    arena = ScoutApm::LayerArena.new
+    record(arena, ScoutApm::Layer.new("Controller", "users/index"))
+    arena.clear
+
+    assert arena.empty?
+    assert_nil arena.root
+  end
+
+  #############
+  #  Helpers  #
+  #############
+
+  # Records +layer+ under +parent+ as TrackedRequest does. Layers recorded in
+  # the block are its children.
+  def record(arena, layer, parent = nil, stop_ns = nil)
+    index = arena.open(layer, parent)
+    yield index if block_given?
+    stop_ns ? layer.record_stop_time!(stop_ns) : layer.record_stop_time!
+    layer.record_allocations_and_gc!
+    arena.stop(index, layer)
+    arena.close(index, layer)
+  end
+end
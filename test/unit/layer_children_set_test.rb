@@ -5,43 +5,40 @@ class LayerChildrenSetTest < Minitest::Test
   SET = ScoutApm::LayerChildrenSet
 
   def test_limit_default
-    assert_equal SET::DEFAULT_UNIQUE_CUTOFF, SET.new.unique_cutoff
+    assert_equal SET::DEFAULT_UNIQUE_CUTOFF, SET.new(ScoutApm::LayerArena.new, 0).unique_cutoff
   end
 
   # Add 5, make sure they're all in the children list we get back.
   def test_add_layer_before_limit
-    s = SET.new(5)
+    arena(5)
 
     5.times do
-      s << make_layer("LayerType", "LayerName")
+      add_child("LayerType", "LayerName")
     end
 
-    children = s.to_a
+    children = root_children
     assert_equal 5, children.size
 
-    # Don't care about order
     (0..4).each do |i|
       assert children.include?(lookup_layer(i))
     end
   end
 
   def test_add_layer_after_limit
-    s = SET.new(5)
+    arena(5)
 
     10.times do
-      s << make_layer("LayerType", "LayerName")
+      add_child("LayerType", "LayerName")
     end
 
-    children = s.to_a
+    children = root_children
     # 6 = 5 real ones + 1 merged.
     assert_equal 6, children.size
 
-    # Don't care about order
     (0..4).each do |i|
       assert children.include?(lookup_layer(i))
     end
 
-    # Don't care about order
     (5..9).each do |i|
       assert ! children.include?(lookup_layer(i))
     end
@@ -49,18 +46,21 @@ class LayerChildrenSetTest < Minitest::Test
     limited_layer = children.last
     assert_equal ScoutApm::LimitedLayer, limited_layer.class
     assert_equal 5, limited_layer.count
+
+    # The limited children's records are reused, only the LimitedLayer's is left
+    assert_equal 7, @arena.size
   end
 
   def test_add_layer_with_different_type_after_limit
-    s = SET.new(5)
+    arena(5)
 
     # Add 20 items
     10.times do
-      s << make_layer("LayerType", "LayerName")
-      s << make_layer("DifferentLayerType", "LayerName")
+      add_child("LayerType", "LayerName")
+      add_child("DifferentLayerType", "LayerName")
     end
 
-    children = s.to_a
+    children = root_children
 
     # Tyo types, so 2 distinct limitdlayer objects
     limited_layers = children.select{ |l| ScoutApm::LimitedLayer === l }
@@ -71,18 +71,110 @@ class LayerChildrenSetTest < Minitest::Test
     limited_layers.each { |ml| assert_equal 5, ml.count }
   end
 
+  def test_children_keep_the_order_they_ran_in
+    arena(5)
+
+    4.times do
+      add_child("LayerType", "LayerName")
+      add_child("DifferentLayerType", "LayerName")
+    end
+
+    assert_equal (0..7).map { |i| lookup_layer(i) }, root_children
+  end
+
+  def test_limited_children_are_dropped_with_their_own_children
+    arena(1)
+
+    add_child("View", "users/_user")
+    add_child("View", "users/_user") { add_child("ActiveRecord", "User/find") }
+
+    children = root_children
+    assert_equal [lookup_layer(0), ScoutApm::LimitedLayer], [children[0], children[1].class]
+    assert_equal 3, @arena.size
+  end
+
+  def test_merges_identical_children_after_merge_after
+    arena(5, 2)
+
+    10.times do |i|
+      add_child("ActiveRecord", "User/find", "SELECT * FROM users WHERE id = ?", 1000 * i, 10 * (i + 1))
+    end
+
+    children = root_children
+    # 2 before merging starts, then the 3rd, with the 7 after it merged in
+    assert_equal 3, children.size
+    assert_equal [lookup_layer(0), lookup_layer(1)], children[0, 2]
+
+    merged = children.last
+    assert_equal ScoutApm::MergedLayer, merged.class
+    assert_equal 8, merged.count
+    assert_equal lookup_layer(2), merged.layer
+    assert_equal "SELECT * FROM users WHERE id = ?", merged.desc
+    assert_in_delta (3..10).inject(0) { |sum, i| sum + 10 * i } / 1e9, merged.total_call_time, 1e-12
+    assert_in_delta 30 / 1e9, merged.timing.min_call_time, 1e-12
+    assert_in_delta 100 / 1e9, merged.timing.max_call_time, 1e-12
+  end
+
+  def test_merged_children_take_one_slot_towards_the_cutoff
+    arena(5, 0)
+
+    100.times { add_child("ActiveRecord", "User/find", "SELECT 1") }
+    4.times { |i| add_child("ActiveRecord", "User/find", "SELECT #{i + 2}") }
+
+    children = root_children
+    assert_equal 5, children.size
+    assert_equal 100, children.first.count
+    assert children.none? { |l| ScoutApm::LimitedLayer === l }
+  end
+
+  def test_only_identical_childless_children_are_merged
+    arena(10, 0)
+
+    add_child("ActiveRecord", "User/find", "SELECT 1")
+    add_child("ActiveRecord", "User/find", "SELECT 2")
+    add_child("ActiveRecord", "User/save", "SELECT 1")
+    add_child("ActiveRecord", "User/find", "SELECT 1") { |l| l.annotate_layer(:ignorable => true) }
+    add_child("ActiveRecord", "User/find", "SELECT 1") { add_child("HTTP", "GET") }
+
+    assert_equal 5, root_children.size
+    assert root_children.none? { |l| ScoutApm::MergedLayer === l }
+  end
+
   #############
   #  Helpers  #
   #############
 
-  def make_layer(type, name)
+  # An arena with a running root layer for the children to be added under
+  def arena(unique_cutoff, merge_after = SET::DEFAULT_MERGE_AFTER)
+    @arena = ScoutApm::LayerArena.new(unique_cutoff, merge_after)
+    @open = [@arena.open(ScoutApm::Layer.new("Controller", "users/index"), nil)]
+  end
+
+  # Records a child of the innermost running layer, as TrackedRequest does.
+  # Layers added in the block are its children.
+  def add_child(type, name, desc = nil, start_ns = 0, duration_ns = 0)
     @made_layers ||= []
-    l = ScoutApm::Layer.new(type, name)
-    @made_layers << l
-    l
+    l = ScoutApm::Layer.new(type, name, start_ns)
+    l.desc = desc
+    index = @arena.open(l, @open.last)
+    @made_layers << index if @open.size == 1
+
+    @open.push(index)
+    yield l if block_given?
+    @open.pop
+
+    l.record_stop_time!(start_ns + duration_ns)
+    l.record_allocations_and_gc!
+    @arena.stop(index, l)
+    @arena.close(index, l)
+  end
+
+  def root_children
+    @arena.children(0)
   end
 
+  # The record of the i-th child added, even if it's since been merged
   def lookup_layer(i)
-    @made_layers[i]
+    ScoutApm::ArenaLayer.new(@arena, @made_layers[i])
   end
 end
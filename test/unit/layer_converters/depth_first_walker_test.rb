@@ -4,9 +4,10 @@ module ScoutApm
 class DepthFirstWalkerTest < Minitest::Test
   def test_walk_single_node_calls_callbacks_in_order
     calls = []
-    layer = Layer.new("A", "x")
+    arena = LayerArena.new
+    record(arena, "A")
 
-    walker = LayerConverters::DepthFirstWalker.new(layer)
+    walker = LayerConverters::DepthFirstWalker.new(arena)
     walker.before { |l| calls << :before }
     walker.after { |l| calls << :after }
     walker.on { |l| calls << :on }
@@ -26,23 +27,19 @@ class DepthFirstWalkerTest < Minitest::Test
   # F  G
   def test_walk_interesting_tree
     calls = []
-    a = Layer.new("A", "x")
-    b = Layer.new("B", "x")
-    c = Layer.new("C", "x")
-    d = Layer.new("D", "x")
-    e = Layer.new("E", "x")
-    f = Layer.new("F", "x")
-    g = Layer.new("G", "x")
-    a.add_child(b)
-    b.add_child(c)
-    b.add_child(d)
-    b.add_child(e)
-    c.add_child(f)
-    c.add_child(g)
-
-    root_layer = a
-
-    walker = LayerConverters::DepthFirstWalker.new(root_layer)
+    arena = LayerArena.new
+    record(arena, "A") do |a|
+      record(arena, "B", a) do |b|
+        record(arena, "C", b) do |c|
+          record(arena, "F", c)
+          record(arena, "G", c)
+        end
+        record(arena, "D", b)
+        record(arena, "E", b)
+      end
+    end
+
+    walker = LayerConverters::DepthFirstWalker.new(arena)
     walker.before { |l| calls << "#{l.type} before" }
     walker.after { |l| calls << "#{l.type} after" }
     walker.on { |l| calls << "#{l.type} on" }
@@ -62,5 +59,66 @@ class DepthFirstWalkerTest < Minitest::Test
       "A after"
     ], calls
   end
+
+  def test_walk_very_deep_tree
+    arena = LayerArena.new
+    layers = [Layer.new("Controller", "x")]
+    open = [arena.open(layers.first, nil)]
+    10_000.times do |i|
+      layers << Layer.new("Layer#{i}", "x")
+      open << arena.open(layers.last, open.last)
+    end
+    until open.empty?
+      close(arena, open.pop, layers.pop)
+    end
+
+    depth = 0
+    max_depth = 0
+    walker = LayerConverters::DepthFirstWalker.new(arena)
+    walker.before { |l| depth += 1; max_depth = depth if depth > max_depth }
+    walker.after { |l| depth -= 1 }
+
+    walker.walk
+
+    assert_equal 10_001, max_depth
+    assert_equal 0, depth
+  end
+
+  def test_walk_reads_merged_layers_in_place
+    arena = LayerArena.new(2, 1)
+    record(arena, "Controller") do |root|
+      3.times { record(arena, "ActiveRecord", root) }
+      record(arena, "View", root)
+    end
+
+    walked = []
+    walker = LayerConverters::DepthFirstWalker.new(arena)
+    walker.on { |l| walked << l.class }
+    walker.walk
+
+    assert_equal [ArenaLayer, ArenaLayer, MergedLayer, ArenaLayer], walked
+  end
+
+  def test_walk_without_layers
+    walker = LayerConverters::DepthFirstWalker.new(LayerArena.new)
+    walker.on { |l| flunk "walked #{l}" }
+    walker.walk
+  end
+
+  # Records a layer of +type+ under the record +parent+, the way a
+  # TrackedRequest does. Layers recorded in the block are its children.
+  def record(arena, type, parent = nil)
+    layer = Layer.new(type, "x")
+    index = arena.open(layer, parent)
+    yield index if block_given?
+    close(arena, index, layer)
+  end
+
+  def close(arena, index, layer)
+    layer.record_stop_time!
+    layer.record_allocations_and_gc!
+    arena.stop(index, layer)
+    arena.close(index, layer)
+  end
 end
 end
@@ -8,8 +8,9 @@ class MetricConverterTest < Minitest::Test
 
   def test_register_adds_hooks
     mc = MetricConverter.new(faux_request, faux_layer_finder, faux_store)
-    faux_walker.expects(:on)
-    mc.register_hooks(faux_walker)
+    walker = faux_walker(subscope_stubs: false)
+    walker.expects(:on)
+    mc.register_hooks(walker)
   end
 
   def test_record
@@ -21,7 +21,7 @@ module ScoutApm
 
       def faux_layer_finder
         @layer_finder ||= stub
-        @layer_finder.stubs(scope: stub)
+        @layer_finder.stubs(scope: stub(:legacy_metric_name => "Controller/faux/show"))
         @layer_finder
       end
 
@@ -0,0 +1,167 @@
+require 'test_helper'
+
+require 'scout_apm/layer_records'
+
+class LayerRecordsTest < Minitest::Test
+  def test_records_times_and_allocations
+    records = ScoutApm::LayerRecords.new
+    fill(records)
+
+    assert_equal 4, records.size
+    assert_nil records.parent(0)
+    assert_equal 1, records.parent(2)
+    assert_equal 7, records.type_id(2)
+
+    assert_equal 1.0, records.total_call_time(0)
+    assert_equal 0.25, records.total_exclusive_time(0)      # 1.0 - 0.5 - 0.25
+    assert_equal 0.5, records.total_call_time(1)
+    assert_equal 0.4, records.total_exclusive_time(1)       # 0.5 - 0.1
+    assert_equal 100, records.total_allocations(0)
+    assert_equal 40, records.total_exclusive_allocations(0) # 100 - 50 - 10
+    assert_equal 2, records.total_gc_count(1)
+    assert_equal 0.125, records.total_gc_time(1)
+  end
+
+  def test_times_read_as_zero_until_stopped
+    records = ScoutApm::LayerRecords.new
+    records.open(0, nil, 1_000)
+
+    assert_nil records.stop_ns(0)
+    assert_equal 0.0, records.total_call_time(0)
+  end
+
+  def test_flags
+    records = ScoutApm::LayerRecords.new
+    records.open(0, nil, 0)
+    records.flag!(0, ScoutApm::LayerRecords::SUBSCOPABLE)
+
+    assert records.flag?(0, ScoutApm::LayerRecords::SUBSCOPABLE)
+    assert !records.flag?(0, ScoutApm::LayerRecords::BACKTRACE_PARSED)
+  end
+
+  def test_truncate_drops_the_last_records
+    records = ScoutApm::LayerRecords.new
+    fill(records)
+    records.truncate(2)
+
+    assert_equal 2, records.size
+    assert_raises(IndexError) { records.type_id(2) }
+    assert_equal 2, records.open(3, 1, 0)
+  end
+
+  def test_index_of_type
+    records = ScoutApm::LayerRecords.new
+    fill(records)
+
+    assert_equal 1, records.index_of_type([7, 3])
+    assert_nil records.index_of_type([9])
+  end
+
+  def test_bad_indexes_raise
+    records = ScoutApm::LayerRecords.new
+
+    assert_raises(IndexError) { records.total_call_time(0) }
+    assert_raises(IndexError) { records.open(0, 0, 0) }
+  end
+
+  def test_marshal_round_trip
+    records = ScoutApm::LayerRecords.new
+    fill(records)
+
+    assert_same_records records, Marshal.load(Marshal.dump(records))
+  end
+
+  def test_marshal_load_rejects_parents_out_of_range
+    [PureRecords, ScoutApm::LayerRecords].uniq.each do |klass|
+      records = klass.new
+      fill(records)
+      data = records.marshal_dump
+
+      [3, 4, -2].each do |parent|
+        corrupt = data.dup
+        corrupt[8 + 4 * 4 + 4 * 3, 4] = [parent].pack("l") # record 3's parent
+        assert_raises(ArgumentError, "#{klass} with parent #{parent}") { klass.allocate.marshal_load(corrupt) }
+      end
+      assert_raises(ArgumentError, klass.to_s) { klass.allocate.marshal_load(data[0, data.size - 1]) }
+    end
+  end
+
+  def test_clear_frees_every_record
+    records = ScoutApm::LayerRecords.new
+    fill(records)
+    records.clear
+
+    assert_equal 0, records.size
+    assert_equal 0, records.open(0, nil, 0)
+  end
+
+  ################################################################################
+  # The native extension must behave exactly like the pure-Ruby version
+
+  class PureRecords
+    include ScoutApm::PureLayerRecords
+  end
+
+  def test_native_matches_pure_ruby
+    skip "Native layer records not loaded" unless native?
+
+    native = ScoutApm::LayerRecords.new
+    pure = PureRecords.new
+    fill(native)
+    fill(pure)
+
+    assert_same_records pure, native
+    assert_equal pure.marshal_dump, native.marshal_dump
+  end
+
+  def test_native_loads_marshal_from_pure_ruby
+    skip "Native layer records not loaded" unless native?
+
+    pure = PureRecords.new
+    fill(pure)
+
+    native = ScoutApm::LayerRecords.allocate
+    native.marshal_load(pure.marshal_dump)
+    assert_same_records pure, native
+
+    pure = PureRecords.allocate
+    pure.marshal_load(native.marshal_dump)
+    assert_same_records native, pure
+  end
+
+  def test_native_rejects_other_data
+    skip "Native layer records not loaded" unless native?
+
+    assert_raises(ArgumentError) { ScoutApm::LayerRecords.allocate.marshal_load("nope") }
+    assert_raises(ArgumentError) { ScoutApm::LayerRecords.allocate.marshal_load([5].pack("q")) }
+  end
+
+  def native?
+    defined?(ScoutApm::LayerRecords::NATIVE)
+  end
+
+  # Controller (1s) > [ActiveRecord (0.5s) > HTTP (0.1s)], View (0.25s)
+  def fill(records)
+    records.open(0, nil, 0)
+    records.open(3, 0, 100_000_000)
+    records.open(7, 1, 200_000_000)
+    records.stop(2, 300_000_000, 10, 0, 0.0)
+    records.stop(1, 600_000_000, 50, 2, 0.125)
+    records.open(3, 0, 700_000_000)
+    records.stop(3, 950_000_000, 10, 0, 0)
+    records.flag!(3, ScoutApm::LayerRecords::BACKTRACE_PARSED)
+    records.stop(0, 1_000_000_000, 100, 3, 0.5)
+  end
+
+  FIELDS = [:type_id, :parent, :start_ns, :stop_ns, :total_call_time, :total_exclusive_time,
+            :total_allocations, :total_exclusive_allocations, :total_gc_count, :total_gc_time]
+  FLAGS = [ScoutApm::LayerRecords::SUBSCOPABLE, ScoutApm::LayerRecords::BACKTRACE_PARSED]
+
+  def assert_same_records(expected, actual)
+    assert_equal expected.size, actual.size
+    expected.size.times do |i|
+      assert_equal FIELDS.map { |field| expected.send(field, i) }, FIELDS.map { |field| actual.send(field, i) }, "record #{i}"
+      assert_equal FLAGS.map { |flag| expected.flag?(i, flag) }, FLAGS.map { |flag| actual.flag?(i, flag) }, "flags of record #{i}"
+    end
+  end
+end
@@ -31,6 +31,15 @@ class LimitedLayerTest < Minitest::Test
     assert_equal 600, ll.total_allocations            # 400 + 200
   end
 
+  def test_sums_gc_while_absorbing
+    ll = ScoutApm::LimitedLayer.new("ActiveRecord")
+
+    ll.absorb faux_layer("ActiveRecord", "User#Find", 2, 1, 200, 100, 0.5, 1)
+    ll.absorb faux_layer("ActiveRecord", "User#Find", 4, 3, 400, 300, 0.25, 2)
+    assert_equal 0.75, ll.total_gc_time
+    assert_equal 3, ll.total_gc_count
+  end
+
   def test_the_name
     ll = ScoutApm::LimitedLayer.new("ActiveRecord")
     assert_equal "ActiveRecord/Limited", ll.legacy_metric_name
@@ -40,7 +49,7 @@ class LimitedLayerTest < Minitest::Test
   #  Helpers  #
   #############
 
-  def faux_layer(type, name, tct, tet, a_tct, a_tet)
+  def faux_layer(type, name, tct, tet, a_tct, a_tet, gc_time = 0, gc_count = 0)
     OpenStruct.new(
       :type => type,
       :name => name,
@@ -48,6 +57,8 @@ class LimitedLayerTest < Minitest::Test
       :total_exclusive_time => tet,
       :total_allocations => a_tct,
       :total_exclusive_allocations => a_tet,
+      :total_gc_time => gc_time,
+      :total_gc_count => gc_count,
     )
   end
 end
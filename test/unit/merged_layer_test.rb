@@ -0,0 +1,77 @@
+require 'test_helper'
+require 'ostruct'
+
+class MergedLayerTest < Minitest::Test
+
+  def test_keeps_the_first_layers_details
+    first = faux_layer("ActiveRecord", "User#Find", 2, 1, 200, 100)
+    ml = ScoutApm::MergedLayer.new(first)
+    ml.absorb faux_layer("ActiveRecord", "User#Find", 4, 3, 400, 300)
+
+    assert_equal first, ml.layer
+    assert_equal "ActiveRecord", ml.type
+    assert_equal "User#Find", ml.name
+    assert_equal "SELECT 1", ml.desc
+    assert_equal "ActiveRecord/User#Find", ml.legacy_metric_name
+    assert_equal 2, ml.count
+  end
+
+  def test_sums_values_while_absorbing
+    ml = ScoutApm::MergedLayer.new(faux_layer("ActiveRecord", "User#Find", 2, 1, 200, 100, 0.5, 1))
+    ml.absorb faux_layer("ActiveRecord", "User#Find", 4, 3, 400, 300, 0.25, 2)
+
+    assert_equal 4, ml.total_exclusive_time           # 3 + 1
+    assert_equal 6, ml.total_call_time                # 4 + 2
+    assert_equal 400, ml.total_exclusive_allocations  # 300 + 100
+    assert_equal 600, ml.total_allocations            # 400 + 200
+    assert_equal 0.75, ml.total_gc_time
+    assert_equal 3, ml.total_gc_count
+
+    assert_equal 1, ml.timing.min_call_time
+    assert_equal 3, ml.timing.max_call_time
+  end
+
+  def test_keeps_the_first_backtrace
+    ml = ScoutApm::MergedLayer.new(faux_layer("ActiveRecord", "User#Find", 2, 1, 200, 100))
+    assert_nil ml.backtrace
+
+    ml.absorb faux_layer("ActiveRecord", "User#Find", 2, 1, 200, 100).tap { |l| l.backtrace = ["app/models/user.rb:10"] }
+    ml.absorb faux_layer("ActiveRecord", "User#Find", 2, 1, 200, 100).tap { |l| l.backtrace = ["app/models/user.rb:20"] }
+    assert_equal ["app/models/user.rb:10"], ml.backtrace
+  end
+
+  def test_db_query_metric_stats_cover_every_query
+    ml = ScoutApm::MergedLayer.new(faux_layer("ActiveRecord", "User#Find", 2, 2, 200, 100, 0, 0, 4))
+    ml.absorb faux_layer("ActiveRecord", "User#Find", 6, 6, 400, 300, 0, 0, 1)
+
+    stats = ScoutApm::DbQueryMetricStats.from_merged_layer("User", "find", "Controller/users/index", ml)
+    assert_equal 2, stats.call_count
+    assert_equal 8, stats.call_time
+    assert_equal 2, stats.min_call_time
+    assert_equal 6, stats.max_call_time
+    assert_equal 5, stats.rows_returned
+    assert_equal 1, stats.min_rows_returned
+    assert_equal 4, stats.max_rows_returned
+    assert_equal 2, stats.histogram.total
+  end
+
+  #############
+  #  Helpers  #
+  #############
+
+  def faux_layer(type, name, tct, tet, a_tct, a_tet, gc_time = 0, gc_count = 0, record_count = 0)
+    OpenStruct.new(
+      :type => type,
+      :name => name,
+      :desc => "SELECT 1",
+      :annotations => {:record_count => record_count},
+      :legacy_metric_name => "#{type}/#{name}",
+      :total_call_time => tct,
+      :total_exclusive_time => tet,
+      :total_allocations => a_tct,
+      :total_exclusive_allocations => a_tet,
+      :total_gc_time => gc_time,
+      :total_gc_count => gc_count,
+    )
+  end
+end
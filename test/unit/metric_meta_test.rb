@@ -0,0 +1,75 @@
+require 'test_helper'
+
+module ScoutApm
+  class MetricMetaTest < Minitest::Test
+    def teardown
+      ScoutApm::MetricMeta.clear_interned!
+    end
+
+    def test_intern_returns_the_same_frozen_meta
+      a = ScoutApm::MetricMeta.intern("ActiveRecord/all", "Controller/users/index")
+      b = ScoutApm::MetricMeta.intern("ActiveRecord/all".dup, "Controller/users/index".dup)
+
+      assert a.equal?(b)
+      assert a.frozen?
+      assert_equal "ActiveRecord/all", a.metric_name
+      assert_equal "Controller/users/index", a.scope
+    end
+
+    def test_intern_separates_scopes
+      scoped = ScoutApm::MetricMeta.intern("ActiveRecord/all", "Controller/users/index")
+      unscoped = ScoutApm::MetricMeta.intern("ActiveRecord/all")
+
+      refute scoped.equal?(unscoped)
+      assert_nil unscoped.scope
+    end
+
+    def test_interned_meta_is_eql_to_a_new_one
+      interned = ScoutApm::MetricMeta.intern("View/users/show", "Controller/users/show")
+      built = ScoutApm::MetricMeta.new("View/users/show", :scope => "Controller/users/show")
+
+      assert interned.eql?(built)
+      assert built.eql?(interned)
+      assert_equal interned.hash, built.hash
+
+      metrics = { built => :found }
+      assert_equal :found, metrics[interned]
+    end
+
+    def test_intern_stops_sharing_when_full
+      (ScoutApm::MetricMeta::MAX_INTERNED - ScoutApm::MetricMeta.interned_count).times do |i|
+        ScoutApm::MetricMeta.intern("Custom/#{i}")
+      end
+
+      meta = ScoutApm::MetricMeta.intern("Custom/overflow")
+      refute meta.frozen?
+      refute meta.equal?(ScoutApm::MetricMeta.intern("Custom/overflow"))
+      assert_equal ScoutApm::MetricMeta::MAX_INTERNED, ScoutApm::MetricMeta.interned_count
+    end
+
+    def test_hash_is_reset_by_writers
+      meta = ScoutApm::MetricMeta.new("ActiveRecord/User/find")
+      old = meta.hash
+
+      meta.metric_name = "ActiveRecord/User/save"
+      refute_equal old, meta.hash
+      assert_equal ScoutApm::MetricMeta.new("ActiveRecord/User/save").hash, meta.hash
+
+      meta.scope = "Controller/users/index"
+      assert_equal ScoutApm::MetricMeta.new("ActiveRecord/User/save", :scope => "Controller/users/index").hash, meta.hash
+    end
+
+    def test_hash_survives_marshal
+      meta = ScoutApm::MetricMeta.new("ActiveRecord/User/find", :scope => "Controller/users/index", :desc => "SELECT 1")
+      meta.hash
+
+      loaded = Marshal.load(Marshal.dump(meta))
+      assert_equal meta.hash, loaded.hash
+      assert loaded.eql?(meta)
+    end
+
+    def test_hash_ignores_case_of_metric_name
+      assert ScoutApm::MetricMeta.new("ActiveRecord/User/find").eql?(ScoutApm::MetricMeta.new("activerecord/user/find"))
+    end
+  end
+end
@@ -0,0 +1,59 @@
+require 'test_helper'
+
+class OverheadTest < Minitest::Test
+  def setup
+    ScoutApm::Overhead.drain
+  end
+
+  def test_slot_registers_once
+    slot = ScoutApm::Overhead.slot("Test/registers_once")
+    assert_equal slot, ScoutApm::Overhead.slot("Test/registers_once")
+    assert_equal "Test/registers_once", ScoutApm::Overhead.names[slot]
+  end
+
+  def test_record_and_drain
+    slot = ScoutApm::Overhead.slot("Test/record")
+
+    3.times do
+      mark = ScoutApm::Overhead.mark
+      sleep 0.002
+      ScoutApm::Overhead.record(slot, mark)
+    end
+
+    count, total_ns, min_ns, max_ns = ScoutApm::Overhead.drain["Test/record"]
+    assert_equal 3, count
+    assert min_ns >= 2_000_000
+    assert max_ns >= min_ns
+    assert total_ns >= 3 * min_ns
+
+    assert_nil ScoutApm::Overhead.drain["Test/record"]
+  end
+
+  def test_measure_records_when_raising
+    slot = ScoutApm::Overhead.slot("Test/raising")
+    assert_raises(RuntimeError) { ScoutApm::Overhead.measure(slot) { raise "boom" } }
+    assert_equal 1, ScoutApm::Overhead.drain["Test/raising"][0]
+  end
+
+  def test_sampler_reports_agent_overhead_metrics
+    store = ScoutApm::Store.new
+    ScoutApm::Overhead.measure(ScoutApm::Overhead::LAYAWAY_WRITE) { }
+    ScoutApm::Overhead.measure(ScoutApm::Overhead::LAYAWAY_WRITE) { }
+
+    metrics = ScoutApm::Instruments::AgentOverhead.new(Logger.new(StringIO.new)).
+      metrics(ScoutApm::StoreReportingPeriodTimestamp.new, store)
+
+    stat = metrics[ScoutApm::MetricMeta.new("Agent/Overhead/Layaway/write")]
+    assert_equal 2, stat.call_count
+    assert stat.total_call_time >= stat.max_call_time
+  end
+
+  def test_sqlsanitizer_counts_only_sanitizing
+    ScoutApm::Utils::SqlSanitizer.fingerprint_cache.clear
+    sql = ScoutApm::Utils::SqlSanitizer.new("SELECT * FROM users WHERE id = 1").tap { |s| s.database_engine = :postgres }
+    sql.to_s
+    sql.to_s
+
+    assert_equal 1, ScoutApm::Overhead.drain["SqlSanitizer/to_s"][0]
+  end
+end
@@ -0,0 +1,95 @@
+require 'test_helper'
+require 'tmpdir'
+
+class RemoteSocketTest < Minitest::Test
+  # Stands in for a TrackedRequest, which needs a running agent to record
+  class FauxRequest
+    attr_reader :name
+
+    def initialize(name)
+      @name = name
+    end
+
+    def recorded!; end
+    def prepare_to_dump!; end
+    def job?; true; end
+    def web?; false; end
+  end
+
+  class CollectingRecorder
+    attr_reader :requests
+
+    def initialize
+      @requests = Queue.new
+    end
+
+    def record!(request)
+      @requests << request
+    end
+  end
+
+  def setup
+    @dir = Dir.mktmpdir
+    @path = File.join(@dir, "scout_apm.sock")
+    @logger = Logger.new(StringIO.new)
+    @collected = CollectingRecorder.new
+    @server = ScoutApm::Remote::SocketServer.new(@path, ScoutApm::Remote::Router.new(@collected, @logger), @logger)
+  end
+
+  def teardown
+    @server.stop
+    FileUtils.remove_entry(@dir)
+  end
+
+  def test_records_arrive_at_the_server
+    @server.start
+    assert @server.running?
+
+    recorder = ScoutApm::Remote::SocketRecorder.new(@path, @logger).start
+    threads = 4.times.map do |t|
+      Thread.new { 25.times { |i| recorder.record!(FauxRequest.new("#{t}-#{i}")) } }
+    end
+    threads.each(&:join)
+    recorder.stop
+
+    names = 100.times.map { Timeout.timeout(5) { @collected.requests.pop.name } }
+    assert_equal 4.times.flat_map { |t| 25.times.map { |i| "#{t}-#{i}" } }.sort, names.sort
+  end
+
+  def test_replaces_a_stale_socket_file
+    UNIXServer.new(@path).close
+    assert File.socket?(@path)
+
+    @server.start
+    recorder = ScoutApm::Remote::SocketRecorder.new(@path, @logger)
+    recorder.record!(FauxRequest.new("after"))
+    assert_equal "after", Timeout.timeout(5) { @collected.requests.pop.name }
+  end
+
+  def test_refuses_a_socket_in_use
+    @server.start
+    other = ScoutApm::Remote::SocketServer.new(@path, stub(:router), @logger)
+    assert_raises(Errno::EADDRINUSE) { other.start }
+  end
+
+  def test_socket_is_only_open_to_its_owner
+    @server.start
+    assert_equal 0600, File.stat(@path).mode & 0777
+  end
+
+  def test_frames_split_from_a_stream
+    first = ScoutApm::Remote::Message.new('record', 'record!', 'first').encode
+    second = ScoutApm::Remote::Message.new('record', 'record!', 'second').encode
+    stream = ScoutApm::Remote::Message.frame(first) + ScoutApm::Remote::Message.frame(second)
+
+    buffer = stream[0, stream.bytesize - 3]
+    frames = []
+    ScoutApm::Remote::Message.each_frame!(buffer) { |frame| frames << frame }
+    assert_equal [first], frames
+
+    buffer << stream[-3, 3]
+    ScoutApm::Remote::Message.each_frame!(buffer) { |frame| frames << frame }
+    assert_equal [first, second], frames
+    assert_equal "", buffer
+  end
+end
@@ -62,4 +62,44 @@ class ScoredItemSetTest < Minitest::Test
     assert set.to_a.include?("called_12_posts/index"),  "Expected to see posts/index in #{set.to_a.inspect}"
     assert set.to_a.include?("called_13_posts/move"),   "Expected to see posts/move in #{set.to_a.inspect}"
   end
+
+  def test_keeps_the_highest_scores_of_many
+    set = ScoutApm::ScoredItemSet.new(50)
+    best = Hash.new(0)
+
+    (1..2000).to_a.shuffle.each do |score|
+      name = "controller/#{rand(500)}"
+      best[name] = score if score > best[name]
+      set << FakeScoredItem.new(name, score)
+    end
+
+    expected = best.sort_by { |name, score| -score }.first(50).map { |name, score| "called_#{score}_#{name}" }
+    assert_equal expected.sort, set.to_a.sort
+  end
+
+  def test_raising_a_score_keeps_it_from_eviction
+    set = ScoutApm::ScoredItemSet.new(2)
+
+    set << FakeScoredItem.new("users/index", 1)
+    set << FakeScoredItem.new("users/show", 5)
+    set << FakeScoredItem.new("users/index", 10)
+    set << FakeScoredItem.new("posts/index", 6)
+
+    assert_equal ["called_10_users/index", "called_6_posts/index"], set.to_a.sort
+  end
+
+  def test_sets_loaded_without_a_heap
+    set = ScoutApm::ScoredItemSet.new(2)
+    set << FakeScoredItem.new("users/index", 10)
+    set << FakeScoredItem.new("users/show", 11)
+
+    # As written before the heap existed
+    data = Marshal.dump(set).sub("@heap", "@xxxx").sub("@positions", "@xxxxxxxxx")
+    loaded = Marshal.load(data)
+    assert_nil loaded.instance_variable_get(:@heap)
+
+    loaded << FakeScoredItem.new("posts/index", 12)
+
+    assert_equal ["called_11_users/show", "called_12_posts/index"], loaded.to_a.sort
+  end
 end
@@ -0,0 +1,91 @@
+require 'test_helper'
+require 'json'
+
+class NativeJsonEncoderTest < Minitest::Test
+  Serializer = ScoutApm::Serializers::PayloadSerializerToJson
+
+  def setup
+    skip "json_encoder extension isn't built" unless Serializer::NATIVE
+  end
+
+  def test_matches_ruby_serializer
+    args = [
+      {:app_root => "/srv/app", :unique_id => "id\t\"quoted\"\n", :agent_version => 123, :started => Time.at(1500000000).utc, :payload_version => 2},
+      metrics,
+      [slow_transaction],
+      [],
+      [],
+      [],
+      db_query_metrics,
+    ]
+
+    assert_same_json Serializer.ruby_payload(*args), Serializer.native_payload(*args)
+  end
+
+  def test_matches_ruby_serializer_for_values
+    [
+      {},
+      [],
+      {:empty => [], :nested => {:a => [1, -2, nil, "x"]}},
+      {"string key" => "back\\slash \b\f\r"},
+      {:floats => [0.0, -0.0, 1.5, 0.1, 1.0e-05, 123456789012345.67, 1.0e+16, 2.0 ** 70, 5.0e-324, Float::MAX]},
+      {:big => 2 ** 70, :symbol => :sym, :bool => [true, false]},
+    ].each do |value|
+      assert_same_json value, value
+    end
+  end
+
+  def test_writes_to_io_in_chunks
+    value = {:metrics => ScoutApm::Serializers::NativeJsonEncoder::Metrics.new(metrics), :big => "x" * 200_000}
+    io = StringIO.new
+
+    written = ScoutApm::Serializers::NativeJsonEncoder.encode(value, io)
+
+    assert_equal io.string.bytesize, written
+    assert_equal ScoutApm::Serializers::NativeJsonEncoder.encode(value), io.string
+  end
+
+  private
+
+  def assert_same_json(ruby_value, native_value)
+    expected = Serializer.jsonify_hash(:value => ruby_value)
+    actual = ScoutApm::Serializers::NativeJsonEncoder.encode(:value => native_value)
+    assert_equal expected, actual
+    JSON.parse(actual)
+  end
+
+  def metrics
+    {
+      ScoutApm::MetricMeta.new('ActiveRecord/all', :scope => "Controller/apps/checkin", :desc => "SELECT * from \"users\" where filter=?").tap { |meta|
+        meta.extra = {:user => 'cooluser', :at => Time.at(1500000000).utc}
+      } => ScoutApm::MetricStats.new.tap { |stats|
+        stats.call_count = 16
+        stats.max_call_time = 0.005338062
+        stats.min_call_time = 0.000613518
+        stats.total_call_time = 0.033245704
+        stats.total_exclusive_time = 0.033245704
+      },
+      ScoutApm::MetricMeta.new("Controller/apps/checkin") => ScoutApm::MetricStats.new.tap { |stats|
+        stats.call_count = 2
+        stats.total_call_time = 0.113403176
+        stats.total_exclusive_time = 0.07813208899999999
+      },
+      ScoutApm::MetricMeta.new("Errors") => ScoutApm::MetricStats.new,
+    }
+  end
+
+  def slow_transaction
+    context = ScoutApm::Context.new
+    context.add(:plan => "gold", :note => "line\nbreak")
+
+    ScoutApm::SlowTransaction.new("/apps/checkin?x=1", "Controller/apps/checkin", 1.25, metrics, {},
+                                  context, Time.at(1500000000).utc, [], 12.5, 3, 10.0, {:ActiveRecord => 2})
+  end
+
+  def db_query_metrics
+    [
+      ScoutApm::DbQueryMetricStats.new("User", "find", "Controller/users/show", 1, 10.0, 3),
+      ScoutApm::DbQueryMetricStats.new("Post", "save", "Controller/users/show", 2, 4.5, 1).tap { |s| s.increment_transaction_count! },
+    ]
+  end
+end
@@ -0,0 +1,141 @@
+require 'test_helper'
+
+require 'scout_apm/layaway'
+require 'scout_apm/layaway_file'
+require 'scout_apm/shared_layaway'
+require 'scout_apm/store'
+
+require 'fileutils'
+
+class SharedLayawayTest < Minitest::Test
+  def setup
+    skip "Native layaway format not available" unless ScoutApm::LayawayFile::NATIVE
+    skip "No writable /dev/shm" unless ScoutApm::SharedLayaway.shm_available?
+
+    FileUtils.mkdir_p '/tmp/scout_apm_test/shared_layaway'
+    config = make_fake_config("data_file" => "/tmp/scout_apm_test/shared_layaway")
+    @layaway = ScoutApm::SharedLayaway.open(config, ScoutApm::Agent.instance.environment)
+    @layaway.delete_files_for(:all)
+    @timestamp = ScoutApm::StoreReportingPeriodTimestamp.minutes_ago(2)
+  end
+
+  def teardown
+    return unless @layaway
+    @layaway.region.close
+    FileUtils.rm_f @layaway.region_path
+    @layaway.delete_files_for(:all)
+  end
+
+  def test_stays_with_files_without_a_writable_shm_directory
+    ScoutApm::SharedLayaway.stubs(:shm_available?).returns(false)
+    config = make_fake_config("data_file" => "/tmp/scout_apm_test/shared_layaway")
+
+    assert_nil ScoutApm::SharedLayaway.open(config, ScoutApm::Agent.instance.environment)
+  end
+
+  def test_merges_periods_from_every_process
+    @layaway.write_reporting_period(period(0.1))
+    @layaway.region.write(@timestamp.timestamp, 10_001, ScoutApm::NativeLayawayFormat.dump(period(0.2)))
+
+    merged, count = merged_claim
+
+    assert_equal 2, count
+    assert_equal 2, merged.request_count
+    assert_equal [], Dir[@layaway.directory + "scout_*.data"]
+    assert_equal 0, @layaway.region.stats[:ready]
+  end
+
+  def test_rewriting_a_period_replaces_it
+    @layaway.write_reporting_period(period(0.1))
+    @layaway.write_reporting_period(period(0.2))
+
+    merged, count = merged_claim
+
+    assert_equal 1, count
+    assert_equal 1, merged.request_count
+  end
+
+  def test_each_timestamp_is_claimed_once
+    @layaway.write_reporting_period(period(0.1))
+
+    assert merged_claim
+    assert_equal false, @layaway.with_merged_claim(@timestamp) { flunk "Already claimed" }
+    assert_equal false, @layaway.with_merged_claim(ScoutApm::StoreReportingPeriodTimestamp.minutes_ago(3)) { flunk "Earlier than a claimed timestamp" }
+  end
+
+  def test_falls_back_to_files_when_the_region_is_full
+    @layaway.region.close
+    FileUtils.rm_f @layaway.region_path
+    @layaway.instance_variable_set(:@region, ScoutApm::NativeLayawayFormat::SharedLayaway.new(@layaway.region_path.to_s, 1, 64 * 1024))
+
+    # Another process has the only slot
+    assert @layaway.region.write(@timestamp.timestamp, 10_001, ScoutApm::NativeLayawayFormat.dump(period(0.2)))
+    @layaway.write_reporting_period(period(0.1))
+    assert_equal 1, Dir[@layaway.directory + "scout_*.data"].length
+
+    merged, count = merged_claim
+
+    assert_equal 2, count
+    assert_equal 2, merged.request_count
+    assert_equal [], Dir[@layaway.directory + "scout_*.data"]
+  end
+
+  def test_shared_with_forked_processes
+    pid = fork do
+      @layaway.write_reporting_period(period(0.3))
+      exit!(0)
+    end
+    Process.wait(pid)
+    @layaway.write_reporting_period(period(0.1))
+
+    _, count = merged_claim
+    assert_equal 2, count
+  end
+
+  def test_opening_a_region_with_a_different_layout
+    assert_raises(ArgumentError) do
+      ScoutApm::NativeLayawayFormat::SharedLayaway.new(@layaway.region_path.to_s, 3, 64 * 1024)
+    end
+  end
+
+  def test_sweep_frees_stale_periods
+    @layaway.region.write(@timestamp.timestamp - 3600, Process.pid, ScoutApm::NativeLayawayFormat.dump(period(0.1)))
+
+    assert_equal 1, @layaway.region.sweep(@timestamp.timestamp)
+    assert_equal @layaway.slot_count, @layaway.region.stats[:free]
+  end
+
+  # A page tmpfs can't supply on first write would kill the process with a
+  # SIGBUS, so it's all backed from the start
+  def test_reserves_the_whole_region
+    stat = File.stat(@layaway.region_path)
+
+    assert_equal 4096 + ScoutApm::SharedLayaway::SLOT_COUNT * ScoutApm::SharedLayaway::SLOT_SIZE, stat.size
+    assert stat.blocks * 512 >= stat.size, "#{stat.blocks} blocks allocated"
+  end
+
+  def test_slot_count_from_config
+    config = make_fake_config("data_file" => "/tmp/scout_apm_test/shared_layaway", "shared_layaway_slots" => 2)
+    layaway = ScoutApm::SharedLayaway.open(config, ScoutApm::Agent.instance.environment)
+
+    assert_equal 2, layaway.region.stats[:free]
+    refute_equal @layaway.region_path, layaway.region_path
+  ensure
+    if layaway
+      layaway.region.close
+      FileUtils.rm_f layaway.region_path
+    end
+  end
+
+  def period(time)
+    rp = ScoutApm::StoreReportingPeriod.new(@timestamp)
+    rp.absorb_metrics!(ScoutApm::MetricMeta.new("Controller/users/show") => ScoutApm::MetricStats.new.update!(time))
+    rp
+  end
+
+  def merged_claim
+    result = nil
+    @layaway.with_merged_claim(@timestamp) { |merged, count| result = [merged, count] }
+    result
+  end
+end
@@ -99,6 +99,121 @@ module ScoutApm
         assert_equal %q|SELECT `blogs`.* FROM `blogs` WHERE (title = ?)|, ss.to_s
       end
 
+      ########################################################################
+      # Native sanitizer - must match the regex passes exactly
+      ########################################################################
+
+      NATIVE_CORPUS = [
+        %q|SELECT  "users".* FROM "users"  ORDER BY "users"."id" ASC LIMIT 1|,
+        %q|SELECT "users".* FROM "users" WHERE "users"."name" = $1  [["name", "chris"]]|,
+        %q|SELECT "users".* FROM "users" INNER JOIN "blogs" ON "blogs"."user_id" = "users"."id" WHERE (blogs.title = 'hello world')|,
+        %q|SELECT "blogs".* FROM "blogs" WHERE id IN (?, ?, ?) AND view_count > 10 OFFSET 20|,
+        %q|SELECT `users`.* FROM `users` WHERE `users`.`name` = ?  [["name", "chris"]]|,
+        %q|INSERT INTO `users` VALUES ('foo', 'b\'ar', "q\"uote", 'it''s', 12, 3.5, x12, 12x)|,
+        %q|UPDATE "t" SET "a" = $12, "b" = 'unterminated '' string|,
+        "SELECT *\n  FROM t [[\"a\", 1]]  \n WHERE x = 1 [[\"b\", 2]]",
+        "SELECT * FROM t JOIN (?, ?) ON\tIN\n(? , 3) WHERE y IN (?,?,?)",
+        "  \t SELECT 1 \n ",
+        "SELECT * FROM t WHERE a = '' AND b = '''' AND c = 'x'''",
+        "",
+      ]
+
+      NATIVE_FUZZ_TOKENS = [
+        "'", "''", '"', '""', "\\", "\\'", '\\"', "[[", "]]", "[", "]",
+        " ", "  ", "\n", "\t", "\r\n", "\v", "\f", "\0",
+        "IN", "JOIN", "IN (", "IN\n(", "(?", "?", ",?", ", ", ")", "(",
+        "$1", "$", "$a", "12", "0", "a1", "1a", "_1", "1_", "LIMIT ", "LIMIT 5", "XLIMIT 7",
+        "x", "SELECT", '"users"', "`t`", "=", ".", "3.14",
+      ]
+
+      def test_native_matches_regex_on_corpus
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        NATIVE_CORPUS.each { |sql| assert_native_matches_regex(sql) }
+      end
+
+      def test_native_matches_regex_on_fuzzed_sql
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        random = Random.new(20170601)
+        3000.times do
+          sql = Array.new(random.rand(1..12)) { NATIVE_FUZZ_TOKENS[random.rand(NATIVE_FUZZ_TOKENS.size)] }.join
+          assert_native_matches_regex(sql)
+        end
+      end
+
+      def test_native_declines_non_ascii
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        sql = "SELECT * FROM t WHERE name = 'caf\u00e9' AND id = 1"
+        assert_nil NativeSqlSanitizer.postgres(sql)
+
+        ss = SqlSanitizer.new(sql).tap{ |it| it.database_engine = :postgres }
+        assert_equal %q|SELECT * FROM t WHERE name = ? AND id = ?|, ss.to_s
+      end
+
+      def test_native_does_not_modify_the_raw_sql
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        sql = %q|SELECT "blogs".* FROM "blogs" WHERE (view_count > 10)|
+        original = sql.dup
+        SqlSanitizer.new(sql).tap{ |it| it.database_engine = :postgres }.to_s
+        assert_equal original, sql
+      end
+
+      def test_repeated_sql_is_served_from_the_fingerprint_cache
+        original = SqlSanitizer.fingerprint_cache
+        SqlSanitizer.fingerprint_cache = SqlFingerprintCache.new(10)
+
+        sql = %q|SELECT "blogs".* FROM "blogs" WHERE (view_count > 10)|
+        first = SqlSanitizer.new(sql).tap{ |it| it.database_engine = :postgres }.to_s
+        second = SqlSanitizer.new(sql.dup).tap{ |it| it.database_engine = :postgres }.to_s
+
+        assert_equal %q|SELECT "blogs".* FROM "blogs" WHERE (view_count > ?)|, second
+        assert_same first, second
+        assert_equal 1, SqlSanitizer.fingerprint_cache.hits
+      ensure
+        SqlSanitizer.fingerprint_cache = original
+      end
+
+      def test_to_s_only_sanitizes_once
+        ss = SqlSanitizer.new(%q|SELECT "blogs".* FROM "blogs" WHERE (view_count > 10)|).tap{ |it| it.database_engine = :postgres }
+        assert_same ss.to_s, ss.to_s
+      end
+
+      def test_fingerprint_is_the_same_for_different_values
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        [
+          [%q|SELECT "users".* FROM "users" WHERE "users"."id" = 1 LIMIT 1|, %q|SELECT "users".* FROM "users" WHERE "users"."id" = 42 LIMIT 1|],
+          [%q|SELECT * FROM users WHERE id IN (1, 2, 3)|, %q|SELECT * FROM users WHERE id IN (7)|],
+          [%q|SELECT * FROM users WHERE name = 'bob''s' AND age > 2.5|, %q|select * from users  where name = $1 and age > $2 /* app:web */|],
+        ].each do |a, b|
+          assert_equal SqlSanitizer.new(a).fingerprint, SqlSanitizer.new(b).fingerprint, "#{a} and #{b} fingerprinted differently"
+        end
+      end
+
+      def test_fingerprint_is_different_for_different_statements
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        [
+          [%q|SELECT * FROM users WHERE id = 1|, %q|SELECT * FROM posts WHERE id = 1|],
+          [%q|SELECT * FROM t1 WHERE id = 1|, %q|SELECT * FROM t2 WHERE id = 1|],
+          [%q|SELECT a FROM users WHERE id = 1|, %q|SELECT a, b FROM users WHERE id = 1|],
+        ].each do |a, b|
+          refute_equal SqlSanitizer.new(a).fingerprint, SqlSanitizer.new(b).fingerprint, "#{a} and #{b} fingerprinted the same"
+        end
+      end
+
+      def assert_native_matches_regex(sql)
+        [:postgres, :mysql, :sqlite].each do |engine|
+          expected = SqlSanitizer.new(sql).send("to_s_#{engine}")
+          actual = NativeSqlSanitizer.send(engine, sql)
+          assert_equal expected, actual, "#{engine} sanitized #{sql.inspect} differently"
+          assert_equal expected.encoding, actual.encoding
+        end
+      end
+
       def assert_faster_than(target_seconds)
         t1 = ::Time.now
         yield
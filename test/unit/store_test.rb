@@ -13,6 +13,7 @@ class StoreTest < Minitest::Test
   def test_writing_layaway_removes_timestamps
     s = ScoutApm::Store.new
     s.track_one!("Controller", "user/show", 10)
+    s.merge_thread_buffers
 
     assert_equal(1, s.instance_variable_get('@reporting_periods').size)
 
@@ -35,6 +36,39 @@ class StoreTest < Minitest::Test
 
     assert_equal({}, s.instance_variable_get('@reporting_periods'))
   end
+
+  def test_merges_metrics_recorded_by_each_thread
+    s = ScoutApm::Store.new
+
+    threads = 4.times.map do
+      Thread.new { 50.times { s.track_one!("Controller", "user/show", 1) } }
+    end
+    threads.each(&:join)
+    s.track_one!("Controller", "user/show", 1)
+
+    assert_equal({}, s.instance_variable_get('@reporting_periods'))
+    s.merge_thread_buffers
+
+    # Two periods if the test ran across a minute boundary
+    periods = s.instance_variable_get('@reporting_periods')
+    assert_includes [1, 2], periods.size
+    assert_equal 201, periods.values.inject(0) { |sum, period| sum + period.request_count }
+
+    # Finished threads' buffers are dropped, the live one is kept
+    assert_equal 1, s.instance_variable_get('@thread_buffers').size
+  end
+
+  def test_fibers_of_a_thread_share_its_buffer
+    s = ScoutApm::Store.new
+
+    100.times { Fiber.new { s.track_one!("Controller", "user/show", 1) }.resume }
+    s.track_one!("Controller", "user/show", 1)
+
+    assert_equal 1, s.instance_variable_get('@thread_buffers').size
+    s.merge_thread_buffers
+    periods = s.instance_variable_get('@reporting_periods')
+    assert_equal 101, periods.values.inject(0) { |sum, period| sum + period.request_count }
+  end
 end
 
 class StoreReportingPeriodTest < Minitest::Test
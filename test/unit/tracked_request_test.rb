@@ -0,0 +1,75 @@
+require 'test_helper'
+
+class TrackedRequestCpuTimeTest < Minitest::Test
+  def test_records_thread_cpu_time_on_root_layer
+    skip "Thread CPU time not available" unless Process.thread_cpu_ns
+
+    controller_layer = ScoutApm::Layer.new("Controller", "users/index")
+    tr = ScoutApm::TrackedRequest.new(ScoutApm::FakeStore.new)
+    tr.start_layer(controller_layer)
+    x = 0
+    200_000.times { x += 1 }
+    sleep 0.05
+    tr.stop_layer
+
+    assert controller_layer.cpu_time > 0
+    assert controller_layer.cpu_time < controller_layer.total_call_time
+  end
+end
+
+class TrackedRequestLayerArenaTest < Minitest::Test
+  def test_backtraces_slow_layers_by_exclusive_time
+    ScoutApm::Agent.instance.stubs(:recorder).returns(stub(:record! => nil))
+
+    tr = ScoutApm::TrackedRequest.new(ScoutApm::FakeStore.new)
+    tr.web!
+    now = ScoutApm::Clock.monotonic_ns
+    tr.start_layer(ScoutApm::Layer.new("Controller", "users/index", now - 3_000_000_000))
+    tr.start_layer(ScoutApm::Layer.new("View", "users/index", now - 2_000_000_000))
+    tr.start_layer(ScoutApm::Layer.new("ActiveRecord", "User/find", now - 1_900_000_000))
+    tr.stop_layer
+    tr.stop_layer
+
+    arena = tr.layer_arena
+    assert arena.backtrace(2), "a 1.9s query is slow"
+    assert_nil arena.backtrace(1), "the view spent all but 0.1s in the query"
+  ensure
+    tr.stop_layer
+  end
+
+  # As the remote recorders send a request, before it's recorded
+  def test_marshals_once_stopped
+    ScoutApm::Agent.instance.stubs(:recorder).returns(stub(:record! => nil))
+
+    tr = ScoutApm::TrackedRequest.new(ScoutApm::FakeStore.new)
+    tr.start_layer(ScoutApm::Layer.new("Controller", "users/index"))
+    3.times do
+      tr.start_layer(ScoutApm::Layer.new("ActiveRecord", "User/find"))
+      tr.stop_layer
+    end
+    tr.stop_layer
+    tr.prepare_to_dump!
+
+    loaded = Marshal.load(Marshal.dump(tr))
+    assert_equal 4, loaded.layer_arena.size
+    assert_equal "users/index", loaded.root_layer.name
+    assert_equal tr.root_layer.total_exclusive_time, loaded.root_layer.total_exclusive_time
+  end
+
+  def test_releases_layers_once_recorded
+    ScoutApm::Agent.instance.stubs(:recorder).returns(ScoutApm::SynchronousRecorder.new(ScoutApm::Agent.instance.logger))
+
+    tr = ScoutApm::TrackedRequest.new(ScoutApm::FakeStore.new)
+    tr.web!
+    tr.start_layer(ScoutApm::Layer.new("Controller", "users/index"))
+    tr.start_layer(ScoutApm::Layer.new("ActiveRecord", "User#find"))
+    tr.stop_layer
+    tr.stop_layer
+
+    assert tr.recorded?
+    assert_nil tr.layer_arena
+    assert_nil tr.root_layer
+    assert_nil tr.current_layer
+    assert_equal "Controller/users/index", tr.unique_name
+  end
+end
@@ -68,4 +68,65 @@ class BacktraceParserTest < Minitest::Test
     assert_equal false, (result[0] =~ %r|app/controllers/users_controller.rb|).nil?
     assert_equal false, (result[1] =~ %r|config/initializers/inject_something.rb|).nil?
   end
+
+  ################################################################################
+  # Native capture
+
+  # Defines a method whose frames appear to come from +path+ under root
+  def define_app_method(name, path, line, &body)
+    self.class.send(:define_method, "#{name}_body", &body)
+    eval(<<-RUBY, binding, "#{root}/#{path}", line)
+      def #{name}
+        #{name}_body
+      end
+    RUBY
+  end
+
+  def test_native_capture_finds_app_frames
+    skip "Native backtrace parser not available" unless ScoutApm::Utils::BacktraceParser::NATIVE
+
+    define_app_method(:bt_controller, "app/controllers/users_controller.rb", 10) { bt_vendor }
+    define_app_method(:bt_vendor, "vendor/ruby/thing.rb", 20) { bt_model }
+    define_app_method(:bt_model, "app/models/user.rb", 30) { ScoutApm::Utils::BacktraceParser.capture(0, 50, root) }
+
+    result = bt_controller
+
+    assert_equal ["app/models/user.rb:31:in `bt_model'", "app/controllers/users_controller.rb:11:in `bt_controller'"], result
+  end
+
+  def test_native_capture_skips_frames
+    skip "Native backtrace parser not available" unless ScoutApm::Utils::BacktraceParser::NATIVE
+
+    define_app_method(:bt_outer, "app/controllers/users_controller.rb", 10) { bt_inner }
+    define_app_method(:bt_inner, "app/models/user.rb", 30) { ScoutApm::Utils::BacktraceParser.capture(2, 50, root) }
+
+    assert_equal ["app/controllers/users_controller.rb:11:in `bt_outer'"], bt_outer
+  end
+
+  def test_native_capture_maxes_at_APP_FRAMES
+    skip "Native backtrace parser not available" unless ScoutApm::Utils::BacktraceParser::NATIVE
+
+    define_app_method(:bt_recurse, "lib/recursive.rb", 1) { |*| }
+    self.class.send(:define_method, :bt_recurse_body) { caller.length > 200 ? ScoutApm::Utils::BacktraceParser.capture(0, 50, root) : bt_recurse }
+
+    assert_equal ScoutApm::Utils::BacktraceParser::APP_FRAMES, bt_recurse.length
+  end
+
+  def test_native_capture_with_no_app_frames
+    skip "Native backtrace parser not available" unless ScoutApm::Utils::BacktraceParser::NATIVE
+
+    assert_equal [], ScoutApm::Utils::BacktraceParser.capture(0, 50, "/Users/scout/different-secrets")
+  end
+
+  def test_native_capture_matches_caller_parsing
+    skip "Native backtrace parser not available" unless ScoutApm::Utils::BacktraceParser::NATIVE
+
+    define_app_method(:bt_compare, "app/models/user.rb", 30) do
+      [ScoutApm::Utils::BacktraceParser.capture(0, 50, root), caller(0)]
+    end
+    native, stack = bt_compare
+    parsed = ScoutApm::Utils::BacktraceParser.new(stack, root).call
+
+    assert_equal parsed, native
+  end
 end
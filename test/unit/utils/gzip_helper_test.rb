@@ -0,0 +1,52 @@
+require 'test_helper'
+
+require 'scout_apm/utils/gzip_helper'
+
+class GzipHelperTest < Minitest::Test
+  def test_deflate_round_trips
+    assert_equal "payload" * 100, gunzip(ScoutApm::Utils::GzipHelper.new.deflate("payload" * 100))
+  end
+
+  def test_stream_compresses_what_is_written
+    helper = ScoutApm::Utils::GzipHelper.new
+    bytes_in = nil
+
+    compressed = helper.stream do |io|
+      1000.times { |i| io.write("chunk #{i},") }
+      bytes_in = io.bytes_in
+    end
+
+    expected = (0...1000).map { |i| "chunk #{i}," }.join
+    assert_equal expected, gunzip(compressed)
+    assert_equal expected.bytesize, bytes_in
+  end
+
+  def test_reuses_the_deflate_stream
+    helper = ScoutApm::Utils::GzipHelper.new(1, "rle")
+
+    first = helper.deflate("first payload")
+    assert_raises(RuntimeError) { helper.stream { |io| io.write("abandoned"); raise "boom" } }
+    second = helper.deflate("second payload")
+
+    assert_equal "first payload", gunzip(first)
+    assert_equal "second payload", gunzip(second)
+    assert_equal Zlib::RLE, helper.strategy
+  end
+
+  def test_streams_serialized_payload
+    metadata = {:app_root => "/srv/app"}
+    metrics = {ScoutApm::MetricMeta.new("Controller/users/show") => ScoutApm::MetricStats.new.tap { |s| s.update!(0.25) }}
+
+    compressed = ScoutApm::Utils::GzipHelper.new.stream do |io|
+      ScoutApm::Serializers::PayloadSerializerToJson.serialize_to(io, metadata.dup, metrics, [], [], [], [], [])
+    end
+
+    assert_equal ScoutApm::Serializers::PayloadSerializerToJson.serialize(metadata.dup, metrics, [], [], [], [], []), gunzip(compressed)
+  end
+
+  private
+
+  def gunzip(str)
+    Zlib::GzipReader.new(StringIO.new(str)).read
+  end
+end
@@ -0,0 +1,87 @@
+require 'test_helper'
+
+require 'scout_apm/utils/sql_sanitizer'
+
+module ScoutApm
+  module Utils
+    class SqlFingerprintCacheTest < Minitest::Test
+      def test_miss_then_hit
+        cache = SqlFingerprintCache.new(10)
+        calls = 0
+
+        2.times { cache.fetch("SELECT 1", :postgres) { calls += 1; "SELECT ?" } }
+
+        assert_equal 1, calls
+        assert_equal 1, cache.hits
+        assert_equal 1, cache.misses
+        assert_equal 0, cache.evictions
+      end
+
+      def test_cached_values_are_frozen
+        cache = SqlFingerprintCache.new(10)
+        assert cache.fetch("SELECT 1", :postgres) { "SELECT ?" }.frozen?
+      end
+
+      def test_keyed_on_database_engine
+        cache = SqlFingerprintCache.new(10)
+        cache.fetch("SELECT 1", :postgres) { "postgres" }
+        assert_equal "mysql", cache.fetch("SELECT 1", :mysql) { "mysql" }
+        assert_equal 2, cache.misses
+      end
+
+      def test_evicts_least_recently_used
+        cache = SqlFingerprintCache.new(2)
+        cache.fetch("a", :postgres) { "a" }
+        cache.fetch("b", :postgres) { "b" }
+        cache.fetch("a", :postgres) { flunk "a should be cached" }
+        cache.fetch("c", :postgres) { "c" }
+
+        assert_equal 2, cache.size
+        assert_equal 1, cache.evictions
+        cache.fetch("a", :postgres) { flunk "a should still be cached" }
+        assert_equal "b again", cache.fetch("b", :postgres) { "b again" }
+      end
+
+      def test_raw_sql_is_copied
+        cache = SqlFingerprintCache.new(10)
+        sql = "SELECT 1"
+        cache.fetch(sql, :postgres) { "SELECT ?" }
+        sql << "0"
+
+        assert_equal "SELECT ?", cache.fetch("SELECT 1", :postgres) { flunk }
+        assert_equal "changed", cache.fetch("SELECT 10", :postgres) { "changed" }
+      end
+
+      def test_size_zero_disables
+        cache = SqlFingerprintCache.new(0)
+        calls = 0
+        2.times { cache.fetch("SELECT 1", :postgres) { calls += 1; "SELECT ?" } }
+        assert_equal 2, calls
+        assert_equal 0, cache.size
+      end
+
+      def test_stats
+        cache = SqlFingerprintCache.new(1)
+        cache.fetch("a", :postgres) { "a" }
+        cache.fetch("b", :postgres) { "b" }
+        cache.fetch("b", :postgres) { "b" }
+
+        assert_equal({:size => 1, :max_size => 1, :hits => 1, :misses => 2, :evictions => 1}, cache.stats)
+        cache.clear
+        assert_equal({:size => 0, :max_size => 1, :hits => 0, :misses => 0, :evictions => 0}, cache.stats)
+      end
+
+      def test_native_fingerprint_is_xxh64
+        skip "Native sanitizer not available" unless SqlSanitizer::NATIVE
+
+        assert_equal 0xEF46DB3751D8E999, NativeSqlSanitizer.xxh64("")
+        assert_equal 0xD24EC4F1A98C6E5B, NativeSqlSanitizer.xxh64("a")
+        assert_equal 0x44BC2CF5AD770999, NativeSqlSanitizer.xxh64("abc")
+        assert_equal 0xFBCEA83C8A378BF1, NativeSqlSanitizer.xxh64("Nobody inspects the spammish repetition")
+
+        sql = "SELECT * FROM users WHERE id = 1"
+        assert_equal NativeSqlSanitizer.xxh64(sql) & (2**62 - 1), SqlFingerprintCache.fingerprint(sql)
+      end
+    end
+  end
+end